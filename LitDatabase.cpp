@@ -2,69 +2,304 @@
 
 void LitDatabase::PrintPrompt() { std::cout << "LitDb > "; }
 
-void LitDatabase::ReadInput() {
-    if (!std::getline(std::cin, input_buffer)) {
+void LitDatabase::ReadInput(Session* session) {
+    if (!std::getline(std::cin, session->input_buffer)) {
         std::cout << "Error reading input" << std::endl;
         exit(EXIT_FAILURE);
     }
 
-    input_buffer.push_back('\0');
-    cur = &input_buffer[0];
+    session->input_buffer.push_back('\0');
+    session->cur = &session->input_buffer[0];
 }
 
-void LitDatabase::ParseWhitespace() {
-    assert(cur != nullptr);
+void LitDatabase::ParseWhitespace(Session* session) {
+    assert(session->cur != nullptr);
+    char* cur = session->cur;
     while (*cur == ' ' || *cur == '\t' || *cur == '\n' || *cur == '\r') ++cur;
+    session->cur = cur;
 }
 
-ParseMetaResult LitDatabase::ParseMeta(Table* table) {
-    assert(cur != nullptr);
+// consume the keyword if the input continues with it as a whole word
+bool LitDatabase::ParseKeyword(Session* session, const char* keyword) {
+    ParseWhitespace(session);
+    size_t length = strlen(keyword);
+    if (strncmp(session->cur, keyword, length) != 0) return false;
+    char next = session->cur[length];
+    if (isalnum(static_cast<unsigned char>(next)) || next == '_') return false;
+    session->cur += length;
+    return true;
+}
+
+ParseStatementResult LitDatabase::ParseId(Session* session, uint32_t* id) {
+    ParseWhitespace(session);
+    char* end;
+    errno = 0;
+    long long value = strtoll(session->cur, &end, 10);
+    if (end == session->cur) {
+        return PARSE_STATEMENT_SYNTAX_ERROR;
+    }
+    if (value < 0) {
+        return PARSE_STATEMENT_NEGATIVE_ID;
+    }
+    if (errno == ERANGE || value > UINT32_MAX) {
+        return PARSE_STATEMENT_ID_TOO_LARGE;
+    }
+    *id = value;
+    session->cur = end;
+    return PARSE_STATEMENT_SUCCESS;
+}
+
+// a word runs up to the next whitespace or comma, or closing parenthesis inside parentheses
+ParseStatementResult LitDatabase::ParseWord(Session* session, char* destination, uint32_t max_length,
+                                            bool in_parentheses) {
+    ParseWhitespace(session);
+    char* start = session->cur;
+    char* cur = start;
+    while (*cur != '\0' && *cur != ',' && *cur != ' ' && *cur != '\t' && *cur != '\r' && *cur != '\n' &&
+           !(in_parentheses && *cur == ')')) {
+        ++cur;
+    }
+    session->cur = cur;
+    if (cur == start) {
+        return PARSE_STATEMENT_SYNTAX_ERROR;
+    }
+    if (static_cast<uint32_t>(cur - start) > max_length) {
+        return PARSE_STATEMENT_STRING_TOO_LONG;
+    }
+    memcpy(destination, start, cur - start);
+    destination[cur - start] = '\0';
+    return PARSE_STATEMENT_SUCCESS;
+}
+
+// the aggregates of a select, a comma separated list of count(*), min(id), max(id) and sum(id). None means rows.
+ParseStatementResult LitDatabase::ParseAggregates(Session* session, Statement* statement) {
+    static const struct {
+        const char* name;
+        const char* argument;
+        AggregateFunction function;
+    } functions[] = {{"count", "*", AGGREGATE_COUNT},
+                     {"min", "id", AGGREGATE_MIN},
+                     {"max", "id", AGGREGATE_MAX},
+                     {"sum", "id", AGGREGATE_SUM}};
+    while (true) {
+        uint32_t i = 0;
+        while (i < sizeof(functions) / sizeof(functions[0]) && !ParseKeyword(session, functions[i].name)) ++i;
+        if (i == sizeof(functions) / sizeof(functions[0])) {
+            // a list cannot end with a comma
+            return statement->num_aggregates == 0 ? PARSE_STATEMENT_SUCCESS : PARSE_STATEMENT_SYNTAX_ERROR;
+        }
+        ParseWhitespace(session);
+        if (*session->cur++ != '(') return PARSE_STATEMENT_SYNTAX_ERROR;
+        ParseWhitespace(session);
+        size_t length = strlen(functions[i].argument);
+        if (strncmp(session->cur, functions[i].argument, length) != 0) return PARSE_STATEMENT_SYNTAX_ERROR;
+        session->cur += length;
+        ParseWhitespace(session);
+        if (*session->cur++ != ')') return PARSE_STATEMENT_SYNTAX_ERROR;
+        if (statement->num_aggregates == SELECT_MAX_AGGREGATES) return PARSE_STATEMENT_SYNTAX_ERROR;
+        statement->aggregates[statement->num_aggregates++] = functions[i].function;
+        statement->output = SELECT_AGGREGATE;
+
+        ParseWhitespace(session);
+        if (*session->cur != ',') return PARSE_STATEMENT_SUCCESS;
+        ++session->cur;
+    }
+}
+
+// username = value or email = value
+ParseStatementResult LitDatabase::ParseWhereColumn(Session* session, Statement* statement) {
+    bool is_username = ParseKeyword(session, "username");
+    if (!is_username && !ParseKeyword(session, "email")) {
+        return PARSE_STATEMENT_SYNTAX_ERROR;
+    }
+    statement->filter_by_column = true;
+    statement->column = is_username ? INDEX_USERNAME : INDEX_EMAIL;
+    ParseWhitespace(session);
+    if (*session->cur++ != '=') return PARSE_STATEMENT_SYNTAX_ERROR;
+    if (statement->column == INDEX_USERNAME) {
+        return ParseWord(session, statement->filter.username, COLUMN_USERNAME_SIZE);
+    }
+    return ParseWord(session, statement->filter.email, COLUMN_EMAIL_SIZE);
+}
+
+// where id = N, must end the statement
+ParseStatementResult LitDatabase::ParseWhereId(Session* session, Statement* statement) {
+    if (!ParseKeyword(session, "where") || !ParseKeyword(session, "id")) {
+        return PARSE_STATEMENT_SYNTAX_ERROR;
+    }
+    ParseWhitespace(session);
+    if (*session->cur != '=') {
+        return PARSE_STATEMENT_SYNTAX_ERROR;
+    }
+    ++session->cur;
+    ParseStatementResult result = ParseId(session, &statement->key);
+    if (result != PARSE_STATEMENT_SUCCESS) {
+        return result;
+    }
+    ParseWhitespace(session);
+    return *session->cur == '\0' ? PARSE_STATEMENT_SUCCESS : PARSE_STATEMENT_SYNTAX_ERROR;
+}
+
+ParseMetaResult LitDatabase::ParseMeta(Session* session, Table* table) {
+    assert(session->cur != nullptr);
 
-    if (strcmp(cur, ".exit") == 0) {
+    if (strcmp(session->cur, ".exit") == 0) {
         DbClose(table);
         exit(EXIT_SUCCESS);
-    } else if (strcmp(cur, ".constants") == 0) {
+    } else if (strcmp(session->cur, ".constants") == 0) {
         std::cout << "Constants: " << std::endl;
         PrintConstants();
         return PARSE_META_SUCCESS;
-    } else if (strcmp(cur, ".btree") == 0) {
+    } else if (strcmp(session->cur, ".stats") == 0) {
+        std::cout << "Stats: " << std::endl;
+        PrintStats(TableStats(table));
+        return PARSE_META_SUCCESS;
+    } else if (strcmp(session->cur, ".btree") == 0) {
         std::cout << "Tree: " << std::endl;
-        PrintTree(table->pager, 0, 0);
+        // commands on the whole table wait for running statements and keep new ones out
+        pthread_rwlock_wrlock(&table->schema_latch);
+        PrintTree(table->pager, table->root_page_num, 0);
+        pthread_rwlock_unlock(&table->schema_latch);
+        return PARSE_META_SUCCESS;
+    } else if (strncmp(session->cur, ".import", 7) == 0 && (session->cur[7] == ' ' || session->cur[7] == '\0')) {
+        // .import <file> [fill percent]
+        char* save = nullptr;
+        strtok_r(session->cur, " ", &save);
+        char* path = strtok_r(nullptr, " ", &save);
+        char* fill_string = strtok_r(nullptr, " ", &save);
+        int fill_percent = fill_string ? atoi(fill_string) : BULK_LOAD_DEFAULT_FILL;
+        if (path == nullptr || fill_percent < 1 || fill_percent > 100) {
+            std::cout << "Usage: .import <file> [fill percent 1-100]" << std::endl;
+            return PARSE_META_SUCCESS;
+        }
+
+        uint64_t line_num = 0;
+        pthread_rwlock_wrlock(&table->schema_latch);
+        ExecuteResult result = ImportFile(table, path, fill_percent, &line_num);
+        pthread_rwlock_unlock(&table->schema_latch);
+        switch (result) {
+            case EXECUTE_SUCCESS: std::cout << "Imported." << std::endl; break;
+            case EXECUTE_TABLE_NOT_EMPTY: std::cout << "Error: Table must be empty to import." << std::endl; break;
+            case EXECUTE_UNSORTED_INPUT: printf("Error: Rows not sorted by id at line %lu.\n", line_num); break;
+            case EXECUTE_DUPLICATE_KEY: printf("Error: Duplicate key at line %lu.\n", line_num); break;
+            case EXECUTE_INVALID_ROW: printf("Error: Could not parse row at line %lu.\n", line_num); break;
+            case EXECUTE_IO_ERROR: printf("Error: Could not read %s.\n", path); break;
+            default: break;
+        }
+        return PARSE_META_SUCCESS;
+    } else if (strncmp(session->cur, ".mode", 5) == 0 && (session->cur[5] == ' ' || session->cur[5] == '\0')) {
+        // .mode table|csv|tsv|binary
+        char* save = nullptr;
+        strtok_r(session->cur, " ", &save);
+        char* mode = strtok_r(nullptr, " ", &save);
+        if (mode != nullptr && strcmp(mode, "table") == 0) {
+            session->writer.mode = OUTPUT_TABLE;
+        } else if (mode != nullptr && strcmp(mode, "csv") == 0) {
+            session->writer.mode = OUTPUT_CSV;
+        } else if (mode != nullptr && strcmp(mode, "tsv") == 0) {
+            session->writer.mode = OUTPUT_TSV;
+        } else if (mode != nullptr && strcmp(mode, "binary") == 0) {
+            session->writer.mode = OUTPUT_BINARY;
+        } else {
+            std::cout << "Usage: .mode table|csv|tsv|binary" << std::endl;
+        }
+        return PARSE_META_SUCCESS;
+    } else if (strncmp(session->cur, ".timer", 6) == 0 && (session->cur[6] == ' ' || session->cur[6] == '\0')) {
+        // .timer on|off, print the time each statement takes
+        char* save = nullptr;
+        strtok_r(session->cur, " ", &save);
+        char* state = strtok_r(nullptr, " ", &save);
+        if (state != nullptr && strcmp(state, "on") == 0) {
+            session->timer_on = true;
+        } else if (state != nullptr && strcmp(state, "off") == 0) {
+            session->timer_on = false;
+        } else {
+            std::cout << "Usage: .timer on|off" << std::endl;
+        }
+        return PARSE_META_SUCCESS;
+    } else if (strncmp(session->cur, ".latency", 8) == 0 && (session->cur[8] == ' ' || session->cur[8] == '\0')) {
+        // .latency [file], the statement latency histograms as JSON
+        char* save = nullptr;
+        strtok_r(session->cur, " ", &save);
+        char* path = strtok_r(nullptr, " ", &save);
+        std::string json = LatencyJson(table->pager);
+        if (path == nullptr) {
+            std::cout << json << std::flush;
+            return PARSE_META_SUCCESS;
+        }
+        std::ofstream file(path);
+        if (!(file << json)) {
+            printf("Error: Could not write %s.\n", path);
+        }
+        return PARSE_META_SUCCESS;
+    } else if (strncmp(session->cur, ".output", 7) == 0 && (session->cur[7] == ' ' || session->cur[7] == '\0')) {
+        // .output [file|stdout], select output goes to the file until switched back
+        char* save = nullptr;
+        strtok_r(session->cur, " ", &save);
+        char* path = strtok_r(nullptr, " ", &save);
+        if (!SetOutputFile(&session->writer, path)) {
+            printf("Error: Could not open %s.\n", path);
+        }
         return PARSE_META_SUCCESS;
     } else {
-        cur = nullptr;
+        session->cur = nullptr;
         return PARSE_META_UNRECOGNIZED;
     }
 
     return PARSE_META_SUCCESS;
 }
 
-ParseStatementResult LitDatabase::ParseStatement(Statement* statement) {
-    if (strncmp(cur, "insert", 6) == 0) {
-        return ParseInsert(statement);
-    } else if (strncmp(cur, "select", 6) == 0) {
-        statement->type = STATEMENT_SELECT;
-        return PARSE_STATEMENT_SUCCESS;
+ParseStatementResult LitDatabase::ParseStatement(Session* session, Statement* statement) {
+    if (strncmp(session->cur, "insert", 6) == 0) {
+        return ParseInsert(session, statement);
+    } else if (strncmp(session->cur, "select", 6) == 0) {
+        return ParseSelect(session, statement);
+    } else if (strncmp(session->cur, "delete", 6) == 0) {
+        return ParseDelete(session, statement);
+    } else if (strncmp(session->cur, "update", 6) == 0) {
+        return ParseUpdate(session, statement);
+    } else if (strncmp(session->cur, "create", 6) == 0) {
+        return ParseCreateIndex(session, statement);
+    }
+
+    // begin, commit and rollback are the whole statement
+    if (ParseKeyword(session, "begin")) {
+        statement->type = STATEMENT_BEGIN;
+    } else if (ParseKeyword(session, "commit")) {
+        statement->type = STATEMENT_COMMIT;
+    } else if (ParseKeyword(session, "rollback")) {
+        statement->type = STATEMENT_ROLLBACK;
     } else {
         return PARSE_STATEMENT_UNRECOGNIZED;
     }
+    ParseWhitespace(session);
+    return *session->cur == '\0' ? PARSE_STATEMENT_SUCCESS : PARSE_STATEMENT_SYNTAX_ERROR;
 }
 
-ParseStatementResult LitDatabase::ParseInsert(Statement* statement) {
+// insert N username email, or insert values (N, username, email), ...
+ParseStatementResult LitDatabase::ParseInsert(Session* session, Statement* statement) {
     statement->type = STATEMENT_INSERT;
+    char* start = session->cur;
+    ParseKeyword(session, "insert");
+    if (ParseKeyword(session, "values")) {
+        return ParseInsertValues(session, statement);
+    }
+    session->cur = start;
 
-    char* keyword = strtok(cur, " ");
-    char* id_string = strtok(nullptr, " ");
-    char* username = strtok(nullptr, " ");
-    char* email = strtok(nullptr, " ");
+    char* save = nullptr;
+    strtok_r(session->cur, " ", &save);
+    char* id_string = strtok_r(nullptr, " ", &save);
+    char* username = strtok_r(nullptr, " ", &save);
+    char* email = strtok_r(nullptr, " ", &save);
 
     if (id_string == nullptr || username == nullptr || email == nullptr) {
         return PARSE_STATEMENT_SYNTAX_ERROR;
     }
 
-    int id = atoi(id_string);
-    if (id < 0) {
-        return PARSE_STATEMENT_NEGATIVE_ID;
+    session->cur = id_string;
+    ParseStatementResult result = ParseId(session, &statement->row_to_insert.id);
+    if (result != PARSE_STATEMENT_SUCCESS) {
+        return result;
     }
 
     if (strlen(username) > COLUMN_USERNAME_SIZE) {
@@ -74,90 +309,513 @@ ParseStatementResult LitDatabase::ParseInsert(Statement* statement) {
         return PARSE_STATEMENT_STRING_TOO_LONG;
     }
 
-    statement->row_to_insert.id = id;
     strcpy(statement->row_to_insert.username, username);
     strcpy(statement->row_to_insert.email, email);
 
     return PARSE_STATEMENT_SUCCESS;
 }
 
-ExecuteResult LitDatabase::ExecuteStatement(Statement* statement, Table* table) {
-    switch (statement->type) {
-        case STATEMENT_INSERT: return ExecuteInsert(statement, table);
-        case STATEMENT_SELECT: return ExecuteSelect(statement, table);
+// the rows of insert values, parsed in place without copying the line apart
+ParseStatementResult LitDatabase::ParseInsertValues(Session* session, Statement* statement) {
+    ParseStatementResult result;
+    Row row;
+    while (true) {
+        ParseWhitespace(session);
+        if (*session->cur++ != '(') return PARSE_STATEMENT_SYNTAX_ERROR;
+        if ((result = ParseId(session, &row.id)) != PARSE_STATEMENT_SUCCESS) return result;
+        ParseWhitespace(session);
+        if (*session->cur++ != ',') return PARSE_STATEMENT_SYNTAX_ERROR;
+        if ((result = ParseWord(session, row.username, COLUMN_USERNAME_SIZE, true)) != PARSE_STATEMENT_SUCCESS) {
+            return result;
+        }
+        ParseWhitespace(session);
+        if (*session->cur++ != ',') return PARSE_STATEMENT_SYNTAX_ERROR;
+        if ((result = ParseWord(session, row.email, COLUMN_EMAIL_SIZE, true)) != PARSE_STATEMENT_SUCCESS) {
+            return result;
+        }
+        ParseWhitespace(session);
+        if (*session->cur++ != ')') return PARSE_STATEMENT_SYNTAX_ERROR;
+        statement->rows.push_back(row);
+
+        ParseWhitespace(session);
+        if (*session->cur == '\0') return PARSE_STATEMENT_SUCCESS;
+        if (*session->cur++ != ',') return PARSE_STATEMENT_SYNTAX_ERROR;
     }
-    return EXECUTE_SUCCESS;
 }
 
-ExecuteResult LitDatabase::ExecuteInsert(Statement* statement, Table* table) {
-    void* node = GetPage(table->pager, table->root_page_num);
+// select [rank | aggregate, ...] [where id = N | where id between A and B | where id >, >=, <, <= N |
+// where id in (N, ...) [and C = V] | where username|email = V] [limit L] [offset O]
+ParseStatementResult LitDatabase::ParseSelect(Session* session, Statement* statement) {
+    statement->type = STATEMENT_SELECT;
+    ParseKeyword(session, "select");
+    ParseStatementResult result = PARSE_STATEMENT_SUCCESS;
+    if (ParseKeyword(session, "rank")) {
+        statement->output = SELECT_RANK;
+    } else if ((result = ParseAggregates(session, statement)) != PARSE_STATEMENT_SUCCESS) {
+        return result;
+    }
+
+    uint32_t id;
+    if (ParseKeyword(session, "where")) {
+        ParseWhitespace(session);
+        if (strncmp(session->cur, "username", 8) == 0 || strncmp(session->cur, "email", 5) == 0) {
+            if ((result = ParseWhereColumn(session, statement)) != PARSE_STATEMENT_SUCCESS) return result;
+        } else if (!ParseKeyword(session, "id")) {
+            return PARSE_STATEMENT_SYNTAX_ERROR;
+        } else if (ParseKeyword(session, "between")) {
+            uint32_t high;
+            if ((result = ParseId(session, &id)) != PARSE_STATEMENT_SUCCESS) return result;
+            if (!ParseKeyword(session, "and")) return PARSE_STATEMENT_SYNTAX_ERROR;
+            if ((result = ParseId(session, &high)) != PARSE_STATEMENT_SUCCESS) return result;
+            statement->range_low = id;
+            statement->range_high = high;
+        } else if (ParseKeyword(session, "in")) {
+            ParseWhitespace(session);
+            if (*session->cur++ != '(') return PARSE_STATEMENT_SYNTAX_ERROR;
+            while (true) {
+                if ((result = ParseId(session, &id)) != PARSE_STATEMENT_SUCCESS) return result;
+                statement->ids.push_back(id);
+                ParseWhitespace(session);
+                if (*session->cur == ')') break;
+                if (*session->cur++ != ',') return PARSE_STATEMENT_SYNTAX_ERROR;
+            }
+            ++session->cur;
+        } else if (ParseWhitespace(session), *session->cur == '=' || *session->cur == '<' || *session->cur == '>') {
+            char op = *session->cur++;
+            bool or_equal = op != '=' && *session->cur == '=';
+            if (or_equal) ++session->cur;
+            if ((result = ParseId(session, &id)) != PARSE_STATEMENT_SUCCESS) return result;
+            if (op == '=' || op == '>') statement->range_low = or_equal || op == '=' ? id : int64_t(id) + 1;
+            if (op == '=' || op == '<') statement->range_high = or_equal || op == '=' ? id : int64_t(id) - 1;
+        } else {
+            return PARSE_STATEMENT_SYNTAX_ERROR;
+        }
+        if (!statement->filter_by_column && ParseKeyword(session, "and")) {
+            if ((result = ParseWhereColumn(session, statement)) != PARSE_STATEMENT_SUCCESS) return result;
+        }
+    }
+    if (ParseKeyword(session, "limit")) {
+        if ((result = ParseId(session, &statement->limit)) != PARSE_STATEMENT_SUCCESS) return result;
+    }
+    if (ParseKeyword(session, "offset")) {
+        if ((result = ParseId(session, &statement->offset)) != PARSE_STATEMENT_SUCCESS) return result;
+    }
+    // the rank is that of a single id
+    if (statement->output == SELECT_RANK &&
+        (statement->filter_by_column || statement->range_low != statement->range_high || !statement->ids.empty())) {
+        return PARSE_STATEMENT_SYNTAX_ERROR;
+    }
+
+    ParseWhitespace(session);
+    return *session->cur == '\0' ? PARSE_STATEMENT_SUCCESS : PARSE_STATEMENT_SYNTAX_ERROR;
+}
+
+// delete where id = N
+ParseStatementResult LitDatabase::ParseDelete(Session* session, Statement* statement) {
+    statement->type = STATEMENT_DELETE;
+    ParseKeyword(session, "delete");
+    return ParseWhereId(session, statement);
+}
+
+// create index on username|email
+ParseStatementResult LitDatabase::ParseCreateIndex(Session* session, Statement* statement) {
+    statement->type = STATEMENT_CREATE_INDEX;
+    if (!ParseKeyword(session, "create") || !ParseKeyword(session, "index") || !ParseKeyword(session, "on")) {
+        return PARSE_STATEMENT_SYNTAX_ERROR;
+    }
+    if (ParseKeyword(session, "username")) {
+        statement->column = INDEX_USERNAME;
+    } else if (ParseKeyword(session, "email")) {
+        statement->column = INDEX_EMAIL;
+    } else {
+        return PARSE_STATEMENT_SYNTAX_ERROR;
+    }
+    ParseWhitespace(session);
+    return *session->cur == '\0' ? PARSE_STATEMENT_SUCCESS : PARSE_STATEMENT_SYNTAX_ERROR;
+}
+
+// update set username = U, email = E where id = N, either assignment may be left out
+ParseStatementResult LitDatabase::ParseUpdate(Session* session, Statement* statement) {
+    statement->type = STATEMENT_UPDATE;
+    ParseKeyword(session, "update");
+    if (!ParseKeyword(session, "set")) {
+        return PARSE_STATEMENT_SYNTAX_ERROR;
+    }
+
+    do {
+        ParseStatementResult result;
+        if (ParseKeyword(session, "username")) {
+            statement->set_username = true;
+            ParseWhitespace(session);
+            if (*session->cur++ != '=') return PARSE_STATEMENT_SYNTAX_ERROR;
+            result = ParseWord(session, statement->row_to_update.username, COLUMN_USERNAME_SIZE);
+        } else if (ParseKeyword(session, "email")) {
+            statement->set_email = true;
+            ParseWhitespace(session);
+            if (*session->cur++ != '=') return PARSE_STATEMENT_SYNTAX_ERROR;
+            result = ParseWord(session, statement->row_to_update.email, COLUMN_EMAIL_SIZE);
+        } else {
+            return PARSE_STATEMENT_SYNTAX_ERROR;
+        }
+        if (result != PARSE_STATEMENT_SUCCESS) {
+            return result;
+        }
+        ParseWhitespace(session);
+    } while (*session->cur == ',' && ++session->cur);
+
+    return ParseWhereId(session, statement);
+}
+
+// every statement is timed into the latency histogram of its class, see latency.cpp
+ExecuteResult LitDatabase::ExecuteStatement(Session* session, Statement* statement, Table* table) {
+    uint64_t start = NowNanoseconds();
+    ExecuteResult result = DispatchStatement(session, statement, table);
+    LatencyRecord(&table->pager->latencies[StatementLatencyClass(statement)], NowNanoseconds() - start);
+    return result;
+}
+
+// Statements run concurrently: each holds the schema latch shared, and a writing statement also holds the commit
+// latch shared while it changes pages. Its commit comes after it let go, together with those of the writers that
+// finished by then.
+ExecuteResult LitDatabase::DispatchStatement(Session* session, Statement* statement, Table* table) {
+    Transaction* transaction = &session->transaction;
+    switch (statement->type) {
+        case STATEMENT_BEGIN:
+            if (transaction->open) return EXECUTE_TRANSACTION_OPEN;
+            transaction->open = true;
+            return EXECUTE_SUCCESS;
+        case STATEMENT_ROLLBACK:
+        case STATEMENT_COMMIT: {
+            if (!transaction->open) return EXECUTE_NO_TRANSACTION;
+            ExecuteResult result = EXECUTE_SUCCESS;
+            if (statement->type == STATEMENT_COMMIT && !transaction->statements.empty()) {
+                result = ExecuteTransaction(table, transaction->statements);
+            }
+            transaction->open = false;
+            transaction->statements.clear();
+            return result;
+        }
+        case STATEMENT_INSERT:
+        case STATEMENT_DELETE:
+        case STATEMENT_UPDATE:
+            if (transaction->open) {
+                transaction->statements.push_back(*statement);
+                return EXECUTE_SUCCESS;
+            }
+            // the rows of a multi-row insert go in together like a transaction of their own
+            if (!statement->rows.empty()) {
+                return ExecuteTransaction(table, std::vector<Statement>(1, *statement));
+            }
+            break;
+        case STATEMENT_SELECT:
+        case STATEMENT_CREATE_INDEX:
+            // a select would read the table without the writes still kept in the transaction
+            if (transaction->open) return EXECUTE_TRANSACTION_OPEN;
+            break;
+        default: break;
+    }
 
-    uint32_t num_cells = *LeafNodeNumCells(node);
+    bool is_write = statement->type != STATEMENT_SELECT;
+    if (statement->type == STATEMENT_CREATE_INDEX) {
+        pthread_rwlock_wrlock(&table->schema_latch);
+    } else {
+        pthread_rwlock_rdlock(&table->schema_latch);
+    }
+    if (is_write) pthread_rwlock_rdlock(&table->pager->commit_latch);
 
+    ExecuteResult result = EXECUTE_SUCCESS;
+    switch (statement->type) {
+        case STATEMENT_INSERT: result = ExecuteInsert(statement, table); break;
+        case STATEMENT_SELECT: result = ExecuteSelect(statement, table, &session->writer); break;
+        case STATEMENT_DELETE: result = ExecuteDelete(statement, table); break;
+        case STATEMENT_UPDATE: result = ExecuteUpdate(statement, table); break;
+        case STATEMENT_CREATE_INDEX: result = ExecuteCreateIndex(statement, table); break;
+        default: break;
+    }
+
+    if (is_write) pthread_rwlock_unlock(&table->pager->commit_latch);
+    pthread_rwlock_unlock(&table->schema_latch);
+    // every statement that writes commits on its own
+    if (is_write) WalCommit(table->pager);
+    return result;
+}
+
+// Most inserts fit in their leaf and only latch that leaf exclusive. One that has to split the leaf goes down again
+// and latches exclusive the part of the path the split changes. The same goes for updates that grow a row.
+ExecuteResult LitDatabase::ExecuteInsert(Statement* statement, Table* table) {
     Row row = statement->row_to_insert;
     uint32_t key_to_insert = row.id;
-    Cursor* cursor = TableFind(table, key_to_insert);
-    if (cursor->cell_num < num_cells) {
-        uint32_t key_at_index = *LeafNodeKey(node, cursor->cell_num);
-        if (key_at_index == key_to_insert) {
-            return EXECUTE_DUPLICATE_KEY;
+    uint32_t length = SerializedRowSize(row);
+    for (CursorMode mode = CURSOR_WRITE;; mode = CURSOR_SPLIT) {
+        Cursor* cursor = TableFind(table, key_to_insert, mode);
+
+        void* node = GetPage(table->pager, cursor->page_num);
+        uint32_t num_cells = *LeafNodeNumCells(node);
+        bool fits = LeafNodeFreeSpace(node) >= LEAF_NODE_CELL_SIZE + length;
+        if (cursor->cell_num < num_cells) {
+            uint32_t key_at_index = *LeafNodeKey(node, cursor->cell_num);
+            if (key_at_index == key_to_insert) {
+                UnpinPage(table->pager, cursor->page_num);
+                CursorClose(cursor);
+                return EXECUTE_DUPLICATE_KEY;
+            }
         }
+        UnpinPage(table->pager, cursor->page_num);
+        if (!fits && mode == CURSOR_WRITE) {
+            CursorClose(cursor);
+            continue;
+        }
+
+        LeafNodeInsert(cursor, row.id, row);
+        CursorClose(cursor);
+        IndexUpdateRow(table, nullptr, &row);
+
+        return EXECUTE_SUCCESS;
+    }
+}
+
+// A select of one id reads it from the live tree, latching its way down to the leaf. Anything longer reads a
+// snapshot of the table, see snapshot.cpp.
+ExecuteResult LitDatabase::ExecuteSelect(Statement* statement, Table* table, ResultWriter* output) {
+    if (statement->range_low == statement->range_high && !statement->filter_by_column) {
+        return ExecuteSelectRows(statement, table, output, nullptr);
     }
+    Snapshot snapshot;
+    SnapshotOpen(table->pager, &snapshot);
+    ExecuteResult result = ExecuteSelectRows(statement, table, output, &snapshot);
+    SnapshotClose(table->pager);
+    return result;
+}
 
-    LeafNodeInsert(cursor, row.id, row);
+// seek to the low end of the range and walk the leaf chain until the high end or the limit. An offset is skipped by
+// counting instead of walking, the scan starts at the row that many places after the first row of the range.
+ExecuteResult LitDatabase::ExecuteSelectRows(Statement* statement, Table* table, ResultWriter* output,
+                                            const Snapshot* snapshot) {
+    if (!statement->ids.empty()) {
+        return ExecuteSelectIn(statement, table, output, snapshot);
+    }
+    if (statement->filter_by_column) {
+        return ExecuteSelectWhereColumn(statement, table, output, snapshot);
+    }
+    if (statement->output != SELECT_ROWS) {
+        return ExecuteSelectAggregate(statement, table, output, snapshot);
+    }
+    if (statement->range_low > statement->range_high || statement->limit == 0) {
+        return EXECUTE_SUCCESS;
+    }
 
-    free(cursor);
+    Cursor* cursor =
+        statement->offset == 0
+            ? TableSeek(table, statement->range_low, CURSOR_READ, snapshot)
+            : TableAt(table, TableCountBelow(table, statement->range_low, nullptr, snapshot) + statement->offset,
+                      snapshot);
+    RowView row;
+    uint32_t num_rows = 0;
+    while (!(cursor->end_of_table) && num_rows < statement->limit) {
+        // the view points into the leaf, the row is written out before the leaf is unpinned
+        ViewRow(CursorValue(cursor), &row);
+        bool in_range = row.id <= statement->range_high;
+        if (in_range) WriteRow(output, row);
+        CursorUnpinLeaf(cursor);
+        if (!in_range) break;
+        num_rows += 1;
+        CursorAdvance(cursor);
+    }
+    CursorClose(cursor);
+    WriterFlush(output);
 
     return EXECUTE_SUCCESS;
 }
 
-ExecuteResult LitDatabase::ExecuteSelect(Statement* statement, Table* table) {
-    Cursor* cursor = TableStart(table);
-    Row row;
-    while (!(cursor->end_of_table)) {
-        DeserializeRow(CursorValue(cursor), &row);
-        PrintRow(row);
-        CursorAdvance(cursor);
+// A delete that leaves its leaf above the minimum fill only changes that leaf. One that does not is done again
+// alone in the tree, since merging or borrowing reaches siblings and parents no descent holds latched.
+ExecuteResult LitDatabase::ExecuteDelete(Statement* statement, Table* table) {
+    for (CursorMode mode = CURSOR_WRITE;; mode = CURSOR_EXCLUSIVE) {
+        Cursor* cursor = TableFind(table, statement->key, mode);
+
+        void* node = GetPage(table->pager, cursor->page_num);
+        bool found =
+            cursor->cell_num < *LeafNodeNumCells(node) && *LeafNodeKey(node, cursor->cell_num) == statement->key;
+        if (!found) {
+            UnpinPage(table->pager, cursor->page_num);
+            CursorClose(cursor);
+            return EXECUTE_KEY_NOT_FOUND;
+        }
+        if (mode == CURSOR_WRITE && !LeafNodeCanRemove(node, cursor->cell_num)) {
+            UnpinPage(table->pager, cursor->page_num);
+            CursorClose(cursor);
+            continue;
+        }
+
+        Row row;
+        DeserializeRow(LeafNodeValue(node, cursor->cell_num), &row);
+        if (mode == CURSOR_WRITE) {
+            LeafNodeRemoveCell(node, cursor->cell_num);
+            MarkPageDirty(table->pager, cursor->page_num);
+            UnpinPage(table->pager, cursor->page_num);
+            CursorAddRows(cursor, -1);
+        } else {
+            UnpinPage(table->pager, cursor->page_num);
+            LeafNodeDelete(cursor);
+        }
+        CursorClose(cursor);
+        IndexUpdateRow(table, &row, nullptr);
+
+        return EXECUTE_SUCCESS;
     }
+}
 
-    free(cursor);
+ExecuteResult LitDatabase::ExecuteUpdate(Statement* statement, Table* table) {
+    for (CursorMode mode = CURSOR_WRITE;; mode = CURSOR_SPLIT) {
+        Cursor* cursor = TableFind(table, statement->key, mode);
 
-    return EXECUTE_SUCCESS;
+        void* node = GetPage(table->pager, cursor->page_num);
+        if (cursor->cell_num >= *LeafNodeNumCells(node) || *LeafNodeKey(node, cursor->cell_num) != statement->key) {
+            UnpinPage(table->pager, cursor->page_num);
+            CursorClose(cursor);
+            return EXECUTE_KEY_NOT_FOUND;
+        }
+
+        Row old_row;
+        DeserializeRow(LeafNodeValue(node, cursor->cell_num), &old_row);
+        Row row = old_row;
+        if (statement->set_username) strcpy(row.username, statement->row_to_update.username);
+        if (statement->set_email) strcpy(row.email, statement->row_to_update.email);
+
+        uint32_t length = SerializedRowSize(row);
+        uint16_t* old_length = LeafNodeRecordLength(node, cursor->cell_num);
+        if (length <= *old_length) {
+            // shrinking in place, the tail of the old record is left fragmented
+            *LeafNodeFragmented(node) += *old_length - length;
+            *old_length = length;
+            SerializeRow(row, LeafNodeValue(node, cursor->cell_num));
+            MarkPageDirty(table->pager, cursor->page_num);
+            UnpinPage(table->pager, cursor->page_num);
+        } else if (mode == CURSOR_WRITE && LeafNodeFreeSpace(node) + *old_length < length) {
+            UnpinPage(table->pager, cursor->page_num);
+            CursorClose(cursor);
+            continue;
+        } else {
+            // a longer record is inserted again, splitting the leaf if it no longer fits
+            LeafNodeRemoveCell(node, cursor->cell_num);
+            MarkPageDirty(table->pager, cursor->page_num);
+            UnpinPage(table->pager, cursor->page_num);
+            CursorAddRows(cursor, -1);
+            LeafNodeInsert(cursor, row.id, row);
+        }
+        CursorClose(cursor);
+        IndexUpdateRow(table, &old_row, &row);
+
+        return EXECUTE_SUCCESS;
+    }
 }
 
-void LitDatabase::PrintRow(const Row& row) { printf("(%d, %s, %s)\n", row.id, row.username, row.email); }
+// the leaf the cursor is on, pinned until CursorUnpinLeaf. A cursor on a snapshot has it in its copy.
+void* LitDatabase::CursorLeaf(Cursor* cursor) {
+    if (cursor->snapshot) return cursor->copy;
+    return GetPage(cursor->table->pager, cursor->page_num);
+}
 
-void* LitDatabase::CursorValue(Cursor* cursor) {
-    uint32_t page_num = cursor->page_num;
-    void* page = GetPage(cursor->table->pager, page_num);
-    return LeafNodeValue(page, cursor->cell_num);
+void LitDatabase::CursorUnpinLeaf(Cursor* cursor) {
+    if (cursor->snapshot == nullptr) UnpinPage(cursor->table->pager, cursor->page_num);
+}
+
+// the record under the cursor, its leaf stays pinned until CursorUnpinLeaf
+void* LitDatabase::CursorValue(Cursor* cursor) { return LeafNodeValue(CursorLeaf(cursor), cursor->cell_num); }
+
+uint32_t LitDatabase::SerializedRowSize(const Row& source) {
+    return ID_SIZE + STRING_LENGTH_SIZE + strlen(source.username) + STRING_LENGTH_SIZE + strlen(source.email);
 }
 
 void LitDatabase::SerializeRow(const Row& source, void* destination) {
-    memcpy(static_cast<unsigned char*>(destination) + ID_OFFSET, &(source.id), ID_SIZE);
-    memcpy(static_cast<unsigned char*>(destination) + USERNAME_OFFSET, &(source.username), USERNAME_SIZE);
-    memcpy(static_cast<unsigned char*>(destination) + EMAIL_OFFSET, &(source.email), EMAIL_SIZE);
+    unsigned char* cursor = static_cast<unsigned char*>(destination);
+    memcpy(cursor, &(source.id), ID_SIZE);
+    cursor += ID_SIZE;
+    uint8_t length = strlen(source.username);
+    *cursor++ = length;
+    memcpy(cursor, source.username, length);
+    cursor += length;
+    length = strlen(source.email);
+    *cursor++ = length;
+    memcpy(cursor, source.email, length);
 }
 
 void LitDatabase::DeserializeRow(void* source, Row* destination) {
-    memcpy(&(destination->id), static_cast<unsigned char*>(source) + ID_OFFSET, ID_SIZE);
-    memcpy(&(destination->username), static_cast<unsigned char*>(source) + USERNAME_OFFSET, USERNAME_SIZE);
-    memcpy((&destination->email), static_cast<unsigned char*>(source) + EMAIL_OFFSET, EMAIL_SIZE);
+    unsigned char* cursor = static_cast<unsigned char*>(source);
+    memcpy(&(destination->id), cursor, ID_SIZE);
+    cursor += ID_SIZE;
+    uint8_t length = *cursor++;
+    memcpy(destination->username, cursor, length);
+    destination->username[length] = '\0';
+    cursor += length;
+    length = *cursor++;
+    memcpy(destination->email, cursor, length);
+    destination->email[length] = '\0';
 }
 
-Table* LitDatabase::DbOpen(const char* filename) {
+void LitDatabase::ViewRow(void* source, RowView* destination) {
+    const char* cursor = static_cast<const char*>(source);
+    memcpy(&(destination->id), cursor, ID_SIZE);
+    cursor += ID_SIZE;
+    destination->username_length = static_cast<uint8_t>(*cursor++);
+    destination->username = cursor;
+    cursor += destination->username_length;
+    destination->email_length = static_cast<uint8_t>(*cursor++);
+    destination->email = cursor;
+}
+
+Table* LitDatabase::DbOpen(const char* filename, uint32_t pool_frames, PagerMode mode) {
     file_name = filename;
     Pager* pager = PagerOpen();
+    pager->max_frames = pool_frames;
+    WalOpen(pager);
+    WalRecover(pager);
+    if (mode == PAGER_MMAP && pager->page_map.enabled) {
+        std::cout << "Compressed database files are read through the buffer pool." << std::endl;
+        mode = PAGER_BUFFER_POOL;
+    }
+    if (mode == PAGER_MMAP) {
+        PagerMapOpen(pager);
+    }
+    if (prefetch_leaves > 0) {
+        PrefetchStart(pager);
+    }
 
     Table* table = new Table();
     table->pager = pager;
-    table->root_page_num = 0;
 
-    if (pager->num_pages == 0) {
-        void* root_node = GetPage(pager, 0);
+    bool is_new = pager->num_pages == 0;
+    void* header = GetPage(pager, DB_HEADER_PAGE_NUM);
+    if (is_new) {
+        // new database, the header is followed by an empty root leaf
+        *HeaderMagic(header) = DB_MAGIC;
+        *HeaderVersion(header) = DB_VERSION;
+        *HeaderRootPage(header) = 1;
+        *HeaderFreelistHead(header) = 0;
+        *HeaderFreelistCount(header) = 0;
+        for (uint32_t i = 0; i < INDEX_COLUMN_COUNT; ++i) {
+            *HeaderIndexRoot(header, static_cast<IndexColumn>(i)) = 0;
+        }
+        MarkPageDirty(pager, DB_HEADER_PAGE_NUM);
+
+        void* root_node = GetPage(pager, 1);
         InitializeLeafNode(root_node);
         set_node_root(root_node, true);
+        MarkPageDirty(pager, 1);
+        UnpinPage(pager, 1);
+    } else if (*HeaderMagic(header) != DB_MAGIC || *HeaderVersion(header) != DB_VERSION) {
+        std::cout << "Not a LitDatabase file, or written by an unsupported version." << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    table->root_page_num = *HeaderRootPage(header);
+    for (uint32_t i = 0; i < INDEX_COLUMN_COUNT; ++i) {
+        uint32_t index_root_page_num = *HeaderIndexRoot(header, static_cast<IndexColumn>(i));
+        if (index_root_page_num != 0) {
+            table->indexes[i] = IndexOpen(table, index_root_page_num);
+        }
     }
+    UnpinPage(pager, DB_HEADER_PAGE_NUM);
+    WalCommit(pager);
 
     return table;
 }
@@ -221,70 +879,196 @@ Pager* LitDatabase::PagerOpen() {
     pager->file_length = file_length;
     pager->num_pages = (file_length / PAGE_SIZE);
 
+    // a compressed file starts with the page map header slots instead of the database header
+    uint32_t magic[2] = {0, 0};
+    for (uint32_t i = 0; i < 2; ++i) {
+        if (pread(file_descriptor, &magic[i], sizeof(uint32_t), i * PAGE_MAP_SLOT_SIZE) != sizeof(uint32_t)) break;
+    }
+    if (file_length == 0 ? compress_pages : magic[0] == PAGE_MAP_MAGIC || magic[1] == PAGE_MAP_MAGIC) {
+        PageMapOpen(pager, file_length == 0);
+        pager->num_pages = pager->page_map.extents.size();
+        return pager;
+    }
+
     if (file_length % PAGE_SIZE != 0) {
         printf("db file is not a whole number of pages\n");
         exit(EXIT_FAILURE);
     }
 
-    for (uint32_t i = 0; i < TABLE_MAX_PAGES; ++i) {
-        pager->pages[i] = nullptr;
-    }
-
     return pager;
 }
 
+// return the page pinned in the buffer pool, every GetPage must be paired with an UnpinPage
 void* LitDatabase::GetPage(Pager* pager, uint32_t page_num) {
-    if (page_num >= TABLE_MAX_PAGES) {
-        std::cout << "Tried to fetch page number out of bounds." << std::endl;
-        exit(EXIT_FAILURE);
+    if (pager->mode == PAGER_MMAP) {
+        // pages already in the file are at fixed addresses and need no lock, the count only ever grows
+        char* page = pager->map + static_cast<size_t>(page_num) * PAGE_SIZE;
+        if (page_num < __atomic_load_n(&pager->num_pages, __ATOMIC_ACQUIRE)) {
+            return page;
+        }
+        pthread_mutex_lock(&pager->mutex);
+        if (static_cast<off_t>(page_num) * PAGE_SIZE >= pager->file_length) {
+            PagerMapGrow(pager, page_num + 1);
+        }
+        if (page_num >= pager->num_pages) {
+            __atomic_store_n(&pager->num_pages, page_num + 1, __ATOMIC_RELEASE);
+        }
+        pthread_mutex_unlock(&pager->mutex);
+        return page;
+    }
+
+    pthread_mutex_lock(&pager->mutex);
+    auto it = pager->page_table.find(page_num);
+    if (it != pager->page_table.end()) {
+        Frame& frame = pager->frames[it->second];
+        frame.pin_count += 1;
+        frame.referenced = true;
+        void* page = frame.data;
+        pager->counters.page_hits.fetch_add(1, std::memory_order_relaxed);
+        pthread_mutex_unlock(&pager->mutex);
+        return page;
+    }
+    pager->counters.page_misses.fetch_add(1, std::memory_order_relaxed);
+
+    // Cache miss, take a free frame or evict one and load from file
+    uint32_t frame_index;
+    if (pager->frames.size() < pager->max_frames) {
+        frame_index = pager->frames.size();
+        Frame frame;
+        frame.data = malloc(PAGE_SIZE);
+        pager->frames.push_back(frame);
+    } else {
+        frame_index = PagerFindVictim(pager);
+    }
+    Frame& frame = pager->frames[frame_index];
+    void* page = frame.data;
+
+    off_t log_offset = -1;
+    auto logged = pager->wal.pending.find(page_num);
+    if (logged != pager->wal.pending.end()) {
+        log_offset = logged->second;
+    } else if ((logged = pager->wal.index.find(page_num)) != pager->wal.index.end()) {
+        log_offset = logged->second;
     }
 
-    if (pager->pages[page_num] == nullptr) {
-        // Cache miss, allocate memory and load from file
-        void* page = malloc(PAGE_SIZE);
-        uint32_t num_pages = pager->file_length / PAGE_SIZE;
-        if (pager->file_length % PAGE_SIZE) {
-            num_pages += 1;
+    if (log_offset != -1) {
+        // the newest image of the page is in the log
+        ssize_t bytes_read = pread(pager->wal.file_descriptor, page, PAGE_SIZE, log_offset + WAL_FRAME_HEADER_SIZE);
+        if (bytes_read != PAGE_SIZE) {
+            printf("Error reading write-ahead log\n");
+            exit(EXIT_FAILURE);
+        }
+        pager->counters.bytes_read.fetch_add(PAGE_SIZE, std::memory_order_relaxed);
+    } else if (pager->page_map.enabled) {
+        pager->counters.bytes_read.fetch_add(PageMapRead(pager, page_num, page), std::memory_order_relaxed);
+    } else if (page_num < PagerFilePages(pager)) {
+        // windows
+        // pager->fd->open(file_name, std::fstream::in);
+        // pager->fd->seekg(page_num * PAGE_SIZE, std::fstream::beg);
+        // pager->fd->read(static_cast<char*>(page), PAGE_SIZE);
+        // if (pager->fd->fail()) {
+        //     std::cout << "Read failed" << std::endl;
+        // }
+
+        // pager->fd->close();
+        // pager->fd->clear();
+
+        // linux
+        ssize_t bytes_read = pread(pager->file_descriptor, page, PAGE_SIZE, static_cast<off_t>(page_num) * PAGE_SIZE);
+        if (bytes_read == -1) {
+            printf("Error reading file\n");
+            exit(EXIT_FAILURE);
         }
+        pager->counters.bytes_read.fetch_add(bytes_read, std::memory_order_relaxed);
+    } else {
+        memset(page, 0, PAGE_SIZE);
+    }
 
-        if (page_num < num_pages) {
-            // windows
-            // pager->fd->open(file_name, std::fstream::in);
-            // pager->fd->seekg(page_num * PAGE_SIZE, std::fstream::beg);
-            // pager->fd->read(static_cast<char*>(page), PAGE_SIZE);
-            // if (pager->fd->fail()) {
-            //     std::cout << "Read failed" << std::endl;
-            // }
+    frame.page_num = page_num;
+    frame.pin_count = 1;
+    frame.dirty = false;
+    frame.referenced = true;
+    pager->page_table[page_num] = frame_index;
 
-            // pager->fd->close();
-            // pager->fd->clear();
+    if (page_num >= pager->num_pages) {
+        pager->num_pages = page_num + 1;
+    }
+    pthread_mutex_unlock(&pager->mutex);
 
-            // linux
-            lseek(pager->file_descriptor, page_num * PAGE_SIZE, SEEK_SET);
-            ssize_t bytes_read = read(pager->file_descriptor, page, PAGE_SIZE);
-            if (bytes_read == -1) {
-                printf("Error reading file\n");
-                exit(EXIT_FAILURE);
-            }
+    return page;
+}
+
+void LitDatabase::UnpinPage(Pager* pager, uint32_t page_num) {
+    if (pager->mode == PAGER_MMAP) return;
+
+    pthread_mutex_lock(&pager->mutex);
+    auto it = pager->page_table.find(page_num);
+    if (it == pager->page_table.end() || pager->frames[it->second].pin_count == 0) {
+        std::cout << "Tried to unpin page that is not pinned." << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    pager->frames[it->second].pin_count -= 1;
+    pthread_mutex_unlock(&pager->mutex);
+}
+
+// callers that write through a pinned page must mark it, clean pages are never written back
+void LitDatabase::MarkPageDirty(Pager* pager, uint32_t page_num) {
+    pthread_mutex_lock(&pager->mutex);
+    if (pager->mode == PAGER_MMAP) {
+        if (!pager->map_dirty[page_num]) {
+            pager->map_dirty[page_num] = true;
+            pager->wal.dirty_pages.push_back(page_num);
         }
+        pthread_mutex_unlock(&pager->mutex);
+        return;
+    }
 
-        pager->pages[page_num] = page;
+    auto it = pager->page_table.find(page_num);
+    if (it == pager->page_table.end() || pager->frames[it->second].pin_count == 0) {
+        std::cout << "Tried to dirty page that is not pinned." << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    Frame& frame = pager->frames[it->second];
+    if (!frame.dirty) {
+        frame.dirty = true;
+        pager->wal.dirty_pages.push_back(page_num);
+    }
+    pthread_mutex_unlock(&pager->mutex);
+}
 
-        if (page_num >= pager->num_pages) {
-            pager->num_pages = page_num + 1;
+// CLOCK replacement: sweep the frames, giving referenced frames a second chance. With every frame pinned it is fatal
+// when a frame is required, otherwise UINT32_MAX.
+uint32_t LitDatabase::PagerFindVictim(Pager* pager, bool required) {
+    uint32_t num_frames = pager->frames.size();
+    for (uint32_t step = 0; step < 2 * num_frames; ++step) {
+        uint32_t index = pager->clock_hand;
+        pager->clock_hand = (pager->clock_hand + 1) % num_frames;
+
+        Frame& frame = pager->frames[index];
+        if (frame.pin_count > 0) continue;
+        if (frame.referenced) {
+            frame.referenced = false;
+            continue;
         }
+
+        if (frame.dirty) PagerFlush(pager, frame.page_num);
+        pager->page_table.erase(frame.page_num);
+        return index;
     }
 
-    return pager->pages[page_num];
+    if (!required) return UINT32_MAX;
+    std::cout << "Buffer pool exhausted, all frames are pinned." << std::endl;
+    exit(EXIT_FAILURE);
 }
 
 void LitDatabase::DbClose(Table* table) {
     Pager* pager = table->pager;
+    PrefetchStop(pager);
 
-    for (uint32_t i = 0; i < pager->num_pages; ++i) {
-        if (pager->pages[i] == nullptr) continue;
-        PagerFlush(pager, i);
-    }
+    WalCommit(pager);
+    WalCheckpoint(pager);
+    close(pager->wal.file_descriptor);
+    unlink((std::string(file_name) + "-wal").c_str());
 
     // windows
     // if (pager->fd->is_open()) pager->fd->close();
@@ -303,92 +1087,382 @@ void LitDatabase::DbClose(Table* table) {
     delete table;
 }
 
+// write back one dirty frame that is being evicted, it goes to the log as an uncommitted frame
 void LitDatabase::PagerFlush(Pager* pager, uint32_t page_num) {
-    // windows--bugs here!!!
-    // pager->fd->open(file_name, std::fstream::out | std::fstream::binary);
-    // if (pager->pages[page_num] == nullptr) {
-    //     std::cout << "Tried to flush null page." << std::endl;
-    //     exit(EXIT_FAILURE);
-    // }
+    auto it = pager->page_table.find(page_num);
+    if (it == pager->page_table.end()) {
+        std::cout << "Tried to flush null page" << std::endl;
+        exit(EXIT_FAILURE);
+    }
 
-    // pager->fd->seekp(page_num * PAGE_SIZE, std::fstream::beg);
-    // if (pager->fd->fail()) {
-    //     std::cout << "Error seeking." << std::endl;
-    //     exit(EXIT_FAILURE);
-    // }
+    WalAppendFrames(pager, std::vector<uint32_t>(1, page_num), false);
+    pager->frames[it->second].dirty = false;
+}
 
-    // pager->fd->write(static_cast<char*>(pager->pages[page_num]), PAGE_SIZE);
-    // if (pager->fd->fail()) {
-    //     std::cout << "Error writing." << std::endl;
-    //     exit(EXIT_FAILURE);
-    // }
-    // pager->fd->close();
+// write every page dirtied since the last commit to the log in page order, the last frame commits. The caller
+// holds the pager mutex.
+void LitDatabase::PagerFlushDirty(Pager* pager) {
+    Wal& wal = pager->wal;
+    // a page spilled by eviction is no longer dirty in the pool, its frame went to the log already
+    std::vector<uint32_t> dirty;
+    for (uint32_t page_num : wal.dirty_pages) {
+        if (pager->mode == PAGER_MMAP) {
+            if (pager->map_dirty[page_num]) dirty.push_back(page_num), pager->map_dirty[page_num] = false;
+            continue;
+        }
+        auto it = pager->page_table.find(page_num);
+        if (it != pager->page_table.end() && pager->frames[it->second].dirty) dirty.push_back(page_num);
+    }
+    wal.dirty_pages.clear();
+    if (dirty.empty() && !wal.pending.empty()) {
+        // everything was spilled already, reload one page so there is a frame to carry the commit
+        uint32_t page_num = wal.pending.begin()->first;
+        GetPage(pager, page_num);
+        MarkPageDirty(pager, page_num);
+        UnpinPage(pager, page_num);
+        dirty.push_back(page_num);
+        wal.dirty_pages.clear();
+    }
+    if (dirty.empty()) return;
 
-    // linux
-    if (pager->pages[page_num] == nullptr) {
-        std::cout << "Tried to flush null page" << std::endl;
-        exit(EXIT_FAILURE);
+    std::sort(dirty.begin(), dirty.end());
+    dirty.erase(std::unique(dirty.begin(), dirty.end()), dirty.end());
+
+    WalAppendFrames(pager, dirty, true);
+    if (pager->mode == PAGER_BUFFER_POOL) {
+        for (uint32_t page_num : dirty) {
+            pager->frames[pager->page_table[page_num]].dirty = false;
+        }
     }
+}
 
-    off_t offset = lseek(pager->file_descriptor, page_num * PAGE_SIZE, SEEK_SET);
+// the newest image of a page if it is in memory, nullptr if it has to come from disk
+void* LitDatabase::PagerCachedPage(Pager* pager, uint32_t page_num) {
+    if (pager->mode == PAGER_MMAP) {
+        return page_num < pager->num_pages ? pager->map + static_cast<size_t>(page_num) * PAGE_SIZE : nullptr;
+    }
+    auto it = pager->page_table.find(page_num);
+    return it == pager->page_table.end() ? nullptr : pager->frames[it->second].data;
+}
 
-    if (offset == -1) {
-        printf("Error seeking\n");
+// switch the pager to serve pages from a private mapping of the file, the frames are no longer used.
+// Writes stay private to the process and reach the file through the log, like in the buffer pool mode.
+void LitDatabase::PagerMapOpen(Pager* pager) {
+    void* reserved = mmap(nullptr, MMAP_RESERVE_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (reserved == MAP_FAILED) {
+        printf("Error reserving address space for mmap\n");
         exit(EXIT_FAILURE);
     }
+    pager->map = static_cast<char*>(reserved);
+    pager->map_pages = 0;
+    pager->mode = PAGER_MMAP;
 
-    ssize_t bytes_written = write(pager->file_descriptor, pager->pages[page_num], PAGE_SIZE);
+    uint32_t file_pages = pager->file_length / PAGE_SIZE;
+    if (file_pages > 0) {
+        PagerMapGrow(pager, file_pages);
+    }
+}
 
-    if (bytes_written == -1) {
-        printf("Error writing\n");
+// extend the file to min_pages and map the new tail in place, addresses of mapped pages never change
+void LitDatabase::PagerMapGrow(Pager* pager, uint32_t min_pages) {
+    off_t new_length = static_cast<off_t>(min_pages) * PAGE_SIZE;
+    if (new_length > pager->file_length) {
+        if (ftruncate(pager->file_descriptor, new_length) == -1) {
+            printf("Error extending db file\n");
+            exit(EXIT_FAILURE);
+        }
+        pager->file_length = new_length;
+    }
+    if (min_pages <= pager->map_pages) return;
+
+    // the mapping runs ahead of the file, pages past the end of file are never touched
+    uint32_t new_pages = std::max(min_pages, pager->map_pages + std::max(MMAP_GROW_PAGES, pager->map_pages / 4));
+    if (static_cast<uint64_t>(new_pages) * PAGE_SIZE > MMAP_RESERVE_SIZE) {
+        std::cout << "Database file exceeds the mmap reservation." << std::endl;
         exit(EXIT_FAILURE);
     }
-}
 
-Cursor* LitDatabase::TableStart(Table* table) {
-    Cursor* cursor = TableFind(table, 0);
+    size_t old_bytes = static_cast<size_t>(pager->map_pages) * PAGE_SIZE;
+    size_t new_bytes = static_cast<size_t>(new_pages) * PAGE_SIZE;
+    void* tail = mmap(pager->map + old_bytes, new_bytes - old_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+                      pager->file_descriptor, old_bytes);
+    if (tail == MAP_FAILED) {
+        printf("Error mapping db file\n");
+        exit(EXIT_FAILURE);
+    }
+    pager->map_pages = new_pages;
+    pager->map_dirty.resize(new_pages, false);
+}
 
-    void* node = GetPage(table->pager, cursor->page_num);
-    uint32_t num_cells = *LeafNodeNumCells(node);
-    cursor->end_of_table = (num_cells == 0);
+Cursor* LitDatabase::TableStart(Table* table) { return TableSeek(table, 0); }
+
+// position the cursor on the first key >= key for a scan. TableFind may stop one past the last cell of a leaf
+// when the key falls between two leaves, the scan then starts on the next leaf.
+Cursor* LitDatabase::TableSeek(Table* table, uint32_t key, CursorMode mode, const Snapshot* snapshot) {
+    Cursor* cursor = TableFind(table, key, mode, snapshot);
+    cursor->end_of_table = false;
+
+    uint32_t num_cells = *LeafNodeNumCells(CursorLeaf(cursor));
+    CursorUnpinLeaf(cursor);
+    if (num_cells == 0) {
+        cursor->end_of_table = true;
+    } else if (cursor->cell_num >= num_cells) {
+        // step from the last cell onto the next leaf
+        cursor->cell_num = num_cells - 1;
+        CursorAdvance(cursor);
+    }
 
     return cursor;
 }
 
-// return the position of the given key
-Cursor* LitDatabase::TableFind(Table* table, uint32_t key) {
-    uint32_t root_page_num = table->root_page_num;
-    void* root_node = GetPage(table->pager, root_page_num);
-    if (get_node_type(root_node) == NODE_LEAF) {
-        return LeafNodeFind(table, root_page_num, key);
-    } else {
-        return InternalNodeFind(table, root_page_num, key);
+// return the position of the given key, the cursor holds its leaf latched as the mode asks until it is closed.
+// Each node on the way down is latched before the latch on its parent is let go, a write cursor keeps the parents.
+Cursor* LitDatabase::TableFind(Table* table, uint32_t key, CursorMode mode, const Snapshot* snapshot) {
+    Pager* pager = table->pager;
+    Cursor* cursor = static_cast<Cursor*>(malloc(sizeof(Cursor)));
+    cursor->table = table;
+    cursor->end_of_table = false;
+    cursor->mode = mode;
+    cursor->num_ancestors = 0;
+    cursor->leaves_entered = 0;
+    cursor->leaves_ahead = 0;
+    cursor->snapshot = snapshot;
+    cursor->copy = snapshot ? malloc(PAGE_SIZE) : nullptr;
+
+    bool latched = mode != CURSOR_EXCLUSIVE && snapshot == nullptr;
+    uint64_t shape_changes = 0;
+    if (latched) {
+        pthread_rwlock_rdlock(&table->tree_latch);
+        if (TableFindRightmost(cursor, key, &shape_changes)) {
+            return mode == CURSOR_SPLIT ? CursorLatchSplit(cursor, key) : cursor;
+        }
+    } else if (snapshot == nullptr) {
+        pthread_rwlock_wrlock(&table->tree_latch);
+        // whatever this cursor changes, the path to the rightmost leaf may be gone by the time it is closed
+        TableShapeChanged(table);
+    }
+
+    pager->counters.descents.fetch_add(1, std::memory_order_relaxed);
+    uint32_t levels = 0;
+    // the path is kept in case it ends at the rightmost leaf
+    RightmostPath path;
+    path.min_key = 0;
+    path.depth = 0;
+    bool rightmost = latched;
+    uint32_t page_num = table->root_page_num;
+    uint32_t parent_page_num = 0;
+    bool has_parent = false;
+    while (true) {
+        if (latched) LatchPage(pager, page_num, LATCH_SHARED);
+        if (latched && mode == CURSOR_READ && has_parent) UnlatchPage(pager, parent_page_num);
+        void* node = ReadNode(pager, snapshot, page_num, cursor->copy);
+        levels += 1;
+        if (mode == CURSOR_WRITE && get_node_type(node) == NODE_LEAF) {
+            // a leaf stays a leaf while its parent is latched, only a root leaf can split in between
+            UnpinPage(pager, page_num);
+            UnlatchPage(pager, page_num);
+            LatchPage(pager, page_num, LATCH_EXCLUSIVE);
+            node = GetPage(pager, page_num);
+            if (get_node_type(node) != NODE_LEAF) {
+                UnpinPage(pager, page_num);
+                UnlatchPage(pager, page_num);
+                continue;
+            }
+        }
+
+        if (get_node_type(node) == NODE_LEAF) {
+            cursor->page_num = page_num;
+            // the position of the key, or where it would be inserted
+            cursor->cell_num = KeyLowerBound(LeafNodeKey(node, 0), *LeafNodeNumCells(node), key);
+            ReleaseNode(pager, snapshot, page_num);
+            pager->counters.descent_levels.fetch_add(levels, std::memory_order_relaxed);
+            if (rightmost && path.depth > 0) {
+                path.valid = true;
+                path.leaf_page_num = page_num;
+                pthread_mutex_lock(&table->rightmost_mutex);
+                // a split on the way down may have moved nodes this descent had already let go
+                if (table->shape_changes.load(std::memory_order_relaxed) == shape_changes) table->rightmost = path;
+                pthread_mutex_unlock(&table->rightmost_mutex);
+            }
+            return mode == CURSOR_SPLIT ? CursorLatchSplit(cursor, key) : cursor;
+        }
+
+        uint32_t num_keys = *InternalNodeNumKeys(node);
+        uint32_t child_num = InternalNodeFindChild(node, key);
+        uint32_t child_page_num = *InternalNodeChild(node, child_num);
+        if (rightmost && child_num == num_keys && path.depth < BTREE_MAX_DEPTH) {
+            uint32_t last_key = num_keys > 0 ? *InternalNodeKey(node, num_keys - 1) : 0;
+            // with UINT32_MAX as a key no larger one can come, the path is of no use
+            rightmost = last_key != UINT32_MAX;
+            path.min_key = std::max(path.min_key, last_key + 1);
+            path.ancestors[path.depth] = page_num;
+            path.child_nums[path.depth] = child_num;
+            path.depth += 1;
+        } else {
+            rightmost = false;
+        }
+        ReleaseNode(pager, snapshot, page_num);
+        if (mode != CURSOR_READ) {
+            if (cursor->num_ancestors == BTREE_MAX_DEPTH) {
+                std::cout << "Tree is too deep." << std::endl;
+                exit(EXIT_FAILURE);
+            }
+            cursor->ancestors[cursor->num_ancestors] = page_num;
+            cursor->child_nums[cursor->num_ancestors] = child_num;
+            cursor->num_ancestors += 1;
+        }
+        parent_page_num = page_num;
+        has_parent = true;
+        page_num = child_page_num;
+    }
+}
+
+// place a cursor that holds the tree latch shared on the rightmost leaf without a descent, if the key is above every
+// key on the path to it. The nodes are latched as a descent would latch them but not searched, and kept if no split
+// changed the shape of the tree before they were all latched. The rows of the leaf can change, so it is searched as
+// usual. Either way shape_changes is the count the path was read with, for a descent to publish its own path with.
+bool LitDatabase::TableFindRightmost(Cursor* cursor, uint32_t key, uint64_t* shape_changes) {
+    Table* table = cursor->table;
+    Pager* pager = table->pager;
+    pthread_mutex_lock(&table->rightmost_mutex);
+    *shape_changes = table->shape_changes.load(std::memory_order_relaxed);
+    bool found = table->rightmost.valid && key >= table->rightmost.min_key;
+    if (found && cursor->mode != CURSOR_READ) {
+        RightmostPath& path = table->rightmost;
+        memcpy(cursor->ancestors, path.ancestors, path.depth * sizeof(uint32_t));
+        memcpy(cursor->child_nums, path.child_nums, path.depth * sizeof(uint32_t));
+        cursor->num_ancestors = path.depth;
+    }
+    uint32_t page_num = table->rightmost.leaf_page_num;
+    pthread_mutex_unlock(&table->rightmost_mutex);
+    if (!found) return false;
+
+    for (uint32_t i = 0; i < cursor->num_ancestors; ++i) {
+        LatchPage(pager, cursor->ancestors[i], LATCH_SHARED);
+    }
+    LatchPage(pager, page_num, cursor->mode == CURSOR_WRITE ? LATCH_EXCLUSIVE : LATCH_SHARED);
+    if (table->shape_changes.load(std::memory_order_acquire) != *shape_changes) {
+        UnlatchPage(pager, page_num);
+        for (uint32_t i = 0; i < cursor->num_ancestors; ++i) {
+            UnlatchPage(pager, cursor->ancestors[i]);
+        }
+        cursor->num_ancestors = 0;
+        return false;
+    }
+    void* node = GetPage(pager, page_num);
+    cursor->page_num = page_num;
+    cursor->cell_num = KeyLowerBound(LeafNodeKey(node, 0), *LeafNodeNumCells(node), key);
+    UnpinPage(pager, page_num);
+    pager->counters.rightmost_hits.fetch_add(1, std::memory_order_relaxed);
+    // a descent of one level, the leaf
+    pager->counters.descents.fetch_add(1, std::memory_order_relaxed);
+    pager->counters.descent_levels.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+// Latch a cursor that came down like CURSOR_WRITE, with its leaf latched shared, for a split of its leaf. The split
+// climbs up to the last node on the path with room for one more key, so that node and everything below it are
+// latched exclusive and the nodes above stay shared, only their row counts change. The lower part of the path is let
+// go bottom up and latched again top down. The node with room is still the child its parent had, which stays latched,
+// but it may have filled up meanwhile, the cursor then starts over. If no node on the path has room the root splits,
+// the cursor starts over as CURSOR_EXCLUSIVE.
+Cursor* LitDatabase::CursorLatchSplit(Cursor* cursor, uint32_t key) {
+    Table* table = cursor->table;
+    Pager* pager = table->pager;
+    uint32_t top = cursor->num_ancestors;
+    for (uint32_t i = cursor->num_ancestors; i > 0 && top == cursor->num_ancestors; --i) {
+        void* node = GetPage(pager, cursor->ancestors[i - 1]);
+        if (*InternalNodeNumKeys(node) < INTERNAL_NODE_MAX_CELLS) top = i - 1;
+        UnpinPage(pager, cursor->ancestors[i - 1]);
+    }
+    if (top == cursor->num_ancestors) {
+        CursorClose(cursor);
+        return TableFind(table, key, CURSOR_EXCLUSIVE);
+    }
+
+    UnlatchPage(pager, cursor->page_num);
+    for (uint32_t i = cursor->num_ancestors; i > top; --i) {
+        UnlatchPage(pager, cursor->ancestors[i - 1]);
+    }
+    uint32_t page_num = cursor->ancestors[top];
+    cursor->num_ancestors = top;
+    while (true) {
+        LatchPage(pager, page_num, LATCH_EXCLUSIVE);
+        void* node = GetPage(pager, page_num);
+        if (get_node_type(node) == NODE_LEAF) {
+            cursor->page_num = page_num;
+            cursor->cell_num = KeyLowerBound(LeafNodeKey(node, 0), *LeafNodeNumCells(node), key);
+            UnpinPage(pager, page_num);
+            return cursor;
+        }
+        if (cursor->num_ancestors == top && *InternalNodeNumKeys(node) >= INTERNAL_NODE_MAX_CELLS) {
+            UnpinPage(pager, page_num);
+            // closed like a cursor on it
+            cursor->page_num = page_num;
+            CursorClose(cursor);
+            return TableFind(table, key, CURSOR_SPLIT);
+        }
+        uint32_t child_num = InternalNodeFindChild(node, key);
+        cursor->ancestors[cursor->num_ancestors] = page_num;
+        cursor->child_nums[cursor->num_ancestors] = child_num;
+        cursor->num_ancestors += 1;
+        uint32_t child_page_num = *InternalNodeChild(node, child_num);
+        UnpinPage(pager, page_num);
+        page_num = child_page_num;
     }
 }
 
+// drop the path to the rightmost leaf and count a change of shape, by a cursor that still holds what it changes
+void LitDatabase::TableShapeChanged(Table* table) {
+    pthread_mutex_lock(&table->rightmost_mutex);
+    table->rightmost.valid = false;
+    table->shape_changes.fetch_add(1, std::memory_order_relaxed);
+    pthread_mutex_unlock(&table->rightmost_mutex);
+}
+
+// step to the next cell, a move to the next leaf latches it before letting go of the current one
 void LitDatabase::CursorAdvance(Cursor* cursor) {
+    Pager* pager = cursor->table->pager;
     uint32_t page_num = cursor->page_num;
-    void* node = GetPage(cursor->table->pager, page_num);
+    void* node = CursorLeaf(cursor);
 
     cursor->cell_num += 1;
     if (cursor->cell_num >= (*LeafNodeNumCells(node))) {
         // cursor->end_of_table = true;
         uint32_t next_page_num = *LeafNodeNextLeaf(node);
+        CursorUnpinLeaf(cursor);
         if (next_page_num == 0) {
             cursor->end_of_table = true;
+        } else if (cursor->snapshot) {
+            SnapshotRead(pager, cursor->snapshot, next_page_num, cursor->copy);
+            cursor->page_num = next_page_num;
+            cursor->cell_num = 0;
         } else {
+            if (cursor->mode != CURSOR_EXCLUSIVE) {
+                LatchPage(pager, next_page_num, cursor->mode == CURSOR_READ ? LATCH_SHARED : LATCH_EXCLUSIVE);
+                UnlatchPage(pager, page_num);
+            }
             cursor->page_num = next_page_num;
             cursor->cell_num = 0;
+            cursor->leaves_entered += 1;
+            cursor->leaves_ahead -= std::min(cursor->leaves_ahead, 1u);
+            if (cursor->mode == CURSOR_READ && cursor->leaves_entered >= PREFETCH_AFTER_LEAVES) {
+                PrefetchLeaves(cursor);
+            }
         }
+        return;
     }
+    CursorUnpinLeaf(cursor);
 }
 
 void LitDatabase::PrintConstants() {
-    std::cout << "ROW_SIZE: " << ROW_SIZE << std::endl;
+    std::cout << "ROW_MAX_SIZE: " << ROW_MAX_SIZE << std::endl;
     std::cout << "COMMON_NODE_HEADER_SIZE: " << static_cast<uint32_t>(COMMON_NODE_HEADER_SIZE) << std::endl;
     std::cout << "LEAF_NODE_HEADER_SIZE: " << LEAF_NODE_HEADER_SIZE << std::endl;
     std::cout << "LEAF_NODE_CELL_SIZE: " << LEAF_NODE_CELL_SIZE << std::endl;
-    std::cout << "LEAF_NODE_MAX_CELLS: " << LEAF_NODE_MAX_CELLS << std::endl;
+    std::cout << "LEAF_NODE_SPACE_FOR_CELLS: " << LEAF_NODE_SPACE_FOR_CELLS << std::endl;
+    std::cout << "INTERNAL_NODE_MAX_CELLS: " << INTERNAL_NODE_MAX_CELLS << std::endl;
+    std::cout << "KEY_SEARCH: " << KeySearchKernel() << std::endl;
 }
 
 void LitDatabase::Indent(uint32_t level) {
@@ -423,7 +1497,9 @@ void LitDatabase::PrintTree(Pager* pager, uint32_t page_num, uint32_t indentatio
             child = *InternalNodeRightChild(node);
             PrintTree(pager, child, indentation_level + 1);
             break;
+        case NODE_FREE: break;
     }
+    UnpinPage(pager, page_num);
 }
 
 NodeType LitDatabase::get_node_type(void* node) {
@@ -435,7 +1511,10 @@ void LitDatabase::set_node_type(void* node, NodeType type) {
     *static_cast<uint8_t*>(static_cast<void*>(static_cast<unsigned char*>(node) + NODE_TYPE_OFFSET)) = value;
 }
 
-void LitDatabase::CreateNewRoot(Table* table, uint32_t right_child_page_num) {
+// the root moves into a new left child and becomes an internal node over it and the right child. The caller
+// passes the max key of the old root, which only it can know without descending into unlatched nodes.
+void LitDatabase::CreateNewRoot(Table* table, uint32_t right_child_page_num, uint32_t left_child_max_key,
+                                uint32_t left_child_rows, uint32_t right_child_rows) {
     void* root = GetPage(table->pager, table->root_page_num);
     void* right_child = GetPage(table->pager, right_child_page_num);
     uint32_t left_child_page_num = GetUnusedPageNum(table->pager);
@@ -443,27 +1522,99 @@ void LitDatabase::CreateNewRoot(Table* table, uint32_t right_child_page_num) {
 
     memcpy(left_child, root, PAGE_SIZE);
     set_node_root(left_child, false);
+    if (get_node_type(left_child) == NODE_INTERNAL) {
+        // the children of an old internal root now hang off the left child
+        for (uint32_t i = 0; i <= *InternalNodeNumKeys(left_child); ++i) {
+            SetNodeParent(table->pager, *InternalNodeChild(left_child, i), left_child_page_num);
+        }
+    }
 
     InitializeInternalNode(root);
     set_node_root(root, true);
     *InternalNodeNumKeys(root) = 1;
     *InternalNodeChild(root, 0) = left_child_page_num;
-    uint32_t left_child_max_key = GetNodeMaxKey(left_child);
     *InternalNodeKey(root, 0) = left_child_max_key;
+    *InternalNodeCount(root, 0) = left_child_rows;
     *InternalNodeRightChild(root) = right_child_page_num;
+    *InternalNodeCount(root, 1) = right_child_rows;
 
     *NodeParent(left_child) = table->root_page_num;
     *NodeParent(right_child) = table->root_page_num;
+
+    MarkPageDirty(table->pager, left_child_page_num);
+    MarkPageDirty(table->pager, right_child_page_num);
+    MarkPageDirty(table->pager, table->root_page_num);
+
+    UnpinPage(table->pager, left_child_page_num);
+    UnpinPage(table->pager, right_child_page_num);
+    UnpinPage(table->pager, table->root_page_num);
 }
 
-uint32_t LitDatabase::GetNodeMaxKey(void* node) {
-    switch (get_node_type(node)) {
-        case NODE_INTERNAL: return *InternalNodeKey(node, *InternalNodeNumKeys(node) - 1);
-        case NODE_LEAF: return *LeafNodeKey(node, *LeafNodeNumCells(node) - 1);
+// reuse the most recently freed page, or append a new one to the file. Both happen under the header page latch, an
+// appended page is touched so the next caller finds it counted in num_pages.
+uint32_t LitDatabase::GetUnusedPageNum(Pager* pager) {
+    LatchPage(pager, DB_HEADER_PAGE_NUM, LATCH_EXCLUSIVE);
+    void* header = GetPage(pager, DB_HEADER_PAGE_NUM);
+    uint32_t page_num = *HeaderFreelistHead(header);
+    if (page_num == 0) {
+        pthread_mutex_lock(&pager->mutex);
+        page_num = pager->num_pages;
+        GetPage(pager, page_num);
+        UnpinPage(pager, page_num);
+        pthread_mutex_unlock(&pager->mutex);
+    } else {
+        void* page = GetPage(pager, page_num);
+        *HeaderFreelistHead(header) = *FreePageNext(page);
+        *HeaderFreelistCount(header) -= 1;
+        MarkPageDirty(pager, DB_HEADER_PAGE_NUM);
+        UnpinPage(pager, page_num);
     }
+    UnpinPage(pager, DB_HEADER_PAGE_NUM);
+    UnlatchPage(pager, DB_HEADER_PAGE_NUM);
+    return page_num;
+}
+
+void LitDatabase::FreePage(Pager* pager, uint32_t page_num) {
+    LatchPage(pager, DB_HEADER_PAGE_NUM, LATCH_EXCLUSIVE);
+    void* header = GetPage(pager, DB_HEADER_PAGE_NUM);
+    void* page = GetPage(pager, page_num);
+    memset(page, 0, PAGE_SIZE);
+    set_node_type(page, NODE_FREE);
+    *FreePageNext(page) = *HeaderFreelistHead(header);
+    *HeaderFreelistHead(header) = page_num;
+    *HeaderFreelistCount(header) += 1;
+    MarkPageDirty(pager, page_num);
+    MarkPageDirty(pager, DB_HEADER_PAGE_NUM);
+    UnpinPage(pager, page_num);
+    UnpinPage(pager, DB_HEADER_PAGE_NUM);
+    UnlatchPage(pager, DB_HEADER_PAGE_NUM);
 }
 
-uint32_t LitDatabase::GetUnusedPageNum(Pager* pager) { return pager->num_pages; }
+uint32_t* LitDatabase::FreePageNext(void* node) {
+    return static_cast<uint32_t*>(static_cast<void*>(static_cast<unsigned char*>(node) + FREE_PAGE_NEXT_OFFSET));
+}
+
+uint32_t* LitDatabase::HeaderMagic(void* header) {
+    return static_cast<uint32_t*>(static_cast<void*>(static_cast<unsigned char*>(header) + DB_HEADER_MAGIC_OFFSET));
+}
+uint32_t* LitDatabase::HeaderVersion(void* header) {
+    return static_cast<uint32_t*>(static_cast<void*>(static_cast<unsigned char*>(header) + DB_HEADER_VERSION_OFFSET));
+}
+uint32_t* LitDatabase::HeaderRootPage(void* header) {
+    return static_cast<uint32_t*>(static_cast<void*>(static_cast<unsigned char*>(header) + DB_HEADER_ROOT_PAGE_OFFSET));
+}
+uint32_t* LitDatabase::HeaderFreelistHead(void* header) {
+    return static_cast<uint32_t*>(
+        static_cast<void*>(static_cast<unsigned char*>(header) + DB_HEADER_FREELIST_HEAD_OFFSET));
+}
+uint32_t* LitDatabase::HeaderFreelistCount(void* header) {
+    return static_cast<uint32_t*>(
+        static_cast<void*>(static_cast<unsigned char*>(header) + DB_HEADER_FREELIST_COUNT_OFFSET));
+}
+uint32_t* LitDatabase::HeaderIndexRoot(void* header, IndexColumn column) {
+    return static_cast<uint32_t*>(static_cast<void*>(static_cast<unsigned char*>(header) +
+                                                     DB_HEADER_INDEX_ROOTS_OFFSET + column * sizeof(uint32_t)));
+}
 
 bool LitDatabase::is_node_root(void* node) {
     uint8_t value = *static_cast<uint8_t*>(static_cast<void*>(static_cast<unsigned char*>(node) + IS_ROOT_OFFSET));
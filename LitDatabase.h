@@ -2,16 +2,37 @@
 #define LITDATABASE_H
 
 #include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/un.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cerrno>
+#include <cinttypes>
+#include <climits>
+#include <csignal>
 #include <cstdio>
 #include <cstring>
+#include <ctime>
+#include <deque>
 #include <fstream>
 #include <iostream>
+#include <map>
+#include <set>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 constexpr uint32_t COLUMN_USERNAME_SIZE = 32;
 constexpr uint32_t COLUMN_EMAIL_SIZE = 255;
@@ -22,10 +43,41 @@ enum ParseStatementResult {
     PARSE_STATEMENT_UNRECOGNIZED,
     PARSE_STATEMENT_STRING_TOO_LONG,
     PARSE_STATEMENT_SYNTAX_ERROR,
-    PARSE_STATEMENT_NEGATIVE_ID
+    PARSE_STATEMENT_NEGATIVE_ID,
+    PARSE_STATEMENT_ID_TOO_LARGE  // above UINT32_MAX, ids are 32 bits
 };
-enum StatementType { STATEMENT_INSERT, STATEMENT_SELECT };
-enum ExecuteResult { EXECUTE_SUCCESS, EXECUTE_TABLE_FULL, EXECUTE_DUPLICATE_KEY };
+enum StatementType {
+    STATEMENT_INSERT,
+    STATEMENT_SELECT,
+    STATEMENT_DELETE,
+    STATEMENT_UPDATE,
+    STATEMENT_CREATE_INDEX,
+    STATEMENT_BEGIN,
+    STATEMENT_COMMIT,
+    STATEMENT_ROLLBACK
+};
+// what a select writes: the rows, one row of aggregates over them, or the position of a row in id order (rank)
+enum SelectOutput { SELECT_ROWS, SELECT_AGGREGATE, SELECT_RANK };
+// count(*), min(id), max(id) and sum(id)
+enum AggregateFunction { AGGREGATE_COUNT, AGGREGATE_MIN, AGGREGATE_MAX, AGGREGATE_SUM };
+constexpr uint32_t SELECT_MAX_AGGREGATES = 8;
+enum ExecuteResult {
+    EXECUTE_SUCCESS,
+    EXECUTE_TABLE_FULL,
+    EXECUTE_DUPLICATE_KEY,
+    EXECUTE_KEY_NOT_FOUND,
+    EXECUTE_TABLE_NOT_EMPTY,
+    EXECUTE_UNSORTED_INPUT,
+    EXECUTE_INVALID_ROW,
+    EXECUTE_IO_ERROR,
+    EXECUTE_INDEX_EXISTS,
+    EXECUTE_TRANSACTION_OPEN,
+    EXECUTE_NO_TRANSACTION
+};
+
+// secondary indexes, at most one per column. An index is a second B+tree in the same file keyed by a hash of the
+// column value, each record holds the id of one row. Rows with the same value, or a colliding one, share a key.
+enum IndexColumn { INDEX_USERNAME, INDEX_EMAIL, INDEX_COLUMN_COUNT };
 
 struct Row {
     uint32_t id = -1;
@@ -33,35 +85,294 @@ struct Row {
     char email[COLUMN_EMAIL_SIZE + 1] = {'\0'};
 };
 
+// serialized row: id, then username and email as a length byte followed by the characters
 const uint32_t ID_SIZE = sizeof(uint32_t);
-const uint32_t USERNAME_SIZE = COLUMN_USERNAME_SIZE + 1;
-const uint32_t EMAIL_SIZE = COLUMN_EMAIL_SIZE + 1;
-const uint32_t ID_OFFSET = 0;
-const uint32_t USERNAME_OFFSET = ID_OFFSET + ID_SIZE;
-const uint32_t EMAIL_OFFSET = USERNAME_OFFSET + USERNAME_SIZE;
-const uint32_t ROW_SIZE = ID_SIZE + USERNAME_SIZE + EMAIL_SIZE;
+const uint32_t STRING_LENGTH_SIZE = sizeof(uint8_t);
+const uint32_t ROW_MAX_SIZE = ID_SIZE + STRING_LENGTH_SIZE + COLUMN_USERNAME_SIZE + STRING_LENGTH_SIZE + COLUMN_EMAIL_SIZE;
+
+// a row read in place from its serialized record, only valid while the page holding the record stays pinned
+struct RowView {
+    uint32_t id = 0;
+    const char* username = nullptr;
+    uint32_t username_length = 0;
+    const char* email = nullptr;
+    uint32_t email_length = 0;
+};
+
+// how select writes rows: "(id, username, email)" lines, csv, tsv, or binary records laid out like the serialized
+// row (id in host byte order, then each string as a length byte followed by the characters)
+enum OutputMode { OUTPUT_TABLE, OUTPUT_CSV, OUTPUT_TSV, OUTPUT_BINARY };
+// select output is formatted into a buffer of this size and written out whenever the next row might not fit
+constexpr uint32_t RESULT_BUFFER_SIZE = 256 * 1024;
+// the most bytes one formatted row can take, quoting or escaping at most doubles the strings
+constexpr uint32_t RESULT_ROW_MAX_SIZE = 16 + 2 * (COLUMN_USERNAME_SIZE + COLUMN_EMAIL_SIZE) + 8;
+
+struct ResultWriter {
+    ResultWriter() = default;
+    ResultWriter(const ResultWriter&) = delete;
+    ResultWriter& operator=(const ResultWriter&) = delete;
+    ~ResultWriter() {
+        free(buffer);
+        if (file != stdout) fclose(file);
+    }
+
+    OutputMode mode = OUTPUT_TABLE;
+    FILE* file = stdout;
+    char* buffer = nullptr;
+    uint32_t length = 0;
+    int socket = -1;       // a server client, output goes to it instead of the file
+    bool corked = false;   // keep the output of finished statements buffered until uncorked
+    bool failed = false;   // the client is gone, further output is dropped
+    uint64_t write_nanoseconds = 0;  // spent handing output over, for .timer
+};
+
 
 constexpr uint32_t PAGE_SIZE = 4096;
-constexpr uint32_t TABLE_MAX_PAGES = 100;
+// default buffer pool budget, 1024 frames = 4 MB
+constexpr uint32_t POOL_DEFAULT_FRAMES = 1024;
+// address space reserved for the mapping in PAGER_MMAP mode, the file can grow to this size
+constexpr uint64_t MMAP_RESERVE_SIZE = 64ull << 30;
+// the mapping grows by at least this many pages at a time
+constexpr uint32_t MMAP_GROW_PAGES = 256;
+
+enum PagerMode { PAGER_BUFFER_POOL, PAGER_MMAP };
+
+// Latches. Every page has a reader/writer latch, found by page number so it does not move with the frame that
+// caches the page. Tree descents take them top-down, each node before letting go of its parent. Latches are taken
+// in this order: the table schema latch, the commit latch, the tree latch, page latches from the root down and
+// from left to right along the leaves, the header page latch, and last the pager mutex.
+enum LatchMode { LATCH_SHARED, LATCH_EXCLUSIVE };
+// page latches are created on first use, this many pages at a time, and live as long as the pager
+constexpr uint32_t LATCH_CHUNK_PAGES = 4096;
+constexpr uint32_t LATCH_CHUNKS = (1ull << 32) / LATCH_CHUNK_PAGES;
+
+// a waiting writer holds off new readers, so a split or a commit is not starved by a stream of lookups
+inline void InitLatch(pthread_rwlock_t* latch) {
+    pthread_rwlockattr_t attributes;
+    pthread_rwlockattr_init(&attributes);
+#ifdef __GLIBC__
+    pthread_rwlockattr_setkind_np(&attributes, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+    pthread_rwlock_init(latch, &attributes);
+    pthread_rwlockattr_destroy(&attributes);
+}
+
+// a buffer pool frame, holds one page while it is cached
+struct Frame {
+    uint32_t page_num;
+    uint32_t pin_count;  // frame can not be evicted while pinned
+    bool dirty;          // set by MarkPageDirty, must be written back before the frame is reused
+    bool referenced;     // CLOCK reference bit
+    void* data;
+};
+
+// write-ahead log layout, the log lives next to the database file as "<name>-wal"
+const uint32_t WAL_MAGIC = 0x4c697457;  // "WtiL"
+const uint32_t WAL_HEADER_SIZE = 16;    // magic, page size, salt, reserved
+// frame header: page_num, commit_pages (non-zero marks a commit), salt, checksum
+const uint32_t WAL_FRAME_HEADER_SIZE = 16;
+const uint32_t WAL_FRAME_SIZE = WAL_FRAME_HEADER_SIZE + PAGE_SIZE;
+// checkpoint once the log holds this many frames
+constexpr uint32_t WAL_CHECKPOINT_FRAMES = 1000;
+// past this many committed frames no new snapshot opens until the open ones let the checkpoint run
+constexpr uint32_t WAL_SNAPSHOT_FRAMES = 4 * WAL_CHECKPOINT_FRAMES;
+
+struct Wal {
+    int file_descriptor = -1;
+    uint32_t salt = 0;
+    off_t end = WAL_HEADER_SIZE;         // append position
+    off_t commit_end = WAL_HEADER_SIZE;  // end of the last commit frame
+    off_t synced_end = WAL_HEADER_SIZE;  // log is durable up to here
+    // group commit: statements that finished take a ticket, and a leader logs and syncs them all at once
+    uint64_t commit_tickets = 0;   // handed out
+    uint64_t durable_tickets = 0;  // tickets up to this one are committed and synced
+    bool committing = false;       // a leader is at it
+    pthread_mutex_t commit_mutex;  // guards the three above, committers wait on committed for their ticket
+    pthread_cond_t committed;
+    std::unordered_map<uint32_t, off_t> index;    // committed page_num -> latest frame offset
+    std::unordered_map<uint32_t, off_t> pending;  // page_num -> frame spilled by the running statement
+    std::vector<uint32_t> dirty_pages;            // pages marked dirty since the last commit
+    uint32_t snapshots = 0;                       // open snapshots, no checkpoint runs while there are any
+    pthread_cond_t checkpointed;                  // with the pager mutex, snapshots held off wait here for a reset
+    // page_num -> the committed frames later commits replaced while snapshots were open, oldest first
+    std::unordered_map<uint32_t, std::vector<off_t>> replaced;
+};
+
+// Snapshots. A select reading more than one id reads the committed state of the file as of when it started, every
+// image of a page the log has taken since then is newer than commit_end and not seen.
+struct Snapshot {
+    off_t commit_end;
+};
+
+// Compressed database files. Pages are compressed when a checkpoint or a bulk load writes them to the file and
+// decompressed when GetPage loads them, the log and the buffer pool hold them whole. A page is stored as an extent
+// of whole units anywhere in the file and found through the page map, one PageExtent per page, which every
+// checkpoint writes out as a table of its own. Two header slots at the start of the file point to the newest table.
+const uint32_t PAGE_MAP_MAGIC = 0x5a74694c;  // "LitZ"
+const uint32_t PAGE_MAP_VERSION = 1;
+const uint32_t PAGE_MAP_UNIT = 64;        // extents are allocated in units of this many bytes
+const uint32_t PAGE_MAP_SLOT_SIZE = 512;  // the slots sit in different sectors, a torn write ruins one of them only
+const uint32_t PAGE_MAP_HEADER_UNITS = 2 * PAGE_MAP_SLOT_SIZE / PAGE_MAP_UNIT;
+// the most bytes a compressed page can take, a page that does not save a unit is stored uncompressed instead
+const uint32_t PAGE_COMPRESS_BOUND = PAGE_SIZE + PAGE_SIZE / 255 + 16;
+
+struct PageExtent {
+    uint32_t offset;  // in units from the start of the file
+    uint16_t length;  // bytes stored, 0 for a page never written and PAGE_SIZE for one stored uncompressed
+    uint16_t units;   // allocated
+};
+
+// a header slot, the valid one with the higher generation is current
+struct PageMapHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t page_size;
+    uint32_t generation;
+    uint32_t num_pages;  // entries in the table
+    uint32_t table_offset;
+    uint32_t table_units;
+    uint32_t table_checksum;
+    uint32_t checksum;  // of the fields above
+};
+
+struct PageMap {
+    bool enabled = false;
+    uint32_t generation = 0;
+    std::vector<PageExtent> extents;  // by page number
+    uint32_t table_offset = 0;        // where the current table is
+    uint32_t table_units = 0;
+    uint32_t end = PAGE_MAP_HEADER_UNITS;                  // units in use up to here, the file may run past it
+    std::map<uint32_t, uint32_t> free_by_offset;           // free space, offset -> units
+    std::set<std::pair<uint32_t, uint32_t>> free_by_size;  // the same as (units, offset), for a best fit
+};
+
+// read-ahead for scans along the leaf chain: once a read cursor has stepped onto a few leaves, the leaves after it
+// under the same parent are read ahead into the buffer pool by a few threads, runs of pages next to each other in
+// the file with one pread
+constexpr uint32_t PREFETCH_DEFAULT_LEAVES = 16;  // leaves read ahead of a scan
+constexpr uint32_t PREFETCH_AFTER_LEAVES = 2;     // leaves a cursor steps onto before its scan is read ahead
+constexpr uint32_t PREFETCH_THREADS = 2;
+
+// pages [first_page_num, first_page_num + num_pages) of the database file
+struct PrefetchRequest {
+    uint32_t first_page_num;
+    uint32_t num_pages;
+    uint32_t salt;  // of the log when asked for, a checkpoint in between may have written newer images to the file
+};
+
+class LitDatabase;
+struct Prefetcher {
+    LitDatabase* db = nullptr;
+    std::vector<pthread_t> threads;
+    std::deque<PrefetchRequest> queue;
+    std::unordered_set<uint32_t> in_flight;  // pages queued or being read
+    // guards the queue and in_flight, taken after the pager mutex
+    pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+    pthread_cond_t wakeup = PTHREAD_COND_INITIALIZER;
+    bool stop = false;
+};
+
+// what the pager and the trees in its file have done since it was opened. Bumped with relaxed atomic adds, a reader
+// sees every count exactly but not as one consistent set.
+struct PagerCounters {
+    std::atomic<uint64_t> page_hits{0};         // GetPage found the page in the buffer pool
+    std::atomic<uint64_t> page_misses{0};       // GetPage had to load the page into a frame
+    std::atomic<uint64_t> bytes_read{0};        // read from the file or the log, for the buffer pool or a snapshot
+    std::atomic<uint64_t> pages_prefetched{0};  // put into the buffer pool ahead of a scan
+    std::atomic<uint64_t> snapshot_reads{0};    // pages read for a snapshot, from the file or the log
+    std::atomic<uint64_t> bytes_written{0};     // written to the log by PagerFlush and commits
+    std::atomic<uint64_t> leaf_splits{0};       // of every tree in the file, the indexes included
+    std::atomic<uint64_t> internal_splits{0};
+    std::atomic<uint64_t> rightmost_hits{0};  // descents to the rightmost leaf skipped for a key above the others
+    std::atomic<uint64_t> descents{0};        // walks from the root towards a leaf, a multi-key lookup is one
+    std::atomic<uint64_t> descent_levels{0};  // nodes read by them on the way down, the leaf included
+};
+
+// Statement latencies. Every statement run through ExecuteStatement is timed and counted in the histogram of its
+// class, see latency.cpp.
+enum LatencyClass {
+    LATENCY_INSERT,
+    LATENCY_POINT_SELECT,  // a select of one id
+    LATENCY_SELECT,        // a select of a list of ids, or of the rows with a username or email
+    LATENCY_SCAN,          // any other select, of a range of ids or the whole table
+    LATENCY_OTHER,         // deletes, updates, transactions and creating an index
+    LATENCY_CLASS_COUNT
+};
+// HdrHistogram style buckets: values below LATENCY_SUB_BUCKETS nanoseconds have one each, every power of two above
+// is cut into LATENCY_SUB_BUCKETS equal ones, so a value is off by at most 1/32 of itself
+constexpr uint32_t LATENCY_SUB_BUCKET_BITS = 5;
+constexpr uint32_t LATENCY_SUB_BUCKETS = 1 << LATENCY_SUB_BUCKET_BITS;
+constexpr uint32_t LATENCY_BUCKETS = (64 - LATENCY_SUB_BUCKET_BITS + 1) * LATENCY_SUB_BUCKETS;
+
+struct LatencyHistogram {
+    std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> total_nanoseconds{0};
+    std::atomic<uint64_t> max_nanoseconds{0};
+    std::atomic<uint64_t> buckets[LATENCY_BUCKETS] = {};
+};
+
+inline uint64_t NowNanoseconds() {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<uint64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
 
 struct Pager {
-    Pager() : fd(nullptr), file_length(0) {
-        for (uint32_t i = 0; i < TABLE_MAX_PAGES; ++i) {
-            pages[i] = nullptr;
-        }
+    Pager()
+        : fd(nullptr),
+          file_length(0),
+          num_pages(0),
+          max_frames(POOL_DEFAULT_FRAMES),
+          clock_hand(0),
+          mode(PAGER_BUFFER_POOL),
+          map(nullptr),
+          map_pages(0) {
+        InitLocks();
     }
 
-    Pager(std::fstream* _fd, uint32_t _len) : fd(_fd), file_length(_len) {
-        for (uint32_t i = 0; i < TABLE_MAX_PAGES; ++i) {
-            pages[i] = nullptr;
-        }
+    Pager(std::fstream* _fd, uint32_t _len)
+        : fd(_fd),
+          file_length(_len),
+          num_pages(0),
+          max_frames(POOL_DEFAULT_FRAMES),
+          clock_hand(0),
+          mode(PAGER_BUFFER_POOL),
+          map(nullptr),
+          map_pages(0) {
+        InitLocks();
     }
 
     ~Pager() {
         delete fd;
-        for (uint32_t i = 0; i < TABLE_MAX_PAGES; ++i) {
-            if (pages[i]) free(pages[i]), pages[i] = nullptr;
+        for (Frame& frame : frames) {
+            if (frame.data) free(frame.data), frame.data = nullptr;
+        }
+        if (map) munmap(map, MMAP_RESERVE_SIZE), map = nullptr;
+        for (uint32_t i = 0; i < LATCH_CHUNKS; ++i) {
+            free(latch_chunks[i].load(std::memory_order_relaxed));
         }
+        free(latch_chunks);
+        pthread_mutex_destroy(&prefetcher.mutex);
+        pthread_cond_destroy(&prefetcher.wakeup);
+        pthread_rwlock_destroy(&commit_latch);
+        pthread_mutex_destroy(&wal.commit_mutex);
+        pthread_cond_destroy(&wal.committed);
+        pthread_cond_destroy(&wal.checkpointed);
+        pthread_mutex_destroy(&mutex);
+    }
+
+    void InitLocks() {
+        pthread_mutexattr_t attributes;
+        pthread_mutexattr_init(&attributes);
+        pthread_mutexattr_settype(&attributes, PTHREAD_MUTEX_RECURSIVE);
+        pthread_mutex_init(&mutex, &attributes);
+        pthread_mutexattr_destroy(&attributes);
+        InitLatch(&commit_latch);
+        pthread_mutex_init(&wal.commit_mutex, nullptr);
+        pthread_cond_init(&wal.committed, nullptr);
+        pthread_cond_init(&wal.checkpointed, nullptr);
+        // the chunk directory is only touched where chunks exist, calloc leaves the rest of it unbacked
+        latch_chunks = static_cast<std::atomic<pthread_rwlock_t*>*>(calloc(LATCH_CHUNKS, sizeof(*latch_chunks)));
     }
 
     std::fstream* fd;
@@ -70,31 +381,199 @@ struct Pager {
     // linux
     int file_descriptor;
     // linux
-    void* pages[TABLE_MAX_PAGES];
+    uint32_t max_frames;  // frame budget, memory use is bounded by max_frames * PAGE_SIZE
+    uint32_t clock_hand;
+    std::vector<Frame> frames;
+    std::unordered_map<uint32_t, uint32_t> page_table;  // page_num -> index into frames
+    // PAGER_MMAP: pages are served straight from a private mapping of the file
+    PagerMode mode;
+    char* map;
+    uint32_t map_pages;  // pages of the file currently mapped
+    std::vector<bool> map_dirty;
+    Wal wal;
+    PagerCounters counters;
+    LatencyHistogram latencies[LATENCY_CLASS_COUNT];
+    Prefetcher prefetcher;
+    PageMap page_map;  // of a compressed file
+    // guards the frames, the page table, the mapping and the log. Recursive because flushing and eviction go
+    // back through GetPage and the log while holding it.
+    pthread_mutex_t mutex;
+    // writers hold it shared while they change pages, a commit takes it exclusive so it only ever logs whole
+    // statements
+    pthread_rwlock_t commit_latch;
+    std::atomic<pthread_rwlock_t*>* latch_chunks;  // LATCH_CHUNKS pointers to chunks of page latches
+};
+
+// deeper than any tree of 2^32 keys
+constexpr uint32_t BTREE_MAX_DEPTH = 32;
+
+// the path to the rightmost leaf as the last descent that ended there took it. Keys from min_key up land in that
+// leaf, so an insert of an id above all the others latches the path without searching it. Only good until the tree
+// changes shape: every split, merge or borrow drops it and counts itself in shape_changes.
+struct RightmostPath {
+    bool valid;
+    uint32_t min_key;  // above the last key of every internal node on the path
+    uint32_t leaf_page_num;
+    uint32_t depth;  // internal nodes on the path, at least the root
+    uint32_t ancestors[BTREE_MAX_DEPTH];
+    uint32_t child_nums[BTREE_MAX_DEPTH];  // the right child of each
 };
 
 struct Table {
-    Table() : root_page_num(0), pager(nullptr) {}
-    ~Table() { delete pager; }
+    Table() : root_page_num(0), pager(nullptr), indexes(), rightmost(), shape_changes(0) {
+        InitLatch(&tree_latch);
+        InitLatch(&schema_latch);
+        pthread_mutex_init(&rightmost_mutex, nullptr);
+    }
+    ~Table() {
+        // the index trees share the pager of the table
+        for (Table* index : indexes) {
+            if (index) index->pager = nullptr, delete index;
+        }
+        delete pager;
+        pthread_rwlock_destroy(&tree_latch);
+        pthread_rwlock_destroy(&schema_latch);
+        pthread_mutex_destroy(&rightmost_mutex);
+    }
 
     // uint32_t num_rows;
     uint32_t root_page_num;
     Pager* pager;
+    Table* indexes[INDEX_COLUMN_COUNT];  // secondary index trees by column, nullptr for a column without one
+    // cursors hold it shared, a delete that has to rebalance or an insert that splits the root holds it exclusive and
+    // works without page latches
+    pthread_rwlock_t tree_latch;
+    // of the primary table: statements hold it shared, creating an index or importing holds it exclusive
+    pthread_rwlock_t schema_latch;
+    RightmostPath rightmost;
+    pthread_mutex_t rightmost_mutex;  // cursors holding the tree latch shared read and publish the path under it
+    // changes of shape so far, counted under rightmost_mutex while the nodes changed are still latched. A walk that
+    // does not latch its way down, or a path kept from before, is only good if no change came in between.
+    std::atomic<uint64_t> shape_changes;
+};
+
+// a snapshot of the pager counters and of the shape of the table tree, taken by TableStats. Page hits and misses
+// are only counted by the buffer pool, in PAGER_MMAP mode the kernel serves every page.
+struct DbStats {
+    uint64_t page_hits = 0;
+    uint64_t page_misses = 0;
+    uint64_t bytes_read = 0;
+    uint64_t bytes_written = 0;
+    uint64_t pages_prefetched = 0;
+    uint64_t snapshot_reads = 0;
+    uint64_t leaf_splits = 0;
+    uint64_t internal_splits = 0;
+    uint64_t rightmost_hits = 0;
+    uint64_t descents = 0;
+    uint64_t descent_levels = 0;
+    uint64_t file_bytes = 0;   // size of the database file
+    uint32_t num_pages = 0;    // pages in the file, the header and free pages included
+    uint32_t free_pages = 0;   // on the freelist
+    uint32_t frames_used = 0;  // buffer pool frames holding a page
+    uint32_t max_frames = 0;
+    uint32_t tree_height = 0;  // levels of the table tree, 1 for a lone root leaf
+    uint64_t leaf_nodes = 0;
+    uint64_t internal_nodes = 0;
+    uint64_t num_rows = 0;
+    double rows_per_leaf = 0;
+    uint64_t leaf_fragmented_bytes = 0;  // freed record bytes inside leaves, reclaimed when a leaf is compacted
+    double leaf_fill = 0;                // average share of the leaf cell space held by live cells and records
+    double internal_fill = 0;            // average share of the internal node cells in use
 };
 
 struct Statement {
     StatementType type;
     Row row_to_insert;
+    std::vector<Row> rows;  // insert values (...), (...): every row, row_to_insert is not used
+    uint32_t key;  // id in the where clause of delete and update
+    // select: ids in [range_low, range_high] in order, skipping offset rows and then at most limit rows, the range is
+    // empty when low > high. Aggregates are over every row in the range.
+    int64_t range_low = 0;
+    int64_t range_high = UINT32_MAX;
+    uint32_t limit = UINT32_MAX;
+    uint32_t offset = 0;
+    SelectOutput output = SELECT_ROWS;
+    uint32_t num_aggregates = 0;
+    AggregateFunction aggregates[SELECT_MAX_AGGREGATES];
+    bool set_username = false;
+    bool set_email = false;
+    Row row_to_update;
+    IndexColumn column = INDEX_USERNAME;  // create index on column, select where [id ... and] column = value
+    bool filter_by_column = false;
+    Row filter;  // select: the value to match is in the field of column
+    std::vector<uint32_t> ids;  // select where id in (...): the ids as given, none for any other select
+};
+
+// Transactions. The write statements between begin and commit are kept in the session and only applied by commit,
+// all of them or none, rollback just drops them. Selects are refused in between, they could not see them.
+struct Transaction {
+    bool open = false;
+    std::vector<Statement> statements;
+};
+
+// what .timer reports after a statement: how long parsing, executing and writing out the result took, and the tree
+// work of the statement, read off the pager counters before and after it
+struct StatementTimer {
+    uint64_t start = 0;  // of the phase being timed
+    uint64_t parse_nanoseconds = 0;
+    uint64_t execute_nanoseconds = 0;  // the output not included
+    uint64_t output_nanoseconds = 0;
+    uint64_t descents = 0;
+    uint64_t descent_levels = 0;
+    uint64_t pages = 0;  // buffer pool hits and misses and snapshot reads, in PAGER_MMAP mode only the last
+};
+
+// the state of one client of the engine: the line being parsed, where its select output goes and its open
+// transaction. The engine object holds none of it, so any number of sessions can run statements against the same
+// tables.
+struct Session {
+    std::string input_buffer;
+    char* cur = nullptr;
+    ResultWriter writer;
+    Transaction transaction;  // the open transaction, if any
+    bool timer_on = false;    // .timer on
+    StatementTimer timer;
 };
 
+// how a cursor latches its way down the tree and what it holds until it is closed
+enum CursorMode {
+    CURSOR_READ,      // shared latches, the leaf stays latched shared. On a snapshot no latches at all.
+    CURSOR_WRITE,     // shared latches on the whole path and the leaf latched exclusive. Enough to add or remove a row
+                      // that neither splits nor underflows the leaf, the row counts on the path change with atomic adds.
+    CURSOR_SPLIT,     // like CURSOR_WRITE down to the last node with room for a key, exclusive latches from there on.
+                      // Enough for a split, which stops at that node. See CursorLatchSplit.
+    CURSOR_EXCLUSIVE  // the tree latch exclusive and no page latches, for merges, borrows and a split of the root
+};
 struct Cursor {
     Table* table;
     uint32_t page_num;
     uint32_t cell_num;
     bool end_of_table;  // the position one past the last element
+    CursorMode mode;
+    // all but CURSOR_READ: the internal nodes from the root down to the leaf the cursor was placed on,
+    // and the child taken at each of them
+    uint32_t num_ancestors;
+    uint32_t ancestors[BTREE_MAX_DEPTH];
+    uint32_t child_nums[BTREE_MAX_DEPTH];
+    uint32_t leaves_entered;   // leaves stepped onto by CursorAdvance, a read cursor past a few is scanning
+    uint32_t leaves_ahead;     // leaves after the cursor's that read-ahead has asked for already
+    const Snapshot* snapshot;  // a read cursor on a snapshot, nullptr for one on the live tree
+    void* copy;                // on a snapshot: the image of the leaf, read into a page of the cursor's own
 };
 
-enum NodeType { NODE_INTERNAL, NODE_LEAF };
+// database header layout, page 0 of the file
+const uint32_t DB_MAGIC = 0x4474694c;  // "LitD"
+const uint32_t DB_VERSION = 6;
+const uint32_t DB_HEADER_MAGIC_OFFSET = 0;
+const uint32_t DB_HEADER_VERSION_OFFSET = DB_HEADER_MAGIC_OFFSET + sizeof(uint32_t);
+const uint32_t DB_HEADER_ROOT_PAGE_OFFSET = DB_HEADER_VERSION_OFFSET + sizeof(uint32_t);
+const uint32_t DB_HEADER_FREELIST_HEAD_OFFSET = DB_HEADER_ROOT_PAGE_OFFSET + sizeof(uint32_t);
+const uint32_t DB_HEADER_FREELIST_COUNT_OFFSET = DB_HEADER_FREELIST_HEAD_OFFSET + sizeof(uint32_t);
+// root page of each secondary index, 0 for a column without an index
+const uint32_t DB_HEADER_INDEX_ROOTS_OFFSET = DB_HEADER_FREELIST_COUNT_OFFSET + sizeof(uint32_t);
+const uint32_t DB_HEADER_PAGE_NUM = 0;
+
+enum NodeType { NODE_INTERNAL, NODE_LEAF, NODE_FREE };
 // common node header layout
 const uint32_t NODE_TYPE_SIZE = sizeof(uint8_t);
 const uint32_t NODE_TYPE_OFFSET = 0;
@@ -104,89 +583,324 @@ const uint32_t PARENT_POINTER_SIZE = sizeof(uint32_t);
 const uint32_t PARENT_POINTER_OFFSET = IS_ROOT_OFFSET + IS_ROOT_SIZE;
 const uint8_t COMMON_NODE_HEADER_SIZE = NODE_TYPE_SIZE + IS_ROOT_SIZE + PARENT_POINTER_SIZE;
 
+// free page layout, free pages are chained from the database header
+const uint32_t FREE_PAGE_NEXT_OFFSET = COMMON_NODE_HEADER_SIZE;
+
 // internal node header layout
 const uint32_t INTERNAL_NODE_NUM_KEYS_SIZE = sizeof(uint32_t);
 const uint32_t INTERNAL_NODE_NUM_KEYS_OFFSET = COMMON_NODE_HEADER_SIZE;
 const uint32_t INTERNAL_NODE_RIGHT_CHILD_SIZE = sizeof(uint32_t);
 const uint32_t INTERNAL_NODE_RIGHT_CHILD_OFFSET = INTERNAL_NODE_NUM_KEYS_OFFSET + INTERNAL_NODE_NUM_KEYS_SIZE;
-const uint32_t INTERNAL_NODE_HEADER_SIZE =
-    COMMON_NODE_HEADER_SIZE + INTERNAL_NODE_NUM_KEYS_SIZE + INTERNAL_NODE_RIGHT_CHILD_SIZE;
-
-// internal node body layout
+const uint32_t INTERNAL_NODE_RIGHT_COUNT_SIZE = sizeof(uint32_t);
+// the counts are updated with atomic adds, an unaligned one may straddle a cache line and lock the bus
+const uint32_t INTERNAL_NODE_RIGHT_COUNT_OFFSET =
+    (INTERNAL_NODE_RIGHT_CHILD_OFFSET + INTERNAL_NODE_RIGHT_CHILD_SIZE + 3) & ~3u;
+const uint32_t INTERNAL_NODE_HEADER_SIZE = INTERNAL_NODE_RIGHT_COUNT_OFFSET + INTERNAL_NODE_RIGHT_COUNT_SIZE;
+
+// internal node body layout, the keys are kept in one contiguous array for searching, the children and the number
+// of rows below each child in parallel arrays after it, the arrays start 4-byte aligned
 const uint32_t INTERNAL_NODE_KEY_SIZE = sizeof(uint32_t);
 const uint32_t INTERNAL_NODE_CHILD_SIZE = sizeof(uint32_t);
-const uint32_t INTERNAL_NODE_CELL_SIZE = INTERNAL_NODE_CHILD_SIZE + INTERNAL_NODE_KEY_SIZE;
-
-// keep this small for testing
-const uint32_t INTERNAL_NODE_MAX_CELLS = 3;
+const uint32_t INTERNAL_NODE_COUNT_SIZE = sizeof(uint32_t);
+const uint32_t INTERNAL_NODE_CELL_SIZE = INTERNAL_NODE_CHILD_SIZE + INTERNAL_NODE_KEY_SIZE + INTERNAL_NODE_COUNT_SIZE;
+const uint32_t INTERNAL_NODE_KEYS_OFFSET = (INTERNAL_NODE_HEADER_SIZE + 3) & ~3u;
+
+const uint32_t INTERNAL_NODE_SPACE_FOR_CELLS = PAGE_SIZE - INTERNAL_NODE_KEYS_OFFSET;
+const uint32_t INTERNAL_NODE_MAX_CELLS = INTERNAL_NODE_SPACE_FOR_CELLS / INTERNAL_NODE_CELL_SIZE;
+const uint32_t INTERNAL_NODE_CHILDREN_OFFSET = INTERNAL_NODE_KEYS_OFFSET + INTERNAL_NODE_MAX_CELLS * INTERNAL_NODE_KEY_SIZE;
+const uint32_t INTERNAL_NODE_COUNTS_OFFSET =
+    INTERNAL_NODE_CHILDREN_OFFSET + INTERNAL_NODE_MAX_CELLS * INTERNAL_NODE_CHILD_SIZE;
+// a non-root internal node with fewer keys borrows from or merges with a sibling
+const uint32_t INTERNAL_NODE_MIN_KEYS = INTERNAL_NODE_MAX_CELLS / 2 - 1;
 
 // leaf node header layout
 const uint32_t LEAF_NODE_NUM_CELLS_SIZE = sizeof(uint32_t);
 const uint32_t LEAF_NODE_NUM_CELLS_OFFSET = COMMON_NODE_HEADER_SIZE;
-// const uint32_t LEAF_NODE_HEADER_SIZE = COMMON_NODE_HEADER_SIZE + LEAF_NODE_NUM_CELLS_SIZE;
 const uint32_t LEAF_NODE_NEXT_LEAF_SIZE = sizeof(uint32_t);
 const uint32_t LEAF_NODE_NEXT_LEAF_OFFSET = LEAF_NODE_NUM_CELLS_OFFSET + LEAF_NODE_NUM_CELLS_SIZE;
-const uint32_t LEAF_NODE_HEADER_SIZE = COMMON_NODE_HEADER_SIZE + LEAF_NODE_NUM_CELLS_SIZE + LEAF_NODE_NEXT_LEAF_SIZE;
-
-// leaf node body layout
+const uint32_t LEAF_NODE_HEAP_START_SIZE = sizeof(uint16_t);
+const uint32_t LEAF_NODE_HEAP_START_OFFSET = LEAF_NODE_NEXT_LEAF_OFFSET + LEAF_NODE_NEXT_LEAF_SIZE;
+const uint32_t LEAF_NODE_FRAGMENTED_SIZE = sizeof(uint16_t);
+const uint32_t LEAF_NODE_FRAGMENTED_OFFSET = LEAF_NODE_HEAP_START_OFFSET + LEAF_NODE_HEAP_START_SIZE;
+const uint32_t LEAF_NODE_HEADER_SIZE = COMMON_NODE_HEADER_SIZE + LEAF_NODE_NUM_CELLS_SIZE + LEAF_NODE_NEXT_LEAF_SIZE +
+                                       LEAF_NODE_HEAP_START_SIZE + LEAF_NODE_FRAGMENTED_SIZE;
+
+// leaf node body layout, a slotted page. The keys grow up from the header as one contiguous array in key order,
+// followed by the slots (record offset, record length) of the same cells. The records grow down from the end of
+// the page. Deleted or shrunk records leave fragmented bytes in the heap that are reclaimed by compacting the leaf.
 const uint32_t LEAF_NODE_KEY_SIZE = sizeof(uint32_t);
-const uint32_t LEAF_NODE_KEY_OFFSET = 0;
-const uint32_t LEAF_NODE_VALUE_SIZE = ROW_SIZE;
-const uint32_t LEAF_NODE_VALUE_OFFSET = LEAF_NODE_KEY_OFFSET + LEAF_NODE_KEY_SIZE;
-const uint32_t LEAF_NODE_CELL_SIZE = LEAF_NODE_KEY_SIZE + LEAF_NODE_VALUE_SIZE;
-const uint32_t LEAF_NODE_SPACE_FOR_CELLS = PAGE_SIZE - LEAF_NODE_HEADER_SIZE;
-const uint32_t LEAF_NODE_MAX_CELLS = LEAF_NODE_SPACE_FOR_CELLS / LEAF_NODE_CELL_SIZE;
-const uint32_t LEAF_NODE_RIGHT_SPLIT_COUNT = (LEAF_NODE_MAX_CELLS + 1) / 2;
-const uint32_t LEAF_NODE_LEFT_SPLIT_COUNT = LEAF_NODE_MAX_CELLS + 1 - LEAF_NODE_RIGHT_SPLIT_COUNT;
-// const uint32_t LEAF_NODE_LEFT_SPLIT_COUNT = LEAF_NODE_MAX_CELLS - LEAF_NODE_RIGHT_SPLIT_COUNT;
+const uint32_t LEAF_NODE_KEYS_OFFSET = (LEAF_NODE_HEADER_SIZE + 3) & ~3u;
+const uint32_t LEAF_NODE_RECORD_OFFSET_SIZE = sizeof(uint16_t);
+const uint32_t LEAF_NODE_RECORD_OFFSET_OFFSET = 0;
+const uint32_t LEAF_NODE_RECORD_LENGTH_SIZE = sizeof(uint16_t);
+const uint32_t LEAF_NODE_RECORD_LENGTH_OFFSET = LEAF_NODE_RECORD_OFFSET_OFFSET + LEAF_NODE_RECORD_OFFSET_SIZE;
+const uint32_t LEAF_NODE_SLOT_SIZE = LEAF_NODE_RECORD_OFFSET_SIZE + LEAF_NODE_RECORD_LENGTH_SIZE;
+const uint32_t LEAF_NODE_CELL_SIZE = LEAF_NODE_KEY_SIZE + LEAF_NODE_SLOT_SIZE;
+const uint32_t LEAF_NODE_SPACE_FOR_CELLS = PAGE_SIZE - LEAF_NODE_KEYS_OFFSET;
+// a non-root leaf using fewer bytes for cells and records borrows from or merges with a sibling
+const uint32_t LEAF_NODE_MIN_BYTES = LEAF_NODE_SPACE_FOR_CELLS / 3;
+
+// bulk loading, nodes are packed to this percentage of their capacity unless told otherwise
+constexpr uint32_t BULK_LOAD_DEFAULT_FILL = 90;
+// finished pages are collected and written to the file in runs of up to this many pages
+constexpr uint32_t BULK_LOAD_RUN_PAGES = 256;
+
+// the node being filled on one level of a bulk loaded tree
+struct BulkLevel {
+    void* node = nullptr;
+    void* spare = nullptr;  // the previous node waits here until its parent and next leaf are known
+    uint32_t page_num = 0;
+    uint32_t num_children = 0;  // cells of a leaf, children of an internal node
+    uint32_t max_key = 0;
+    uint32_t num_rows = 0;   // rows below the node
+    uint32_t num_nodes = 0;  // nodes opened on this level so far
+};
+
+// state of a bulk load, pages are appended past the end of the file and bypass the pager
+struct BulkLoader {
+    Table* table = nullptr;
+    uint32_t leaf_bytes = 0;     // bytes of cells and records per leaf
+    uint32_t internal_keys = 0;  // keys per internal node
+    uint32_t first_page_num = 0;
+    uint32_t next_page_num = 0;
+    uint64_t num_rows = 0;
+    uint32_t last_key = 0;
+    std::vector<BulkLevel> levels;  // levels[0] holds the leaf being filled
+    char* run = nullptr;            // consecutive finished pages not written yet
+    uint32_t run_start = 0;
+    uint32_t run_pages = 0;
+};
+
+// Server mode. Clients send statements one per line and may send many before reading any answers. Each request is
+// answered in order by its rows followed by a single status line, status lines never start with '('.
+
+// bytes read from a client per turn, a busy client gives up its worker after each read
+constexpr uint32_t SERVER_READ_SIZE = 64 * 1024;
+// longest request line a client may send
+constexpr uint32_t SERVER_MAX_REQUEST = 64 * 1024;
+
+// Parallel scans. Aggregates that have to visit every row of a range split it into pieces and scan them on several
+// threads, each worker adding the rows it sees to its own partial result.
+
+// the running result of the aggregate functions, partial results merge into one
+struct Aggregate {
+    uint64_t count = 0;
+    uint64_t sum = 0;
+    uint32_t min = UINT32_MAX;
+    uint32_t max = 0;
+};
+
+// ids from low to high, both included
+struct ScanRange {
+    uint32_t low;
+    uint32_t high;
+};
+
+// a scan is split into about this many pieces per worker, so a worker done early has pieces left to take over
+constexpr uint32_t SCAN_RANGES_PER_WORKER = 8;
+
+class LitDatabase;
+struct ParallelScan;
+
+// the pieces a worker scans from the front, other workers that run out take them from the back
+struct ScanWorker {
+    ParallelScan* scan = nullptr;
+    std::deque<ScanRange> ranges;
+    pthread_mutex_t mutex;
+    Aggregate partial;
+};
+
+struct ParallelScan {
+    LitDatabase* db = nullptr;
+    Table* table = nullptr;
+    const Statement* statement = nullptr;
+    const Snapshot* snapshot = nullptr;
+    std::vector<ScanWorker> workers;
+};
+
+struct Connection {
+    int socket = -1;
+    std::string pending;  // bytes received after the last complete request
+    Session session;
+};
+
+struct Server {
+    LitDatabase* db = nullptr;
+    Table* table = nullptr;
+    int listen_socket = -1;
+    int epoll_fd = -1;
+    // connections with input, handed from the event loop to the workers. The event loop waits for a connection again
+    // only once its worker is done with it, so a connection is served by one worker at a time, in order.
+    std::deque<Connection*> ready;
+    std::unordered_set<Connection*> connections;
+    bool stopping = false;
+    pthread_mutex_t mutex;
+    pthread_cond_t wakeup;
+};
 
 class LitDatabase {
 public:
     void PrintPrompt();
 
-    void ReadInput();
-    ParseMetaResult ParseMeta(Table*);
-    ParseStatementResult ParseStatement(Statement*);
-    ParseStatementResult ParseInsert(Statement*);
-    ExecuteResult ExecuteStatement(Statement* statement, Table* table);
-
-    Table* DbOpen(const char* filename);
+    void ReadInput(Session* session);
+    ParseMetaResult ParseMeta(Session* session, Table* table);
+    ParseStatementResult ParseStatement(Session* session, Statement* statement);
+    ParseStatementResult ParseInsert(Session* session, Statement* statement);
+    ParseStatementResult ParseSelect(Session* session, Statement* statement);
+    ParseStatementResult ParseDelete(Session* session, Statement* statement);
+    ParseStatementResult ParseUpdate(Session* session, Statement* statement);
+    ParseStatementResult ParseCreateIndex(Session* session, Statement* statement);
+    ExecuteResult ExecuteStatement(Session* session, Statement* statement, Table* table);
+    void TimerStart(Session* session, Pager* pager);
+    void TimerParsed(Session* session);
+    void TimerFinish(Session* session, Pager* pager);
+    void PrintTimer(const StatementTimer& timer);
+    void Serve(Table* table, const char* socket_path, uint32_t num_workers);
+
+    Table* DbOpen(const char* filename, uint32_t pool_frames = POOL_DEFAULT_FRAMES,
+                  PagerMode mode = PAGER_BUFFER_POOL);
     Pager* PagerOpen();
+    void PagerMapOpen(Pager* pager);
+    void PagerMapGrow(Pager* pager, uint32_t min_pages);
+    void* PagerCachedPage(Pager* pager, uint32_t page_num);
     void* GetPage(Pager* pager, uint32_t page_num);
+    void UnpinPage(Pager* pager, uint32_t page_num);
+    void MarkPageDirty(Pager* pager, uint32_t page_num);
     void DbClose(Table* table);
+    DbStats TableStats(Table* table);
     void PagerFlush(Pager* pager, uint32_t page_num);
+    void PagerFlushDirty(Pager* pager);
+    void PrefetchStart(Pager* pager);
+    void PrefetchStop(Pager* pager);
+    void PrefetchLeaves(Cursor* cursor);
+    void PrefetchPages(Pager* pager, std::vector<uint32_t>& page_nums);
+    void PrefetchRead(Pager* pager, const PrefetchRequest& request);
+    uint32_t PagerFilePages(Pager* pager);
+
+    void PageMapOpen(Pager* pager, bool create);
+    uint32_t PageMapRead(Pager* pager, uint32_t page_num, void* page);
+    uint32_t PageMapReadRun(Pager* pager, uint32_t first_page_num, uint32_t num_pages, char* pages);
+    void PageMapWrite(Pager* pager, uint32_t first_page_num, const std::vector<struct iovec>& pages);
+    void PageMapSync(Pager* pager);
+    void PageMapTruncate(Pager* pager, uint32_t num_pages);
+
+    void WalOpen(Pager* pager);
+    void WalAppendFrames(Pager* pager, const std::vector<uint32_t>& page_nums, bool commit);
+    void WalCommit(Pager* pager);
+    void WalSync(Pager* pager);
+    void WalCheckpoint(Pager* pager);
+    void WalRecover(Pager* pager);
+    void WalReset(Pager* pager);
+
+    void SnapshotOpen(Pager* pager, Snapshot* snapshot);
+    void SnapshotClose(Pager* pager);
+    off_t SnapshotFrame(Pager* pager, const Snapshot* snapshot, uint32_t page_num);
+    void SnapshotRead(Pager* pager, const Snapshot* snapshot, uint32_t page_num, void* page);
+    void SnapshotPrefetch(Pager* pager, const Snapshot* snapshot, const std::vector<uint32_t>& page_nums);
+    void* ReadNode(Pager* pager, const Snapshot* snapshot, uint32_t page_num, void* copy);
+    void ReleaseNode(Pager* pager, const Snapshot* snapshot, uint32_t page_num);
+
+    pthread_rwlock_t* PageLatch(Pager* pager, uint32_t page_num);
+    void LatchPage(Pager* pager, uint32_t page_num, LatchMode mode);
+    void UnlatchPage(Pager* pager, uint32_t page_num);
 
     Cursor* TableStart(Table* table);
-    Cursor* TableFind(Table* table, uint32_t key);
+    Cursor* TableFind(Table* table, uint32_t key, CursorMode mode = CURSOR_READ, const Snapshot* snapshot = nullptr);
+    bool TableFindRightmost(Cursor* cursor, uint32_t key, uint64_t* shape_changes);
+    Cursor* CursorLatchSplit(Cursor* cursor, uint32_t key);
+    void TableShapeChanged(Table* table);
+    std::vector<Row> TableGetMany(Table* table, std::vector<uint32_t> keys, const Snapshot* snapshot = nullptr);
+    Cursor* TableSeek(Table* table, uint32_t key, CursorMode mode = CURSOR_READ, const Snapshot* snapshot = nullptr);
+    void* CursorLeaf(Cursor* cursor);
+    void CursorUnpinLeaf(Cursor* cursor);
     void* CursorValue(Cursor* cursor);
     void CursorAdvance(Cursor* cursor);
+    void CursorClose(Cursor* cursor);
+    void CursorAddRows(Cursor* cursor, int32_t delta);
+    uint64_t TableCountBelow(Table* table, int64_t key, bool* found = nullptr, const Snapshot* snapshot = nullptr);
+    Cursor* TableAt(Table* table, uint64_t position, const Snapshot* snapshot = nullptr);
 
     uint32_t* LeafNodeNumCells(void* node);
-    void* LeafNodeCell(void* node, uint32_t cell_num);
+    void* LeafNodeSlot(void* node, uint32_t cell_num);
     uint32_t* LeafNodeKey(void* node, uint32_t cell_num);
     void* LeafNodeValue(void* node, uint32_t cell_num);
     void LeafNodeInsert(Cursor* cursor, uint32_t key, const Row& value);
     void InitializeLeafNode(void* node);
-    Cursor* LeafNodeFind(Table* table, uint32_t page_num, uint32_t key);
     uint32_t* LeafNodeNextLeaf(void* node);
+    void LeafNodeDelete(Cursor* cursor);
+    uint16_t* LeafNodeHeapStart(void* node);
+    uint16_t* LeafNodeFragmented(void* node);
+    uint16_t* LeafNodeRecordOffset(void* node, uint32_t cell_num);
+    uint16_t* LeafNodeRecordLength(void* node, uint32_t cell_num);
+    uint32_t LeafNodeUsedSpace(void* node);
+    uint32_t LeafNodeFreeSpace(void* node);
+    void LeafNodeCompact(void* node);
+    void* LeafNodeInsertCell(void* node, uint32_t cell_num, uint32_t key, uint32_t length);
+    void LeafNodeCopyCell(void* destination, uint32_t destination_cell, void* source, uint32_t source_cell);
+    void LeafNodeRemoveCell(void* node, uint32_t cell_num);
+    bool LeafNodeCanRemove(void* node, uint32_t cell_num);
 
     void LeafNodeSplitAndInsert(Cursor* cursor, uint32_t key, const Row& value);
-    void CreateNewRoot(Table* table, uint32_t right_child_page_num);
+    void CreateNewRoot(Table* table, uint32_t right_child_page_num, uint32_t left_child_max_key,
+                       uint32_t left_child_rows, uint32_t right_child_rows);
 
     void InitializeInternalNode(void* node);
     uint32_t* InternalNodeNumKeys(void* node);
     uint32_t* InternalNodeRightChild(void* node);
-    uint32_t* InternalNodeCell(void* node, uint32_t cell_num);
     uint32_t* InternalNodeChild(void* node, uint32_t child_num);
     uint32_t* InternalNodeKey(void* node, uint32_t key_num);
-    Cursor* InternalNodeFind(Table* table, uint32_t root_page_num, uint32_t key);
+    uint32_t* InternalNodeCount(void* node, uint32_t child_num);
+    uint32_t NodeNumRows(void* node);
     uint32_t* NodeParent(void* node);
-    void UpdateInternalNodeKey(void* node, uint32_t old_key, uint32_t new_key);
+    void SetNodeParent(Pager* pager, uint32_t page_num, uint32_t parent_page_num);
     uint32_t InternalNodeFindChild(void* node, uint32_t key);
-    void InternalNodeInsert(Table* table, uint32_t parent_page_num, uint32_t child_page_num);
+    void InternalNodeInsert(Table* table, uint32_t parent_page_num, uint32_t left_page_num, uint32_t left_max_key,
+                            uint32_t left_rows, uint32_t child_page_num, uint32_t child_rows, bool appending = false);
+    void InternalNodeSplitAndInsert(Table* table, uint32_t old_page_num, uint32_t left_page_num,
+                                    uint32_t left_max_key, uint32_t left_rows, uint32_t child_page_num,
+                                    uint32_t child_rows, bool appending);
+    uint32_t InternalNodeChildIndex(void* node, uint32_t child_page_num);
+    void InternalNodeRemove(void* node, uint32_t key_num);
+    void InternalNodeMoveCells(void* destination, uint32_t destination_num, void* source, uint32_t source_num,
+                               uint32_t count);
+    void NodeRebalance(Table* table, uint32_t page_num);
+    void CollapseRoot(Table* table);
+
+    std::vector<ScanRange> ScanSplit(Table* table, uint32_t low, uint32_t high, uint32_t num_ranges,
+                                     const Snapshot* snapshot);
+    Aggregate ScanAggregate(const Statement* statement, Table* table, const Snapshot* snapshot);
+    void ScanAggregateRange(const Statement* statement, Table* table, ScanRange range, Aggregate* partial,
+                            const Snapshot* snapshot);
+    bool RowMatchesFilter(const Statement* statement, const RowView& row);
+
+    uint32_t KeyLowerBound(const uint32_t* keys, uint32_t num_keys, uint32_t key);
+    const char* KeySearchKernel();
 
-    uint32_t GetNodeMaxKey(void* node);
     uint32_t GetUnusedPageNum(Pager* pager);
+    void FreePage(Pager* pager, uint32_t page_num);
+    uint32_t* FreePageNext(void* node);
+
+    ExecuteResult BulkLoadBegin(Table* table, BulkLoader* loader, uint32_t fill_percent = BULK_LOAD_DEFAULT_FILL);
+    ExecuteResult BulkLoadAdd(BulkLoader* loader, const Row& row);
+    void BulkLoadFinish(BulkLoader* loader);
+    void BulkLoadAbort(BulkLoader* loader);
+    ExecuteResult ImportFile(Table* table, const char* path, uint32_t fill_percent, uint64_t* line_num);
+
+    Table* IndexOpen(Table* table, uint32_t root_page_num);
+    uint32_t IndexKey(const char* value, uint32_t length);
+    const char* RowColumnValue(const Row& row, IndexColumn column);
+    void IndexBuild(Table* table, IndexColumn column);
+    void IndexInsert(Table* index, uint32_t key, uint32_t id);
+    void IndexRemove(Table* index, uint32_t key, uint32_t id);
+    std::vector<uint32_t> IndexLookup(Table* index, uint32_t key, const Snapshot* snapshot = nullptr);
+    void IndexUpdateRow(Table* table, const Row* old_row, const Row* new_row);
+
+    uint32_t* HeaderMagic(void* header);
+    uint32_t* HeaderVersion(void* header);
+    uint32_t* HeaderRootPage(void* header);
+    uint32_t* HeaderFreelistHead(void* header);
+    uint32_t* HeaderFreelistCount(void* header);
+    uint32_t* HeaderIndexRoot(void* header, IndexColumn column);
 
     bool is_node_root(void* node);
     void set_node_root(void* node, bool is_root);
@@ -194,22 +908,77 @@ public:
     NodeType get_node_type(void* node);
     void set_node_type(void* node, NodeType type);
 
-    std::string get_input_buffer() { return input_buffer; }
-
-    char* cur = nullptr;
     const char* file_name = nullptr;
+    uint32_t scan_threads = 1;  // workers of a parallel scan, the thread running the statement is one of them
+    uint32_t prefetch_leaves = PREFETCH_DEFAULT_LEAVES;  // leaves read ahead of a scan, 0 turns read-ahead off
+    bool compress_pages = false;                         // a new database file is created compressed
 
 private:
-    std::string input_buffer;
-
-    void ParseWhitespace();
-
-    void PrintRow(const Row& row);
+    void ParseWhitespace(Session* session);
+    bool ParseKeyword(Session* session, const char* keyword);
+    ParseStatementResult ParseId(Session* session, uint32_t* id);
+    ParseStatementResult ParseWord(Session* session, char* destination, uint32_t max_length,
+                                   bool in_parentheses = false);
+    ParseStatementResult ParseInsertValues(Session* session, Statement* statement);
+    ParseStatementResult ParseWhereId(Session* session, Statement* statement);
+    ParseStatementResult ParseAggregates(Session* session, Statement* statement);
+    ParseStatementResult ParseWhereColumn(Session* session, Statement* statement);
+
+    uint32_t PagerFindVictim(Pager* pager, bool required = true);
+    void BulkOpenNode(BulkLoader* loader, uint32_t level);
+    void BulkReplaceNode(BulkLoader* loader, uint32_t level);
+    void BulkAttach(BulkLoader* loader, uint32_t level, uint32_t child_page_num, uint32_t child_max_key,
+                    uint32_t child_rows);
+    void BulkWritePage(BulkLoader* loader, uint32_t page_num, const void* page);
+    void BulkFlushRun(BulkLoader* loader);
+    void BulkFreeLevels(BulkLoader* loader);
+    uint32_t WalChecksum(const unsigned char* header, const void* page);
+
+    void ViewRow(void* source, RowView* destination);
+    char* WriterReserve(ResultWriter* writer, uint32_t length);
+    void WriteRow(ResultWriter* writer, const RowView& row);
+    void WriteCount(ResultWriter* writer, uint64_t count);
+    void WriteAggregate(ResultWriter* writer, const Statement* statement, const Aggregate& aggregate);
+    void WriteText(ResultWriter* writer, const char* text);
+    void WriterWrite(ResultWriter* writer);
+    void WriterFlush(ResultWriter* writer);
+    bool SetOutputFile(ResultWriter* writer, const char* path);
+    uint32_t SerializedRowSize(const Row& source);
     void SerializeRow(const Row& source, void* destination);
     void DeserializeRow(void* source, Row* destination);
+    ExecuteResult DispatchStatement(Session* session, Statement* statement, Table* table);
     ExecuteResult ExecuteInsert(Statement* statement, Table* table);
-    ExecuteResult ExecuteSelect(Statement* statement, Table* table);
-
+    ExecuteResult ExecuteSelect(Statement* statement, Table* table, ResultWriter* output);
+    ExecuteResult ExecuteDelete(Statement* statement, Table* table);
+    ExecuteResult ExecuteUpdate(Statement* statement, Table* table);
+    ExecuteResult ExecuteCreateIndex(Statement* statement, Table* table);
+    ExecuteResult ExecuteTransaction(Table* table, const std::vector<Statement>& statements);
+    ExecuteResult TransactionCheck(Table* table, const std::vector<Statement>& statements);
+    std::vector<bool> TableHasKeys(Table* table, const std::vector<uint32_t>& keys);
+    void ExecuteInsertBatch(Table* table, const std::vector<Row>& rows);
+    uint32_t CursorLeafHigh(Cursor* cursor);
+    ExecuteResult ExecuteSelectRows(Statement* statement, Table* table, ResultWriter* output, const Snapshot* snapshot);
+    ExecuteResult ExecuteSelectIn(Statement* statement, Table* table, ResultWriter* output, const Snapshot* snapshot);
+    ExecuteResult ExecuteSelectWhereColumn(Statement* statement, Table* table, ResultWriter* output,
+                                           const Snapshot* snapshot);
+    ExecuteResult ExecuteSelectAggregate(Statement* statement, Table* table, ResultWriter* output,
+                                         const Snapshot* snapshot);
+
+    static void* ScanWorkerMain(void* argument);
+    static bool ScanTakeRange(ParallelScan* scan, uint32_t worker_num, ScanRange* range);
+    static void AggregateRow(Aggregate* aggregate, uint32_t id);
+    static void AggregateMerge(Aggregate* aggregate, const Aggregate& partial);
+
+    static void* PrefetchWorker(void* argument);
+    static void* ServeWorker(void* argument);
+    bool ServeConnection(Server* server, Connection* connection);
+    bool ServeRequest(Server* server, Session* session);
+
+    void StatsWalk(Pager* pager, uint32_t page_num, uint32_t depth, DbStats* stats);
+    void PrintStats(const DbStats& stats);
+    LatencyClass StatementLatencyClass(const Statement* statement);
+    void LatencyRecord(LatencyHistogram* histogram, uint64_t nanoseconds);
+    std::string LatencyJson(Pager* pager);
     void PrintConstants();
     // void PrintLeafNode(void* node);
     void PrintTree(Pager* pager, uint32_t page_num, uint32_t indentation_level);
@@ -0,0 +1,293 @@
+#include "LitDatabase.h"
+
+// Bulk loading builds the tree bottom-up from rows sorted by id. Every level keeps the node being filled, a full
+// node is written once the node after it is opened, by then its parent and for a leaf the next leaf are known.
+// A parent level is only opened once its level holds a second node, so the single node left on the top level is
+// the root. Pages are taken past the end of the file in the order they are opened and written straight to the
+// file in long runs, the header switches to the new root in one commit at the end.
+
+ExecuteResult LitDatabase::BulkLoadBegin(Table* table, BulkLoader* loader, uint32_t fill_percent) {
+    Pager* pager = table->pager;
+    void* root = GetPage(pager, table->root_page_num);
+    bool is_empty = get_node_type(root) == NODE_LEAF && *LeafNodeNumCells(root) == 0;
+    UnpinPage(pager, table->root_page_num);
+    if (!is_empty) {
+        return EXECUTE_TABLE_NOT_EMPTY;
+    }
+
+    fill_percent = std::min(std::max(fill_percent, 1u), 100u);
+    loader->table = table;
+    loader->leaf_bytes = LEAF_NODE_SPACE_FOR_CELLS * fill_percent / 100;
+    loader->internal_keys = std::max(INTERNAL_NODE_MAX_CELLS * fill_percent / 100, 1u);
+    // free pages are left alone, overwriting them would break the freelist if the load never commits
+    loader->first_page_num = pager->num_pages;
+    loader->next_page_num = pager->num_pages;
+    loader->num_rows = 0;
+    loader->run = static_cast<char*>(malloc(static_cast<size_t>(BULK_LOAD_RUN_PAGES) * PAGE_SIZE));
+    loader->run_pages = 0;
+    loader->levels.clear();
+    loader->levels.push_back(BulkLevel());
+    loader->levels[0].node = malloc(PAGE_SIZE);
+    loader->levels[0].spare = malloc(PAGE_SIZE);
+    BulkOpenNode(loader, 0);
+    return EXECUTE_SUCCESS;
+}
+
+ExecuteResult LitDatabase::BulkLoadAdd(BulkLoader* loader, const Row& row) {
+    if (loader->num_rows > 0 && row.id <= loader->last_key) {
+        return row.id == loader->last_key ? EXECUTE_DUPLICATE_KEY : EXECUTE_UNSORTED_INPUT;
+    }
+
+    // a leaf takes at least one row whatever the fill factor
+    uint32_t length = SerializedRowSize(row);
+    BulkLevel* leaf = &loader->levels[0];
+    if (leaf->num_children > 0 && LeafNodeUsedSpace(leaf->node) + LEAF_NODE_CELL_SIZE + length > loader->leaf_bytes) {
+        BulkReplaceNode(loader, 0);
+        leaf = &loader->levels[0];
+    }
+
+    SerializeRow(row, LeafNodeInsertCell(leaf->node, leaf->num_children++, row.id, length));
+    leaf->max_key = row.id;
+    leaf->num_rows += 1;
+    loader->last_key = row.id;
+    loader->num_rows += 1;
+    return EXECUTE_SUCCESS;
+}
+
+// write the nodes still being filled, make the top one the root and commit
+void LitDatabase::BulkLoadFinish(BulkLoader* loader) {
+    if (loader->num_rows == 0) {
+        BulkLoadAbort(loader);
+        return;
+    }
+
+    // the loop bound is read every time, attaching a node can still open a new top level
+    for (uint32_t level = 0; level + 1 < loader->levels.size(); ++level) {
+        BulkAttach(loader, level + 1, loader->levels[level].page_num, loader->levels[level].max_key,
+                   loader->levels[level].num_rows);
+        *NodeParent(loader->levels[level].node) = loader->levels[level + 1].page_num;
+        BulkWritePage(loader, loader->levels[level].page_num, loader->levels[level].node);
+    }
+    BulkLevel& top = loader->levels.back();
+    set_node_root(top.node, true);
+    *NodeParent(top.node) = 0;
+    BulkWritePage(loader, top.page_num, top.node);
+    BulkFlushRun(loader);
+
+    // the new pages have to be durable before the commit that makes them reachable
+    Table* table = loader->table;
+    Pager* pager = table->pager;
+    if (pager->page_map.enabled) {
+        pthread_mutex_lock(&pager->mutex);
+        PageMapSync(pager);
+        pthread_mutex_unlock(&pager->mutex);
+    } else if (fdatasync(pager->file_descriptor) == -1) {
+        printf("Error syncing db file\n");
+        exit(EXIT_FAILURE);
+    } else {
+        pager->file_length =
+            std::max<off_t>(pager->file_length, static_cast<off_t>(loader->next_page_num) * PAGE_SIZE);
+    }
+    pager->num_pages = loader->next_page_num;
+    if (pager->mode == PAGER_MMAP) {
+        PagerMapGrow(pager, pager->num_pages);
+    }
+
+    uint32_t old_root_page_num = table->root_page_num;
+    void* header = GetPage(pager, DB_HEADER_PAGE_NUM);
+    *HeaderRootPage(header) = top.page_num;
+    MarkPageDirty(pager, DB_HEADER_PAGE_NUM);
+    UnpinPage(pager, DB_HEADER_PAGE_NUM);
+    table->root_page_num = top.page_num;
+    table->rightmost.valid = false;
+    FreePage(pager, old_root_page_num);
+    // indexes on the empty table are filled in the same commit
+    for (uint32_t i = 0; i < INDEX_COLUMN_COUNT; ++i) {
+        if (table->indexes[i]) IndexBuild(table, static_cast<IndexColumn>(i));
+    }
+    WalCommit(pager);
+
+    BulkFreeLevels(loader);
+}
+
+// drop a load that did not finish, the table is left as it was
+void LitDatabase::BulkLoadAbort(BulkLoader* loader) {
+    Pager* pager = loader->table->pager;
+    if (pager->page_map.enabled) {
+        // the map was not synced, the space the pages took is free again
+        pthread_mutex_lock(&pager->mutex);
+        PageMapTruncate(pager, loader->first_page_num);
+        pthread_mutex_unlock(&pager->mutex);
+    } else if (loader->next_page_num > loader->first_page_num) {
+        if (ftruncate(pager->file_descriptor, pager->file_length) == -1) {
+            printf("Error truncating db file\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    BulkFreeLevels(loader);
+}
+
+// read "id username email" rows sorted by id from a file, fields are separated by spaces, tabs or commas
+ExecuteResult LitDatabase::ImportFile(Table* table, const char* path, uint32_t fill_percent, uint64_t* line_num) {
+    *line_num = 0;
+    FILE* file = fopen(path, "r");
+    if (file == nullptr) {
+        return EXECUTE_IO_ERROR;
+    }
+
+    BulkLoader loader;
+    ExecuteResult result = BulkLoadBegin(table, &loader, fill_percent);
+    if (result != EXECUTE_SUCCESS) {
+        fclose(file);
+        return result;
+    }
+
+    char* line = nullptr;
+    size_t capacity = 0;
+    Row row;
+    while (getline(&line, &capacity, file) != -1) {
+        *line_num += 1;
+        const char* separators = " \t,\r\n";
+        char* save = nullptr;
+        char* id_string = strtok_r(line, separators, &save);
+        if (id_string == nullptr) continue;
+        char* username = strtok_r(nullptr, separators, &save);
+        char* email = strtok_r(nullptr, separators, &save);
+
+        char* end = nullptr;
+        unsigned long id = strtoul(id_string, &end, 10);
+        if (username == nullptr || email == nullptr || *end != '\0' || *id_string == '-' || id > UINT32_MAX ||
+            strlen(username) > COLUMN_USERNAME_SIZE || strlen(email) > COLUMN_EMAIL_SIZE) {
+            result = EXECUTE_INVALID_ROW;
+            break;
+        }
+        row.id = id;
+        strcpy(row.username, username);
+        strcpy(row.email, email);
+        result = BulkLoadAdd(&loader, row);
+        if (result != EXECUTE_SUCCESS) break;
+    }
+    if (result == EXECUTE_SUCCESS && ferror(file)) {
+        result = EXECUTE_IO_ERROR;
+    }
+    free(line);
+    fclose(file);
+
+    if (result != EXECUTE_SUCCESS) {
+        BulkLoadAbort(&loader);
+        return result;
+    }
+    BulkLoadFinish(&loader);
+    return EXECUTE_SUCCESS;
+}
+
+// take the next page for a node on the level, opening the parent level once the level has a second node
+void LitDatabase::BulkOpenNode(BulkLoader* loader, uint32_t level) {
+    BulkLevel& current = loader->levels[level];
+    current.page_num = loader->next_page_num++;
+    if (level == 0) {
+        InitializeLeafNode(current.node);
+    } else {
+        InitializeInternalNode(current.node);
+    }
+    current.num_children = 0;
+    current.num_rows = 0;
+    current.num_nodes += 1;
+
+    if (current.num_nodes == 2 && level + 1 == loader->levels.size()) {
+        loader->levels.push_back(BulkLevel());
+        loader->levels[level + 1].node = malloc(PAGE_SIZE);
+        loader->levels[level + 1].spare = malloc(PAGE_SIZE);
+        BulkOpenNode(loader, level + 1);
+    }
+}
+
+// the node on the level is full, start the next one and write the full node under its parent
+void LitDatabase::BulkReplaceNode(BulkLoader* loader, uint32_t level) {
+    std::swap(loader->levels[level].node, loader->levels[level].spare);
+    uint32_t full_page_num = loader->levels[level].page_num;
+    uint32_t full_max_key = loader->levels[level].max_key;
+    uint32_t full_num_rows = loader->levels[level].num_rows;
+
+    BulkOpenNode(loader, level);
+    void* full = loader->levels[level].spare;
+    if (level == 0) {
+        *LeafNodeNextLeaf(full) = loader->levels[0].page_num;
+    }
+    BulkAttach(loader, level + 1, full_page_num, full_max_key, full_num_rows);
+    *NodeParent(full) = loader->levels[level + 1].page_num;
+    BulkWritePage(loader, full_page_num, full);
+}
+
+// append a child to the internal node being filled on the level, the previous right child gets a cell
+void LitDatabase::BulkAttach(BulkLoader* loader, uint32_t level, uint32_t child_page_num, uint32_t child_max_key,
+                             uint32_t child_rows) {
+    if (loader->levels[level].num_children == loader->internal_keys + 1) {
+        BulkReplaceNode(loader, level);
+    }
+
+    BulkLevel& parent = loader->levels[level];
+    if (parent.num_children > 0) {
+        uint32_t key_num = parent.num_children - 1;
+        uint32_t right_rows = *InternalNodeCount(parent.node, key_num);
+        *InternalNodeNumKeys(parent.node) = key_num + 1;
+        *InternalNodeChild(parent.node, key_num) = *InternalNodeRightChild(parent.node);
+        *InternalNodeKey(parent.node, key_num) = parent.max_key;
+        *InternalNodeCount(parent.node, key_num) = right_rows;
+    }
+    *InternalNodeRightChild(parent.node) = child_page_num;
+    *InternalNodeCount(parent.node, parent.num_children) = child_rows;
+    parent.max_key = child_max_key;
+    parent.num_rows += child_rows;
+    parent.num_children += 1;
+}
+
+// pages are mostly finished in page order, consecutive ones are gathered into a single write
+void LitDatabase::BulkWritePage(BulkLoader* loader, uint32_t page_num, const void* page) {
+    if (loader->run_pages == BULK_LOAD_RUN_PAGES ||
+        (loader->run_pages > 0 && page_num != loader->run_start + loader->run_pages)) {
+        BulkFlushRun(loader);
+    }
+    if (loader->run_pages == 0) {
+        loader->run_start = page_num;
+    }
+    memcpy(loader->run + static_cast<size_t>(loader->run_pages) * PAGE_SIZE, page, PAGE_SIZE);
+    loader->run_pages += 1;
+}
+
+void LitDatabase::BulkFlushRun(BulkLoader* loader) {
+    Pager* pager = loader->table->pager;
+    if (pager->page_map.enabled) {
+        std::vector<struct iovec> pages;
+        for (uint32_t i = 0; i < loader->run_pages; ++i) {
+            pages.push_back({loader->run + static_cast<size_t>(i) * PAGE_SIZE, PAGE_SIZE});
+        }
+        pthread_mutex_lock(&pager->mutex);
+        PageMapWrite(pager, loader->run_start, pages);
+        pthread_mutex_unlock(&pager->mutex);
+        loader->run_pages = 0;
+        return;
+    }
+    size_t length = static_cast<size_t>(loader->run_pages) * PAGE_SIZE;
+    off_t offset = static_cast<off_t>(loader->run_start) * PAGE_SIZE;
+    size_t written = 0;
+    while (written < length) {
+        ssize_t result = pwrite(pager->file_descriptor, loader->run + written, length - written, offset + written);
+        if (result <= 0) {
+            printf("Error writing db file\n");
+            exit(EXIT_FAILURE);
+        }
+        written += result;
+    }
+    loader->run_pages = 0;
+}
+
+void LitDatabase::BulkFreeLevels(BulkLoader* loader) {
+    for (BulkLevel& level : loader->levels) {
+        free(level.node);
+        free(level.spare);
+    }
+    loader->levels.clear();
+    free(loader->run);
+    loader->run = nullptr;
+}
@@ -0,0 +1,487 @@
+#include "LitDatabase.h"
+
+// Compressed database files. The log and the buffer pool see whole pages as always, compression happens only where
+// pages meet the database file: a checkpoint or a bulk load compresses the pages it writes and GetPage decompresses
+// the ones it loads. A compressed page takes a variable number of units, so pages no longer sit at page_num *
+// PAGE_SIZE and the page map says where each one is.
+//
+// The map is kept in memory and written out as a table by every checkpoint, after the pages it points to and before
+// the log is emptied. A page is rewritten in place when it still fits its extent and moved otherwise, which is safe
+// because every page a checkpoint writes is also in the log: a crash before the new table is durable leaves the old
+// table, whose extents of pages not in the log were not touched, and recovery writes the logged pages again. The
+// table itself is always written to fresh space, and the space of the previous one is only given back once the header
+// slot pointing to the new one is durable.
+
+namespace {
+
+// a page is matched against this many earlier positions by a hash of 4 bytes
+constexpr uint32_t COMPRESS_HASH_BITS = 12;
+constexpr uint32_t COMPRESS_MIN_MATCH = 4;
+
+uint32_t Load32(const unsigned char* bytes) {
+    uint32_t value;
+    memcpy(&value, bytes, sizeof(value));
+    return value;
+}
+
+// a nibble of 15 is continued in bytes, 255 meaning more follow
+unsigned char* WriteLength(unsigned char* out, uint32_t length) {
+    for (; length >= 255; length -= 255) {
+        *out++ = 255;
+    }
+    *out++ = length;
+    return out;
+}
+
+unsigned char* WriteSequence(unsigned char* out, const unsigned char* literals, uint32_t num_literals,
+                             uint32_t match_offset, uint32_t match_length) {
+    unsigned char* token = out++;
+    *token = std::min(num_literals, 15u) << 4;
+    if (num_literals >= 15) out = WriteLength(out, num_literals - 15);
+    memcpy(out, literals, num_literals);
+    out += num_literals;
+    if (match_length == 0) return out;
+
+    *out++ = match_offset & 0xff;
+    *out++ = match_offset >> 8;
+    uint32_t extra = match_length - COMPRESS_MIN_MATCH;
+    *token |= std::min(extra, 15u);
+    if (extra >= 15) out = WriteLength(out, extra - 15);
+    return out;
+}
+
+// LZ77 coded like LZ4: sequences of a token, literals and a match. The token holds the number of literals in its
+// high nibble and the match length less 4 in the low one, the match is a 16-bit offset back into the page. The last
+// sequence has literals only. Free space and padding inside a page is a match at offset 1.
+uint32_t CompressPage(const void* page, unsigned char* destination) {
+    const unsigned char* input = static_cast<const unsigned char*>(page);
+    uint16_t positions[1 << COMPRESS_HASH_BITS];
+    memset(positions, 0, sizeof(positions));
+    unsigned char* out = destination;
+    uint32_t anchor = 0;
+    uint32_t position = 0;
+    while (position + COMPRESS_MIN_MATCH <= PAGE_SIZE) {
+        uint32_t sequence = Load32(input + position);
+        uint32_t hash = (sequence * 2654435761u) >> (32 - COMPRESS_HASH_BITS);
+        uint32_t candidate = positions[hash];
+        positions[hash] = position;
+        if (candidate >= position || Load32(input + candidate) != sequence) {
+            position += 1;
+            continue;
+        }
+        uint32_t length = COMPRESS_MIN_MATCH;
+        while (position + length < PAGE_SIZE && input[candidate + length] == input[position + length]) {
+            length += 1;
+        }
+        out = WriteSequence(out, input + anchor, position - anchor, position - candidate, length);
+        position += length;
+        anchor = position;
+    }
+    out = WriteSequence(out, input + anchor, PAGE_SIZE - anchor, 0, 0);
+    return out - destination;
+}
+
+bool ReadLength(const unsigned char** in, const unsigned char* end, uint32_t* length) {
+    unsigned char byte;
+    do {
+        if (*in == end) return false;
+        byte = *(*in)++;
+        *length += byte;
+    } while (byte == 255);
+    return true;
+}
+
+// copies in steps of 16 bytes, so it may read and write up to 15 bytes past the end
+void CopyWide(unsigned char* out, const unsigned char* in, uint32_t length) {
+    for (uint32_t i = 0; i < length; i += 16) {
+        memcpy(out + i, in + i, 16);
+    }
+}
+
+// false if the input is not a whole page worth of sequences. The page is put together in a buffer with room past its
+// end, so most literals and matches can be copied in wide steps without checking where the page ends.
+bool DecompressPage(const unsigned char* source, uint32_t length, void* page) {
+    unsigned char buffer[PAGE_SIZE + 16];
+    const unsigned char* in = source;
+    const unsigned char* end = source + length;
+    unsigned char* out = buffer;
+    unsigned char* out_end = buffer + PAGE_SIZE;
+    while (in < end) {
+        unsigned char token = *in++;
+        uint32_t num_literals = token >> 4;
+        if (num_literals == 15 && !ReadLength(&in, end, &num_literals)) return false;
+        if (num_literals > static_cast<uint32_t>(end - in) || num_literals > static_cast<uint32_t>(out_end - out)) {
+            return false;
+        }
+        if (static_cast<uint32_t>(end - in) >= num_literals + 16) {
+            CopyWide(out, in, num_literals);
+        } else {
+            memcpy(out, in, num_literals);
+        }
+        in += num_literals;
+        out += num_literals;
+        if (in == end) break;
+
+        if (end - in < 2) return false;
+        uint32_t match_offset = in[0] | in[1] << 8;
+        in += 2;
+        uint32_t match_length = token & 15;
+        if (match_length == 15 && !ReadLength(&in, end, &match_length)) return false;
+        match_length += COMPRESS_MIN_MATCH;
+        if (match_offset == 0 || match_offset > static_cast<uint32_t>(out - buffer) ||
+            match_length > static_cast<uint32_t>(out_end - out)) {
+            return false;
+        }
+        // the match may overlap the bytes it produces, a run of one byte is the common case of that
+        const unsigned char* match = out - match_offset;
+        if (match_offset >= 16) {
+            CopyWide(out, match, match_length);
+        } else if (match_offset == 1) {
+            memset(out, *match, match_length);
+        } else {
+            for (uint32_t i = 0; i < match_length; ++i) {
+                out[i] = match[i];
+            }
+        }
+        out += match_length;
+    }
+    if (out != out_end) return false;
+    memcpy(page, buffer, PAGE_SIZE);
+    return true;
+}
+
+uint32_t Checksum(const void* data, size_t length) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; ++i) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+uint32_t Units(uint64_t bytes) { return (bytes + PAGE_MAP_UNIT - 1) / PAGE_MAP_UNIT; }
+
+// give space back, merged with the free space around it. Space at the end of what is in use shortens it instead.
+void Release(PageMap* map, uint32_t offset, uint32_t units) {
+    if (units == 0) return;
+    auto next = map->free_by_offset.lower_bound(offset);
+    if (next != map->free_by_offset.begin()) {
+        auto previous = std::prev(next);
+        if (previous->first + previous->second == offset) {
+            offset = previous->first;
+            units += previous->second;
+            map->free_by_size.erase(std::make_pair(previous->second, previous->first));
+            map->free_by_offset.erase(previous);
+        }
+    }
+    if (next != map->free_by_offset.end() && offset + units == next->first) {
+        units += next->second;
+        map->free_by_size.erase(std::make_pair(next->second, next->first));
+        map->free_by_offset.erase(next);
+    }
+    if (offset + units == map->end) {
+        map->end = offset;
+        return;
+    }
+    map->free_by_offset[offset] = units;
+    map->free_by_size.insert(std::make_pair(units, offset));
+}
+
+// the smallest free space that fits, the end of the file when none does
+uint32_t Allocate(PageMap* map, uint32_t units) {
+    auto fit = map->free_by_size.lower_bound(std::make_pair(units, 0u));
+    if (fit == map->free_by_size.end()) {
+        uint32_t offset = map->end;
+        if (static_cast<uint64_t>(offset) + units > UINT32_MAX) {
+            std::cout << "Compressed database file is full." << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        map->end += units;
+        return offset;
+    }
+    uint32_t free_units = fit->first;
+    uint32_t offset = fit->second;
+    map->free_by_size.erase(fit);
+    map->free_by_offset.erase(offset);
+    if (free_units > units) {
+        map->free_by_offset[offset + units] = free_units - units;
+        map->free_by_size.insert(std::make_pair(free_units - units, offset + units));
+    }
+    return offset;
+}
+
+bool ValidHeader(const PageMapHeader& header) {
+    return header.magic == PAGE_MAP_MAGIC && header.version == PAGE_MAP_VERSION && header.page_size == PAGE_SIZE &&
+           header.checksum == Checksum(&header, offsetof(PageMapHeader, checksum));
+}
+
+}  // namespace
+
+// pages the database file has an image of, the ones past it read as zeros
+uint32_t LitDatabase::PagerFilePages(Pager* pager) {
+    if (pager->page_map.enabled) {
+        return pager->page_map.extents.size();
+    }
+    return (pager->file_length + PAGE_SIZE - 1) / PAGE_SIZE;
+}
+
+// start the page map of a new file, or load the current table of an existing one and find the free space between
+// the extents
+void LitDatabase::PageMapOpen(Pager* pager, bool create) {
+    PageMap& map = pager->page_map;
+    map.enabled = true;
+    if (create) {
+        PageMapSync(pager);
+        return;
+    }
+
+    PageMapHeader slots[2];
+    for (uint32_t i = 0; i < 2; ++i) {
+        if (pread(pager->file_descriptor, &slots[i], sizeof(PageMapHeader), i * PAGE_MAP_SLOT_SIZE) !=
+            sizeof(PageMapHeader)) {
+            memset(&slots[i], 0, sizeof(PageMapHeader));
+        }
+    }
+    bool valid[2] = {ValidHeader(slots[0]), ValidHeader(slots[1])};
+    if (!valid[0] && !valid[1]) {
+        std::cout << "Compressed database file has no valid page map header." << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    const PageMapHeader& header = valid[0] && (!valid[1] || slots[0].generation > slots[1].generation) ? slots[0]
+                                                                                                         : slots[1];
+
+    map.generation = header.generation;
+    map.table_offset = header.table_offset;
+    map.table_units = header.table_units;
+    map.extents.resize(header.num_pages);
+    size_t table_bytes = map.extents.size() * sizeof(PageExtent);
+    if (table_bytes > static_cast<uint64_t>(map.table_units) * PAGE_MAP_UNIT ||
+        (table_bytes > 0 && pread(pager->file_descriptor, map.extents.data(), table_bytes,
+                                  static_cast<off_t>(map.table_offset) * PAGE_MAP_UNIT) !=
+                                static_cast<ssize_t>(table_bytes)) ||
+        Checksum(map.extents.data(), table_bytes) != header.table_checksum) {
+        std::cout << "Page map of the compressed database file is corrupt." << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    // everything between the header slots, the table and the extents is free
+    std::vector<std::pair<uint32_t, uint32_t>> used;
+    used.push_back(std::make_pair(0u, PAGE_MAP_HEADER_UNITS));
+    used.push_back(std::make_pair(map.table_offset, map.table_units));
+    for (const PageExtent& extent : map.extents) {
+        if (extent.units > 0) used.push_back(std::make_pair(extent.offset, static_cast<uint32_t>(extent.units)));
+    }
+    std::sort(used.begin(), used.end());
+    map.end = 0;
+    for (const auto& range : used) {
+        if (range.first > map.end) {
+            map.free_by_offset[map.end] = range.first - map.end;
+            map.free_by_size.insert(std::make_pair(range.first - map.end, map.end));
+        }
+        map.end = std::max(map.end, range.first + range.second);
+    }
+}
+
+// load one page into the given frame, the caller holds the pager mutex. Returns the bytes read from the file.
+uint32_t LitDatabase::PageMapRead(Pager* pager, uint32_t page_num, void* page) {
+    PageMap& map = pager->page_map;
+    if (page_num >= map.extents.size() || map.extents[page_num].length == 0) {
+        memset(page, 0, PAGE_SIZE);
+        return 0;
+    }
+    const PageExtent& extent = map.extents[page_num];
+    unsigned char compressed[PAGE_SIZE];
+    unsigned char* destination = extent.length == PAGE_SIZE ? static_cast<unsigned char*>(page) : compressed;
+    if (pread(pager->file_descriptor, destination, extent.length, static_cast<off_t>(extent.offset) * PAGE_MAP_UNIT) !=
+        extent.length) {
+        printf("Error reading file\n");
+        exit(EXIT_FAILURE);
+    }
+    if (extent.length < PAGE_SIZE && !DecompressPage(compressed, extent.length, page)) {
+        std::cout << "Compressed page " << page_num << " is corrupt." << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    return extent.length;
+}
+
+// read-ahead of pages [first_page_num, first_page_num + num_pages) into pages, without the pager mutex held. The
+// extents are looked up under it and read with one pread when they lie close together. Returns how many pages from
+// the first one were read, a checkpoint moving them in between is caught by the caller checking the log salt.
+uint32_t LitDatabase::PageMapReadRun(Pager* pager, uint32_t first_page_num, uint32_t num_pages, char* pages) {
+    PageMap& map = pager->page_map;
+    std::vector<PageExtent> extents;
+    pthread_mutex_lock(&pager->mutex);
+    for (uint32_t i = 0; i < num_pages && first_page_num + i < map.extents.size(); ++i) {
+        extents.push_back(map.extents[first_page_num + i]);
+    }
+    pthread_mutex_unlock(&pager->mutex);
+    if (extents.empty()) return 0;
+
+    uint64_t start = UINT64_MAX;
+    uint64_t end = 0;
+    uint64_t total = 0;
+    for (const PageExtent& extent : extents) {
+        if (extent.length == 0) continue;
+        start = std::min<uint64_t>(start, static_cast<uint64_t>(extent.offset) * PAGE_MAP_UNIT);
+        end = std::max<uint64_t>(end, static_cast<uint64_t>(extent.offset) * PAGE_MAP_UNIT + extent.length);
+        total += extent.length;
+    }
+    // pages written in order sit next to each other, scattered ones are read one at a time
+    bool one_read = start < end && end - start <= 2 * total;
+    std::vector<unsigned char> buffer(one_read ? end - start : PAGE_SIZE);
+    if (one_read && pread(pager->file_descriptor, buffer.data(), buffer.size(), start) !=
+                        static_cast<ssize_t>(buffer.size())) {
+        return 0;
+    }
+
+    uint32_t pages_read = 0;
+    uint64_t bytes_read = one_read ? buffer.size() : 0;
+    for (const PageExtent& extent : extents) {
+        char* page = pages + static_cast<size_t>(pages_read) * PAGE_SIZE;
+        const unsigned char* source = buffer.data();
+        if (extent.length == 0) {
+            memset(page, 0, PAGE_SIZE);
+            pages_read += 1;
+            continue;
+        }
+        off_t offset = static_cast<off_t>(extent.offset) * PAGE_MAP_UNIT;
+        if (one_read) {
+            source += offset - start;
+        } else if (pread(pager->file_descriptor, buffer.data(), extent.length, offset) != extent.length) {
+            break;
+        } else {
+            bytes_read += extent.length;
+        }
+        if (extent.length == PAGE_SIZE) {
+            memcpy(page, source, PAGE_SIZE);
+        } else if (!DecompressPage(source, extent.length, page)) {
+            break;
+        }
+        pages_read += 1;
+    }
+    pager->counters.bytes_read.fetch_add(bytes_read, std::memory_order_relaxed);
+    return pages_read;
+}
+
+// compress consecutive pages starting at first_page_num and write them to their extents, the caller holds the pager
+// mutex. The extents are written in file order, those next to each other with one pwritev.
+void LitDatabase::PageMapWrite(Pager* pager, uint32_t first_page_num, const std::vector<struct iovec>& pages) {
+    PageMap& map = pager->page_map;
+    if (pages.empty()) return;
+    if (first_page_num + pages.size() > map.extents.size()) {
+        map.extents.resize(first_page_num + pages.size(), PageExtent{0, 0, 0});
+    }
+
+    static const char padding[PAGE_MAP_UNIT] = {0};
+    std::vector<unsigned char> compressed(pages.size() * PAGE_COMPRESS_BOUND);
+    std::vector<std::pair<uint32_t, struct iovec>> writes;  // unit offset, bytes
+    for (size_t i = 0; i < pages.size(); ++i) {
+        unsigned char* destination = &compressed[i * PAGE_COMPRESS_BOUND];
+        struct iovec data = {destination, CompressPage(pages[i].iov_base, destination)};
+        if (Units(data.iov_len) >= Units(PAGE_SIZE)) {
+            data = {pages[i].iov_base, PAGE_SIZE};
+        }
+
+        // a page that still fits stays where it is, the space it no longer needs is given back
+        PageExtent& extent = map.extents[first_page_num + i];
+        uint32_t units = Units(data.iov_len);
+        if (units > extent.units) {
+            Release(&map, extent.offset, extent.units);
+            extent.offset = Allocate(&map, units);
+        } else {
+            Release(&map, extent.offset + units, extent.units - units);
+        }
+        extent.units = units;
+        extent.length = data.iov_len;
+        writes.push_back(std::make_pair(extent.offset, data));
+    }
+    std::sort(writes.begin(), writes.end(),
+              [](const std::pair<uint32_t, struct iovec>& a, const std::pair<uint32_t, struct iovec>& b) {
+                  return a.first < b.first;
+              });
+
+    // each extent is padded to whole units, so extents next to each other make one contiguous write
+    std::vector<struct iovec> iov;
+    size_t run_start = 0;
+    while (run_start < writes.size()) {
+        iov.clear();
+        size_t run_end = run_start;
+        uint32_t next_offset = writes[run_start].first;
+        size_t length = 0;
+        while (run_end < writes.size() && writes[run_end].first == next_offset && iov.size() + 2 <= IOV_MAX) {
+            const struct iovec& data = writes[run_end].second;
+            uint32_t units = Units(data.iov_len);
+            iov.push_back(data);
+            if (units * PAGE_MAP_UNIT > data.iov_len) {
+                iov.push_back({const_cast<char*>(padding), units * PAGE_MAP_UNIT - data.iov_len});
+            }
+            length += units * PAGE_MAP_UNIT;
+            next_offset += units;
+            ++run_end;
+        }
+        off_t offset = static_cast<off_t>(writes[run_start].first) * PAGE_MAP_UNIT;
+        if (pwritev(pager->file_descriptor, iov.data(), iov.size(), offset) != static_cast<ssize_t>(length)) {
+            printf("Error writing\n");
+            exit(EXIT_FAILURE);
+        }
+        run_start = run_end;
+    }
+    pager->file_length = std::max<off_t>(pager->file_length, static_cast<off_t>(map.end) * PAGE_MAP_UNIT);
+}
+
+// make the pages written so far and the map pointing to them durable: the table goes to fresh space, then the header
+// slot the older table is in is overwritten to point to it. The caller holds the pager mutex.
+void LitDatabase::PageMapSync(Pager* pager) {
+    PageMap& map = pager->page_map;
+    size_t table_bytes = map.extents.size() * sizeof(PageExtent);
+    uint32_t table_units = Units(table_bytes);
+    uint32_t table_offset = table_units > 0 ? Allocate(&map, table_units) : 0;
+    if (table_bytes > 0 && pwrite(pager->file_descriptor, map.extents.data(), table_bytes,
+                                  static_cast<off_t>(table_offset) * PAGE_MAP_UNIT) !=
+                               static_cast<ssize_t>(table_bytes)) {
+        printf("Error writing page map\n");
+        exit(EXIT_FAILURE);
+    }
+    // space past the end is free, left by moved pages or a bulk load that did not finish
+    off_t length = std::max<off_t>(static_cast<off_t>(map.end) * PAGE_MAP_UNIT, PAGE_MAP_HEADER_UNITS * PAGE_MAP_UNIT);
+    if (pager->file_length != length && ftruncate(pager->file_descriptor, length) == -1) {
+        printf("Error truncating db file\n");
+        exit(EXIT_FAILURE);
+    }
+    pager->file_length = length;
+    if (fdatasync(pager->file_descriptor) == -1) {
+        printf("Error syncing db file\n");
+        exit(EXIT_FAILURE);
+    }
+
+    PageMapHeader header;
+    header.magic = PAGE_MAP_MAGIC;
+    header.version = PAGE_MAP_VERSION;
+    header.page_size = PAGE_SIZE;
+    header.generation = map.generation + 1;
+    header.num_pages = map.extents.size();
+    header.table_offset = table_offset;
+    header.table_units = table_units;
+    header.table_checksum = Checksum(map.extents.data(), table_bytes);
+    header.checksum = Checksum(&header, offsetof(PageMapHeader, checksum));
+    off_t slot = (header.generation % 2) * PAGE_MAP_SLOT_SIZE;
+    if (pwrite(pager->file_descriptor, &header, sizeof(header), slot) != sizeof(header) ||
+        fdatasync(pager->file_descriptor) == -1) {
+        printf("Error writing page map\n");
+        exit(EXIT_FAILURE);
+    }
+
+    Release(&map, map.table_offset, map.table_units);
+    map.generation = header.generation;
+    map.table_offset = table_offset;
+    map.table_units = table_units;
+}
+
+// forget the pages from num_pages on, written by a bulk load that was given up before the map was synced
+void LitDatabase::PageMapTruncate(Pager* pager, uint32_t num_pages) {
+    PageMap& map = pager->page_map;
+    for (uint32_t page_num = num_pages; page_num < map.extents.size(); ++page_num) {
+        Release(&map, map.extents[page_num].offset, map.extents[page_num].units);
+    }
+    if (num_pages < map.extents.size()) map.extents.resize(num_pages);
+}
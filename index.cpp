@@ -0,0 +1,234 @@
+#include "LitDatabase.h"
+
+// Secondary indexes. An index is a Table of its own over the shared pager, so the tree code that serves the rows
+// serves the index as well. Its leaves hold rows with only the id filled in, keyed by the hash of the column value.
+// Equal keys are allowed: a lookup seeks to the first one and walks the run, the rows found are checked against the
+// value since different values can hash alike.
+
+Table* LitDatabase::IndexOpen(Table* table, uint32_t root_page_num) {
+    Table* index = new Table();
+    index->root_page_num = root_page_num;
+    index->pager = table->pager;
+    return index;
+}
+
+// 32-bit FNV-1a
+uint32_t LitDatabase::IndexKey(const char* value, uint32_t length) {
+    uint32_t hash = 2166136261u;
+    for (uint32_t i = 0; i < length; ++i) {
+        hash ^= static_cast<unsigned char>(value[i]);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+const char* LitDatabase::RowColumnValue(const Row& row, IndexColumn column) {
+    return column == INDEX_USERNAME ? row.username : row.email;
+}
+
+// add every row of the table to the new index on column, in key order so the inserts walk the index leaves
+void LitDatabase::IndexBuild(Table* table, IndexColumn column) {
+    std::vector<std::pair<uint32_t, uint32_t>> entries;
+    Cursor* cursor = TableStart(table);
+    RowView row;
+    while (!(cursor->end_of_table)) {
+        ViewRow(CursorValue(cursor), &row);
+        UnpinPage(table->pager, cursor->page_num);
+        if (column == INDEX_USERNAME) {
+            entries.emplace_back(IndexKey(row.username, row.username_length), row.id);
+        } else {
+            entries.emplace_back(IndexKey(row.email, row.email_length), row.id);
+        }
+        CursorAdvance(cursor);
+    }
+    CursorClose(cursor);
+
+    std::sort(entries.begin(), entries.end());
+    for (const auto& entry : entries) {
+        IndexInsert(table->indexes[column], entry.first, entry.second);
+    }
+}
+
+// latched like a row insert, see ExecuteInsert
+void LitDatabase::IndexInsert(Table* index, uint32_t key, uint32_t id) {
+    Row entry;
+    entry.id = id;
+    Cursor* cursor = TableFind(index, key, CURSOR_WRITE);
+    void* node = GetPage(index->pager, cursor->page_num);
+    bool fits = LeafNodeFreeSpace(node) >= LEAF_NODE_CELL_SIZE + SerializedRowSize(entry);
+    UnpinPage(index->pager, cursor->page_num);
+    if (!fits) {
+        CursorClose(cursor);
+        cursor = TableFind(index, key, CURSOR_SPLIT);
+    }
+    LeafNodeInsert(cursor, key, entry);
+    CursorClose(cursor);
+}
+
+// remove the entry for the row with the id from the run of entries with the key, latched like a row delete. A write
+// cursor only holds the path to the leaf it found, a run going on past that leaf is searched with the tree held.
+void LitDatabase::IndexRemove(Table* index, uint32_t key, uint32_t id) {
+    for (CursorMode mode = CURSOR_WRITE;; mode = CURSOR_EXCLUSIVE) {
+        Cursor* cursor = TableSeek(index, key, mode);
+        bool needs_exclusive = false;
+        while (!(cursor->end_of_table)) {
+            void* node = GetPage(index->pager, cursor->page_num);
+            uint32_t entry_key = *LeafNodeKey(node, cursor->cell_num);
+            uint32_t entry_id;
+            memcpy(&entry_id, LeafNodeValue(node, cursor->cell_num), ID_SIZE);
+            if (entry_key != key) {
+                UnpinPage(index->pager, cursor->page_num);
+                break;
+            }
+            if (entry_id == id) {
+                if (mode == CURSOR_EXCLUSIVE) {
+                    UnpinPage(index->pager, cursor->page_num);
+                    LeafNodeDelete(cursor);
+                } else if (LeafNodeCanRemove(node, cursor->cell_num)) {
+                    LeafNodeRemoveCell(node, cursor->cell_num);
+                    MarkPageDirty(index->pager, cursor->page_num);
+                    UnpinPage(index->pager, cursor->page_num);
+                    CursorAddRows(cursor, -1);
+                } else {
+                    UnpinPage(index->pager, cursor->page_num);
+                    needs_exclusive = true;
+                }
+                break;
+            }
+            if (mode == CURSOR_WRITE && cursor->cell_num + 1 == *LeafNodeNumCells(node)) {
+                UnpinPage(index->pager, cursor->page_num);
+                needs_exclusive = true;
+                break;
+            }
+            UnpinPage(index->pager, cursor->page_num);
+            CursorAdvance(cursor);
+        }
+        CursorClose(cursor);
+        if (!needs_exclusive) return;
+    }
+}
+
+// ids of the rows whose value hashes to the key
+std::vector<uint32_t> LitDatabase::IndexLookup(Table* index, uint32_t key, const Snapshot* snapshot) {
+    std::vector<uint32_t> ids;
+    Cursor* cursor = TableSeek(index, key, CURSOR_READ, snapshot);
+    while (!(cursor->end_of_table)) {
+        void* node = CursorLeaf(cursor);
+        uint32_t entry_key = *LeafNodeKey(node, cursor->cell_num);
+        uint32_t entry_id;
+        memcpy(&entry_id, LeafNodeValue(node, cursor->cell_num), ID_SIZE);
+        CursorUnpinLeaf(cursor);
+        if (entry_key != key) break;
+        ids.push_back(entry_id);
+        CursorAdvance(cursor);
+    }
+    CursorClose(cursor);
+    return ids;
+}
+
+// keep the indexes in step with a row that was inserted (no old row), deleted (no new row) or updated
+void LitDatabase::IndexUpdateRow(Table* table, const Row* old_row, const Row* new_row) {
+    for (uint32_t i = 0; i < INDEX_COLUMN_COUNT; ++i) {
+        IndexColumn column = static_cast<IndexColumn>(i);
+        Table* index = table->indexes[column];
+        if (index == nullptr) continue;
+
+        const char* old_value = old_row ? RowColumnValue(*old_row, column) : nullptr;
+        const char* new_value = new_row ? RowColumnValue(*new_row, column) : nullptr;
+        if (old_value && new_value && strcmp(old_value, new_value) == 0) continue;
+        if (old_value) IndexRemove(index, IndexKey(old_value, strlen(old_value)), old_row->id);
+        if (new_value) IndexInsert(index, IndexKey(new_value, strlen(new_value)), new_row->id);
+    }
+}
+
+ExecuteResult LitDatabase::ExecuteCreateIndex(Statement* statement, Table* table) {
+    if (table->indexes[statement->column] != nullptr) {
+        return EXECUTE_INDEX_EXISTS;
+    }
+
+    Pager* pager = table->pager;
+    uint32_t root_page_num = GetUnusedPageNum(pager);
+    void* root = GetPage(pager, root_page_num);
+    InitializeLeafNode(root);
+    set_node_root(root, true);
+    MarkPageDirty(pager, root_page_num);
+    UnpinPage(pager, root_page_num);
+
+    LatchPage(pager, DB_HEADER_PAGE_NUM, LATCH_EXCLUSIVE);
+    void* header = GetPage(pager, DB_HEADER_PAGE_NUM);
+    *HeaderIndexRoot(header, statement->column) = root_page_num;
+    MarkPageDirty(pager, DB_HEADER_PAGE_NUM);
+    UnpinPage(pager, DB_HEADER_PAGE_NUM);
+    UnlatchPage(pager, DB_HEADER_PAGE_NUM);
+
+    table->indexes[statement->column] = IndexOpen(table, root_page_num);
+    IndexBuild(table, statement->column);
+    return EXECUTE_SUCCESS;
+}
+
+// select where [id ... and] username|email = value, through the index on the column or else by checking every row
+// in the id range. Aggregates without an index go through a parallel scan.
+ExecuteResult LitDatabase::ExecuteSelectWhereColumn(Statement* statement, Table* table, ResultWriter* output,
+                                                   const Snapshot* snapshot) {
+    if (statement->range_low > statement->range_high) {
+        if (statement->output == SELECT_AGGREGATE) WriteAggregate(output, statement, Aggregate());
+        WriterFlush(output);
+        return EXECUTE_SUCCESS;
+    }
+
+    // rows skip the first offset matches and stop at the limit, aggregates take every match
+    Aggregate aggregate;
+    uint64_t to_skip = statement->offset;
+    uint64_t num_rows = 0;
+    uint64_t max_rows = statement->output == SELECT_AGGREGATE ? UINT64_MAX : statement->limit;
+    auto emit = [&](const RowView& row) {
+        if (statement->output == SELECT_AGGREGATE) {
+            AggregateRow(&aggregate, row.id);
+            return;
+        }
+        if (to_skip > 0) {
+            to_skip -= 1;
+            return;
+        }
+        WriteRow(output, row);
+        num_rows += 1;
+    };
+
+    RowView row;
+    Table* index = table->indexes[statement->column];
+    if (index == nullptr && statement->output == SELECT_AGGREGATE) {
+        aggregate = ScanAggregate(statement, table, snapshot);
+    } else if (index == nullptr) {
+        Cursor* cursor = TableSeek(table, statement->range_low, CURSOR_READ, snapshot);
+        while (!(cursor->end_of_table) && num_rows < max_rows) {
+            ViewRow(CursorValue(cursor), &row);
+            bool in_range = row.id <= statement->range_high;
+            if (in_range && RowMatchesFilter(statement, row)) emit(row);
+            CursorUnpinLeaf(cursor);
+            if (!in_range) break;
+            CursorAdvance(cursor);
+        }
+        CursorClose(cursor);
+    } else {
+        // rows come out in id order like a scan would give them. The index and the table are read from one snapshot, so
+        // every id the index gives is in the table.
+        const char* value = RowColumnValue(statement->filter, statement->column);
+        std::vector<uint32_t> ids = IndexLookup(index, IndexKey(value, strlen(value)), snapshot);
+        std::sort(ids.begin(), ids.end());
+        for (uint32_t i = 0; i < ids.size() && num_rows < max_rows; ++i) {
+            if (ids[i] < statement->range_low || ids[i] > statement->range_high) continue;
+            Cursor* cursor = TableFind(table, ids[i], CURSOR_READ, snapshot);
+            void* node = CursorLeaf(cursor);
+            if (cursor->cell_num < *LeafNodeNumCells(node) && *LeafNodeKey(node, cursor->cell_num) == ids[i]) {
+                ViewRow(LeafNodeValue(node, cursor->cell_num), &row);
+                if (RowMatchesFilter(statement, row)) emit(row);
+            }
+            CursorUnpinLeaf(cursor);
+            CursorClose(cursor);
+        }
+    }
+    if (statement->output == SELECT_AGGREGATE) WriteAggregate(output, statement, aggregate);
+    WriterFlush(output);
+
+    return EXECUTE_SUCCESS;
+}
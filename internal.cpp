@@ -6,11 +6,6 @@ void LitDatabase::InitializeInternalNode(void* node) {
     *InternalNodeNumKeys(node) = 0;
 }
 
-void LitDatabase::UpdateInternalNodeKey(void* node, uint32_t old_key, uint32_t new_key) {
-    uint32_t old_child_index = InternalNodeFindChild(node, old_key);
-    *InternalNodeKey(node, old_child_index) = new_key;
-}
-
 uint32_t* LitDatabase::InternalNodeNumKeys(void* node) {
     return static_cast<uint32_t*>(
         static_cast<void*>(static_cast<unsigned char*>(node) + INTERNAL_NODE_NUM_KEYS_OFFSET));
@@ -19,10 +14,6 @@ uint32_t* LitDatabase::InternalNodeRightChild(void* node) {
     return static_cast<uint32_t*>(
         static_cast<void*>(static_cast<unsigned char*>(node) + INTERNAL_NODE_RIGHT_CHILD_OFFSET));
 }
-uint32_t* LitDatabase::InternalNodeCell(void* node, uint32_t cell_num) {
-    return static_cast<uint32_t*>(static_cast<void*>(static_cast<unsigned char*>(node) + INTERNAL_NODE_HEADER_SIZE +
-                                                     cell_num * INTERNAL_NODE_CELL_SIZE));
-}
 uint32_t* LitDatabase::InternalNodeChild(void* node, uint32_t child_num) {
     uint32_t num_keys = *InternalNodeNumKeys(node);
     if (child_num > num_keys) {
@@ -31,77 +22,368 @@ uint32_t* LitDatabase::InternalNodeChild(void* node, uint32_t child_num) {
     } else if (child_num == num_keys) {
         return InternalNodeRightChild(node);
     } else {
-        return InternalNodeCell(node, child_num);
+        return static_cast<uint32_t*>(static_cast<void*>(static_cast<unsigned char*>(node) +
+                                                         INTERNAL_NODE_CHILDREN_OFFSET +
+                                                         child_num * INTERNAL_NODE_CHILD_SIZE));
     }
 }
 uint32_t* LitDatabase::InternalNodeKey(void* node, uint32_t key_num) {
-    return static_cast<uint32_t*>(static_cast<void*>(
-        static_cast<unsigned char*>(static_cast<void*>(InternalNodeCell(node, key_num))) + INTERNAL_NODE_CHILD_SIZE));
+    return static_cast<uint32_t*>(static_cast<void*>(static_cast<unsigned char*>(node) + INTERNAL_NODE_KEYS_OFFSET +
+                                                     key_num * INTERNAL_NODE_KEY_SIZE));
 }
 
-uint32_t LitDatabase::InternalNodeFindChild(void* node, uint32_t key) {
+// rows in the subtree under the child, the right child's count is kept in the header next to it
+uint32_t* LitDatabase::InternalNodeCount(void* node, uint32_t child_num) {
     uint32_t num_keys = *InternalNodeNumKeys(node);
-
-    // binary search
-    uint32_t min_index = 0;
-    uint32_t max_index = num_keys;
-    while (min_index != max_index) {
-        uint32_t index = (min_index + max_index) / 2;
-        uint32_t key_to_right = *InternalNodeKey(node, index);
-        if (key_to_right >= key) {
-            max_index = index;
-        } else {
-            min_index = index + 1;
-        }
+    if (child_num > num_keys) {
+        std::cout << "try to access unvalid child_num" << std::endl;
+        exit(EXIT_FAILURE);
+    } else if (child_num == num_keys) {
+        return static_cast<uint32_t*>(
+            static_cast<void*>(static_cast<unsigned char*>(node) + INTERNAL_NODE_RIGHT_COUNT_OFFSET));
+    } else {
+        return static_cast<uint32_t*>(static_cast<void*>(static_cast<unsigned char*>(node) +
+                                                         INTERNAL_NODE_COUNTS_OFFSET +
+                                                         child_num * INTERNAL_NODE_COUNT_SIZE));
     }
-
-    return min_index;
 }
 
-Cursor* LitDatabase::InternalNodeFind(Table* table, uint32_t page_num, uint32_t key) {
-    void* node = GetPage(table->pager, page_num);
-    uint32_t child_index = InternalNodeFindChild(node, key);
-    uint32_t child_num = *InternalNodeChild(node, child_index);
-    void* child = GetPage(table->pager, child_num);
-    switch (get_node_type(child)) {
-        case NODE_LEAF: return LeafNodeFind(table, child_num, key);
-        case NODE_INTERNAL: return InternalNodeFind(table, child_num, key);
+// rows in the subtree under the node
+uint32_t LitDatabase::NodeNumRows(void* node) {
+    if (get_node_type(node) == NODE_LEAF) {
+        return *LeafNodeNumCells(node);
     }
+    uint32_t num_rows = 0;
+    for (uint32_t i = 0; i <= *InternalNodeNumKeys(node); ++i) {
+        num_rows += __atomic_load_n(InternalNodeCount(node, i), __ATOMIC_RELAXED);
+    }
+    return num_rows;
+}
+
+uint32_t LitDatabase::InternalNodeFindChild(void* node, uint32_t key) {
+    return KeyLowerBound(InternalNodeKey(node, 0), *InternalNodeNumKeys(node), key);
 }
 
-void LitDatabase::InternalNodeInsert(Table* table, uint32_t parent_page_num, uint32_t child_page_num) {
-    void* parent = GetPage(table->pager, parent_page_num);
-    void* child = GetPage(table->pager, child_page_num);
-    uint32_t child_max_key = GetNodeMaxKey(child);
-    uint32_t index = InternalNodeFindChild(parent, child_max_key);
+// move count keys and the children before them with their row counts, the right child is not touched
+void LitDatabase::InternalNodeMoveCells(void* destination, uint32_t destination_num, void* source, uint32_t source_num,
+                                        uint32_t count) {
+    unsigned char* destination_bytes = static_cast<unsigned char*>(destination);
+    unsigned char* source_bytes = static_cast<unsigned char*>(source);
+    memmove(destination_bytes + INTERNAL_NODE_KEYS_OFFSET + destination_num * INTERNAL_NODE_KEY_SIZE,
+            source_bytes + INTERNAL_NODE_KEYS_OFFSET + source_num * INTERNAL_NODE_KEY_SIZE,
+            count * INTERNAL_NODE_KEY_SIZE);
+    memmove(destination_bytes + INTERNAL_NODE_CHILDREN_OFFSET + destination_num * INTERNAL_NODE_CHILD_SIZE,
+            source_bytes + INTERNAL_NODE_CHILDREN_OFFSET + source_num * INTERNAL_NODE_CHILD_SIZE,
+            count * INTERNAL_NODE_CHILD_SIZE);
+    memmove(destination_bytes + INTERNAL_NODE_COUNTS_OFFSET + destination_num * INTERNAL_NODE_COUNT_SIZE,
+            source_bytes + INTERNAL_NODE_COUNTS_OFFSET + source_num * INTERNAL_NODE_COUNT_SIZE,
+            count * INTERNAL_NODE_COUNT_SIZE);
+}
 
+// the child was split off the right of the left node and goes in right after it. Children are placed by page
+// number rather than by key so that runs of equal keys, which secondary indexes have, keep their order. The left
+// node is keyed by left_max_key from now on, the splitting node passes it up so no one looks below the parent. It
+// passes up the row counts of both halves as well, they replace the count the left node had. appending is set when
+// the child is a new last leaf that an append split off, or a node split off above one.
+void LitDatabase::InternalNodeInsert(Table* table, uint32_t parent_page_num, uint32_t left_page_num,
+                                     uint32_t left_max_key, uint32_t left_rows, uint32_t child_page_num,
+                                     uint32_t child_rows, bool appending) {
+    Pager* pager = table->pager;
+    void* parent = GetPage(pager, parent_page_num);
     uint32_t original_num_keys = *InternalNodeNumKeys(parent);
-    *InternalNodeNumKeys(parent) = original_num_keys + 1;
-
     if (original_num_keys >= INTERNAL_NODE_MAX_CELLS) {
-        std::cout << "Need to implement splitting internal node" << std::endl;
-        exit(EXIT_FAILURE);
+        UnpinPage(pager, parent_page_num);
+        InternalNodeSplitAndInsert(table, parent_page_num, left_page_num, left_max_key, left_rows, child_page_num,
+                                   child_rows, appending);
+        return;
     }
 
-    uint32_t right_child_page_num = *InternalNodeRightChild(parent);
-    void* right_child = GetPage(table->pager, right_child_page_num);
-    if (child_max_key > GetNodeMaxKey(right_child)) {
-        // replace right child
-        *InternalNodeChild(parent, original_num_keys) = right_child_page_num;
-        *InternalNodeKey(parent, original_num_keys) = GetNodeMaxKey(right_child);
+    uint32_t index = InternalNodeChildIndex(parent, left_page_num);
+    *InternalNodeNumKeys(parent) = original_num_keys + 1;
+    MarkPageDirty(pager, parent_page_num);
+    if (index == original_num_keys) {
+        // the left node was the right child, it gets a key and the new child becomes the right child
+        *InternalNodeChild(parent, index) = left_page_num;
         *InternalNodeRightChild(parent) = child_page_num;
     } else {
-        // make room for the new cell
-        for (uint32_t i = original_num_keys; i > index; --i) {
-            void* destination = InternalNodeCell(parent, i);
-            void* source = InternalNodeCell(parent, i - 1);
-            memcpy(destination, source, INTERNAL_NODE_CELL_SIZE);
-        }
-        *InternalNodeChild(parent, index) = child_page_num;
-        *InternalNodeKey(parent, index) = child_max_key;
+        // the new child takes over the left node's key, the left node is keyed by its new max
+        InternalNodeMoveCells(parent, index + 2, parent, index + 1, original_num_keys - index - 1);
+        *InternalNodeChild(parent, index + 1) = child_page_num;
+        *InternalNodeKey(parent, index + 1) = *InternalNodeKey(parent, index);
+    }
+    *InternalNodeKey(parent, index) = left_max_key;
+    *InternalNodeCount(parent, index) = left_rows;
+    *InternalNodeCount(parent, index + 1) = child_rows;
+
+    UnpinPage(pager, parent_page_num);
+}
+
+// split a full internal node in half and insert the new child after the left node, the split moves up to the parent.
+// A node on the right edge of the tree that gains a new last child from an append keeps all but its last child and
+// the new one, like the leaf did.
+void LitDatabase::InternalNodeSplitAndInsert(Table* table, uint32_t old_page_num, uint32_t left_page_num,
+                                             uint32_t left_max_key, uint32_t left_rows, uint32_t child_page_num,
+                                             uint32_t child_rows, bool appending) {
+    Pager* pager = table->pager;
+    void* old_node = GetPage(pager, old_page_num);
+
+    // line up all the children with their keys, the right child has none, then add the new child after the left node
+    uint32_t num_keys = *InternalNodeNumKeys(old_node);
+    std::vector<uint32_t> children, keys, counts;
+    for (uint32_t i = 0; i <= num_keys; ++i) {
+        children.push_back(*InternalNodeChild(old_node, i));
+        keys.push_back(i < num_keys ? *InternalNodeKey(old_node, i) : 0);
+        counts.push_back(*InternalNodeCount(old_node, i));
+    }
+    uint32_t index = std::find(children.begin(), children.end(), left_page_num) - children.begin();
+    children.insert(children.begin() + index + 1, child_page_num);
+    keys.insert(keys.begin() + index + 1, keys[index]);
+    keys[index] = left_max_key;
+    counts.insert(counts.begin() + index + 1, child_rows);
+    counts[index] = left_rows;
+
+    appending = appending && index + 2 == children.size();
+    uint32_t left_count = appending ? children.size() - 2 : children.size() / 2;
+    uint32_t right_count = children.size() - left_count;
+
+    uint32_t new_page_num = GetUnusedPageNum(pager);
+    void* new_node = GetPage(pager, new_page_num);
+    InitializeInternalNode(new_node);
+    pager->counters.internal_splits.fetch_add(1, std::memory_order_relaxed);
+
+    uint32_t old_rows = 0;
+    uint32_t new_rows = 0;
+    *InternalNodeNumKeys(old_node) = left_count - 1;
+    for (uint32_t i = 0; i < left_count; ++i) {
+        *InternalNodeChild(old_node, i) = children[i];
+        if (i + 1 < left_count) *InternalNodeKey(old_node, i) = keys[i];
+        *InternalNodeCount(old_node, i) = counts[i];
+        old_rows += counts[i];
+    }
+
+    *InternalNodeNumKeys(new_node) = right_count - 1;
+    for (uint32_t i = 0; i < right_count; ++i) {
+        *InternalNodeChild(new_node, i) = children[left_count + i];
+        if (i + 1 < right_count) *InternalNodeKey(new_node, i) = keys[left_count + i];
+        *InternalNodeCount(new_node, i) = counts[left_count + i];
+        new_rows += counts[left_count + i];
+    }
+
+    MarkPageDirty(pager, old_page_num);
+    MarkPageDirty(pager, new_page_num);
+
+    // fix up the parent pointers of everything that moved
+    for (uint32_t i = 0; i < children.size(); ++i) {
+        uint32_t parent_page_num = i < left_count ? old_page_num : new_page_num;
+        if (parent_page_num == old_page_num && children[i] != child_page_num) continue;
+        SetNodeParent(pager, children[i], parent_page_num);
+    }
+
+    bool old_is_root = is_node_root(old_node);
+    uint32_t parent_page_num = *NodeParent(old_node);
+    *NodeParent(new_node) = parent_page_num;
+    UnpinPage(pager, new_page_num);
+    UnpinPage(pager, old_page_num);
+
+    // the key of the old node's last child bounds everything left in it
+    uint32_t old_max_key = keys[left_count - 1];
+    if (old_is_root) {
+        CreateNewRoot(table, new_page_num, old_max_key, old_rows, new_rows);
+    } else {
+        InternalNodeInsert(table, parent_page_num, old_page_num, old_max_key, old_rows, new_page_num, new_rows,
+                           appending);
     }
 }
 
 uint32_t* LitDatabase::NodeParent(void* node) {
     return static_cast<uint32_t*>(static_cast<void*>(static_cast<unsigned char*>(node) + PARENT_POINTER_OFFSET));
-}
\ No newline at end of file
+}
+
+// the node may be latched by a reader, which does not look at the pointer but read-ahead may
+void LitDatabase::SetNodeParent(Pager* pager, uint32_t page_num, uint32_t parent_page_num) {
+    void* node = GetPage(pager, page_num);
+    __atomic_store_n(NodeParent(node), parent_page_num, __ATOMIC_RELAXED);
+    MarkPageDirty(pager, page_num);
+    UnpinPage(pager, page_num);
+}
+
+uint32_t LitDatabase::InternalNodeChildIndex(void* node, uint32_t child_page_num) {
+    uint32_t num_keys = *InternalNodeNumKeys(node);
+    for (uint32_t i = 0; i < num_keys; ++i) {
+        if (*InternalNodeChild(node, i) == child_page_num) return i;
+    }
+    return num_keys;
+}
+
+// drop key key_num and the child after it, the child before it takes over the dropped child's slot and rows. Only
+// a merge drops a child, the rows of the dropped child are in the child before it by then.
+void LitDatabase::InternalNodeRemove(void* node, uint32_t key_num) {
+    uint32_t num_keys = *InternalNodeNumKeys(node);
+    *InternalNodeChild(node, key_num + 1) = *InternalNodeChild(node, key_num);
+    *InternalNodeCount(node, key_num + 1) += *InternalNodeCount(node, key_num);
+    InternalNodeMoveCells(node, key_num, node, key_num + 1, num_keys - key_num - 1);
+    *InternalNodeNumKeys(node) = num_keys - 1;
+}
+
+// restore the minimum fill of a node after a delete. The node merges with a sibling when both fit in one
+// page, otherwise it borrows one entry. A merge removes a key from the parent, which may underflow in turn.
+void LitDatabase::NodeRebalance(Table* table, uint32_t page_num) {
+    Pager* pager = table->pager;
+    void* node = GetPage(pager, page_num);
+    bool is_leaf = get_node_type(node) == NODE_LEAF;
+    uint32_t count = is_leaf ? LeafNodeUsedSpace(node) : *InternalNodeNumKeys(node);
+    bool is_root = is_node_root(node);
+    uint32_t parent_page_num = *NodeParent(node);
+    UnpinPage(pager, page_num);
+
+    if (is_root) {
+        if (!is_leaf && count == 0) CollapseRoot(table);
+        return;
+    }
+    if (count >= (is_leaf ? LEAF_NODE_MIN_BYTES : INTERNAL_NODE_MIN_KEYS)) return;
+
+    void* parent = GetPage(pager, parent_page_num);
+    uint32_t parent_num_keys = *InternalNodeNumKeys(parent);
+    if (parent_num_keys == 0) {
+        // an only child has no sibling to take from, the parent gets siblings or collapses into the root first
+        bool parent_is_root = is_node_root(parent);
+        UnpinPage(pager, parent_page_num);
+        if (parent_is_root) {
+            CollapseRoot(table);
+        } else {
+            NodeRebalance(table, parent_page_num);
+            NodeRebalance(table, page_num);
+        }
+        return;
+    }
+
+    // work on the node and its left sibling, or its right sibling for the first child
+    uint32_t index = InternalNodeChildIndex(parent, page_num);
+    uint32_t left_index = index > 0 ? index - 1 : 0;
+    uint32_t separator = *InternalNodeKey(parent, left_index);
+    uint32_t left_page_num = *InternalNodeChild(parent, left_index);
+    uint32_t right_page_num = *InternalNodeChild(parent, left_index + 1);
+    void* left = GetPage(pager, left_page_num);
+    void* right = GetPage(pager, right_page_num);
+    MarkPageDirty(pager, parent_page_num);
+    MarkPageDirty(pager, left_page_num);
+    MarkPageDirty(pager, right_page_num);
+
+    bool merged = false;
+    if (is_leaf) {
+        uint32_t left_used = LeafNodeUsedSpace(left);
+        uint32_t right_used = LeafNodeUsedSpace(right);
+        if (left_used + right_used <= LEAF_NODE_SPACE_FOR_CELLS) {
+            uint32_t right_cells = *LeafNodeNumCells(right);
+            for (uint32_t i = 0; i < right_cells; ++i) {
+                LeafNodeCopyCell(left, *LeafNodeNumCells(left), right, i);
+            }
+            *LeafNodeNextLeaf(left) = *LeafNodeNextLeaf(right);
+            merged = true;
+        } else {
+            // move cells from the fuller sibling, always one and more while the pair gets closer to even in bytes
+            bool from_right = left_used < right_used;
+            void* giver = from_right ? right : left;
+            void* taker = from_right ? left : right;
+            uint32_t gap = from_right ? right_used - left_used : left_used - right_used;
+            for (bool first = true;; first = false) {
+                uint32_t giver_cell = from_right ? 0 : *LeafNodeNumCells(left) - 1;
+                uint32_t cell_bytes = LEAF_NODE_CELL_SIZE + *LeafNodeRecordLength(giver, giver_cell);
+                if (!first && 2 * cell_bytes > gap) break;
+                LeafNodeCopyCell(taker, from_right ? *LeafNodeNumCells(left) : 0, giver, giver_cell);
+                LeafNodeRemoveCell(giver, giver_cell);
+                if (2 * cell_bytes >= gap) break;
+                gap -= 2 * cell_bytes;
+            }
+        }
+        if (!merged) {
+            *InternalNodeKey(parent, left_index) = *LeafNodeKey(left, *LeafNodeNumCells(left) - 1);
+            *InternalNodeCount(parent, left_index) = *LeafNodeNumCells(left);
+            *InternalNodeCount(parent, left_index + 1) = *LeafNodeNumCells(right);
+        }
+    } else {
+        uint32_t left_keys = *InternalNodeNumKeys(left);
+        uint32_t right_keys = *InternalNodeNumKeys(right);
+        if (left_keys + 1 + right_keys <= INTERNAL_NODE_MAX_CELLS) {
+            // the old right child of the left node is keyed by the separator, the right node's cells follow
+            uint32_t left_right_rows = *InternalNodeCount(left, left_keys);
+            *InternalNodeNumKeys(left) = left_keys + 1 + right_keys;
+            *InternalNodeChild(left, left_keys) = *InternalNodeRightChild(left);
+            *InternalNodeKey(left, left_keys) = separator;
+            *InternalNodeCount(left, left_keys) = left_right_rows;
+            InternalNodeMoveCells(left, left_keys + 1, right, 0, right_keys);
+            *InternalNodeRightChild(left) = *InternalNodeRightChild(right);
+            *InternalNodeCount(left, left_keys + 1 + right_keys) = *InternalNodeCount(right, right_keys);
+            for (uint32_t i = 0; i <= right_keys; ++i) {
+                SetNodeParent(pager, *InternalNodeChild(right, i), left_page_num);
+            }
+            merged = true;
+        } else if (left_keys < right_keys) {
+            // rotate the first child of the right node through the parent
+            uint32_t moved_page_num = *InternalNodeChild(right, 0);
+            uint32_t moved_rows = *InternalNodeCount(right, 0);
+            uint32_t left_right_rows = *InternalNodeCount(left, left_keys);
+            *InternalNodeNumKeys(left) = left_keys + 1;
+            *InternalNodeChild(left, left_keys) = *InternalNodeRightChild(left);
+            *InternalNodeKey(left, left_keys) = separator;
+            *InternalNodeCount(left, left_keys) = left_right_rows;
+            *InternalNodeRightChild(left) = moved_page_num;
+            *InternalNodeCount(left, left_keys + 1) = moved_rows;
+            *InternalNodeKey(parent, left_index) = *InternalNodeKey(right, 0);
+            *InternalNodeCount(parent, left_index) += moved_rows;
+            *InternalNodeCount(parent, left_index + 1) -= moved_rows;
+            InternalNodeMoveCells(right, 0, right, 1, right_keys - 1);
+            *InternalNodeNumKeys(right) = right_keys - 1;
+            SetNodeParent(pager, moved_page_num, left_page_num);
+        } else {
+            // rotate the right child of the left node through the parent
+            uint32_t moved_page_num = *InternalNodeRightChild(left);
+            uint32_t moved_rows = *InternalNodeCount(left, left_keys);
+            InternalNodeMoveCells(right, 1, right, 0, right_keys);
+            *InternalNodeNumKeys(right) = right_keys + 1;
+            *InternalNodeChild(right, 0) = moved_page_num;
+            *InternalNodeKey(right, 0) = separator;
+            *InternalNodeCount(right, 0) = moved_rows;
+            *InternalNodeRightChild(left) = *InternalNodeChild(left, left_keys - 1);
+            uint32_t last_rows = *InternalNodeCount(left, left_keys - 1);
+            *InternalNodeKey(parent, left_index) = *InternalNodeKey(left, left_keys - 1);
+            *InternalNodeCount(parent, left_index) -= moved_rows;
+            *InternalNodeCount(parent, left_index + 1) += moved_rows;
+            *InternalNodeNumKeys(left) = left_keys - 1;
+            *InternalNodeCount(left, left_keys - 1) = last_rows;
+            SetNodeParent(pager, moved_page_num, right_page_num);
+        }
+    }
+    UnpinPage(pager, right_page_num);
+    UnpinPage(pager, left_page_num);
+
+    if (merged) {
+        InternalNodeRemove(parent, left_index);
+        UnpinPage(pager, parent_page_num);
+        FreePage(pager, right_page_num);
+        NodeRebalance(table, parent_page_num);
+    } else {
+        UnpinPage(pager, parent_page_num);
+    }
+}
+
+// a root left with a single child absorbs it, the tree gets one level shorter
+void LitDatabase::CollapseRoot(Table* table) {
+    Pager* pager = table->pager;
+    void* root = GetPage(pager, table->root_page_num);
+    uint32_t child_page_num = *InternalNodeRightChild(root);
+    void* child = GetPage(pager, child_page_num);
+
+    memcpy(root, child, PAGE_SIZE);
+    set_node_root(root, true);
+    MarkPageDirty(pager, table->root_page_num);
+    UnpinPage(pager, child_page_num);
+
+    if (get_node_type(root) == NODE_INTERNAL) {
+        for (uint32_t i = 0; i <= *InternalNodeNumKeys(root); ++i) {
+            SetNodeParent(pager, *InternalNodeChild(root, i), table->root_page_num);
+        }
+    }
+    UnpinPage(pager, table->root_page_num);
+    FreePage(pager, child_page_num);
+}
@@ -0,0 +1,59 @@
+#include "LitDatabase.h"
+
+// Page latches. A latch protects the contents of one page against other threads, the pager mutex only protects the
+// frame holding it. Descents latch a node before letting go of its parent, so a node is never reached through a
+// pointer that a concurrent change has made stale. Writers that stay inside one leaf keep their path latched shared
+// and the leaf exclusive. A split keeps the path shared down to the last node with room for a key and latches that
+// node and the full ones below it exclusive, all it changes. The parent pointer of a node is written by a thread
+// holding the parent exclusive and read by one holding the parent too, or atomically by read-ahead, which only takes
+// it as a hint. Merges and borrows change siblings that no descent holds, and a split of the root changes the depth
+// of the tree, they run alone under the tree latch instead.
+
+pthread_rwlock_t* LitDatabase::PageLatch(Pager* pager, uint32_t page_num) {
+    std::atomic<pthread_rwlock_t*>& chunk = pager->latch_chunks[page_num / LATCH_CHUNK_PAGES];
+    pthread_rwlock_t* latches = chunk.load(std::memory_order_acquire);
+    if (latches == nullptr) {
+        pthread_mutex_lock(&pager->mutex);
+        latches = chunk.load(std::memory_order_relaxed);
+        if (latches == nullptr) {
+            latches = static_cast<pthread_rwlock_t*>(malloc(LATCH_CHUNK_PAGES * sizeof(pthread_rwlock_t)));
+            for (uint32_t i = 0; i < LATCH_CHUNK_PAGES; ++i) {
+                InitLatch(&latches[i]);
+            }
+            chunk.store(latches, std::memory_order_release);
+        }
+        pthread_mutex_unlock(&pager->mutex);
+    }
+    return &latches[page_num % LATCH_CHUNK_PAGES];
+}
+
+void LitDatabase::LatchPage(Pager* pager, uint32_t page_num, LatchMode mode) {
+    pthread_rwlock_t* latch = PageLatch(pager, page_num);
+    if (mode == LATCH_SHARED) {
+        pthread_rwlock_rdlock(latch);
+    } else {
+        pthread_rwlock_wrlock(latch);
+    }
+}
+
+void LitDatabase::UnlatchPage(Pager* pager, uint32_t page_num) { pthread_rwlock_unlock(PageLatch(pager, page_num)); }
+
+// let go of everything the cursor holds and free it
+void LitDatabase::CursorClose(Cursor* cursor) {
+    Pager* pager = cursor->table->pager;
+    if (cursor->snapshot) {
+        free(cursor->copy);
+        free(cursor);
+        return;
+    }
+    // the nodes the split changed are still latched, whoever latches them next sees the change counted
+    if (cursor->mode == CURSOR_SPLIT) TableShapeChanged(cursor->table);
+    if (cursor->mode != CURSOR_EXCLUSIVE) {
+        UnlatchPage(pager, cursor->page_num);
+        for (uint32_t i = 0; i < cursor->num_ancestors; ++i) {
+            UnlatchPage(pager, cursor->ancestors[i]);
+        }
+    }
+    pthread_rwlock_unlock(&cursor->table->tree_latch);
+    free(cursor);
+}
@@ -0,0 +1,152 @@
+#include "LitDatabase.h"
+
+// Statement latencies. Every statement is timed from the moment ExecuteStatement gets it until it returns, its commit
+// included, and counted in the histogram of its class in the pager. A histogram is an array of atomic counters over
+// buckets that grow with the value, in the manner of HdrHistogram: one bucket per nanosecond below 32, and 32 buckets
+// of equal width in every power of two above, so any value lands in a bucket at most 1/32 wider than itself.
+// Recording a value is a bucket index from the position of its top bit and a few relaxed adds, cheap enough to do
+// for every statement. .latency prints the histograms as JSON, with their percentiles.
+//
+// .timer on has the shell print how long each statement spent being parsed, executed and written out, with the
+// descents into the tree and the page reads it made. Those are read off the pager counters, which all sessions and
+// the prefetcher add to, so they only add up to the statement's own work when nothing else is running.
+
+namespace {
+
+const char* const LATENCY_CLASS_NAMES[LATENCY_CLASS_COUNT] = {"insert", "point_select", "select", "scan", "other"};
+
+uint32_t LatencyBucket(uint64_t nanoseconds) {
+    if (nanoseconds < LATENCY_SUB_BUCKETS) return nanoseconds;
+    uint32_t top_bit = 63 - __builtin_clzll(nanoseconds);
+    uint32_t shift = top_bit - LATENCY_SUB_BUCKET_BITS;
+    return (shift + 1) * LATENCY_SUB_BUCKETS + (nanoseconds >> shift) - LATENCY_SUB_BUCKETS;
+}
+
+// the largest value that lands in the bucket
+uint64_t LatencyBucketHigh(uint32_t bucket) {
+    if (bucket < LATENCY_SUB_BUCKETS) return bucket;
+    uint32_t shift = bucket / LATENCY_SUB_BUCKETS - 1;
+    uint64_t sub_bucket = bucket % LATENCY_SUB_BUCKETS + LATENCY_SUB_BUCKETS;
+    // wraps to UINT64_MAX for the last bucket
+    return ((sub_bucket + 1) << shift) - 1;
+}
+
+// the high end of the bucket holding the value at the quantile, no more than the largest value seen
+uint64_t LatencyPercentile(const std::vector<uint64_t>& counts, uint64_t total, double quantile, uint64_t max) {
+    uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(quantile * total + 0.999999));
+    uint64_t seen = 0;
+    for (uint32_t bucket = 0; bucket < LATENCY_BUCKETS; ++bucket) {
+        seen += counts[bucket];
+        if (seen >= rank) return std::min(LatencyBucketHigh(bucket), max);
+    }
+    return max;
+}
+
+double Milliseconds(uint64_t nanoseconds) { return nanoseconds / 1e6; }
+
+}  // namespace
+
+LatencyClass LitDatabase::StatementLatencyClass(const Statement* statement) {
+    switch (statement->type) {
+        case STATEMENT_INSERT: return LATENCY_INSERT;
+        case STATEMENT_SELECT:
+            if (!statement->ids.empty() || statement->filter_by_column) return LATENCY_SELECT;
+            return statement->range_low == statement->range_high ? LATENCY_POINT_SELECT : LATENCY_SCAN;
+        default: return LATENCY_OTHER;
+    }
+}
+
+void LitDatabase::LatencyRecord(LatencyHistogram* histogram, uint64_t nanoseconds) {
+    histogram->buckets[LatencyBucket(nanoseconds)].fetch_add(1, std::memory_order_relaxed);
+    histogram->count.fetch_add(1, std::memory_order_relaxed);
+    histogram->total_nanoseconds.fetch_add(nanoseconds, std::memory_order_relaxed);
+    uint64_t max = histogram->max_nanoseconds.load(std::memory_order_relaxed);
+    while (nanoseconds > max &&
+           !histogram->max_nanoseconds.compare_exchange_weak(max, nanoseconds, std::memory_order_relaxed)) {
+    }
+}
+
+// one object per statement class: count, mean, max and percentiles in nanoseconds, and the buckets with any value
+// in them as [high end, count] pairs. Statements recorded while it is read may be in some fields and not others.
+std::string LitDatabase::LatencyJson(Pager* pager) {
+    std::string json = "{";
+    char number[64];
+    std::vector<uint64_t> counts(LATENCY_BUCKETS);
+    for (uint32_t i = 0; i < LATENCY_CLASS_COUNT; ++i) {
+        LatencyHistogram& histogram = pager->latencies[i];
+        uint64_t total = 0;
+        for (uint32_t bucket = 0; bucket < LATENCY_BUCKETS; ++bucket) {
+            counts[bucket] = histogram.buckets[bucket].load(std::memory_order_relaxed);
+            total += counts[bucket];
+        }
+        uint64_t max = histogram.max_nanoseconds.load(std::memory_order_relaxed);
+        uint64_t sum = histogram.total_nanoseconds.load(std::memory_order_relaxed);
+
+        json += i == 0 ? "\n  \"" : ",\n  \"";
+        json += LATENCY_CLASS_NAMES[i];
+        snprintf(number, sizeof(number), "\": {\"count\": %" PRIu64 ", \"mean_ns\": %" PRIu64, total,
+                 total > 0 ? sum / total : 0);
+        json += number;
+        snprintf(number, sizeof(number), ", \"max_ns\": %" PRIu64, max);
+        json += number;
+        const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+        const char* const quantile_names[] = {"p50_ns", "p90_ns", "p99_ns", "p999_ns"};
+        for (uint32_t q = 0; q < 4; ++q) {
+            uint64_t value = total > 0 ? LatencyPercentile(counts, total, quantiles[q], max) : 0;
+            snprintf(number, sizeof(number), ", \"%s\": %" PRIu64, quantile_names[q], value);
+            json += number;
+        }
+        json += ", \"buckets\": [";
+        bool first = true;
+        for (uint32_t bucket = 0; bucket < LATENCY_BUCKETS; ++bucket) {
+            if (counts[bucket] == 0) continue;
+            snprintf(number, sizeof(number), "%s[%" PRIu64 ", %" PRIu64 "]", first ? "" : ", ",
+                     LatencyBucketHigh(bucket), counts[bucket]);
+            json += number;
+            first = false;
+        }
+        json += "]}";
+    }
+    json += "\n}\n";
+    return json;
+}
+
+// the counters are kept as they are at the start, TimerFinish turns them into what the statement added
+void LitDatabase::TimerStart(Session* session, Pager* pager) {
+    StatementTimer& timer = session->timer;
+    timer = StatementTimer();
+    timer.descents = pager->counters.descents.load(std::memory_order_relaxed);
+    timer.descent_levels = pager->counters.descent_levels.load(std::memory_order_relaxed);
+    timer.pages = pager->counters.page_hits.load(std::memory_order_relaxed) +
+                  pager->counters.page_misses.load(std::memory_order_relaxed) +
+                  pager->counters.snapshot_reads.load(std::memory_order_relaxed);
+    session->writer.write_nanoseconds = 0;
+    timer.start = NowNanoseconds();
+}
+
+void LitDatabase::TimerParsed(Session* session) {
+    StatementTimer& timer = session->timer;
+    uint64_t now = NowNanoseconds();
+    timer.parse_nanoseconds = now - timer.start;
+    timer.start = now;
+}
+
+void LitDatabase::TimerFinish(Session* session, Pager* pager) {
+    StatementTimer& timer = session->timer;
+    uint64_t elapsed = NowNanoseconds() - timer.start;
+    timer.output_nanoseconds = std::min(session->writer.write_nanoseconds, elapsed);
+    timer.execute_nanoseconds = elapsed - timer.output_nanoseconds;
+    timer.descents = pager->counters.descents.load(std::memory_order_relaxed) - timer.descents;
+    timer.descent_levels = pager->counters.descent_levels.load(std::memory_order_relaxed) - timer.descent_levels;
+    timer.pages = pager->counters.page_hits.load(std::memory_order_relaxed) +
+                  pager->counters.page_misses.load(std::memory_order_relaxed) +
+                  pager->counters.snapshot_reads.load(std::memory_order_relaxed) - timer.pages;
+}
+
+void LitDatabase::PrintTimer(const StatementTimer& timer) {
+    printf("Timer: parse %.3f ms, execute %.3f ms, output %.3f ms, %" PRIu64 " descents of %.1f levels, %" PRIu64
+           " page reads\n",
+           Milliseconds(timer.parse_nanoseconds), Milliseconds(timer.execute_nanoseconds),
+           Milliseconds(timer.output_nanoseconds), timer.descents,
+           timer.descents > 0 ? static_cast<double>(timer.descent_levels) / timer.descents : 0.0, timer.pages);
+}
@@ -5,53 +5,74 @@ void LitDatabase::InitializeLeafNode(void* node) {
     set_node_root(node, false);
     *LeafNodeNumCells(node) = 0;
     *LeafNodeNextLeaf(node) = 0;
+    *LeafNodeHeapStart(node) = PAGE_SIZE;
+    *LeafNodeFragmented(node) = 0;
 }
 
 void LitDatabase::LeafNodeSplitAndInsert(Cursor* cursor, uint32_t key, const Row& value) {
     void* old_node = GetPage(cursor->table->pager, cursor->page_num);
-    uint32_t old_max = GetNodeMaxKey(old_node);
     uint32_t new_page_num = GetUnusedPageNum(cursor->table->pager);
     void* new_node = GetPage(cursor->table->pager, new_page_num);
     InitializeLeafNode(new_node);
+    cursor->table->pager->counters.leaf_splits.fetch_add(1, std::memory_order_relaxed);
     *NodeParent(new_node) = *NodeParent(old_node);
+    // a key past the end of the last leaf is an append, likely one of a run of increasing ids. The old leaf then
+    // keeps all of its cells and the new one starts with just the new cell, so the run leaves full leaves behind
+    // rather than half full ones that no key will ever land in again.
+    bool appending = cursor->cell_num == *LeafNodeNumCells(old_node) && *LeafNodeNextLeaf(old_node) == 0;
     *LeafNodeNextLeaf(new_node) = *LeafNodeNextLeaf(old_node);
     *LeafNodeNextLeaf(old_node) = new_page_num;
 
-    for (int32_t i = LEAF_NODE_MAX_CELLS; i >= 0; --i) {
-        void* destination_node;
-        if (i >= LEAF_NODE_LEFT_SPLIT_COUNT) {
+    // otherwise the cells are split by bytes, not by count, so both halves hold about the same amount of data
+    unsigned char old_copy[PAGE_SIZE];
+    memcpy(old_copy, old_node, PAGE_SIZE);
+    uint32_t num_cells = *LeafNodeNumCells(old_copy);
+    uint32_t length = SerializedRowSize(value);
+    uint32_t total_bytes = LeafNodeUsedSpace(old_copy) + LEAF_NODE_CELL_SIZE + length;
+
+    *LeafNodeNumCells(old_node) = 0;
+    *LeafNodeHeapStart(old_node) = PAGE_SIZE;
+    *LeafNodeFragmented(old_node) = 0;
+    // free space is kept zeroed, it costs nothing to store in a compressed file
+    memset(static_cast<unsigned char*>(old_node) + LEAF_NODE_KEYS_OFFSET, 0, LEAF_NODE_SPACE_FOR_CELLS);
+    void* destination_node = old_node;
+    uint32_t left_bytes = 0;
+    for (uint32_t i = 0; i <= num_cells; ++i) {
+        // i walks the old cells with the new one placed at cursor->cell_num
+        bool is_new = i == cursor->cell_num;
+        uint32_t source_cell = i > cursor->cell_num ? i - 1 : i;
+        uint32_t cell_bytes = LEAF_NODE_CELL_SIZE + (is_new ? length : *LeafNodeRecordLength(old_copy, source_cell));
+        // the left half takes cells up to half of the bytes, both halves get at least one cell
+        if (destination_node == old_node && i > 0 &&
+            (i == num_cells || (!appending && left_bytes + cell_bytes / 2 > total_bytes / 2))) {
             destination_node = new_node;
-        } else {
-            destination_node = old_node;
         }
-        uint32_t index_within_node = i % LEAF_NODE_LEFT_SPLIT_COUNT;
-        void* destination = LeafNodeCell(destination_node, index_within_node);
-
-        if (i == cursor->cell_num) {
-            // SerializeRow(value, destination);
-            SerializeRow(value, LeafNodeValue(destination_node, index_within_node));
-            *LeafNodeKey(destination_node, index_within_node) = key;
-        } else if (i > cursor->cell_num) {
-            memcpy(destination, LeafNodeCell(old_node, i - 1), LEAF_NODE_CELL_SIZE);
+        if (destination_node == old_node) left_bytes += cell_bytes;
+
+        uint32_t destination_cell = *LeafNodeNumCells(destination_node);
+        if (is_new) {
+            SerializeRow(value, LeafNodeInsertCell(destination_node, destination_cell, key, length));
         } else {
-            memcpy(destination, LeafNodeCell(old_node, i), LEAF_NODE_CELL_SIZE);
+            LeafNodeCopyCell(destination_node, destination_cell, old_copy, source_cell);
         }
     }
 
-    *LeafNodeNumCells(old_node) = LEAF_NODE_LEFT_SPLIT_COUNT;
-    *LeafNodeNumCells(new_node) = LEAF_NODE_RIGHT_SPLIT_COUNT;
+    MarkPageDirty(cursor->table->pager, cursor->page_num);
+    MarkPageDirty(cursor->table->pager, new_page_num);
+
+    bool old_is_root = is_node_root(old_node);
+    uint32_t parent_page_num = *NodeParent(old_node);
+    uint32_t old_max_key = *LeafNodeKey(old_node, *LeafNodeNumCells(old_node) - 1);
+    uint32_t old_rows = *LeafNodeNumCells(old_node);
+    uint32_t new_rows = *LeafNodeNumCells(new_node);
+    UnpinPage(cursor->table->pager, new_page_num);
+    UnpinPage(cursor->table->pager, cursor->page_num);
 
-    if (is_node_root(old_node)) {
-        return CreateNewRoot(cursor->table, new_page_num);
+    if (old_is_root) {
+        return CreateNewRoot(cursor->table, new_page_num, old_max_key, old_rows, new_rows);
     } else {
-        // std::cout << "Need to implement updating parent after split" << std::endl;
-        // exit(EXIT_FAILURE);
-        uint32_t parent_page_num = *NodeParent(old_node);
-        uint32_t new_max = GetNodeMaxKey(old_node);
-        void* parent = GetPage(cursor->table->pager, parent_page_num);
-
-        UpdateInternalNodeKey(parent, old_max, new_max);
-        InternalNodeInsert(cursor->table, parent_page_num, new_page_num);
+        InternalNodeInsert(cursor->table, parent_page_num, cursor->page_num, old_max_key, old_rows, new_page_num,
+                           new_rows, appending);
         return;
     }
 }
@@ -60,67 +81,169 @@ uint32_t* LitDatabase::LeafNodeNextLeaf(void* node) {
     return static_cast<uint32_t*>(static_cast<void*>(static_cast<unsigned char*>(node) + LEAF_NODE_NEXT_LEAF_OFFSET));
 }
 
-Cursor* LitDatabase::LeafNodeFind(Table* table, uint32_t page_num, uint32_t key) {
-    void* node = GetPage(table->pager, page_num);
-    uint32_t num_cells = *LeafNodeNumCells(node);
-
-    Cursor* cursor = static_cast<Cursor*>(malloc(sizeof(Cursor)));
-    cursor->table = table;
-    cursor->page_num = page_num;
-
-    // binary search
-    uint32_t min_index = 0;
-    uint32_t one_past_max_index = num_cells;
-    while (one_past_max_index != min_index) {
-        uint32_t index = (min_index + one_past_max_index) / 2;
-        uint32_t key_at_index = *LeafNodeKey(node, index);
-        if (key == key_at_index) {
-            cursor->cell_num = index;
-            return cursor;
-        } else if (key < key_at_index) {
-            one_past_max_index = index;
-        } else {
-            min_index = index + 1;
-        }
-    }
-    cursor->cell_num = min_index;
-    return cursor;
-}
-
 uint32_t* LitDatabase::LeafNodeKey(void* node, uint32_t cell_num) {
-    return static_cast<uint32_t*>(LeafNodeCell(node, cell_num));
+    return static_cast<uint32_t*>(
+        static_cast<void*>(static_cast<unsigned char*>(node) + LEAF_NODE_KEYS_OFFSET + cell_num * LEAF_NODE_KEY_SIZE));
 }
 
 void* LitDatabase::LeafNodeValue(void* node, uint32_t cell_num) {
-    return static_cast<void*>(static_cast<unsigned char*>(LeafNodeCell(node, cell_num)) + LEAF_NODE_KEY_SIZE);
+    return static_cast<void*>(static_cast<unsigned char*>(node) + *LeafNodeRecordOffset(node, cell_num));
 }
 
+// the row is counted on the way down first, a split then sets the counts of the nodes it divides from their contents
 void LitDatabase::LeafNodeInsert(Cursor* cursor, uint32_t key, const Row& value) {
+    CursorAddRows(cursor, 1);
     void* node = GetPage(cursor->table->pager, cursor->page_num);
 
-    uint32_t num_cells = *LeafNodeNumCells(node);
-    if (num_cells >= LEAF_NODE_MAX_CELLS) {
+    uint32_t length = SerializedRowSize(value);
+    if (LeafNodeFreeSpace(node) < LEAF_NODE_CELL_SIZE + length) {
+        UnpinPage(cursor->table->pager, cursor->page_num);
         LeafNodeSplitAndInsert(cursor, key, value);
         return;
     }
 
-    if (cursor->cell_num < num_cells) {
-        // make room for new cell
-        for (uint32_t i = num_cells; i > cursor->cell_num; --i) {
-            memcpy(LeafNodeCell(node, i), LeafNodeCell(node, i - 1), LEAF_NODE_CELL_SIZE);
-        }
+    SerializeRow(value, LeafNodeInsertCell(node, cursor->cell_num, key, length));
+    MarkPageDirty(cursor->table->pager, cursor->page_num);
+    UnpinPage(cursor->table->pager, cursor->page_num);
+}
+
+// remove the cell under the cursor, the leaf is rebalanced if it drops below LEAF_NODE_MIN_BYTES. The cursor holds
+// the tree exclusive but may have walked off the leaf it was placed on, the row is taken off the counts of the
+// ancestors found through the parent pointers.
+void LitDatabase::LeafNodeDelete(Cursor* cursor) {
+    Pager* pager = cursor->table->pager;
+    void* node = GetPage(pager, cursor->page_num);
+
+    LeafNodeRemoveCell(node, cursor->cell_num);
+    MarkPageDirty(pager, cursor->page_num);
+    bool is_root = is_node_root(node);
+    uint32_t parent_page_num = *NodeParent(node);
+    UnpinPage(pager, cursor->page_num);
+
+    uint32_t child_page_num = cursor->page_num;
+    while (!is_root) {
+        void* parent = GetPage(pager, parent_page_num);
+        *InternalNodeCount(parent, InternalNodeChildIndex(parent, child_page_num)) -= 1;
+        MarkPageDirty(pager, parent_page_num);
+        is_root = is_node_root(parent);
+        uint32_t next_page_num = *NodeParent(parent);
+        UnpinPage(pager, parent_page_num);
+        child_page_num = parent_page_num;
+        parent_page_num = next_page_num;
     }
 
-    *(LeafNodeNumCells(node)) += 1;
-    *(LeafNodeKey(node, cursor->cell_num)) = key;
-    SerializeRow(value, LeafNodeValue(node, cursor->cell_num));
+    NodeRebalance(cursor->table, cursor->page_num);
 }
 
 uint32_t* LitDatabase::LeafNodeNumCells(void* node) {
     return static_cast<uint32_t*>(static_cast<void*>(static_cast<unsigned char*>(node) + LEAF_NODE_NUM_CELLS_OFFSET));
 }
 
-void* LitDatabase::LeafNodeCell(void* node, uint32_t cell_num) {
-    return static_cast<void*>(static_cast<unsigned char*>(node) + LEAF_NODE_HEADER_SIZE +
-                              cell_num * LEAF_NODE_CELL_SIZE);
-}
\ No newline at end of file
+// the slots start right after the last key, so they move whenever a cell is added or removed
+void* LitDatabase::LeafNodeSlot(void* node, uint32_t cell_num) {
+    return static_cast<void*>(static_cast<unsigned char*>(node) + LEAF_NODE_KEYS_OFFSET +
+                              *LeafNodeNumCells(node) * LEAF_NODE_KEY_SIZE + cell_num * LEAF_NODE_SLOT_SIZE);
+}
+
+uint16_t* LitDatabase::LeafNodeHeapStart(void* node) {
+    return static_cast<uint16_t*>(static_cast<void*>(static_cast<unsigned char*>(node) + LEAF_NODE_HEAP_START_OFFSET));
+}
+
+uint16_t* LitDatabase::LeafNodeFragmented(void* node) {
+    return static_cast<uint16_t*>(static_cast<void*>(static_cast<unsigned char*>(node) + LEAF_NODE_FRAGMENTED_OFFSET));
+}
+
+uint16_t* LitDatabase::LeafNodeRecordOffset(void* node, uint32_t cell_num) {
+    return static_cast<uint16_t*>(
+        static_cast<void*>(static_cast<unsigned char*>(LeafNodeSlot(node, cell_num)) + LEAF_NODE_RECORD_OFFSET_OFFSET));
+}
+
+uint16_t* LitDatabase::LeafNodeRecordLength(void* node, uint32_t cell_num) {
+    return static_cast<uint16_t*>(
+        static_cast<void*>(static_cast<unsigned char*>(LeafNodeSlot(node, cell_num)) + LEAF_NODE_RECORD_LENGTH_OFFSET));
+}
+
+// bytes taken by live cells and records
+uint32_t LitDatabase::LeafNodeUsedSpace(void* node) {
+    return *LeafNodeNumCells(node) * LEAF_NODE_CELL_SIZE + PAGE_SIZE - *LeafNodeHeapStart(node) -
+           *LeafNodeFragmented(node);
+}
+
+// bytes available for new cells and records once the leaf is compacted
+uint32_t LitDatabase::LeafNodeFreeSpace(void* node) { return LEAF_NODE_SPACE_FOR_CELLS - LeafNodeUsedSpace(node); }
+
+// pack the records against the end of the page in cell order, the fragmented bytes join the free gap. Only the
+// heap is copied aside, the header holds the parent pointer that is not the leaf's to read.
+void LitDatabase::LeafNodeCompact(void* node) {
+    unsigned char copy[PAGE_SIZE];
+    uint32_t old_heap_start = *LeafNodeHeapStart(node);
+    memcpy(copy + old_heap_start, static_cast<unsigned char*>(node) + old_heap_start, PAGE_SIZE - old_heap_start);
+    uint32_t heap_start = PAGE_SIZE;
+    uint32_t num_cells = *LeafNodeNumCells(node);
+    for (uint32_t i = 0; i < num_cells; ++i) {
+        uint32_t length = *LeafNodeRecordLength(node, i);
+        heap_start -= length;
+        memcpy(static_cast<unsigned char*>(node) + heap_start, copy + *LeafNodeRecordOffset(node, i), length);
+        *LeafNodeRecordOffset(node, i) = heap_start;
+    }
+    uint32_t cells_end = LEAF_NODE_KEYS_OFFSET + num_cells * LEAF_NODE_CELL_SIZE;
+    memset(static_cast<unsigned char*>(node) + cells_end, 0, heap_start - cells_end);
+    *LeafNodeHeapStart(node) = heap_start;
+    *LeafNodeFragmented(node) = 0;
+}
+
+// open a cell for key at cell_num and return the record space of the given length, the caller checked that it
+// fits with LeafNodeFreeSpace
+void* LitDatabase::LeafNodeInsertCell(void* node, uint32_t cell_num, uint32_t key, uint32_t length) {
+    uint32_t num_cells = *LeafNodeNumCells(node);
+    uint32_t cells_end = LEAF_NODE_KEYS_OFFSET + num_cells * LEAF_NODE_CELL_SIZE;
+    if (cells_end + LEAF_NODE_CELL_SIZE + length > *LeafNodeHeapStart(node)) {
+        LeafNodeCompact(node);
+    }
+
+    // the slots after the new cell move by a key and a slot, the ones before it by a key, then the keys follow
+    unsigned char* keys = static_cast<unsigned char*>(static_cast<void*>(LeafNodeKey(node, 0)));
+    unsigned char* slots = keys + num_cells * LEAF_NODE_KEY_SIZE;
+    memmove(slots + LEAF_NODE_KEY_SIZE + (cell_num + 1) * LEAF_NODE_SLOT_SIZE, slots + cell_num * LEAF_NODE_SLOT_SIZE,
+            (num_cells - cell_num) * LEAF_NODE_SLOT_SIZE);
+    memmove(slots + LEAF_NODE_KEY_SIZE, slots, cell_num * LEAF_NODE_SLOT_SIZE);
+    memmove(keys + (cell_num + 1) * LEAF_NODE_KEY_SIZE, keys + cell_num * LEAF_NODE_KEY_SIZE,
+            (num_cells - cell_num) * LEAF_NODE_KEY_SIZE);
+    *LeafNodeNumCells(node) = num_cells + 1;
+    *LeafNodeHeapStart(node) -= length;
+    *LeafNodeKey(node, cell_num) = key;
+    *LeafNodeRecordOffset(node, cell_num) = *LeafNodeHeapStart(node);
+    *LeafNodeRecordLength(node, cell_num) = length;
+    return LeafNodeValue(node, cell_num);
+}
+
+void LitDatabase::LeafNodeCopyCell(void* destination, uint32_t destination_cell, void* source, uint32_t source_cell) {
+    uint32_t length = *LeafNodeRecordLength(source, source_cell);
+    void* record = LeafNodeInsertCell(destination, destination_cell, *LeafNodeKey(source, source_cell), length);
+    memcpy(record, LeafNodeValue(source, source_cell), length);
+}
+
+// whether the cell can be removed without the leaf dropping below LEAF_NODE_MIN_BYTES, a root leaf has no minimum
+bool LitDatabase::LeafNodeCanRemove(void* node, uint32_t cell_num) {
+    uint32_t cell_bytes = LEAF_NODE_CELL_SIZE + *LeafNodeRecordLength(node, cell_num);
+    return is_node_root(node) || LeafNodeUsedSpace(node) - cell_bytes >= LEAF_NODE_MIN_BYTES;
+}
+
+void LitDatabase::LeafNodeRemoveCell(void* node, uint32_t cell_num) {
+    uint32_t num_cells = *LeafNodeNumCells(node);
+    uint16_t offset = *LeafNodeRecordOffset(node, cell_num);
+    uint16_t length = *LeafNodeRecordLength(node, cell_num);
+    if (offset == *LeafNodeHeapStart(node)) {
+        *LeafNodeHeapStart(node) += length;
+    } else {
+        *LeafNodeFragmented(node) += length;
+    }
+    unsigned char* keys = static_cast<unsigned char*>(static_cast<void*>(LeafNodeKey(node, 0)));
+    unsigned char* slots = keys + num_cells * LEAF_NODE_KEY_SIZE;
+    memmove(keys + cell_num * LEAF_NODE_KEY_SIZE, keys + (cell_num + 1) * LEAF_NODE_KEY_SIZE,
+            (num_cells - cell_num - 1) * LEAF_NODE_KEY_SIZE);
+    memmove(slots - LEAF_NODE_KEY_SIZE, slots, cell_num * LEAF_NODE_SLOT_SIZE);
+    memmove(slots - LEAF_NODE_KEY_SIZE + cell_num * LEAF_NODE_SLOT_SIZE, slots + (cell_num + 1) * LEAF_NODE_SLOT_SIZE,
+            (num_cells - cell_num - 1) * LEAF_NODE_SLOT_SIZE);
+    *LeafNodeNumCells(node) = num_cells - 1;
+}
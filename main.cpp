@@ -1,6 +1,7 @@
 #include <cstdio>
 #include <iostream>
 #include <string>
+#include <thread>
 
 #include "LitDatabase.h"
 
@@ -12,46 +13,96 @@ int main(int argc, char* argv[]) {
     }
 
     char* filename = argv[1];
+    uint32_t pool_frames = POOL_DEFAULT_FRAMES;
+    PagerMode pager_mode = PAGER_BUFFER_POOL;
+    const char* socket_path = nullptr;
+    uint32_t num_workers = std::max(std::thread::hardware_concurrency(), 1u);
+    uint32_t scan_threads = num_workers;
+    uint32_t prefetch_leaves = PREFETCH_DEFAULT_LEAVES;
+    bool compress_pages = false;
+    for (int i = 2; i < argc; ++i) {
+        if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            pool_frames = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--mmap") == 0) {
+            pager_mode = PAGER_MMAP;
+        } else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+            socket_path = argv[++i];
+        } else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+            num_workers = std::max(atoi(argv[++i]), 1);
+        } else if (strcmp(argv[i], "--scan-threads") == 0 && i + 1 < argc) {
+            scan_threads = std::max(atoi(argv[++i]), 1);
+        } else if (strcmp(argv[i], "--prefetch") == 0 && i + 1 < argc) {
+            prefetch_leaves = std::max(atoi(argv[++i]), 0);
+        } else if (strcmp(argv[i], "--compress") == 0) {
+            compress_pages = true;
+        } else {
+            std::cout << "Unknown option: " << argv[i] << std::endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (pool_frames < 8) {
+        std::cout << "Buffer pool needs at least 8 frames." << std::endl;
+        exit(EXIT_FAILURE);
+    }
 
     LitDatabase lit_db;
-    Table* table = lit_db.DbOpen(filename);
+    lit_db.scan_threads = scan_threads;
+    lit_db.prefetch_leaves = prefetch_leaves;
+    lit_db.compress_pages = compress_pages;
+    Table* table = lit_db.DbOpen(filename, pool_frames, pager_mode);
+    if (socket_path != nullptr) {
+        lit_db.Serve(table, socket_path, num_workers);
+        return 0;
+    }
 
+    Session session;
     while (true) {
         lit_db.PrintPrompt();
-        lit_db.ReadInput();
+        lit_db.ReadInput(&session);
 
-        assert(lit_db.cur != nullptr);
-        if (*lit_db.cur == '\0') {
+        assert(session.cur != nullptr);
+        if (*session.cur == '\0') {
             std::cout << "Empty input" << std::endl;
             continue;
         }
 
-        if (*lit_db.cur == '.') {
-            switch (lit_db.ParseMeta(table)) {
+        if (*session.cur == '.') {
+            switch (lit_db.ParseMeta(&session, table)) {
                 case PARSE_META_SUCCESS: continue;
                 case PARSE_META_UNRECOGNIZED:
-                    std::cout << "Unrecognized command: " << lit_db.get_input_buffer() << std::endl;
+                    std::cout << "Unrecognized command: " << session.input_buffer << std::endl;
                     continue;
             }
         }
 
+        if (session.timer_on) lit_db.TimerStart(&session, table->pager);
         Statement statement;
-        switch (lit_db.ParseStatement(&statement)) {
+        switch (lit_db.ParseStatement(&session, &statement)) {
             case PARSE_STATEMENT_SUCCESS: break;
             case PARSE_STATEMENT_NEGATIVE_ID: std::cout << "ID must be positive." << std::endl;
             case PARSE_STATEMENT_STRING_TOO_LONG: std::cout << "String is too long." << std::endl; continue;
+            case PARSE_STATEMENT_ID_TOO_LARGE: std::cout << "ID is too large." << std::endl; continue;
             case PARSE_STATEMENT_SYNTAX_ERROR:
                 std::cout << "Syntax error. Could not parse statement." << std::endl;
                 continue;
             case PARSE_STATEMENT_UNRECOGNIZED:
-                std::cout << "Unrecognized keyword at start of " << lit_db.get_input_buffer() << std::endl;
+                std::cout << "Unrecognized keyword at start of " << session.input_buffer << std::endl;
                 continue;
         }
 
-        switch (lit_db.ExecuteStatement(&statement, table)) {
+        if (session.timer_on) lit_db.TimerParsed(&session);
+        ExecuteResult result = lit_db.ExecuteStatement(&session, &statement, table);
+        if (session.timer_on) lit_db.TimerFinish(&session, table->pager);
+        switch (result) {
             case EXECUTE_SUCCESS: std::cout << "Executed." << std::endl; break;
             case EXECUTE_TABLE_FULL: std::cout << "Error: Table full." << std::endl; break;
             case EXECUTE_DUPLICATE_KEY: std::cout << "Error: Duplicate key." << std::endl; break;
+            case EXECUTE_KEY_NOT_FOUND: std::cout << "Error: Key not found." << std::endl; break;
+            case EXECUTE_INDEX_EXISTS: std::cout << "Error: Index already exists." << std::endl; break;
+            case EXECUTE_TRANSACTION_OPEN: std::cout << "Error: A transaction is open." << std::endl; break;
+            case EXECUTE_NO_TRANSACTION: std::cout << "Error: No transaction is open." << std::endl; break;
+            default: break;
         }
+        if (session.timer_on) lit_db.PrintTimer(session.timer);
     }
 }
\ No newline at end of file
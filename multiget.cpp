@@ -0,0 +1,143 @@
+#include "LitDatabase.h"
+
+// Multi-key lookups, for select where id in (...). The ids are sorted and looked up in one walk down the tree instead
+// of one descent each: the walk goes a level at a time, every node of a level is visited once for all the ids under
+// it, and the ids reaching it are divided among its children in one pass, each search starting where the last one
+// stopped. Before a level is visited its nodes are all asked for at once, from the prefetcher on the live tree or the
+// kernel on a snapshot, so their misses overlap instead of each probe waiting for its own in turn.
+
+namespace {
+
+// a node and the ids [begin, end) that lead to it
+struct Probe {
+    uint32_t page_num;
+    uint32_t begin;
+    uint32_t end;
+};
+
+RowView ViewOf(const Row& row) {
+    RowView view;
+    view.id = row.id;
+    view.username = row.username;
+    view.username_length = strlen(row.username);
+    view.email = row.email;
+    view.email_length = strlen(row.email);
+    return view;
+}
+
+}  // namespace
+
+// the rows with any of the ids, in id order, ids not in the table are left out. Without a snapshot it reads the live
+// tree under the tree latch held shared, which keeps merges out, and latches each node shared while it looks at it.
+// A split may still move ids out of a node between the visit to its parent and its own, so if any split ran during
+// the walk its rows are thrown away and the ids looked up one at a time.
+std::vector<Row> LitDatabase::TableGetMany(Table* table, std::vector<uint32_t> keys, const Snapshot* snapshot) {
+    Pager* pager = table->pager;
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    std::vector<Row> rows;
+    if (keys.empty()) return rows;
+
+    // pages read ahead into the buffer pool come a quarter of it at a time, so they are not evicted again before the
+    // walk gets to them
+    size_t window = snapshot == nullptr && pager->mode == PAGER_BUFFER_POOL ? std::max(1u, pager->max_frames / 4)
+                                                                            : keys.size();
+    alignas(8) char copy[PAGE_SIZE];
+    if (snapshot == nullptr) pthread_rwlock_rdlock(&table->tree_latch);
+    uint64_t shape_changes = table->shape_changes.load(std::memory_order_acquire);
+    std::vector<Probe> level(1, Probe{table->root_page_num, 0, static_cast<uint32_t>(keys.size())});
+    std::vector<Probe> next;
+    std::vector<uint32_t> page_nums;
+    // one descent however many ids, as deep as the tree
+    pager->counters.descents.fetch_add(1, std::memory_order_relaxed);
+    while (!level.empty()) {
+        pager->counters.descent_levels.fetch_add(1, std::memory_order_relaxed);
+        next.clear();
+        for (size_t j = 0; j < level.size(); ++j) {
+            if (level.size() > 1 && j % window == 0) {
+                page_nums.clear();
+                for (size_t k = j; k < std::min(level.size(), j + window); ++k) {
+                    page_nums.push_back(level[k].page_num);
+                }
+                if (snapshot) {
+                    SnapshotPrefetch(pager, snapshot, page_nums);
+                } else {
+                    PrefetchPages(pager, page_nums);
+                }
+            }
+            const Probe& probe = level[j];
+            if (snapshot == nullptr) LatchPage(pager, probe.page_num, LATCH_SHARED);
+            void* node = ReadNode(pager, snapshot, probe.page_num, copy);
+            if (get_node_type(node) == NODE_LEAF) {
+                uint32_t num_cells = *LeafNodeNumCells(node);
+                uint32_t cell_num = 0;
+                for (uint32_t i = probe.begin; i < probe.end && cell_num < num_cells; ++i) {
+                    cell_num += KeyLowerBound(LeafNodeKey(node, cell_num), num_cells - cell_num, keys[i]);
+                    if (cell_num < num_cells && *LeafNodeKey(node, cell_num) == keys[i]) {
+                        rows.emplace_back();
+                        DeserializeRow(LeafNodeValue(node, cell_num), &rows.back());
+                    }
+                }
+            } else {
+                uint32_t num_keys = *InternalNodeNumKeys(node);
+                uint32_t child_num = 0;
+                for (uint32_t i = probe.begin; i < probe.end;) {
+                    child_num += KeyLowerBound(InternalNodeKey(node, child_num), num_keys - child_num, keys[i]);
+                    // the ids up to the child's key go to it with this one
+                    uint32_t end = i + 1;
+                    while (end < probe.end &&
+                           (child_num == num_keys || keys[end] <= *InternalNodeKey(node, child_num))) {
+                        ++end;
+                    }
+                    next.push_back(Probe{*InternalNodeChild(node, child_num), i, end});
+                    i = end;
+                }
+            }
+            ReleaseNode(pager, snapshot, probe.page_num);
+            if (snapshot == nullptr) UnlatchPage(pager, probe.page_num);
+        }
+        level.swap(next);
+    }
+    if (snapshot != nullptr) return rows;
+    bool reshaped = table->shape_changes.load(std::memory_order_acquire) != shape_changes;
+    pthread_rwlock_unlock(&table->tree_latch);
+    if (reshaped) {
+        rows.clear();
+        for (uint32_t key : keys) {
+            Cursor* cursor = TableFind(table, key, CURSOR_READ);
+            void* node = CursorLeaf(cursor);
+            if (cursor->cell_num < *LeafNodeNumCells(node) && *LeafNodeKey(node, cursor->cell_num) == key) {
+                rows.emplace_back();
+                DeserializeRow(LeafNodeValue(node, cursor->cell_num), &rows.back());
+            }
+            CursorUnpinLeaf(cursor);
+            CursorClose(cursor);
+        }
+    }
+    return rows;
+}
+
+// select ... where id in (...), the rows come out in id order like those of a range
+ExecuteResult LitDatabase::ExecuteSelectIn(Statement* statement, Table* table, ResultWriter* output,
+                                           const Snapshot* snapshot) {
+    std::vector<Row> rows = TableGetMany(table, statement->ids, snapshot);
+    Aggregate aggregate;
+    uint32_t to_skip = statement->offset;
+    uint32_t num_rows = 0;
+    for (const Row& row : rows) {
+        RowView view = ViewOf(row);
+        if (!RowMatchesFilter(statement, view)) continue;
+        if (statement->output == SELECT_AGGREGATE) {
+            AggregateRow(&aggregate, row.id);
+        } else if (to_skip > 0) {
+            to_skip -= 1;
+        } else if (num_rows < statement->limit) {
+            WriteRow(output, view);
+            num_rows += 1;
+        }
+    }
+    if (statement->output == SELECT_AGGREGATE) WriteAggregate(output, statement, aggregate);
+    WriterFlush(output);
+
+    return EXECUTE_SUCCESS;
+}
@@ -0,0 +1,246 @@
+#include "LitDatabase.h"
+
+// Select output. Rows are formatted straight from their views into one large buffer that is handed to stdio only
+// when the next row might not fit, so a long scan costs one write per buffer instead of one formatted call per row.
+
+namespace {
+
+const char DIGIT_PAIRS[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+// decimal digits of value, two at a time from the end
+char* FormatUint(char* out, uint32_t value) {
+    char digits[10];
+    char* end = digits + sizeof(digits);
+    char* start = end;
+    while (value >= 100) {
+        uint32_t pair = value % 100 * 2;
+        value /= 100;
+        *--start = DIGIT_PAIRS[pair + 1];
+        *--start = DIGIT_PAIRS[pair];
+    }
+    if (value >= 10) {
+        *--start = DIGIT_PAIRS[value * 2 + 1];
+        *--start = DIGIT_PAIRS[value * 2];
+    } else {
+        *--start = '0' + value;
+    }
+    memcpy(out, start, end - start);
+    return out + (end - start);
+}
+
+char* FormatBytes(char* out, const char* bytes, uint32_t length) {
+    memcpy(out, bytes, length);
+    return out + length;
+}
+
+// fields holding a separator, a quote or a line break are quoted, quotes inside are doubled
+char* FormatCsvField(char* out, const char* field, uint32_t length) {
+    bool needs_quotes = false;
+    for (uint32_t i = 0; i < length && !needs_quotes; ++i) {
+        needs_quotes = field[i] == ',' || field[i] == '"' || field[i] == '\n' || field[i] == '\r';
+    }
+    if (!needs_quotes) {
+        return FormatBytes(out, field, length);
+    }
+    *out++ = '"';
+    for (uint32_t i = 0; i < length; ++i) {
+        if (field[i] == '"') *out++ = '"';
+        *out++ = field[i];
+    }
+    *out++ = '"';
+    return out;
+}
+
+// tabs, line breaks and backslashes are escaped with a backslash
+char* FormatTsvField(char* out, const char* field, uint32_t length) {
+    for (uint32_t i = 0; i < length; ++i) {
+        switch (field[i]) {
+            case '\t': *out++ = '\\'; *out++ = 't'; break;
+            case '\n': *out++ = '\\'; *out++ = 'n'; break;
+            case '\r': *out++ = '\\'; *out++ = 'r'; break;
+            case '\\': *out++ = '\\'; *out++ = '\\'; break;
+            default: *out++ = field[i];
+        }
+    }
+    return out;
+}
+
+}  // namespace
+
+// room for length more bytes at the end of the buffer, flushing what is there if needed
+char* LitDatabase::WriterReserve(ResultWriter* writer, uint32_t length) {
+    if (writer->buffer == nullptr) {
+        writer->buffer = static_cast<char*>(malloc(RESULT_BUFFER_SIZE));
+    }
+    if (writer->length + length > RESULT_BUFFER_SIZE) {
+        WriterWrite(writer);
+    }
+    return writer->buffer + writer->length;
+}
+
+void LitDatabase::WriteRow(ResultWriter* writer, const RowView& row) {
+    char* start = WriterReserve(writer, RESULT_ROW_MAX_SIZE);
+    char* out = start;
+    switch (writer->mode) {
+        case OUTPUT_TABLE:
+            *out++ = '(';
+            out = FormatUint(out, row.id);
+            out = FormatBytes(out, ", ", 2);
+            out = FormatBytes(out, row.username, row.username_length);
+            out = FormatBytes(out, ", ", 2);
+            out = FormatBytes(out, row.email, row.email_length);
+            out = FormatBytes(out, ")\n", 2);
+            break;
+        case OUTPUT_CSV:
+            out = FormatUint(out, row.id);
+            *out++ = ',';
+            out = FormatCsvField(out, row.username, row.username_length);
+            *out++ = ',';
+            out = FormatCsvField(out, row.email, row.email_length);
+            *out++ = '\n';
+            break;
+        case OUTPUT_TSV:
+            out = FormatUint(out, row.id);
+            *out++ = '\t';
+            out = FormatTsvField(out, row.username, row.username_length);
+            *out++ = '\t';
+            out = FormatTsvField(out, row.email, row.email_length);
+            *out++ = '\n';
+            break;
+        case OUTPUT_BINARY:
+            out = FormatBytes(out, reinterpret_cast<const char*>(&row.id), ID_SIZE);
+            *out++ = static_cast<char>(row.username_length);
+            out = FormatBytes(out, row.username, row.username_length);
+            *out++ = static_cast<char>(row.email_length);
+            out = FormatBytes(out, row.email, row.email_length);
+            break;
+    }
+    writer->length += out - start;
+}
+
+// a line of text, such as the status line the server sends after a statement
+void LitDatabase::WriteText(ResultWriter* writer, const char* text) {
+    uint32_t length = strlen(text);
+    while (length > 0) {
+        uint32_t chunk = std::min(length, RESULT_ROW_MAX_SIZE);
+        memcpy(WriterReserve(writer, chunk), text, chunk);
+        writer->length += chunk;
+        text += chunk;
+        length -= chunk;
+    }
+}
+
+// a count or a rank, a one column row in the output format
+void LitDatabase::WriteCount(ResultWriter* writer, uint64_t count) {
+    char* start = WriterReserve(writer, 32);
+    char* out = start;
+    switch (writer->mode) {
+        case OUTPUT_TABLE: out += snprintf(out, 32, "(%" PRIu64 ")\n", count); break;
+        case OUTPUT_CSV:
+        case OUTPUT_TSV: out += snprintf(out, 32, "%" PRIu64 "\n", count); break;
+        case OUTPUT_BINARY: out = FormatBytes(out, reinterpret_cast<const char*>(&count), sizeof(count)); break;
+    }
+    writer->length += out - start;
+}
+
+// the aggregates of a select as one row in the output format. Min and max of no rows are NULL, 0 in binary.
+void LitDatabase::WriteAggregate(ResultWriter* writer, const Statement* statement, const Aggregate& aggregate) {
+    char* start = WriterReserve(writer, SELECT_MAX_AGGREGATES * 24 + 4);
+    char* out = start;
+    const char* separator = writer->mode == OUTPUT_TABLE ? ", " : writer->mode == OUTPUT_CSV ? "," : "\t";
+    if (writer->mode == OUTPUT_TABLE) *out++ = '(';
+    for (uint32_t i = 0; i < statement->num_aggregates; ++i) {
+        uint64_t value = 0;
+        bool present = true;
+        switch (statement->aggregates[i]) {
+            case AGGREGATE_COUNT: value = aggregate.count; break;
+            case AGGREGATE_SUM: value = aggregate.sum; break;
+            case AGGREGATE_MIN:
+                value = aggregate.min;
+                present = aggregate.count > 0;
+                break;
+            case AGGREGATE_MAX:
+                value = aggregate.max;
+                present = aggregate.count > 0;
+                break;
+        }
+        if (writer->mode == OUTPUT_BINARY) {
+            if (!present) value = 0;
+            out = FormatBytes(out, reinterpret_cast<const char*>(&value), sizeof(value));
+            continue;
+        }
+        if (i > 0) out = FormatBytes(out, separator, strlen(separator));
+        out += present ? snprintf(out, 24, "%" PRIu64, value) : snprintf(out, 24, "NULL");
+    }
+    if (writer->mode == OUTPUT_TABLE) *out++ = ')';
+    if (writer->mode != OUTPUT_BINARY) *out++ = '\n';
+    writer->length += out - start;
+}
+
+// hand the buffered output to the file, or to the client socket waiting whenever it is not ready for more
+void LitDatabase::WriterWrite(ResultWriter* writer) {
+    uint64_t start = NowNanoseconds();
+    if (writer->socket < 0) {
+        // goes through stdio so the rows stay in order with the messages printed around them
+        if (writer->length > 0 && fwrite(writer->buffer, 1, writer->length, writer->file) != writer->length) {
+            printf("Error writing output\n");
+            exit(EXIT_FAILURE);
+        }
+        writer->length = 0;
+        writer->write_nanoseconds += NowNanoseconds() - start;
+        return;
+    }
+
+    uint32_t sent = 0;
+    while (sent < writer->length && !writer->failed) {
+        ssize_t result = send(writer->socket, writer->buffer + sent, writer->length - sent, MSG_NOSIGNAL);
+        if (result >= 0) {
+            sent += result;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            pollfd ready = {writer->socket, POLLOUT, 0};
+            poll(&ready, 1, -1);
+        } else if (errno != EINTR) {
+            writer->failed = true;
+        }
+    }
+    writer->length = 0;
+    writer->write_nanoseconds += NowNanoseconds() - start;
+}
+
+// the end of a statement's output
+void LitDatabase::WriterFlush(ResultWriter* writer) {
+    if (writer->corked) return;
+    WriterWrite(writer);
+    if (writer->socket < 0) {
+        uint64_t start = NowNanoseconds();
+        fflush(writer->file);
+        writer->write_nanoseconds += NowNanoseconds() - start;
+    }
+}
+
+// send select output to a file, or back to stdout when path is nullptr or "stdout"
+bool LitDatabase::SetOutputFile(ResultWriter* writer, const char* path) {
+    FILE* file = stdout;
+    if (path != nullptr && strcmp(path, "stdout") != 0) {
+        file = fopen(path, "wb");
+        if (file == nullptr) {
+            return false;
+        }
+    }
+    WriterFlush(writer);
+    if (writer->file != stdout) {
+        fclose(writer->file);
+    }
+    writer->file = file;
+    return true;
+}
@@ -0,0 +1,203 @@
+#include "LitDatabase.h"
+
+// Read-ahead for scans. A read cursor that keeps stepping from leaf to leaf is scanning, so each time it steps onto
+// a leaf the leaves after it under the same parent are asked for. In the buffer pool mode the ones that are neither
+// cached nor in the log are grouped into runs of pages next to each other in the file and queued for a few threads,
+// which read a run with one pread and put its pages into frames. The scan never waits for them: a page it gets to
+// first it reads itself, joining the read already in flight in the kernel, and the prefetched copy is dropped. A
+// prefetched page only goes into the pool if nothing newer of it turned up meanwhile, that is if it is still not
+// cached, not in the log and no checkpoint ran. The mmap mode hands the runs to the kernel with madvise instead. The
+// kernel's own read-ahead is left on: it already covers leaves that follow each other in the file, which a bulk import
+// or sequential inserts leave behind, and this covers the leaves a split moved elsewhere. A multi-key lookup on the
+// live tree asks for the nodes of each level it goes through the same way.
+
+void LitDatabase::PrefetchStart(Pager* pager) {
+    if (pager->mode == PAGER_MMAP) return;
+    Prefetcher& prefetcher = pager->prefetcher;
+    prefetcher.db = this;
+    prefetcher.threads.resize(PREFETCH_THREADS);
+    for (pthread_t& thread : prefetcher.threads) {
+        pthread_create(&thread, nullptr, PrefetchWorker, pager);
+    }
+}
+
+// reads still queued are dropped
+void LitDatabase::PrefetchStop(Pager* pager) {
+    Prefetcher& prefetcher = pager->prefetcher;
+    pthread_mutex_lock(&prefetcher.mutex);
+    prefetcher.stop = true;
+    pthread_cond_broadcast(&prefetcher.wakeup);
+    pthread_mutex_unlock(&prefetcher.mutex);
+    for (pthread_t thread : prefetcher.threads) {
+        pthread_join(thread, nullptr);
+    }
+    prefetcher.threads.clear();
+}
+
+// ask for the leaves after the one the cursor just stepped onto. A split of the parent may move the leaf to another one
+// meanwhile, so the parent pointer is read atomically and the leaf looked for in the node it names. Parents come
+// before children in the latch order: the parent is skipped if it is latched exclusive.
+void LitDatabase::PrefetchLeaves(Cursor* cursor) {
+    Pager* pager = cursor->table->pager;
+    uint32_t num_leaves = prefetch_leaves;
+    if (pager->mode == PAGER_BUFFER_POOL) {
+        // ahead of the scan, not instead of what it is using
+        num_leaves = std::min(num_leaves, pager->max_frames / 4);
+    }
+    // the window is topped up once the cursor is half way through it
+    if (cursor->leaves_ahead > num_leaves / 2) return;
+    void* leaf = GetPage(pager, cursor->page_num);
+    bool is_root = is_node_root(leaf);
+    uint32_t parent_page_num = __atomic_load_n(NodeParent(leaf), __ATOMIC_RELAXED);
+    UnpinPage(pager, cursor->page_num);
+    if (is_root || num_leaves == 0) return;
+
+    pthread_rwlock_t* latch = PageLatch(pager, parent_page_num);
+    if (pthread_rwlock_tryrdlock(latch) != 0) return;
+    std::vector<uint32_t> page_nums;
+    void* parent = GetPage(pager, parent_page_num);
+    if (get_node_type(parent) == NODE_INTERNAL) {
+        uint32_t num_keys = *InternalNodeNumKeys(parent);
+        for (uint32_t child_num = InternalNodeChildIndex(parent, cursor->page_num) + 1;
+             child_num <= num_keys && page_nums.size() < num_leaves; ++child_num) {
+            page_nums.push_back(*InternalNodeChild(parent, child_num));
+        }
+    }
+    UnpinPage(pager, parent_page_num);
+    pthread_rwlock_unlock(latch);
+    cursor->leaves_ahead = page_nums.size();
+    PrefetchPages(pager, page_nums);
+}
+
+// ask for the pages to be read ahead, in runs of pages next to each other in the file
+void LitDatabase::PrefetchPages(Pager* pager, std::vector<uint32_t>& page_nums) {
+    if (page_nums.empty()) return;
+    std::sort(page_nums.begin(), page_nums.end());
+
+    if (pager->mode == PAGER_MMAP) {
+        uint32_t num_pages = __atomic_load_n(&pager->num_pages, __ATOMIC_ACQUIRE);
+        size_t start = 0;
+        while (start < page_nums.size()) {
+            size_t end = start + 1;
+            while (end < page_nums.size() && page_nums[end] == page_nums[end - 1] + 1) {
+                ++end;
+            }
+            if (page_nums[end - 1] < num_pages) {
+                madvise(pager->map + static_cast<size_t>(page_nums[start]) * PAGE_SIZE, (end - start) * PAGE_SIZE,
+                        MADV_WILLNEED);
+            }
+            start = end;
+        }
+        return;
+    }
+
+    Prefetcher& prefetcher = pager->prefetcher;
+    std::vector<PrefetchRequest> requests;
+    pthread_mutex_lock(&pager->mutex);
+    pthread_mutex_lock(&prefetcher.mutex);
+    bool compressed = pager->page_map.enabled;
+    uint32_t file_pages = PagerFilePages(pager);
+    PrefetchRequest request = {0, 0, pager->wal.salt};
+    for (size_t i = 0; i <= page_nums.size(); ++i) {
+        bool wanted = i < page_nums.size();
+        if (wanted) {
+            uint32_t page_num = page_nums[i];
+            wanted = page_num < file_pages && pager->page_table.count(page_num) == 0 &&
+                     pager->wal.pending.count(page_num) == 0 && pager->wal.index.count(page_num) == 0 &&
+                     prefetcher.in_flight.count(page_num) == 0;
+        }
+        if (wanted && request.num_pages > 0 && page_nums[i] == request.first_page_num + request.num_pages) {
+            request.num_pages += 1;
+            prefetcher.in_flight.insert(page_nums[i]);
+            continue;
+        }
+        if (request.num_pages > 0) {
+            prefetcher.queue.push_back(request);
+            requests.push_back(request);
+            pthread_cond_signal(&prefetcher.wakeup);
+            request.num_pages = 0;
+        }
+        if (wanted) {
+            request.first_page_num = page_nums[i];
+            request.num_pages = 1;
+            prefetcher.in_flight.insert(page_nums[i]);
+        }
+    }
+    pthread_mutex_unlock(&prefetcher.mutex);
+    pthread_mutex_unlock(&pager->mutex);
+
+    // the threads read a run at a time, the kernel is told about all of them at once so the reads of the runs
+    // further down the queue are under way before a thread gets to them
+    if (compressed) return;
+    for (const PrefetchRequest& queued : requests) {
+        posix_fadvise(pager->file_descriptor, static_cast<off_t>(queued.first_page_num) * PAGE_SIZE,
+                      static_cast<off_t>(queued.num_pages) * PAGE_SIZE, POSIX_FADV_WILLNEED);
+    }
+}
+
+void* LitDatabase::PrefetchWorker(void* argument) {
+    Pager* pager = static_cast<Pager*>(argument);
+    Prefetcher& prefetcher = pager->prefetcher;
+    while (true) {
+        pthread_mutex_lock(&prefetcher.mutex);
+        while (prefetcher.queue.empty() && !prefetcher.stop) {
+            pthread_cond_wait(&prefetcher.wakeup, &prefetcher.mutex);
+        }
+        if (prefetcher.stop) {
+            pthread_mutex_unlock(&prefetcher.mutex);
+            return nullptr;
+        }
+        PrefetchRequest request = prefetcher.queue.front();
+        prefetcher.queue.pop_front();
+        pthread_mutex_unlock(&prefetcher.mutex);
+        prefetcher.db->PrefetchRead(pager, request);
+    }
+}
+
+// read a run of pages and put the ones still wanted into frames, marked referenced so they last until the scan gets
+// there. A page is never worth evicting a pinned one for, with every frame pinned the rest of the run is dropped.
+void LitDatabase::PrefetchRead(Pager* pager, const PrefetchRequest& request) {
+    std::vector<char> buffer(static_cast<size_t>(request.num_pages) * PAGE_SIZE);
+    uint32_t pages_read;
+    if (pager->page_map.enabled) {
+        pages_read = PageMapReadRun(pager, request.first_page_num, request.num_pages, buffer.data());
+    } else {
+        ssize_t bytes_read = pread(pager->file_descriptor, buffer.data(), buffer.size(),
+                                   static_cast<off_t>(request.first_page_num) * PAGE_SIZE);
+        pages_read = bytes_read > 0 ? bytes_read / PAGE_SIZE : 0;
+        pager->counters.bytes_read.fetch_add(pages_read * PAGE_SIZE, std::memory_order_relaxed);
+    }
+
+    pthread_mutex_lock(&pager->mutex);
+    for (uint32_t i = 0; i < pages_read && pager->wal.salt == request.salt; ++i) {
+        uint32_t page_num = request.first_page_num + i;
+        if (pager->page_table.count(page_num) || pager->wal.pending.count(page_num) ||
+            pager->wal.index.count(page_num)) {
+            continue;
+        }
+        uint32_t frame_index;
+        if (pager->frames.size() < pager->max_frames) {
+            frame_index = pager->frames.size();
+            Frame frame;
+            frame.data = malloc(PAGE_SIZE);
+            pager->frames.push_back(frame);
+        } else if ((frame_index = PagerFindVictim(pager, false)) == UINT32_MAX) {
+            break;
+        }
+        Frame& frame = pager->frames[frame_index];
+        memcpy(frame.data, &buffer[static_cast<size_t>(i) * PAGE_SIZE], PAGE_SIZE);
+        frame.page_num = page_num;
+        frame.pin_count = 0;
+        frame.dirty = false;
+        frame.referenced = true;
+        pager->page_table[page_num] = frame_index;
+        pager->counters.pages_prefetched.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    pthread_mutex_lock(&pager->prefetcher.mutex);
+    for (uint32_t i = 0; i < request.num_pages; ++i) {
+        pager->prefetcher.in_flight.erase(request.first_page_num + i);
+    }
+    pthread_mutex_unlock(&pager->prefetcher.mutex);
+    pthread_mutex_unlock(&pager->mutex);
+}
@@ -0,0 +1,176 @@
+#include "LitDatabase.h"
+
+// Order statistics. Every internal node keeps the number of rows below each of its children, so the rows before a
+// key, the row at a position and the size of the table are found on one walk down the tree instead of a scan of the
+// leaves. A write cursor holds its whole path latched, shared above any nodes a split changes, and adds the row it
+// inserts or removes to the count of the child it took at every level, with atomic adds since other writers may be
+// doing the same in the nodes they hold shared too.
+// Counts read from the live tree while others write may be off by the statements still running, those read from a
+// snapshot are exact.
+
+// add delta rows to the path the cursor took down to its leaf
+void LitDatabase::CursorAddRows(Cursor* cursor, int32_t delta) {
+    Pager* pager = cursor->table->pager;
+    for (uint32_t i = 0; i < cursor->num_ancestors; ++i) {
+        void* node = GetPage(pager, cursor->ancestors[i]);
+        __atomic_add_fetch(InternalNodeCount(node, cursor->child_nums[i]), delta, __ATOMIC_RELAXED);
+        MarkPageDirty(pager, cursor->ancestors[i]);
+        UnpinPage(pager, cursor->ancestors[i]);
+    }
+}
+
+// the number of rows with an id below key, and whether a row has the id. Keys past UINT32_MAX count every row.
+uint64_t LitDatabase::TableCountBelow(Table* table, int64_t key, bool* found, const Snapshot* snapshot) {
+    Pager* pager = table->pager;
+    alignas(8) char copy[PAGE_SIZE];
+    uint64_t count = 0;
+    uint32_t levels = 0;
+    uint32_t page_num = table->root_page_num;
+    if (snapshot == nullptr) {
+        pthread_rwlock_rdlock(&table->tree_latch);
+        LatchPage(pager, page_num, LATCH_SHARED);
+    }
+    while (true) {
+        void* node = ReadNode(pager, snapshot, page_num, copy);
+        levels += 1;
+        if (key > UINT32_MAX) {
+            count += NodeNumRows(node);
+            if (found) *found = false;
+            ReleaseNode(pager, snapshot, page_num);
+            break;
+        }
+        if (get_node_type(node) == NODE_LEAF) {
+            uint32_t num_cells = *LeafNodeNumCells(node);
+            uint32_t cell_num = KeyLowerBound(LeafNodeKey(node, 0), num_cells, key);
+            count += cell_num;
+            if (found) *found = cell_num < num_cells && *LeafNodeKey(node, cell_num) == key;
+            ReleaseNode(pager, snapshot, page_num);
+            break;
+        }
+
+        uint32_t child_num = InternalNodeFindChild(node, key);
+        for (uint32_t i = 0; i < child_num; ++i) {
+            count += __atomic_load_n(InternalNodeCount(node, i), __ATOMIC_RELAXED);
+        }
+        uint32_t child_page_num = *InternalNodeChild(node, child_num);
+        ReleaseNode(pager, snapshot, page_num);
+        if (snapshot == nullptr) {
+            LatchPage(pager, child_page_num, LATCH_SHARED);
+            UnlatchPage(pager, page_num);
+        }
+        page_num = child_page_num;
+    }
+    if (snapshot == nullptr) {
+        UnlatchPage(pager, page_num);
+        pthread_rwlock_unlock(&table->tree_latch);
+    }
+    pager->counters.descents.fetch_add(1, std::memory_order_relaxed);
+    pager->counters.descent_levels.fetch_add(levels, std::memory_order_relaxed);
+    return count;
+}
+
+// a read cursor on the row at the position in id order, counting from 0, or at the end past the last row
+Cursor* LitDatabase::TableAt(Table* table, uint64_t position, const Snapshot* snapshot) {
+    Pager* pager = table->pager;
+    Cursor* cursor = static_cast<Cursor*>(malloc(sizeof(Cursor)));
+    cursor->table = table;
+    cursor->end_of_table = false;
+    cursor->mode = CURSOR_READ;
+    cursor->num_ancestors = 0;
+    cursor->leaves_entered = 0;
+    cursor->leaves_ahead = 0;
+    cursor->snapshot = snapshot;
+    cursor->copy = snapshot ? malloc(PAGE_SIZE) : nullptr;
+
+    uint32_t levels = 0;
+    uint32_t page_num = table->root_page_num;
+    if (snapshot == nullptr) {
+        pthread_rwlock_rdlock(&table->tree_latch);
+        LatchPage(pager, page_num, LATCH_SHARED);
+    }
+    pager->counters.descents.fetch_add(1, std::memory_order_relaxed);
+    while (true) {
+        void* node = ReadNode(pager, snapshot, page_num, cursor->copy);
+        levels += 1;
+        if (get_node_type(node) == NODE_LEAF) {
+            uint32_t num_cells = *LeafNodeNumCells(node);
+            ReleaseNode(pager, snapshot, page_num);
+            pager->counters.descent_levels.fetch_add(levels, std::memory_order_relaxed);
+            cursor->page_num = page_num;
+            if (num_cells == 0) {
+                cursor->cell_num = 0;
+                cursor->end_of_table = true;
+            } else if (position < num_cells) {
+                cursor->cell_num = position;
+            } else {
+                // past the last row, or the counts above were read while a writer was on its way down
+                cursor->cell_num = num_cells - 1;
+                CursorAdvance(cursor);
+            }
+            return cursor;
+        }
+
+        // the child whose rows hold the position, the right child takes whatever is left
+        uint32_t num_keys = *InternalNodeNumKeys(node);
+        uint32_t child_num = 0;
+        for (; child_num < num_keys; ++child_num) {
+            uint32_t child_rows = __atomic_load_n(InternalNodeCount(node, child_num), __ATOMIC_RELAXED);
+            if (position < child_rows) break;
+            position -= child_rows;
+        }
+        uint32_t child_page_num = *InternalNodeChild(node, child_num);
+        ReleaseNode(pager, snapshot, page_num);
+        if (snapshot == nullptr) {
+            LatchPage(pager, child_page_num, LATCH_SHARED);
+            UnlatchPage(pager, page_num);
+        }
+        page_num = child_page_num;
+    }
+}
+
+// select rank where id = N: the position of the row counting from 1. Aggregates over an id range without a column
+// filter: count, min and max come from the counts, sum has to visit the rows.
+ExecuteResult LitDatabase::ExecuteSelectAggregate(Statement* statement, Table* table, ResultWriter* output,
+                                                 const Snapshot* snapshot) {
+    if (statement->output == SELECT_RANK) {
+        bool found = false;
+        uint64_t below = TableCountBelow(table, statement->range_low, &found, snapshot);
+        if (!found) {
+            return EXECUTE_KEY_NOT_FOUND;
+        }
+        WriteCount(output, below + 1);
+        WriterFlush(output);
+        return EXECUTE_SUCCESS;
+    }
+
+    bool needs_scan = false;
+    for (uint32_t i = 0; i < statement->num_aggregates; ++i) {
+        needs_scan |= statement->aggregates[i] == AGGREGATE_SUM;
+    }
+    Aggregate aggregate;
+    if (needs_scan) {
+        aggregate = ScanAggregate(statement, table, snapshot);
+    } else if (statement->range_low <= statement->range_high) {
+        uint64_t low = TableCountBelow(table, statement->range_low, nullptr, snapshot);
+        uint64_t high = TableCountBelow(table, statement->range_high + 1, nullptr, snapshot);
+        aggregate.count = high > low ? high - low : 0;
+        // the first and last rows of the range are at known positions
+        auto id_at = [&](uint64_t position, uint32_t otherwise) {
+            Cursor* cursor = TableAt(table, position, snapshot);
+            uint32_t id = otherwise;
+            if (!(cursor->end_of_table)) {
+                id = *LeafNodeKey(CursorLeaf(cursor), cursor->cell_num);
+                CursorUnpinLeaf(cursor);
+            }
+            CursorClose(cursor);
+            return id;
+        };
+        if (aggregate.count > 0) {
+            aggregate.min = id_at(low, aggregate.min);
+            aggregate.max = id_at(high - 1, aggregate.max);
+        }
+    }
+    WriteAggregate(output, statement, aggregate);
+    WriterFlush(output);
+    return EXECUTE_SUCCESS;
+}
@@ -0,0 +1,192 @@
+#include "LitDatabase.h"
+
+// Parallel scans for aggregates. The id range is cut at the separator keys of the top levels of the tree until there
+// are a few pieces per worker, so pieces cover about as many leaves each. Every worker gets a run of neighbouring
+// pieces and walks them in key order with its own read cursor, adding what it sees to its own partial aggregate. A
+// worker that runs out takes pieces from the far end of another worker's run, so a range where the rows bunch up does
+// not leave the others idle. The partial aggregates are merged once every piece is done. The thread running the
+// statement is one of the workers. Given a snapshot every worker reads it, rows written meanwhile are not seen.
+
+void LitDatabase::AggregateRow(Aggregate* aggregate, uint32_t id) {
+    aggregate->count += 1;
+    aggregate->sum += id;
+    aggregate->min = std::min(aggregate->min, id);
+    aggregate->max = std::max(aggregate->max, id);
+}
+
+void LitDatabase::AggregateMerge(Aggregate* aggregate, const Aggregate& partial) {
+    aggregate->count += partial.count;
+    aggregate->sum += partial.sum;
+    aggregate->min = std::min(aggregate->min, partial.min);
+    aggregate->max = std::max(aggregate->max, partial.max);
+}
+
+// whether the row has the value the select filters its column on
+bool LitDatabase::RowMatchesFilter(const Statement* statement, const RowView& row) {
+    if (!statement->filter_by_column) return true;
+    const char* value = RowColumnValue(statement->filter, statement->column);
+    uint32_t length = strlen(value);
+    if (statement->column == INDEX_USERNAME) {
+        return row.username_length == length && memcmp(row.username, value, length) == 0;
+    }
+    return row.email_length == length && memcmp(row.email, value, length) == 0;
+}
+
+// cut [low, high] at the keys of the top levels of the tree into at least num_ranges pieces, or into one piece per
+// leaf when the tree is too small for that. Without a snapshot, holding the tree latch shared keeps merges out
+// meanwhile. A split may not be seen, the pieces still cover the range, only less evenly.
+std::vector<ScanRange> LitDatabase::ScanSplit(Table* table, uint32_t low, uint32_t high, uint32_t num_ranges,
+                                              const Snapshot* snapshot) {
+    Pager* pager = table->pager;
+    alignas(8) char copy[PAGE_SIZE];
+    std::vector<std::pair<ScanRange, uint32_t>> pieces;  // a range and the node holding it
+    std::vector<std::pair<ScanRange, uint32_t>> next;
+    if (snapshot == nullptr) pthread_rwlock_rdlock(&table->tree_latch);
+    pieces.push_back({{low, high}, table->root_page_num});
+    bool at_leaves = false;
+    while (pieces.size() < num_ranges && !at_leaves) {
+        next.clear();
+        for (const std::pair<ScanRange, uint32_t>& piece : pieces) {
+            if (snapshot == nullptr) LatchPage(pager, piece.second, LATCH_SHARED);
+            void* node = ReadNode(pager, snapshot, piece.second, copy);
+            if (get_node_type(node) == NODE_LEAF) {
+                at_leaves = true;
+                next.push_back(piece);
+            } else {
+                // the child at key_num holds the keys up to its key, the right child the keys above the last one
+                uint32_t num_keys = *InternalNodeNumKeys(node);
+                uint32_t child_low = piece.first.low;
+                for (uint32_t child_num = InternalNodeFindChild(node, child_low); child_num <= num_keys; ++child_num) {
+                    uint32_t child_high =
+                        child_num < num_keys ? std::min(*InternalNodeKey(node, child_num), piece.first.high)
+                                             : piece.first.high;
+                    next.push_back({{child_low, child_high}, *InternalNodeChild(node, child_num)});
+                    if (child_high == piece.first.high) break;
+                    child_low = child_high + 1;
+                }
+            }
+            ReleaseNode(pager, snapshot, piece.second);
+            if (snapshot == nullptr) UnlatchPage(pager, piece.second);
+        }
+        pieces.swap(next);
+    }
+    if (snapshot == nullptr) pthread_rwlock_unlock(&table->tree_latch);
+
+    std::vector<ScanRange> ranges;
+    ranges.reserve(pieces.size());
+    for (const std::pair<ScanRange, uint32_t>& piece : pieces) {
+        ranges.push_back(piece.first);
+    }
+    return ranges;
+}
+
+// the aggregates over the rows in the id range of the select that pass its column filter
+Aggregate LitDatabase::ScanAggregate(const Statement* statement, Table* table, const Snapshot* snapshot) {
+    Aggregate aggregate;
+    if (statement->range_low > statement->range_high) {
+        return aggregate;
+    }
+    uint32_t num_workers = std::max(scan_threads, 1u);
+    std::vector<ScanRange> ranges = ScanSplit(table, statement->range_low, statement->range_high,
+                                              num_workers * SCAN_RANGES_PER_WORKER, snapshot);
+    num_workers = std::min<uint32_t>(num_workers, ranges.size());
+    if (num_workers == 1) {
+        for (const ScanRange& range : ranges) {
+            ScanAggregateRange(statement, table, range, &aggregate, snapshot);
+        }
+        return aggregate;
+    }
+
+    ParallelScan scan;
+    scan.db = this;
+    scan.table = table;
+    scan.statement = statement;
+    scan.snapshot = snapshot;
+    scan.workers.resize(num_workers);
+    for (uint32_t i = 0; i < num_workers; ++i) {
+        ScanWorker& worker = scan.workers[i];
+        worker.scan = &scan;
+        pthread_mutex_init(&worker.mutex, nullptr);
+        // neighbouring pieces stay together, a worker walks one stretch of the leaf chain
+        size_t first = ranges.size() * i / num_workers;
+        size_t last = ranges.size() * (i + 1) / num_workers;
+        worker.ranges.assign(ranges.begin() + first, ranges.begin() + last);
+    }
+    std::vector<pthread_t> threads(num_workers - 1);
+    for (uint32_t i = 1; i < num_workers; ++i) {
+        pthread_create(&threads[i - 1], nullptr, ScanWorkerMain, &scan.workers[i]);
+    }
+    ScanWorkerMain(&scan.workers[0]);
+    for (pthread_t thread : threads) {
+        pthread_join(thread, nullptr);
+    }
+    for (ScanWorker& worker : scan.workers) {
+        AggregateMerge(&aggregate, worker.partial);
+        pthread_mutex_destroy(&worker.mutex);
+    }
+    return aggregate;
+}
+
+void* LitDatabase::ScanWorkerMain(void* argument) {
+    ScanWorker* worker = static_cast<ScanWorker*>(argument);
+    ParallelScan* scan = worker->scan;
+    uint32_t worker_num = worker - &scan->workers[0];
+    ScanRange range;
+    while (ScanTakeRange(scan, worker_num, &range)) {
+        scan->db->ScanAggregateRange(scan->statement, scan->table, range, &worker->partial, scan->snapshot);
+    }
+    return nullptr;
+}
+
+// the next piece of the worker's own run, or else the last piece of the first other worker that still has some.
+// Pieces are never added once the scan runs, so finding every run empty means the scan is done.
+bool LitDatabase::ScanTakeRange(ParallelScan* scan, uint32_t worker_num, ScanRange* range) {
+    uint32_t num_workers = scan->workers.size();
+    for (uint32_t i = 0; i < num_workers; ++i) {
+        ScanWorker& victim = scan->workers[(worker_num + i) % num_workers];
+        pthread_mutex_lock(&victim.mutex);
+        bool found = !victim.ranges.empty();
+        if (found && i == 0) {
+            *range = victim.ranges.front();
+            victim.ranges.pop_front();
+        } else if (found) {
+            *range = victim.ranges.back();
+            victim.ranges.pop_back();
+        }
+        pthread_mutex_unlock(&victim.mutex);
+        if (found) return true;
+    }
+    return false;
+}
+
+// walk the leaves holding the range, pinning each leaf once for all of its rows
+void LitDatabase::ScanAggregateRange(const Statement* statement, Table* table, ScanRange range, Aggregate* partial,
+                                     const Snapshot* snapshot) {
+    Aggregate aggregate;
+    Cursor* cursor = TableSeek(table, range.low, CURSOR_READ, snapshot);
+    RowView row;
+    bool past_range = false;
+    while (!(cursor->end_of_table) && !past_range) {
+        void* node = CursorLeaf(cursor);
+        uint32_t num_cells = *LeafNodeNumCells(node);
+        for (uint32_t cell_num = cursor->cell_num; cell_num < num_cells; ++cell_num) {
+            uint32_t id = *LeafNodeKey(node, cell_num);
+            if (id > range.high) {
+                past_range = true;
+                break;
+            }
+            if (statement->filter_by_column) {
+                ViewRow(LeafNodeValue(node, cell_num), &row);
+                if (!RowMatchesFilter(statement, row)) continue;
+            }
+            AggregateRow(&aggregate, id);
+        }
+        CursorUnpinLeaf(cursor);
+        if (past_range) break;
+        // step off the last cell onto the next leaf
+        cursor->cell_num = std::max(num_cells, 1u) - 1;
+        CursorAdvance(cursor);
+    }
+    CursorClose(cursor);
+    AggregateMerge(partial, aggregate);
+}
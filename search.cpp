@@ -0,0 +1,88 @@
+#include "LitDatabase.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define LITDB_X86 1
+#endif
+
+// Key search inside a node. Binary search narrows the sorted key array to a window, the window is then counted
+// with a compare-and-movemask kernel instead of probing it key by key. The kernel is picked once at startup from
+// what the CPU reports, the scalar one works everywhere.
+
+namespace {
+
+// windows of up to this many keys are counted instead of being narrowed further
+constexpr uint32_t KEY_SEARCH_WINDOW = 32;
+
+typedef uint32_t (*CountLessKernel)(const uint32_t* keys, uint32_t num_keys, uint32_t key);
+
+uint32_t CountLessScalar(const uint32_t* keys, uint32_t num_keys, uint32_t key) {
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < num_keys; ++i) {
+        count += keys[i] < key;
+    }
+    return count;
+}
+
+#ifdef LITDB_X86
+// a lane holds a key >= the one searched for when max(lane, key) == lane, the rest of the lanes are smaller
+__attribute__((target("sse4.1"))) uint32_t CountLessSse41(const uint32_t* keys, uint32_t num_keys, uint32_t key) {
+    const __m128i needle = _mm_set1_epi32(key);
+    uint32_t count = 0;
+    uint32_t i = 0;
+    for (; i + 4 <= num_keys; i += 4) {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(keys + i));
+        __m128i not_less = _mm_cmpeq_epi32(_mm_max_epu32(block, needle), block);
+        count += 4 - __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(not_less)));
+    }
+    return count + CountLessScalar(keys + i, num_keys - i, key);
+}
+
+__attribute__((target("avx2"))) uint32_t CountLessAvx2(const uint32_t* keys, uint32_t num_keys, uint32_t key) {
+    const __m256i needle = _mm256_set1_epi32(key);
+    uint32_t count = 0;
+    uint32_t i = 0;
+    for (; i + 8 <= num_keys; i += 8) {
+        __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys + i));
+        __m256i not_less = _mm256_cmpeq_epi32(_mm256_max_epu32(block, needle), block);
+        count += 8 - __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(not_less)));
+    }
+    return count + CountLessSse41(keys + i, num_keys - i, key);
+}
+#endif
+
+struct KeySearch {
+    CountLessKernel count_less;
+    const char* name;
+};
+
+KeySearch ChooseKeySearch() {
+#ifdef LITDB_X86
+    // reads CPUID, and for AVX2 also whether the OS saves the ymm registers
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return {CountLessAvx2, "avx2"};
+    if (__builtin_cpu_supports("sse4.1")) return {CountLessSse41, "sse4.1"};
+#endif
+    return {CountLessScalar, "scalar"};
+}
+
+const KeySearch key_search = ChooseKeySearch();
+
+}  // namespace
+
+// index of the first key that is >= key, num_keys if there is none
+uint32_t LitDatabase::KeyLowerBound(const uint32_t* keys, uint32_t num_keys, uint32_t key) {
+    uint32_t min_index = 0;
+    uint32_t max_index = num_keys;
+    while (max_index - min_index > KEY_SEARCH_WINDOW) {
+        uint32_t index = (min_index + max_index) / 2;
+        if (keys[index] < key) {
+            min_index = index + 1;
+        } else {
+            max_index = index;
+        }
+    }
+    return min_index + key_search.count_less(keys + min_index, max_index - min_index, key);
+}
+
+const char* LitDatabase::KeySearchKernel() { return key_search.name; }
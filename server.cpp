@@ -0,0 +1,247 @@
+#include "LitDatabase.h"
+
+// Server mode. One event loop waits on the listening socket and on every idle connection, a pool of workers runs the
+// statements. A connection is armed with EPOLLONESHOT: once it reports input it is out of the epoll set until its
+// worker has read a batch, answered every complete request in it and armed it again. So the requests of one client
+// run one after another in the order they were sent, while different clients run side by side on the shared table
+// and its page cache. Answers to a batch of pipelined requests are gathered and sent together.
+
+namespace {
+
+volatile sig_atomic_t stop_requested = 0;
+
+void RequestStop(int) { stop_requested = 1; }
+
+void ArmConnection(Server* server, Connection* connection, int operation) {
+    epoll_event event = {};
+    event.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+    event.data.ptr = connection;
+    if (epoll_ctl(server->epoll_fd, operation, connection->socket, &event) == -1) {
+        printf("Error watching client socket\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+}  // namespace
+
+// serve the table on a Unix domain socket until SIGINT or SIGTERM, then close it like .exit does
+void LitDatabase::Serve(Table* table, const char* socket_path, uint32_t num_workers) {
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(address.sun_path)) {
+        printf("Socket path too long: %s\n", socket_path);
+        exit(EXIT_FAILURE);
+    }
+    strcpy(address.sun_path, socket_path);
+
+    Server server;
+    server.db = this;
+    server.table = table;
+    server.listen_socket = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    // a socket file left by a server that did not shut down would make bind fail
+    unlink(socket_path);
+    if (server.listen_socket == -1 || bind(server.listen_socket, reinterpret_cast<sockaddr*>(&address),
+                                           sizeof(address)) == -1 ||
+        listen(server.listen_socket, SOMAXCONN) == -1) {
+        printf("Unable to listen on %s\n", socket_path);
+        exit(EXIT_FAILURE);
+    }
+    server.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.ptr = nullptr;  // the listening socket, connections carry their Connection
+    if (server.epoll_fd == -1 || epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, server.listen_socket, &event) == -1) {
+        printf("Error creating event loop\n");
+        exit(EXIT_FAILURE);
+    }
+    pthread_mutex_init(&server.mutex, nullptr);
+    pthread_cond_init(&server.wakeup, nullptr);
+
+    // the stop signals are only let in while the event loop waits, the workers never see them
+    sigset_t stop_signals, wait_mask;
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stop_signals, &wait_mask);
+    sigdelset(&wait_mask, SIGINT);
+    sigdelset(&wait_mask, SIGTERM);
+    struct sigaction action = {};
+    action.sa_handler = RequestStop;
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+
+    std::vector<pthread_t> workers(std::max(num_workers, 1u));
+    for (pthread_t& worker : workers) {
+        pthread_create(&worker, nullptr, ServeWorker, &server);
+    }
+    printf("Serving %s on %s with %zu workers\n", file_name, socket_path, workers.size());
+    fflush(stdout);
+
+    const int max_events = 64;
+    epoll_event events[max_events];
+    while (!stop_requested) {
+        int num_events = epoll_pwait(server.epoll_fd, events, max_events, -1, &wait_mask);
+        if (num_events == -1) {
+            if (errno == EINTR) continue;
+            printf("Error waiting for clients\n");
+            exit(EXIT_FAILURE);
+        }
+
+        pthread_mutex_lock(&server.mutex);
+        for (int i = 0; i < num_events; ++i) {
+            Connection* connection = static_cast<Connection*>(events[i].data.ptr);
+            if (connection != nullptr) {
+                server.ready.push_back(connection);
+                continue;
+            }
+            int client;
+            while ((client = accept4(server.listen_socket, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1) {
+                connection = new Connection();
+                connection->socket = client;
+                connection->session.writer.socket = client;
+                server.connections.insert(connection);
+                ArmConnection(&server, connection, EPOLL_CTL_ADD);
+            }
+        }
+        pthread_cond_broadcast(&server.wakeup);
+        pthread_mutex_unlock(&server.mutex);
+    }
+
+    // finish the batches already handed out, then drop the clients that are still connected
+    pthread_mutex_lock(&server.mutex);
+    server.stopping = true;
+    pthread_cond_broadcast(&server.wakeup);
+    pthread_mutex_unlock(&server.mutex);
+    for (pthread_t worker : workers) {
+        pthread_join(worker, nullptr);
+    }
+    for (Connection* connection : server.connections) {
+        close(connection->socket);
+        delete connection;
+    }
+    close(server.epoll_fd);
+    close(server.listen_socket);
+    unlink(socket_path);
+    pthread_cond_destroy(&server.wakeup);
+    pthread_mutex_destroy(&server.mutex);
+    pthread_sigmask(SIG_SETMASK, &wait_mask, nullptr);
+    DbClose(table);
+}
+
+void* LitDatabase::ServeWorker(void* argument) {
+    Server* server = static_cast<Server*>(argument);
+    while (true) {
+        pthread_mutex_lock(&server->mutex);
+        while (server->ready.empty() && !server->stopping) {
+            pthread_cond_wait(&server->wakeup, &server->mutex);
+        }
+        if (server->ready.empty()) {
+            pthread_mutex_unlock(&server->mutex);
+            return nullptr;
+        }
+        Connection* connection = server->ready.front();
+        server->ready.pop_front();
+        pthread_mutex_unlock(&server->mutex);
+
+        bool open = server->db->ServeConnection(server, connection);
+        // the mutex hands the connection back, the event loop takes it before giving the connection to a worker
+        pthread_mutex_lock(&server->mutex);
+        if (open) {
+            ArmConnection(server, connection, EPOLL_CTL_MOD);
+            pthread_mutex_unlock(&server->mutex);
+            continue;
+        }
+        server->connections.erase(connection);
+        pthread_mutex_unlock(&server->mutex);
+        // closing the socket also takes it out of the epoll set
+        close(connection->socket);
+        delete connection;
+    }
+}
+
+// read what the client sent and answer every complete request in it, false once the connection should be closed
+bool LitDatabase::ServeConnection(Server* server, Connection* connection) {
+    std::string& pending = connection->pending;
+    size_t old_size = pending.size();
+    pending.resize(old_size + SERVER_READ_SIZE);
+    ssize_t result;
+    do {
+        result = recv(connection->socket, &pending[old_size], SERVER_READ_SIZE, 0);
+    } while (result == -1 && errno == EINTR);
+    pending.resize(old_size + std::max<ssize_t>(result, 0));
+    if (result == 0 || (result == -1 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+        return false;
+    }
+
+    Session* session = &connection->session;
+    session->writer.corked = true;
+    bool open = true;
+    size_t start = 0;
+    size_t end;
+    while (open && (end = pending.find('\n', start)) != std::string::npos) {
+        size_t length = end - start;
+        if (length > 0 && pending[end - 1] == '\r') --length;
+        session->input_buffer.assign(pending, start, length);
+        session->input_buffer.push_back('\0');
+        session->cur = &session->input_buffer[0];
+        open = ServeRequest(server, session);
+        start = end + 1;
+    }
+    pending.erase(0, start);
+    if (open && pending.size() > SERVER_MAX_REQUEST) {
+        WriteText(&session->writer, "Error: Request too long.\n");
+        open = false;
+    }
+    session->writer.corked = false;
+    WriterFlush(&session->writer);
+    return open && !session->writer.failed;
+}
+
+// run one request line and write its status line, false if the client asked to disconnect
+bool LitDatabase::ServeRequest(Server* server, Session* session) {
+    ResultWriter* writer = &session->writer;
+    if (*session->cur == '\0') {
+        WriteText(writer, "Empty input\n");
+        return true;
+    }
+    if (*session->cur == '.') {
+        // meta commands act on the server process, a client may only leave or read the latencies
+        if (strcmp(session->cur, ".exit") == 0) return false;
+        if (strcmp(session->cur, ".latency") == 0) {
+            WriteText(writer, LatencyJson(server->table->pager).c_str());
+            return true;
+        }
+        WriteText(writer, "Unrecognized command: ");
+        WriteText(writer, session->cur);
+        WriteText(writer, "\n");
+        return true;
+    }
+
+    Statement statement;
+    switch (ParseStatement(session, &statement)) {
+        case PARSE_STATEMENT_SUCCESS: break;
+        case PARSE_STATEMENT_NEGATIVE_ID: WriteText(writer, "ID must be positive.\n"); return true;
+        case PARSE_STATEMENT_STRING_TOO_LONG: WriteText(writer, "String is too long.\n"); return true;
+        case PARSE_STATEMENT_ID_TOO_LARGE: WriteText(writer, "ID is too large.\n"); return true;
+        case PARSE_STATEMENT_SYNTAX_ERROR:
+            WriteText(writer, "Syntax error. Could not parse statement.\n");
+            return true;
+        case PARSE_STATEMENT_UNRECOGNIZED:
+            WriteText(writer, "Unrecognized keyword at start of ");
+            WriteText(writer, session->input_buffer.c_str());
+            WriteText(writer, "\n");
+            return true;
+    }
+
+    switch (ExecuteStatement(session, &statement, server->table)) {
+        case EXECUTE_SUCCESS: WriteText(writer, "Executed.\n"); break;
+        case EXECUTE_TABLE_FULL: WriteText(writer, "Error: Table full.\n"); break;
+        case EXECUTE_DUPLICATE_KEY: WriteText(writer, "Error: Duplicate key.\n"); break;
+        case EXECUTE_KEY_NOT_FOUND: WriteText(writer, "Error: Key not found.\n"); break;
+        case EXECUTE_INDEX_EXISTS: WriteText(writer, "Error: Index already exists.\n"); break;
+        case EXECUTE_TRANSACTION_OPEN: WriteText(writer, "Error: A transaction is open.\n"); break;
+        case EXECUTE_NO_TRANSACTION: WriteText(writer, "Error: No transaction is open.\n"); break;
+        default: WriteText(writer, "Error: Statement failed.\n"); break;
+    }
+    return true;
+}
@@ -0,0 +1,115 @@
+#include "LitDatabase.h"
+
+// Snapshot reads. A select that reads more than one id reads the table as the last commit before it started left it,
+// without taking the tree latch or any page latch, so a long scan neither holds up a split nor waits for one, and
+// rows committed meanwhile are not in its result. Every commit appends new images of the pages it changed to the
+// log and never overwrites an older one, so the image a snapshot sees is the newest one committed before it was
+// taken, or the one in the database file if the log has none. While snapshots are open the images a commit replaces
+// are remembered, and they are dropped with the last snapshot. The checkpoint that would write the log into the file
+// and empty it waits until then. Scans that always overlap would put it off for good, so once the log holds
+// WAL_SNAPSHOT_FRAMES committed frames new snapshots wait for the open ones to finish and the checkpoint to run,
+// which bounds both the log and the replaced images. Pages are read with pread into a page of the reader's own, never from the buffer
+// pool, where writers change them in place, and are not read ahead by the prefetcher, whose pages go to the pool.
+
+void LitDatabase::SnapshotOpen(Pager* pager, Snapshot* snapshot) {
+    Wal& wal = pager->wal;
+    pthread_mutex_lock(&pager->mutex);
+    // the last snapshot out, or the commit that took the log past the limit with none open, runs the checkpoint
+    while ((wal.commit_end - WAL_HEADER_SIZE) / WAL_FRAME_SIZE >= WAL_SNAPSHOT_FRAMES) {
+        pthread_cond_wait(&wal.checkpointed, &pager->mutex);
+    }
+    snapshot->commit_end = wal.commit_end;
+    wal.snapshots += 1;
+    pthread_mutex_unlock(&pager->mutex);
+}
+
+// a snapshot holds nothing of its own, closing one only counts it out. The last one out runs the checkpoint the
+// snapshots put off, through a commit of the statements that finished meanwhile.
+void LitDatabase::SnapshotClose(Pager* pager) {
+    Wal& wal = pager->wal;
+    pthread_mutex_lock(&pager->mutex);
+    wal.snapshots -= 1;
+    bool last = wal.snapshots == 0;
+    if (last) wal.replaced.clear();
+    bool log_full = (wal.commit_end - WAL_HEADER_SIZE) / WAL_FRAME_SIZE >= WAL_CHECKPOINT_FRAMES;
+    pthread_mutex_unlock(&pager->mutex);
+    if (last && log_full) WalCommit(pager);
+}
+
+// the log frame with the image of the page the snapshot sees, 0 if the database file has it. Called with the pager
+// mutex held.
+off_t LitDatabase::SnapshotFrame(Pager* pager, const Snapshot* snapshot, uint32_t page_num) {
+    Wal& wal = pager->wal;
+    auto it = wal.index.find(page_num);
+    if (it == wal.index.end()) return 0;
+    if (it->second < snapshot->commit_end) return it->second;
+    auto replaced = wal.replaced.find(page_num);
+    if (replaced != wal.replaced.end()) {
+        for (auto version = replaced->second.rbegin(); version != replaced->second.rend(); ++version) {
+            if (*version < snapshot->commit_end) return *version;
+        }
+    }
+    return 0;
+}
+
+// read the image of the page the snapshot sees
+void LitDatabase::SnapshotRead(Pager* pager, const Snapshot* snapshot, uint32_t page_num, void* page) {
+    Wal& wal = pager->wal;
+    pager->counters.snapshot_reads.fetch_add(1, std::memory_order_relaxed);
+    pthread_mutex_lock(&pager->mutex);
+    off_t frame = SnapshotFrame(pager, snapshot, page_num);
+    if (frame == 0 && pager->page_map.enabled) {
+        // extents only move in a checkpoint
+        pager->counters.bytes_read.fetch_add(PageMapRead(pager, page_num, page), std::memory_order_relaxed);
+        pthread_mutex_unlock(&pager->mutex);
+        return;
+    }
+    pthread_mutex_unlock(&pager->mutex);
+
+    ssize_t bytes_read;
+    if (frame != 0) {
+        bytes_read = pread(wal.file_descriptor, page, PAGE_SIZE, frame + WAL_FRAME_HEADER_SIZE);
+        if (bytes_read != PAGE_SIZE) {
+            printf("Error reading write-ahead log\n");
+            exit(EXIT_FAILURE);
+        }
+    } else {
+        bytes_read = pread(pager->file_descriptor, page, PAGE_SIZE, static_cast<off_t>(page_num) * PAGE_SIZE);
+        if (bytes_read == -1) {
+            printf("Error reading file\n");
+            exit(EXIT_FAILURE);
+        }
+        memset(static_cast<char*>(page) + bytes_read, 0, PAGE_SIZE - bytes_read);
+    }
+    pager->counters.bytes_read.fetch_add(bytes_read, std::memory_order_relaxed);
+}
+
+// have the kernel start reading the images of the pages the snapshot sees, so the reads of them that follow wait
+// for all of them at once rather than one after the other. Pages of a compressed file are left to be read.
+void LitDatabase::SnapshotPrefetch(Pager* pager, const Snapshot* snapshot, const std::vector<uint32_t>& page_nums) {
+    std::vector<std::pair<int, off_t>> reads;
+    pthread_mutex_lock(&pager->mutex);
+    for (uint32_t page_num : page_nums) {
+        off_t frame = SnapshotFrame(pager, snapshot, page_num);
+        if (frame != 0) {
+            reads.emplace_back(pager->wal.file_descriptor, frame + WAL_FRAME_HEADER_SIZE);
+        } else if (!pager->page_map.enabled) {
+            reads.emplace_back(pager->file_descriptor, static_cast<off_t>(page_num) * PAGE_SIZE);
+        }
+    }
+    pthread_mutex_unlock(&pager->mutex);
+    for (const auto& read : reads) {
+        posix_fadvise(read.first, read.second, PAGE_SIZE, POSIX_FADV_WILLNEED);
+    }
+}
+
+// a node to read: the page pinned in the buffer pool, or with a snapshot the image it sees, read into copy
+void* LitDatabase::ReadNode(Pager* pager, const Snapshot* snapshot, uint32_t page_num, void* copy) {
+    if (snapshot == nullptr) return GetPage(pager, page_num);
+    SnapshotRead(pager, snapshot, page_num, copy);
+    return copy;
+}
+
+void LitDatabase::ReleaseNode(Pager* pager, const Snapshot* snapshot, uint32_t page_num) {
+    if (snapshot == nullptr) UnpinPage(pager, page_num);
+}
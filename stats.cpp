@@ -0,0 +1,109 @@
+#include "LitDatabase.h"
+
+// Statistics for sizing the buffer pool and spotting fragmentation. The pager counts its hits, misses and bytes as it
+// goes, the shape of the tree is measured when asked for by walking every node of it. The walk holds the tree latch
+// shared, so no node splits or merges under it, and latches one node at a time, so writers only wait for the node
+// being looked at.
+
+DbStats LitDatabase::TableStats(Table* table) {
+    Pager* pager = table->pager;
+    DbStats stats;
+    stats.page_hits = pager->counters.page_hits.load(std::memory_order_relaxed);
+    stats.page_misses = pager->counters.page_misses.load(std::memory_order_relaxed);
+    stats.bytes_read = pager->counters.bytes_read.load(std::memory_order_relaxed);
+    stats.bytes_written = pager->counters.bytes_written.load(std::memory_order_relaxed);
+    stats.pages_prefetched = pager->counters.pages_prefetched.load(std::memory_order_relaxed);
+    stats.snapshot_reads = pager->counters.snapshot_reads.load(std::memory_order_relaxed);
+    stats.leaf_splits = pager->counters.leaf_splits.load(std::memory_order_relaxed);
+    stats.internal_splits = pager->counters.internal_splits.load(std::memory_order_relaxed);
+    stats.rightmost_hits = pager->counters.rightmost_hits.load(std::memory_order_relaxed);
+    stats.descents = pager->counters.descents.load(std::memory_order_relaxed);
+    stats.descent_levels = pager->counters.descent_levels.load(std::memory_order_relaxed);
+
+    // an import replaces the whole tree, it holds the schema latch exclusive
+    pthread_rwlock_rdlock(&table->schema_latch);
+    pthread_mutex_lock(&pager->mutex);
+    stats.file_bytes = pager->file_length;
+    stats.num_pages = pager->num_pages;
+    stats.frames_used = pager->page_table.size();
+    stats.max_frames = pager->mode == PAGER_BUFFER_POOL ? pager->max_frames : 0;
+    pthread_mutex_unlock(&pager->mutex);
+
+    LatchPage(pager, DB_HEADER_PAGE_NUM, LATCH_SHARED);
+    void* header = GetPage(pager, DB_HEADER_PAGE_NUM);
+    stats.free_pages = *HeaderFreelistCount(header);
+    UnpinPage(pager, DB_HEADER_PAGE_NUM);
+    UnlatchPage(pager, DB_HEADER_PAGE_NUM);
+
+    pthread_rwlock_rdlock(&table->tree_latch);
+    StatsWalk(pager, table->root_page_num, 1, &stats);
+    pthread_rwlock_unlock(&table->tree_latch);
+    pthread_rwlock_unlock(&table->schema_latch);
+
+    if (stats.leaf_nodes > 0) {
+        stats.rows_per_leaf = static_cast<double>(stats.num_rows) / stats.leaf_nodes;
+        stats.leaf_fill /= stats.leaf_nodes;
+    }
+    if (stats.internal_nodes > 0) {
+        stats.internal_fill /= stats.internal_nodes;
+    }
+    return stats;
+}
+
+// add the node and everything below it, the fills are summed here and averaged by TableStats
+void LitDatabase::StatsWalk(Pager* pager, uint32_t page_num, uint32_t depth, DbStats* stats) {
+    LatchPage(pager, page_num, LATCH_SHARED);
+    void* node = GetPage(pager, page_num);
+    stats->tree_height = std::max(stats->tree_height, depth);
+    if (get_node_type(node) == NODE_LEAF) {
+        stats->leaf_nodes += 1;
+        stats->num_rows += *LeafNodeNumCells(node);
+        stats->leaf_fragmented_bytes += *LeafNodeFragmented(node);
+        stats->leaf_fill += static_cast<double>(LeafNodeUsedSpace(node)) / LEAF_NODE_SPACE_FOR_CELLS;
+        UnpinPage(pager, page_num);
+        UnlatchPage(pager, page_num);
+        return;
+    }
+
+    uint32_t num_keys = *InternalNodeNumKeys(node);
+    stats->internal_nodes += 1;
+    stats->internal_fill += static_cast<double>(num_keys) / INTERNAL_NODE_MAX_CELLS;
+    std::vector<uint32_t> children;
+    for (uint32_t i = 0; i <= num_keys; ++i) {
+        children.push_back(*InternalNodeChild(node, i));
+    }
+    UnpinPage(pager, page_num);
+    UnlatchPage(pager, page_num);
+    for (uint32_t child_page_num : children) {
+        StatsWalk(pager, child_page_num, depth + 1, stats);
+    }
+}
+
+void LitDatabase::PrintStats(const DbStats& stats) {
+    uint64_t lookups = stats.page_hits + stats.page_misses;
+    printf("page_hits: %" PRIu64 "\n", stats.page_hits);
+    printf("page_misses: %" PRIu64 "\n", stats.page_misses);
+    printf("hit_ratio: %.4f\n", lookups > 0 ? static_cast<double>(stats.page_hits) / lookups : 0.0);
+    printf("bytes_read: %" PRIu64 "\n", stats.bytes_read);
+    printf("bytes_written: %" PRIu64 "\n", stats.bytes_written);
+    printf("pages_prefetched: %" PRIu64 "\n", stats.pages_prefetched);
+    printf("snapshot_reads: %" PRIu64 "\n", stats.snapshot_reads);
+    printf("leaf_splits: %" PRIu64 "\n", stats.leaf_splits);
+    printf("internal_splits: %" PRIu64 "\n", stats.internal_splits);
+    printf("rightmost_hits: %" PRIu64 "\n", stats.rightmost_hits);
+    printf("descents: %" PRIu64 "\n", stats.descents);
+    printf("descent_levels: %" PRIu64 "\n", stats.descent_levels);
+    printf("file_bytes: %" PRIu64 "\n", stats.file_bytes);
+    printf("num_pages: %u\n", stats.num_pages);
+    printf("free_pages: %u\n", stats.free_pages);
+    printf("frames_used: %u\n", stats.frames_used);
+    printf("max_frames: %u\n", stats.max_frames);
+    printf("tree_height: %u\n", stats.tree_height);
+    printf("leaf_nodes: %" PRIu64 "\n", stats.leaf_nodes);
+    printf("internal_nodes: %" PRIu64 "\n", stats.internal_nodes);
+    printf("num_rows: %" PRIu64 "\n", stats.num_rows);
+    printf("rows_per_leaf: %.2f\n", stats.rows_per_leaf);
+    printf("leaf_fill: %.4f\n", stats.leaf_fill);
+    printf("leaf_fragmented_bytes: %" PRIu64 "\n", stats.leaf_fragmented_bytes);
+    printf("internal_fill: %.4f\n", stats.internal_fill);
+}
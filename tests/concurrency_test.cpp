@@ -0,0 +1,224 @@
+#include <numeric>
+#include <random>
+#include <thread>
+
+#include "test_util.h"
+
+// Tests of statements running side by side on one table. Writers own disjoint ranges of ids and keep a model of
+// them, readers check that whatever they see is whole and in order, and the table matches the models at the end.
+
+namespace {
+
+const uint32_t WRITERS = 4;
+const uint32_t READERS = 3;
+const uint32_t WRITER_IDS = 600;
+
+std::string Username(uint32_t id, uint32_t version) {
+    return "u" + std::to_string(id) + "v" + std::to_string(version);
+}
+
+// a row is whole if its username names its id
+bool RowIsWhole(uint32_t id, const char* username) {
+    std::string prefix = "u" + std::to_string(id) + "v";
+    return strncmp(username, prefix.c_str(), prefix.size()) == 0;
+}
+
+// check the rows of table output are whole and in id order
+void CheckRows(const std::string& output) {
+    std::vector<uint32_t> ids;
+    std::istringstream lines(output);
+    std::string line;
+    while (std::getline(lines, line)) {
+        unsigned id;
+        char username[64];
+        if (!CHECK(sscanf(line.c_str(), "(%u, %63[^,]", &id, username) == 2) || !CHECK(RowIsWhole(id, username)) ||
+            !CHECK(ids.empty() || id > ids.back())) {
+            printf("  in %s\n", line.c_str());
+            break;
+        }
+        ids.push_back(id);
+    }
+}
+
+// the rows of a writer by id, username and email
+typedef std::map<uint32_t, std::pair<std::string, std::string>> Model;
+
+void Writer(TestDatabase* database, uint32_t writer_num, Model* model) {
+    Session session;
+    std::mt19937 random(writer_num + 1);
+    uint32_t first = 1 + writer_num * WRITER_IDS;
+    for (uint32_t version = 0; version < 1500; ++version) {
+        uint32_t id = first + random() % WRITER_IDS;
+        std::string key = std::to_string(id);
+        bool exists = model->count(id) != 0;
+        uint32_t action = random() % 10;
+        ExecuteResult result;
+        if (action < 5) {
+            std::string username = Username(id, version);
+            std::string email = std::string(random() % 200, 'e') + "@x";
+            database->RunIn(&session, "insert " + key + " " + username + " " + email, &result);
+            CHECK_EQ(result, exists ? EXECUTE_DUPLICATE_KEY : EXECUTE_SUCCESS);
+            if (!exists) (*model)[id] = {username, email};
+        } else if (action < 8) {
+            database->RunIn(&session, "delete where id = " + key, &result);
+            CHECK_EQ(result, exists ? EXECUTE_SUCCESS : EXECUTE_KEY_NOT_FOUND);
+            model->erase(id);
+        } else {
+            std::string email = std::string(random() % 250, 'z') + "@z";
+            database->RunIn(&session, "update set email = " + email + " where id = " + key, &result);
+            CHECK_EQ(result, exists ? EXECUTE_SUCCESS : EXECUTE_KEY_NOT_FOUND);
+            if (exists) (*model)[id].second = email;
+        }
+    }
+}
+
+void Reader(TestDatabase* database, uint32_t reader_num, const std::atomic<bool>* stop) {
+    Session session;
+    std::mt19937 random(100 + reader_num);
+    while (!stop->load()) {
+        uint32_t id = 1 + random() % (WRITERS * WRITER_IDS);
+        std::string key = std::to_string(id);
+        switch (random() % 5) {
+            case 0: CheckRows(database->RunIn(&session, "select where id = " + key)); break;
+            case 1: CheckRows(database->RunIn(&session, "select where id >= " + key + " limit 100")); break;
+            case 2: CheckRows(database->RunIn(&session, "select")); break;
+            case 3: {
+                unsigned long long count = 0;
+                std::string output = database->RunIn(&session, "select count(*) where id > " + key);
+                CHECK(sscanf(output.c_str(), "(%llu)", &count) == 1);
+                CHECK(count <= WRITERS * WRITER_IDS);
+                break;
+            }
+            default: {
+                std::vector<uint32_t> keys;
+                for (uint32_t i = 0; i < 30; ++i) keys.push_back(1 + random() % (WRITERS * WRITER_IDS));
+                std::vector<Row> rows = database->db->TableGetMany(database->table, keys);
+                for (size_t i = 0; i < rows.size(); ++i) {
+                    CHECK(RowIsWhole(rows[i].id, rows[i].username));
+                    CHECK(i == 0 || rows[i].id > rows[i - 1].id);
+                }
+            }
+        }
+    }
+}
+
+void RunWritersAndReaders(TestDatabase* database) {
+    database->db->scan_threads = 3;
+    std::vector<Model> models(WRITERS);
+    std::atomic<bool> stop(false);
+    std::vector<std::thread> writers;
+    std::vector<std::thread> readers;
+    for (uint32_t i = 0; i < WRITERS; ++i) writers.emplace_back(Writer, database, i, &models[i]);
+    for (uint32_t i = 0; i < READERS; ++i) readers.emplace_back(Reader, database, i, &stop);
+    for (std::thread& writer : writers) writer.join();
+    stop = true;
+    for (std::thread& reader : readers) reader.join();
+
+    std::string rows;
+    for (const auto& model : models) {
+        for (const auto& row : model) {
+            rows += "(" + std::to_string(row.first) + ", " + row.second.first + ", " + row.second.second + ")\n";
+        }
+    }
+    CHECK_EQ(database->Run("select"), rows);
+    database->Reopen();
+    CHECK_EQ(database->Run("select"), rows);
+}
+
+// writers that split, merge and borrow among one another, with a pool too small for the table
+void TestWritersAndReaders() {
+    TestDatabase database("threads.db", 16);
+    RunWritersAndReaders(&database);
+}
+
+void TestWritersAndReadersMmap() {
+    TestDatabase database("threads_mmap.db", POOL_DEFAULT_FRAMES, PAGER_MMAP);
+    RunWritersAndReaders(&database);
+}
+
+// the ids a snapshot sees, walking its leaves
+std::vector<uint32_t> SnapshotIds(TestDatabase* database, const Snapshot* snapshot) {
+    std::vector<uint32_t> ids;
+    Cursor* cursor = database->db->TableSeek(database->table, 0, CURSOR_READ, snapshot);
+    while (!cursor->end_of_table) {
+        ids.push_back(*database->db->LeafNodeKey(database->db->CursorLeaf(cursor), cursor->cell_num));
+        database->db->CursorAdvance(cursor);
+    }
+    database->db->CursorClose(cursor);
+    return ids;
+}
+
+// a snapshot sees the table as it was when it was taken however much is written after, the checkpoint that would
+// overwrite what it sees waits for it. Scans running beside a writer each see a whole number of its commits.
+void TestSnapshots() {
+    TestDatabase database("snapshots.db", 32);
+    std::vector<uint32_t> ids;
+    for (uint32_t id = 1; id <= 2000; ++id) {
+        CHECK_EQ(database.Execute(InsertStatement(id)), EXECUTE_SUCCESS);
+        ids.push_back(id);
+    }
+    database.Reopen();
+
+    Pager* pager = database.table->pager;
+    Snapshot snapshot;
+    database.db->SnapshotOpen(pager, &snapshot);
+    for (uint32_t id = 1; id <= 2000; id += 2) {
+        CHECK_EQ(database.Execute("delete where id = " + std::to_string(id)), EXECUTE_SUCCESS);
+        CHECK_EQ(database.Execute(InsertStatement(id + 5000)), EXECUTE_SUCCESS);
+    }
+    CHECK_EQ(database.Execute("update set username = changed where id = 2"), EXECUTE_SUCCESS);
+    // past the checkpoint, which the snapshot puts off
+    CHECK(FileSize(TestPath("snapshots.db-wal")) > WAL_HEADER_SIZE + WAL_CHECKPOINT_FRAMES * WAL_FRAME_SIZE);
+
+    CHECK(SnapshotIds(&database, &snapshot) == ids);
+    std::vector<Row> rows = database.db->TableGetMany(database.table, {1, 2, 5001}, &snapshot);
+    CHECK_EQ(rows.size(), 2u);
+    CHECK_EQ(rows[0].id, 1u);
+    CHECK_EQ(std::string(rows[1].username), TestUsername(2));
+    // the live tree has the writes
+    rows = database.db->TableGetMany(database.table, {1, 2, 5001});
+    CHECK_EQ(rows.size(), 2u);
+    CHECK_EQ(std::string(rows[0].username), "changed");
+    CHECK_EQ(rows[1].id, 5001u);
+    database.db->SnapshotClose(pager);
+    CHECK_EQ(database.Run("select count(*)"), "(2000)\n");
+    std::string changed = "(2, changed, " + TestEmail(2) + ")\n";
+    CHECK_EQ(database.Run("select where id between 1 and 4"), changed + ExpectedRows({4}));
+
+    // appended ids in order: a scan that sees a commit sees the ones before it, and later scans see no fewer
+    std::atomic<bool> stop(false);
+    std::thread writer([&]() {
+        Session session;
+        for (uint32_t id = 10001; id <= 12000; ++id) {
+            ExecuteResult result;
+            database.RunIn(&session, InsertStatement(id), &result);
+            CHECK_EQ(result, EXECUTE_SUCCESS);
+        }
+        stop = true;
+    });
+    Session session;
+    unsigned long long seen = 0;
+    uint32_t scans = 0;
+    while (!stop.load()) {
+        std::string output = database.RunIn(&session, "select where id > 10000");
+        unsigned long long count = std::count(output.begin(), output.end(), '\n');
+        std::vector<uint32_t> appended(count);
+        std::iota(appended.begin(), appended.end(), 10001);
+        if (!CHECK_EQ(output, ExpectedRows(appended)) || !CHECK(count >= seen)) break;
+        seen = count;
+        scans += 1;
+    }
+    writer.join();
+    CHECK(scans > 1);
+    CHECK_EQ(database.Run("select count(*) where id > 10000"), "(2000)\n");
+}
+
+}  // namespace
+
+int main() {
+    return RunTests({
+        {"writers and readers", TestWritersAndReaders},
+        {"writers and readers, mmap", TestWritersAndReadersMmap},
+        {"snapshots", TestSnapshots},
+    });
+}
@@ -0,0 +1,214 @@
+#include <numeric>
+#include <random>
+
+#include "test_util.h"
+
+// Tests of the pager: the buffer pool and how pages get to the file and back.
+
+namespace {
+
+std::vector<uint32_t> ShuffledIds(uint32_t count, uint32_t seed) {
+    std::vector<uint32_t> ids(count);
+    std::iota(ids.begin(), ids.end(), 1);
+    std::mt19937 random(seed);
+    std::shuffle(ids.begin(), ids.end(), random);
+    return ids;
+}
+
+std::vector<uint32_t> SortedIds(std::vector<uint32_t> ids) {
+    std::sort(ids.begin(), ids.end());
+    return ids;
+}
+
+// a table many times the size of the pool is written and read back through it, in one run and the next
+void TestBufferPoolEvicts() {
+    const uint32_t frames = 8;
+    TestDatabase database("evict.db", frames);
+    std::vector<uint32_t> ids = ShuffledIds(3000, 1);
+    for (uint32_t id : ids) {
+        CHECK_EQ(database.Execute(InsertStatement(id)), EXECUTE_SUCCESS);
+    }
+    DbStats stats = database.db->TableStats(database.table);
+    CHECK(stats.num_pages > 4 * frames);
+    CHECK(stats.frames_used <= frames);
+    CHECK_EQ(database.Run("select"), ExpectedRows(SortedIds(ids)));
+
+    // point selects read the live tree through the pool, scans would read a snapshot
+    database.Reopen();
+    for (uint32_t id : ids) {
+        CHECK_EQ(database.Run("select where id = " + std::to_string(id)), ExpectedRows({id}));
+    }
+    stats = database.db->TableStats(database.table);
+    CHECK(stats.page_misses > frames);
+    CHECK(stats.frames_used <= frames);
+}
+
+// only pages a statement changed are written, a session that only reads writes nothing
+void TestWritesOnlyDirtyPages() {
+    TestDatabase database("dirty.db");
+    for (uint32_t id = 1; id <= 3000; ++id) {
+        CHECK_EQ(database.Execute(InsertStatement(id)), EXECUTE_SUCCESS);
+    }
+
+    database.Reopen();
+    database.Run("select");
+    database.Run("select where id = 1500");
+    DbStats stats = database.db->TableStats(database.table);
+    CHECK_EQ(stats.bytes_written, 0u);
+
+    // the leaf and the row counts of its ancestors
+    CHECK_EQ(database.Execute(InsertStatement(3001)), EXECUTE_SUCCESS);
+    stats = database.db->TableStats(database.table);
+    CHECK(stats.bytes_written > 0);
+    CHECK(stats.bytes_written <= stats.tree_height * WAL_FRAME_SIZE);
+    CHECK(stats.num_pages > 4 * stats.tree_height);
+
+    database.Reopen();
+    CHECK_EQ(database.Run("select where id >= 2999"), ExpectedRows({2999, 3000, 3001}));
+}
+
+// a file written through the mapping reads the same through it and through the pool, and the other way round
+void TestMmapMode() {
+    TestDatabase database("mmap.db", POOL_DEFAULT_FRAMES, PAGER_MMAP);
+    std::vector<uint32_t> ids = ShuffledIds(3000, 2);
+    for (uint32_t id : ids) {
+        CHECK_EQ(database.Execute(InsertStatement(id)), EXECUTE_SUCCESS);
+    }
+    for (uint32_t id = 1; id <= 3000; id += 3) {
+        CHECK_EQ(database.Execute("delete where id = " + std::to_string(id)), EXECUTE_SUCCESS);
+        ids.erase(std::find(ids.begin(), ids.end(), id));
+    }
+    ids = SortedIds(ids);
+    CHECK_EQ(database.Run("select"), ExpectedRows(ids));
+
+    database.Reopen();
+    CHECK_EQ(database.Run("select"), ExpectedRows(ids));
+
+    database.mode = PAGER_BUFFER_POOL;
+    database.Reopen();
+    CHECK_EQ(database.Run("select"), ExpectedRows(ids));
+    for (uint32_t id = 3001; id <= 3100; ++id) {
+        CHECK_EQ(database.Execute(InsertStatement(id)), EXECUTE_SUCCESS);
+        ids.push_back(id);
+    }
+
+    database.mode = PAGER_MMAP;
+    database.Reopen();
+    CHECK_EQ(database.Run("select"), ExpectedRows(ids));
+}
+
+// the ids a cursor on the live tree steps over from the first row to the last, slowly enough that the leaves read
+// ahead of it get to the pool before it does
+std::vector<uint32_t> WalkLeaves(TestDatabase* database) {
+    std::vector<uint32_t> ids;
+    Cursor* cursor = database->db->TableSeek(database->table, 0);
+    uint32_t page_num = 0;
+    while (!cursor->end_of_table) {
+        if (cursor->page_num != page_num) {
+            page_num = cursor->page_num;
+            usleep(1000);
+        }
+        ids.push_back(*database->db->LeafNodeKey(database->db->CursorLeaf(cursor), cursor->cell_num));
+        database->db->CursorUnpinLeaf(cursor);
+        database->db->CursorAdvance(cursor);
+    }
+    database->db->CursorClose(cursor);
+    return ids;
+}
+
+// a cursor stepping along the leaves of a cold pool finds leaves read ahead of it there, and the same rows as
+// without read-ahead
+void TestReadAhead() {
+    const uint32_t frames = 64;
+    TestDatabase database("prefetch.db", frames);
+    std::vector<uint32_t> ids = ShuffledIds(3000, 4);
+    for (uint32_t id : ids) {
+        CHECK_EQ(database.Execute(InsertStatement(id)), EXECUTE_SUCCESS);
+    }
+    ids = SortedIds(ids);
+
+    database.Reopen();
+    CHECK(WalkLeaves(&database) == ids);
+    DbStats stats = database.db->TableStats(database.table);
+    CHECK(stats.pages_prefetched > 0);
+    // every leaf read ahead is one the cursor did not have to read
+    CHECK(stats.page_misses + stats.pages_prefetched <= stats.num_pages + stats.tree_height);
+    CHECK(stats.frames_used <= frames);
+
+    database.prefetch_leaves = 0;
+    database.Reopen();
+    CHECK(WalkLeaves(&database) == ids);
+    stats = database.db->TableStats(database.table);
+    CHECK_EQ(stats.pages_prefetched, 0u);
+    CHECK(stats.page_misses >= stats.leaf_nodes);
+    CHECK_EQ(database.Run("select"), ExpectedRows(ids));
+}
+
+// the rows of a file a workload of inserts, deletes and updates left behind
+std::string RunWorkload(TestDatabase* database) {
+    std::vector<uint32_t> ids = ShuffledIds(3000, 5);
+    for (uint32_t id : ids) {
+        CHECK_EQ(database->Execute(InsertStatement(id)), EXECUTE_SUCCESS);
+    }
+    for (uint32_t id = 1; id <= 3000; id += 4) {
+        CHECK_EQ(database->Execute("delete where id = " + std::to_string(id)), EXECUTE_SUCCESS);
+    }
+    for (uint32_t id = 2; id <= 3000; id += 4) {
+        CHECK_EQ(database->Execute("update set email = " + std::string(100, 'x') + " where id = " + std::to_string(id)),
+                 EXECUTE_SUCCESS);
+    }
+    return database->Run("select");
+}
+
+// a compressed file holds the rows an uncompressed one does in less space, is found compressed when it is opened
+// again whatever the database asks for, and comes back after a crash
+void TestCompressedPages() {
+    TestDatabase plain("plain.db");
+    std::string rows = RunWorkload(&plain);
+    plain.Close();
+
+    TestDatabase compressed("compressed.db", POOL_DEFAULT_FRAMES, PAGER_BUFFER_POOL, true);
+    CHECK(compressed.table->pager->page_map.enabled);
+    CHECK_EQ(RunWorkload(&compressed), rows);
+    compressed.Close();
+    CHECK(FileSize(TestPath("compressed.db")) * 2 < FileSize(TestPath("plain.db")));
+
+    compressed.compress = false;
+    compressed.Open();
+    CHECK(compressed.table->pager->page_map.enabled);
+    CHECK_EQ(compressed.Run("select"), rows);
+    // point selects read through the pool, which decompresses what it loads
+    CHECK_EQ(compressed.Run("select where id = 2"), "(2, " + TestUsername(2) + ", " + std::string(100, 'x') + ")\n");
+    CHECK_EQ(compressed.Run("select where id = 3"), ExpectedRows({3}));
+    CHECK_EQ(compressed.Run("select where id = 5"), "");
+    compressed.Close();
+
+    // pages grow out of their extents and move, the map has to follow them through the crash
+    int status = RunInChild([]() {
+        TestDatabase* crashing = new TestDatabase("compressed.db");
+        for (uint32_t id = 1; id <= 3000; id += 4) {
+            std::string key = std::to_string(id);
+            CHECK_EQ(crashing->Execute("insert " + key + " back " + std::string(200, 'y')), EXECUTE_SUCCESS);
+        }
+    });
+    CHECK_EQ(status, 0);
+    compressed.Open();
+    CHECK_EQ(compressed.Run("select count(*)"), "(3000)\n");
+    CHECK_EQ(compressed.Run("select where id = 1"), "(1, back, " + std::string(200, 'y') + ")\n");
+    compressed.Reopen();
+    CHECK_EQ(compressed.Run("select count(*)"), "(3000)\n");
+    CHECK_EQ(compressed.Run("select where id between 2 and 3"),
+             "(2, " + TestUsername(2) + ", " + std::string(100, 'x') + ")\n" + ExpectedRows({3}));
+}
+
+}  // namespace
+
+int main() {
+    return RunTests({
+        {"buffer pool evicts", TestBufferPoolEvicts},
+        {"writes only dirty pages", TestWritesOnlyDirtyPages},
+        {"mmap mode", TestMmapMode},
+        {"read ahead", TestReadAhead},
+        {"compressed pages", TestCompressedPages},
+    });
+}
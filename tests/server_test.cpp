@@ -0,0 +1,116 @@
+#include <thread>
+
+#include "test_util.h"
+
+// Tests of the server. It runs in a child process on a socket in the test directory, the test is its client.
+
+namespace {
+
+int Connect(const std::string& socket_path) {
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, socket_path.c_str());
+    // the server may not be listening yet
+    for (uint32_t attempt = 0; attempt < 500; ++attempt) {
+        int client = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (connect(client, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0) return client;
+        close(client);
+        usleep(10000);
+    }
+    CHECK(!"could not connect");
+    return -1;
+}
+
+void Send(int client, const std::string& requests) {
+    size_t sent = 0;
+    while (sent < requests.size()) {
+        ssize_t result = send(client, requests.data() + sent, requests.size() - sent, MSG_NOSIGNAL);
+        if (!CHECK(result > 0)) return;
+        sent += result;
+    }
+}
+
+// the answers until they are as long as expected, the connection is closed or nothing comes for five seconds
+std::string Receive(int client, size_t length) {
+    std::string answers;
+    char buffer[4096];
+    while (answers.size() < length) {
+        pollfd readable = {client, POLLIN, 0};
+        if (poll(&readable, 1, 5000) != 1) break;
+        ssize_t result = recv(client, buffer, sizeof(buffer), 0);
+        if (result <= 0) break;
+        answers.append(buffer, result);
+    }
+    return answers;
+}
+
+void CheckAnswers(int client, const std::string& requests, const std::string& expected) {
+    Send(client, requests);
+    CHECK_EQ(Receive(client, expected.size()), expected);
+}
+
+// requests are answered in order, pipelined or split over several sends, and clients are served side by side.
+// The server closes the database when it is stopped.
+void TestServer() {
+    std::string path = TestPath("server.db");
+    std::string socket_path = TestPath("server.sock");
+    fflush(stdout);
+    pid_t server = fork();
+    if (server == 0) {
+        LitDatabase db;
+        Table* table = db.DbOpen(path.c_str());
+        db.Serve(table, socket_path.c_str(), 2);
+        fflush(stdout);
+        _exit(0);
+    }
+
+    int client = Connect(socket_path);
+    CheckAnswers(client, "insert 1 a a@x\ninsert 2 b b@x\nselect\n",
+                 "Executed.\nExecuted.\n(1, a, a@x)\n(2, b, b@x)\nExecuted.\n");
+    CheckAnswers(client, "insert 1 a a@x\nselect where\nfrobnicate\n.tables\n\n",
+                 "Error: Duplicate key.\nSyntax error. Could not parse statement.\n"
+                 "Unrecognized keyword at start of frobnicate\nUnrecognized command: .tables\nEmpty input\n");
+    Send(client, "sel");
+    usleep(20000);
+    CheckAnswers(client, "ect where id = 2\r\n", "(2, b, b@x)\nExecuted.\n");
+
+    // two clients sending batches at once
+    auto insert_many = [&](uint32_t first) {
+        int other = Connect(socket_path);
+        std::string requests, expected;
+        for (uint32_t id = first; id < first + 200; ++id) {
+            requests += InsertStatement(id) + "\n";
+            expected += "Executed.\n";
+        }
+        CheckAnswers(other, requests, expected);
+        close(other);
+    };
+    std::thread first(insert_many, 100);
+    std::thread second(insert_many, 1000);
+    first.join();
+    second.join();
+    CheckAnswers(client, "select count(*)\n", "(402)\nExecuted.\n");
+
+    // .exit closes the connection after answering what came before it
+    CheckAnswers(client, "select where id = 1\n.exit\nselect\n", "(1, a, a@x)\nExecuted.\n");
+    CHECK_EQ(Receive(client, 1), "");
+    close(client);
+
+    kill(server, SIGTERM);
+    int status = 0;
+    waitpid(server, &status, 0);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    CHECK(access(socket_path.c_str(), F_OK) != 0);
+
+    TestDatabase database("server.db");
+    CHECK_EQ(database.Run("select count(*)"), "(402)\n");
+    CHECK_EQ(database.Run("select where id between 1000 and 1001"), ExpectedRows({1000, 1001}));
+}
+
+}  // namespace
+
+int main() {
+    return RunTests({
+        {"server", TestServer},
+    });
+}
@@ -0,0 +1,485 @@
+#include <fstream>
+#include <functional>
+#include <random>
+
+#include "test_util.h"
+
+// Tests of the statements: what selects find and print, indexes, aggregates, transactions and the meta commands.
+
+namespace {
+
+std::vector<uint32_t> IdsWhere(const std::vector<uint32_t>& ids, const std::function<bool(uint32_t)>& predicate) {
+    std::vector<uint32_t> matching;
+    for (uint32_t id : ids) {
+        if (predicate(id)) matching.push_back(id);
+    }
+    return matching;
+}
+
+std::vector<uint32_t> Slice(const std::vector<uint32_t>& ids, size_t offset, size_t limit) {
+    std::vector<uint32_t> slice;
+    for (size_t i = offset; i < ids.size() && i < offset + limit; ++i) slice.push_back(ids[i]);
+    return slice;
+}
+
+// what the function prints to stdout, for the meta commands that print there
+std::string CaptureStdout(const std::function<void()>& function) {
+    std::string path = TestPath("stdout.txt");
+    fflush(stdout);
+    std::cout.flush();
+    int saved = dup(STDOUT_FILENO);
+    int file = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    dup2(file, STDOUT_FILENO);
+    function();
+    fflush(stdout);
+    std::cout.flush();
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+    close(file);
+    std::ifstream captured(path);
+    std::stringstream contents;
+    contents << captured.rdbuf();
+    return contents.str();
+}
+
+// a counter or shape field of the .stats output
+double StatsField(const std::string& output, const std::string& name) {
+    size_t at = output.find("\n" + name + ": ");
+    if (!CHECK(at != std::string::npos)) return -1;
+    return atof(output.c_str() + at + name.size() + 3);
+}
+
+// every comparison on id finds the rows a filter of all of them would, a range is found by a seek and reads only
+// the leaves it covers
+void TestIdPredicates() {
+    TestDatabase database("predicates.db");
+    std::vector<uint32_t> ids;
+    for (uint32_t id = 2; id <= 20000; id += 2) {
+        CHECK_EQ(database.Execute(InsertStatement(id)), EXECUTE_SUCCESS);
+        ids.push_back(id);
+    }
+
+    CHECK_EQ(database.Run("select where id = 1000"), ExpectedRows({1000}));
+    CHECK_EQ(database.Run("select where id = 1001"), "");
+    CHECK_EQ(database.Run("select where id > 19990"), ExpectedRows({19992, 19994, 19996, 19998, 20000}));
+    CHECK_EQ(database.Run("select where id >= 19996"), ExpectedRows({19996, 19998, 20000}));
+    CHECK_EQ(database.Run("select where id < 7"), ExpectedRows({2, 4, 6}));
+    CHECK_EQ(database.Run("select where id <= 6"), ExpectedRows({2, 4, 6}));
+    CHECK_EQ(database.Run("select where id between 99 and 105"), ExpectedRows({100, 102, 104}));
+    CHECK_EQ(database.Run("select where id between 105 and 99"), "");
+    CHECK_EQ(database.Run("select where id < 0"), "");
+    CHECK_EQ(database.Run("select where id > 4294967295"), "");
+    CHECK_EQ(database.Run("select where id > 5000 limit 4"), ExpectedRows({5002, 5004, 5006, 5008}));
+    CHECK_EQ(database.Run("select limit 0"), "");
+    CHECK_EQ(database.Run("select where id >= 10001"),
+             ExpectedRows(IdsWhere(ids, [](uint32_t id) { return id >= 10001; })));
+    CHECK_EQ(database.Run("select where id < 10001 limit 100"),
+             ExpectedRows(Slice(IdsWhere(ids, [](uint32_t id) { return id < 10001; }), 0, 100)));
+
+    database.db->TimerStart(database.session.get(), database.table->pager);
+    CHECK_EQ(database.Run("select where id between 10000 and 10010"),
+             ExpectedRows({10000, 10002, 10004, 10006, 10008, 10010}));
+    database.db->TimerFinish(database.session.get(), database.table->pager);
+    DbStats stats = database.db->TableStats(database.table);
+    CHECK(stats.leaf_nodes > 20);
+    CHECK(database.session->timer.pages <= stats.tree_height + 1);
+
+    // ids are unsigned 32 bit numbers
+    CHECK_EQ(database.Execute("insert 4294967295 last l@x"), EXECUTE_SUCCESS);
+    CHECK_EQ(database.Run("select where id >= 4294967295"), "(4294967295, last, l@x)\n");
+    CHECK_EQ(database.Parse("insert 4294967296 over o@x"), PARSE_STATEMENT_ID_TOO_LARGE);
+    CHECK_EQ(database.Parse("select where id = 99999999999999999999999"), PARSE_STATEMENT_ID_TOO_LARGE);
+    CHECK_EQ(database.Parse("insert -1 negative n@x"), PARSE_STATEMENT_NEGATIVE_ID);
+    CHECK_EQ(database.Parse("select where id > -1"), PARSE_STATEMENT_NEGATIVE_ID);
+    CHECK_EQ(database.Parse("select where id ! 4"), PARSE_STATEMENT_SYNTAX_ERROR);
+    CHECK_EQ(database.Parse("select where id = 4 limit"), PARSE_STATEMENT_SYNTAX_ERROR);
+}
+
+// rows print the same in every mode whatever the buffer boundaries, fields that need it are quoted or escaped
+void TestOutputModes() {
+    TestDatabase database("output.db");
+    CHECK_EQ(database.Execute("insert 7 a\"b,c x\\y"), EXECUTE_SUCCESS);
+    CHECK_EQ(database.Run("select"), "(7, a\"b,c, x\\y)\n");
+    database.Meta(".mode csv");
+    CHECK_EQ(database.Run("select"), "7,\"a\"\"b,c\",x\\y\n");
+    database.Meta(".mode tsv");
+    CHECK_EQ(database.Run("select"), "7\ta\"b,c\tx\\\\y\n");
+    database.Meta(".mode binary");
+    uint32_t binary_id = 7;
+    std::string binary(reinterpret_cast<const char*>(&binary_id), sizeof(binary_id));
+    binary += std::string(1, 5) + "a\"b,c" + std::string(1, 3) + "x\\y";
+    CHECK_EQ(database.Run("select"), binary);
+    database.Meta(".mode table");
+    CHECK_EQ(database.Execute("delete where id = 7"), EXECUTE_SUCCESS);
+
+    // many times the size of the output buffer
+    std::vector<uint32_t> ids;
+    for (uint32_t id = 1; id <= 30000; ++id) {
+        CHECK_EQ(database.Execute(InsertStatement(id)), EXECUTE_SUCCESS);
+        ids.push_back(id);
+    }
+    std::string rows = ExpectedRows(ids);
+    CHECK(rows.size() > 4 * RESULT_BUFFER_SIZE);
+    CHECK_EQ(database.Run("select"), rows);
+
+    // .output sends rows to a file until it is switched back
+    std::string path = TestPath("rows.txt");
+    database.Meta(".output " + path);
+    CHECK_EQ(database.Parse("select"), PARSE_STATEMENT_SUCCESS);
+    std::string row = CaptureStdout([&]() {
+        CHECK_EQ(database.db->ExecuteStatement(database.session.get(), &database.statement, database.table),
+                 EXECUTE_SUCCESS);
+    });
+    database.Meta(".output stdout");
+    std::ifstream file(path);
+    std::string written((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    CHECK_EQ(written, rows);
+}
+
+// selects by username or email through an index find the rows a filter of every row would, as rows come, change
+// and go. The username index is built over rows already there, the email one is kept from the start.
+void TestSecondaryIndexes() {
+    TestDatabase database("index.db");
+    CHECK_EQ(database.Execute("create index on email"), EXECUTE_SUCCESS);
+    std::map<uint32_t, std::pair<std::string, std::string>> rows;
+    auto insert = [&](uint32_t id, const std::string& username, const std::string& email) {
+        CHECK_EQ(database.Execute("insert " + std::to_string(id) + " " + username + " " + email), EXECUTE_SUCCESS);
+        rows[id] = {username, email};
+    };
+    for (uint32_t id = 1; id <= 3000; ++id) {
+        insert(id, "name" + std::to_string(id % 50), "mail" + std::to_string(id % 700) + "@x");
+    }
+    CHECK_EQ(database.Execute("create index on username"), EXECUTE_SUCCESS);
+    CHECK_EQ(database.Execute("create index on username"), EXECUTE_INDEX_EXISTS);
+
+    for (uint32_t id = 5; id <= 3000; id += 7) {
+        CHECK_EQ(database.Execute("delete where id = " + std::to_string(id)), EXECUTE_SUCCESS);
+        rows.erase(id);
+    }
+    for (uint32_t id = 3; id <= 3000; id += 11) {
+        if (rows.count(id) == 0) continue;
+        CHECK_EQ(database.Execute("update set username = name7 where id = " + std::to_string(id)), EXECUTE_SUCCESS);
+        rows[id].first = "name7";
+    }
+    for (uint32_t id = 3001; id <= 3300; ++id) insert(id, "name7", "new" + std::to_string(id % 3) + "@x");
+
+    auto expected = [&](bool by_username, const std::string& value, uint32_t above) {
+        std::string text;
+        for (const auto& row : rows) {
+            if (row.first <= above || (by_username ? row.second.first : row.second.second) != value) continue;
+            text += "(" + std::to_string(row.first) + ", " + row.second.first + ", " + row.second.second + ")\n";
+        }
+        return text;
+    };
+    for (uint32_t round = 0; round < 2; ++round) {
+        for (uint32_t n = 0; n < 50; n += 7) {
+            std::string name = "name" + std::to_string(n);
+            CHECK_EQ(database.Run("select where username = " + name), expected(true, name, 0));
+            CHECK_EQ(database.Run("select where id > 1500 and username = " + name), expected(true, name, 1500));
+        }
+        for (const std::string& email : {"mail0@x", "mail699@x", "new1@x", "none@x"}) {
+            CHECK_EQ(database.Run("select where email = " + email), expected(false, email, 0));
+        }
+        CHECK(!expected(true, "name7", 0).empty());
+        database.Reopen();
+    }
+
+    // a lookup reads down the index and to the leaf of the row it finds, not the whole table
+    insert(5000, "name5000", "unique@x");
+    database.db->TimerStart(database.session.get(), database.table->pager);
+    CHECK_EQ(database.Run("select where email = unique@x"), "(5000, name5000, unique@x)\n");
+    database.db->TimerFinish(database.session.get(), database.table->pager);
+    DbStats stats = database.db->TableStats(database.table);
+    CHECK(database.session->timer.pages * 3 < stats.leaf_nodes);
+}
+
+// aggregates split over scan workers come out as they do from one, and as a model of the rows says
+void TestParallelAggregates() {
+    TestDatabase database("aggregate.db");
+    std::vector<uint32_t> ids;
+    for (uint32_t id = 3; id <= 60000; id += 3) {
+        CHECK_EQ(database.Execute("insert " + std::to_string(id) + " g" + std::to_string(id % 7) + " e@x"),
+                 EXECUTE_SUCCESS);
+        ids.push_back(id);
+    }
+    auto expected = [&](uint32_t low, uint32_t high, int group) {
+        uint64_t count = 0, sum = 0;
+        uint32_t min = 0, max = 0;
+        for (uint32_t id : ids) {
+            if (id < low || id > high || (group >= 0 && id % 7 != static_cast<uint32_t>(group))) continue;
+            if (count++ == 0) min = id;
+            max = id;
+            sum += id;
+        }
+        if (count == 0) return std::string("(0, 0, NULL, NULL)\n");
+        return "(" + std::to_string(count) + ", " + std::to_string(sum) + ", " + std::to_string(min) + ", " +
+               std::to_string(max) + ")\n";
+    };
+    for (uint32_t threads : {1u, 4u}) {
+        database.db->scan_threads = threads;
+        CHECK_EQ(database.Run("select count(*), sum(id), min(id), max(id)"), expected(0, UINT32_MAX, -1));
+        std::mt19937 random(37);
+        for (uint32_t i = 0; i < 40; ++i) {
+            uint32_t low = random() % 61000;
+            uint32_t high = low + random() % 30000;
+            int group = random() % 8 - 1;
+            std::string query = "select count(*), sum(id), min(id), max(id) where id between " + std::to_string(low) +
+                                " and " + std::to_string(high);
+            if (group >= 0) query += " and username = g" + std::to_string(group);
+            CHECK_EQ(database.Run(query), expected(low, high, group));
+        }
+    }
+}
+
+// a multi-row insert or a transaction is applied whole or not at all, and a commit that returned survives a crash
+void TestTransactions() {
+    TestDatabase database("transactions.db");
+    CHECK_EQ(database.Execute("insert values (1, a, a@x), (3, c, c@x),(2, b, b@x)"), EXECUTE_SUCCESS);
+    CHECK_EQ(database.Run("select"), "(1, a, a@x)\n(2, b, b@x)\n(3, c, c@x)\n");
+    CHECK_EQ(database.Execute("insert values (4, d, d@x), (1, a, a@x)"), EXECUTE_DUPLICATE_KEY);
+    CHECK_EQ(database.Execute("insert values (4, d, d@x), (4, d, d@x)"), EXECUTE_DUPLICATE_KEY);
+    CHECK_EQ(database.Run("select count(*)"), "(3)\n");
+
+    // the statements see what the ones before them did
+    CHECK_EQ(database.Execute("begin"), EXECUTE_SUCCESS);
+    CHECK_EQ(database.Execute("begin"), EXECUTE_TRANSACTION_OPEN);
+    CHECK_EQ(database.Execute("insert 4 d d@x"), EXECUTE_SUCCESS);
+    CHECK_EQ(database.Execute("delete where id = 1"), EXECUTE_SUCCESS);
+    CHECK_EQ(database.Execute("insert 1 again a@y"), EXECUTE_SUCCESS);
+    CHECK_EQ(database.Execute("update set email = d@y where id = 4"), EXECUTE_SUCCESS);
+    CHECK_EQ(database.Execute("select"), EXECUTE_TRANSACTION_OPEN);
+    CHECK_EQ(database.Execute("create index on email"), EXECUTE_TRANSACTION_OPEN);
+    CHECK_EQ(database.Execute("commit"), EXECUTE_SUCCESS);
+    CHECK_EQ(database.Run("select"), "(1, again, a@y)\n(2, b, b@x)\n(3, c, c@x)\n(4, d, d@y)\n");
+
+    // a statement that would fail fails the commit before anything is written
+    CHECK_EQ(database.Execute("begin"), EXECUTE_SUCCESS);
+    CHECK_EQ(database.Execute("insert 5 e e@x"), EXECUTE_SUCCESS);
+    CHECK_EQ(database.Execute("delete where id = 2"), EXECUTE_SUCCESS);
+    CHECK_EQ(database.Execute("update set email = x@x where id = 2"), EXECUTE_SUCCESS);
+    CHECK_EQ(database.Execute("commit"), EXECUTE_KEY_NOT_FOUND);
+    CHECK_EQ(database.Execute("begin"), EXECUTE_SUCCESS);
+    CHECK_EQ(database.Execute("insert 5 e e@x"), EXECUTE_SUCCESS);
+    CHECK_EQ(database.Execute("rollback"), EXECUTE_SUCCESS);
+    CHECK_EQ(database.Execute("commit"), EXECUTE_NO_TRANSACTION);
+    CHECK_EQ(database.Execute("rollback"), EXECUTE_NO_TRANSACTION);
+    CHECK_EQ(database.Run("select"), "(1, again, a@y)\n(2, b, b@x)\n(3, c, c@x)\n(4, d, d@y)\n");
+    database.Close();
+
+    int status = RunInChild([]() {
+        TestDatabase* crashing = new TestDatabase("transactions.db");
+        std::string rows = "insert values ";
+        for (uint32_t id = 10; id < 1010; ++id) {
+            std::string key = std::to_string(id);
+            rows += (id == 10 ? "(" : ", (") + key + ", " + TestUsername(id) + ", " + TestEmail(id) + ")";
+        }
+        CHECK_EQ(crashing->Execute(rows), EXECUTE_SUCCESS);
+        CHECK_EQ(crashing->Execute("begin"), EXECUTE_SUCCESS);
+        CHECK_EQ(crashing->Execute("delete where id = 10"), EXECUTE_SUCCESS);
+        CHECK_EQ(crashing->Execute("insert 2000 lost l@x"), EXECUTE_SUCCESS);
+    });
+    CHECK_EQ(status, 0);
+    database.Open();
+    std::vector<uint32_t> ids;
+    for (uint32_t id = 10; id < 1010; ++id) ids.push_back(id);
+    CHECK_EQ(database.Run("select where id >= 5"), ExpectedRows(ids));
+}
+
+// the counters follow what the statements did and the shape of the tree is the one a walk of it finds, .stats
+// prints the same numbers
+void TestStats() {
+    const uint32_t frames = 16;
+    TestDatabase database("stats.db", frames);
+    std::vector<uint32_t> ids;
+    std::mt19937 random(11);
+    for (uint32_t i = 0; i < 3000; ++i) ids.push_back(i + 1);
+    std::shuffle(ids.begin(), ids.end(), random);
+    for (uint32_t id : ids) CHECK_EQ(database.Execute(InsertStatement(id)), EXECUTE_SUCCESS);
+
+    DbStats stats = database.db->TableStats(database.table);
+    CHECK_EQ(stats.num_rows, 3000u);
+    CHECK(stats.tree_height >= 2);
+    CHECK(stats.internal_nodes >= 1);
+    // every leaf but the first came from a split, nothing was merged
+    CHECK_EQ(stats.leaf_splits, stats.leaf_nodes - 1);
+    CHECK_EQ(stats.rows_per_leaf, static_cast<double>(stats.num_rows) / stats.leaf_nodes);
+    CHECK(stats.leaf_fill > 0.4 && stats.leaf_fill <= 1.0);
+    CHECK(stats.internal_fill > 0.0 && stats.internal_fill <= 1.0);
+    CHECK(stats.leaf_nodes + stats.internal_nodes + 1 <= stats.num_pages);
+    CHECK_EQ(stats.max_frames, frames);
+    CHECK(stats.frames_used <= frames);
+    // the table is larger than the pool, so pages were evicted and read again
+    CHECK(stats.page_misses > stats.num_pages);
+    CHECK(stats.page_hits > 0);
+    CHECK(stats.bytes_read > 0);
+    CHECK(stats.bytes_written > 0);
+    CHECK(stats.descents >= 3000);
+    CHECK(stats.descent_levels >= stats.descents);
+    CHECK_EQ(stats.free_pages, 0u);
+
+    // deletes leave fragmented space or free pages behind, and the counters only grow
+    for (uint32_t id = 1; id <= 3000; id += 3) {
+        CHECK_EQ(database.Execute("delete where id = " + std::to_string(id)), EXECUTE_SUCCESS);
+    }
+    database.Run("select");
+    DbStats after = database.db->TableStats(database.table);
+    CHECK_EQ(after.num_rows, 2000u);
+    CHECK(after.leaf_fragmented_bytes > 0 || after.leaf_nodes < stats.leaf_nodes);
+    CHECK(after.page_hits + after.page_misses > stats.page_hits + stats.page_misses);
+    CHECK(after.descents > stats.descents);
+
+    std::string output = CaptureStdout([&]() { CHECK_EQ(database.Meta(".stats"), PARSE_META_SUCCESS); });
+    CHECK_EQ(StatsField(output, "num_rows"), 2000.0);
+    CHECK_EQ(StatsField(output, "leaf_nodes"), static_cast<double>(after.leaf_nodes));
+    CHECK_EQ(StatsField(output, "tree_height"), static_cast<double>(after.tree_height));
+    CHECK_EQ(StatsField(output, "max_frames"), static_cast<double>(frames));
+    CHECK_EQ(StatsField(output, "leaf_splits"), static_cast<double>(after.leaf_splits));
+
+    // a reopened database counts from zero and has the same shape
+    database.Reopen();
+    DbStats reopened = database.db->TableStats(database.table);
+    CHECK_EQ(reopened.leaf_splits, 0u);
+    CHECK_EQ(reopened.num_rows, 2000u);
+    CHECK_EQ(reopened.leaf_nodes, after.leaf_nodes);
+    CHECK_EQ(reopened.tree_height, after.tree_height);
+}
+
+// a select of many ids finds what a filter of every row would, whatever order, repeats and misses they come in, and
+// reads each node on the way to them once
+void TestSelectIn() {
+    TestDatabase database("select_in.db", 16);
+    std::vector<uint32_t> ids;
+    for (uint32_t id = 3; id <= 15000; id += 3) ids.push_back(id);
+    std::mt19937 random(12);
+    std::vector<uint32_t> shuffled = ids;
+    std::shuffle(shuffled.begin(), shuffled.end(), random);
+    for (uint32_t id : shuffled) CHECK_EQ(database.Execute(InsertStatement(id)), EXECUTE_SUCCESS);
+
+    for (uint32_t round = 0; round < 20; ++round) {
+        std::vector<uint32_t> keys;
+        uint32_t num_keys = 1 + random() % 300;
+        for (uint32_t i = 0; i < num_keys; ++i) keys.push_back(random() % 15100);
+        if (round % 2 == 0) keys.push_back(keys.front());
+        std::string list;
+        for (uint32_t key : keys) list += (list.empty() ? "" : ", ") + std::to_string(key);
+        auto wanted = [&](uint32_t id) { return std::find(keys.begin(), keys.end(), id) != keys.end(); };
+        std::vector<uint32_t> found = IdsWhere(ids, wanted);
+        CHECK_EQ(database.Run("select where id in (" + list + ")"), ExpectedRows(found));
+        CHECK_EQ(database.Run("select count(*) where id in (" + list + ")"),
+                 "(" + std::to_string(found.size()) + ")\n");
+        CHECK_EQ(database.Run("select where id in (" + list + ") limit 5 offset 2"), ExpectedRows(Slice(found, 2, 5)));
+
+        std::vector<Row> rows = database.db->TableGetMany(database.table, keys);
+        CHECK_EQ(rows.size(), found.size());
+        for (size_t i = 0; i < rows.size() && i < found.size(); ++i) {
+            CHECK_EQ(rows[i].id, found[i]);
+            CHECK_EQ(std::string(rows[i].email), TestEmail(found[i]));
+        }
+    }
+    CHECK_EQ(database.Run("select where id in (9, 10) and username = user9"), ExpectedRows({9}));
+    CHECK_EQ(database.Run("select where id in (10, 11)"), "");
+    CHECK_EQ(database.Run("select where id in (15000, 3, 15000)"), ExpectedRows({3, 15000}));
+
+    // every third row of the table, one walk reads each node at most once where a descent each would read each
+    // path again
+    std::string list;
+    for (size_t i = 0; i < ids.size(); i += 3) list += (list.empty() ? "" : ", ") + std::to_string(ids[i]);
+    DbStats before = database.db->TableStats(database.table);
+    database.Run("select count(*) where id in (" + list + ")");
+    DbStats after = database.db->TableStats(database.table);
+    CHECK(after.snapshot_reads - before.snapshot_reads <= after.leaf_nodes + after.internal_nodes);
+    CHECK_EQ(after.descents - before.descents, 1u);
+}
+
+// a number following the key in the JSON, from the position given on
+uint64_t JsonNumber(const std::string& json, const std::string& key, size_t from = 0) {
+    size_t at = json.find("\"" + key + "\": ", from);
+    if (!CHECK(at != std::string::npos)) return 0;
+    return strtoull(json.c_str() + at + key.size() + 4, nullptr, 10);
+}
+
+// every statement is counted in the histogram of its class, whose buckets and percentiles agree with the count. The
+// timer of a statement has the descents and page reads it made.
+void TestLatency() {
+    TestDatabase database("latency.db");
+    for (uint32_t id = 1; id <= 500; ++id) CHECK_EQ(database.Execute(InsertStatement(id)), EXECUTE_SUCCESS);
+    for (uint32_t id = 1; id <= 40; ++id) database.Run("select where id = " + std::to_string(id));
+    for (uint32_t i = 0; i < 7; ++i) database.Run("select where id > 100");
+    for (uint32_t i = 0; i < 3; ++i) database.Run("select where id in (1, 2, 3)");
+    database.Run("select where username = user7");
+    CHECK_EQ(database.Execute("delete where id = 1"), EXECUTE_SUCCESS);
+    CHECK_EQ(database.Execute("insert 1 a a@x"), EXECUTE_SUCCESS);
+
+    std::string path = TestPath("latency.json");
+    CHECK_EQ(database.Meta(".latency " + path), PARSE_META_SUCCESS);
+    std::ifstream file(path);
+    std::stringstream contents;
+    contents << file.rdbuf();
+    std::string json = contents.str();
+    const std::pair<const char*, uint64_t> classes[] = {
+        {"insert", 501}, {"point_select", 40}, {"select", 4}, {"scan", 7}, {"other", 1}};
+    for (const auto& expected : classes) {
+        size_t at = json.find("\"" + std::string(expected.first) + "\": {");
+        if (!CHECK(at != std::string::npos)) continue;
+        CHECK_EQ(JsonNumber(json, "count", at), expected.second);
+        uint64_t p50 = JsonNumber(json, "p50_ns", at);
+        uint64_t p99 = JsonNumber(json, "p99_ns", at);
+        uint64_t max = JsonNumber(json, "max_ns", at);
+        CHECK(p50 > 0 && p50 <= p99 && p99 <= max);
+        // the bucket counts add up to the count
+        size_t buckets = json.find("\"buckets\": [", at);
+        size_t end = json.find("]}", buckets);
+        uint64_t total = 0;
+        for (size_t pair = json.find('[', buckets + 12); pair < end; pair = json.find('[', pair + 1)) {
+            unsigned long long high, count;
+            if (CHECK(sscanf(json.c_str() + pair, "[%llu, %llu]", &high, &count) == 2)) total += count;
+        }
+        CHECK_EQ(total, expected.second);
+    }
+
+    // a point select goes down one path, a few page reads however large the table
+    database.Reopen();
+    CHECK_EQ(database.Meta(".timer on"), PARSE_META_SUCCESS);
+    CHECK(database.session->timer_on);
+    uint32_t height = database.db->TableStats(database.table).tree_height;
+    database.db->TimerStart(database.session.get(), database.table->pager);
+    CHECK_EQ(database.Parse("select where id = 250"), PARSE_STATEMENT_SUCCESS);
+    database.db->TimerParsed(database.session.get());
+    std::string row = CaptureStdout([&]() {
+        CHECK_EQ(database.db->ExecuteStatement(database.session.get(), &database.statement, database.table),
+                 EXECUTE_SUCCESS);
+    });
+    database.db->TimerFinish(database.session.get(), database.table->pager);
+    const StatementTimer& timer = database.session->timer;
+    CHECK_EQ(timer.descents, 1u);
+    CHECK_EQ(timer.descent_levels, static_cast<uint64_t>(height));
+    CHECK(timer.pages >= height && timer.pages <= 4 * height);
+    CHECK(timer.execute_nanoseconds > 0);
+    CHECK_EQ(row, ExpectedRows({250}));
+    std::string printed = CaptureStdout([&]() { database.db->PrintTimer(timer); });
+    CHECK(printed.find("Timer: parse ") == 0);
+    CHECK(printed.find(", 1 descents of " + std::to_string(height) + ".0 levels, ") != std::string::npos);
+    CHECK_EQ(database.Meta(".timer off"), PARSE_META_SUCCESS);
+    CHECK(!database.session->timer_on);
+    CHECK_EQ(CaptureStdout([&]() { database.Meta(".timer maybe"); }), "Usage: .timer on|off\n");
+
+    // a reopened database counts from nothing
+    std::string reopened = CaptureStdout([&]() { database.Meta(".latency"); });
+    CHECK_EQ(JsonNumber(reopened, "count"), 0u);
+    CHECK_EQ(JsonNumber(reopened, "count", reopened.find("\"point_select\"")), 1u);
+}
+
+}  // namespace
+
+int main() {
+    return RunTests({
+        {"id predicates", TestIdPredicates},
+        {"output modes", TestOutputModes},
+        {"secondary indexes", TestSecondaryIndexes},
+        {"parallel aggregates", TestParallelAggregates},
+        {"transactions", TestTransactions},
+        {"stats", TestStats},
+        {"select in", TestSelectIn},
+        {"latency", TestLatency},
+    });
+}
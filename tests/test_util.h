@@ -0,0 +1,224 @@
+#ifndef LITDB_TESTS_TEST_UTIL_H
+#define LITDB_TESTS_TEST_UTIL_H
+
+// Shared by the tests. A test file is one executable that runs its tests in order and fails if any check in them
+// failed, ctest runs each of them. The tests drive the engine in process through the calls the shell makes, on
+// database files in a directory of their own that is removed at the end.
+
+#include <dirent.h>
+#include <sys/wait.h>
+
+#include <functional>
+#include <memory>
+#include <sstream>
+
+#include "LitDatabase.h"
+
+namespace {
+
+std::atomic<int> check_failures(0);
+
+inline void CheckFailed(const char* file, int line, const std::string& message) {
+    printf("%s:%d: check failed: %s\n", file, line, message.c_str());
+    check_failures += 1;
+}
+
+template <typename T>
+std::string Describe(const T& value) {
+    std::ostringstream stream;
+    stream << value;
+    return stream.str();
+}
+
+template <typename A, typename B>
+bool CheckEqual(const A& actual, const B& expected, const char* text, const char* file, int line) {
+    if (actual == expected) return true;
+    CheckFailed(file, line, std::string(text) + " is " + Describe(actual) + ", expected " + Describe(expected));
+    return false;
+}
+
+#define CHECK(condition) ((condition) ? true : (CheckFailed(__FILE__, __LINE__, #condition), false))
+#define CHECK_EQ(actual, expected) CheckEqual((actual), (expected), #actual, __FILE__, __LINE__)
+
+// the directory the databases of the tests go in, made on first use
+inline std::string TestDirectory() {
+    static std::string directory;
+    if (directory.empty()) {
+        const char* tmpdir = getenv("TMPDIR");
+        std::string pattern = std::string(tmpdir != nullptr ? tmpdir : "/tmp") + "/litdb_test.XXXXXX";
+        if (mkdtemp(&pattern[0]) == nullptr) {
+            printf("Unable to create %s\n", pattern.c_str());
+            exit(EXIT_FAILURE);
+        }
+        directory = pattern;
+    }
+    return directory;
+}
+
+inline std::string TestPath(const std::string& name) { return TestDirectory() + "/" + name; }
+
+inline void RemoveTestDirectory() {
+    std::string directory = TestDirectory();
+    DIR* dir = opendir(directory.c_str());
+    if (dir == nullptr) return;
+    while (dirent* entry = readdir(dir)) {
+        if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) {
+            unlink((directory + "/" + entry->d_name).c_str());
+        }
+    }
+    closedir(dir);
+    rmdir(directory.c_str());
+}
+
+inline uint64_t FileSize(const std::string& path) {
+    struct stat status;
+    return stat(path.c_str(), &status) == 0 ? status.st_size : 0;
+}
+
+// a database file of the test directory opened in process, with one session to run statements in. The file is
+// created unless an earlier database of the test left it. Reopening starts from a new engine object, as a new
+// process would.
+struct TestDatabase {
+    explicit TestDatabase(const std::string& name, uint32_t frames = POOL_DEFAULT_FRAMES,
+                          PagerMode mode = PAGER_BUFFER_POOL, bool compress = false)
+        : path(TestPath(name)), frames(frames), mode(mode), compress(compress) {
+        Open();
+    }
+    ~TestDatabase() {
+        if (table != nullptr) Close();
+    }
+
+    void Open() {
+        db.reset(new LitDatabase());
+        db->compress_pages = compress;
+        db->prefetch_leaves = prefetch_leaves;
+        table = db->DbOpen(path.c_str(), frames, mode);
+        session.reset(new Session());
+    }
+    void Close() {
+        db->DbClose(table);
+        table = nullptr;
+    }
+    void Reopen() {
+        Close();
+        Open();
+    }
+
+    // parse the line as the shell would, the statement is left in statement
+    ParseStatementResult Parse(const std::string& line) {
+        session->input_buffer = line;
+        session->input_buffer.push_back('\0');
+        session->cur = &session->input_buffer[0];
+        statement = Statement();
+        return db->ParseStatement(session.get(), &statement);
+    }
+
+    // run a statement and return what it wrote, its result in *result
+    std::string Run(const std::string& line, ExecuteResult* result = nullptr) {
+        return RunIn(session.get(), line, result);
+    }
+
+    // the same in a session of the caller, so threads can each run statements in their own
+    std::string RunIn(Session* in_session, const std::string& line, ExecuteResult* result = nullptr) {
+        in_session->input_buffer = line;
+        in_session->input_buffer.push_back('\0');
+        in_session->cur = &in_session->input_buffer[0];
+        Statement parsed;
+        if (!CHECK_EQ(db->ParseStatement(in_session, &parsed), PARSE_STATEMENT_SUCCESS)) {
+            printf("  in %s\n", line.c_str());
+            if (result != nullptr) *result = EXECUTE_INVALID_ROW;
+            return "";
+        }
+        char* buffer = nullptr;
+        size_t length = 0;
+        FILE* output = open_memstream(&buffer, &length);
+        in_session->writer.file = output;
+        ExecuteResult executed = db->ExecuteStatement(in_session, &parsed, table);
+        fflush(output);
+        std::string text(buffer, length);
+        in_session->writer.file = stdout;
+        fclose(output);
+        free(buffer);
+        if (result != nullptr) *result = executed;
+        return text;
+    }
+
+    ExecuteResult Execute(const std::string& line) {
+        ExecuteResult result;
+        Run(line, &result);
+        return result;
+    }
+
+    ParseMetaResult Meta(const std::string& line) {
+        session->input_buffer = line;
+        session->input_buffer.push_back('\0');
+        session->cur = &session->input_buffer[0];
+        return db->ParseMeta(session.get(), table);
+    }
+
+    std::string path;
+    uint32_t frames;
+    PagerMode mode;
+    bool compress;
+    uint32_t prefetch_leaves = PREFETCH_DEFAULT_LEAVES;
+    std::unique_ptr<LitDatabase> db;
+    Table* table = nullptr;
+    std::unique_ptr<Session> session;
+    Statement statement;
+};
+
+// the row the tests insert for an id, its email varies in length with the id
+inline std::string TestUsername(uint32_t id) { return "user" + std::to_string(id); }
+inline std::string TestEmail(uint32_t id) { return std::string(id % 40, 'e') + std::to_string(id) + "@example.com"; }
+
+inline std::string InsertStatement(uint32_t id) {
+    return "insert " + std::to_string(id) + " " + TestUsername(id) + " " + TestEmail(id);
+}
+
+// what a select prints for the rows with the ids
+inline std::string ExpectedRows(const std::vector<uint32_t>& ids) {
+    std::string rows;
+    for (uint32_t id : ids) {
+        rows += "(" + std::to_string(id) + ", " + TestUsername(id) + ", " + TestEmail(id) + ")\n";
+    }
+    return rows;
+}
+
+// run the function in a child process that leaves with _exit, as if it crashed, and return its exit status. A
+// database the function leaves open is not closed.
+inline int RunInChild(const std::function<void()>& function) {
+    fflush(stdout);
+    int failures_before = check_failures;
+    pid_t pid = fork();
+    if (pid == 0) {
+        function();
+        fflush(stdout);
+        _exit(check_failures == failures_before ? 0 : 1);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+struct TestCase {
+    const char* name;
+    void (*run)();
+};
+
+inline int RunTests(const std::vector<TestCase>& tests) {
+    int failed = 0;
+    for (const TestCase& test : tests) {
+        int before = check_failures;
+        test.run();
+        bool ok = check_failures == before;
+        printf("%s %s\n", ok ? "ok    " : "FAILED", test.name);
+        failed += !ok;
+    }
+    RemoveTestDirectory();
+    printf("%d of %zu tests failed\n", failed, tests.size());
+    return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+}  // namespace
+
+#endif
@@ -0,0 +1,355 @@
+#include <numeric>
+#include <random>
+
+#include "test_util.h"
+
+// Tests of the B+tree: splits, merges and borrows, bulk loading, the row format, key search and row counts.
+
+namespace {
+
+std::vector<uint32_t> ShuffledIds(uint32_t first, uint32_t count, uint32_t seed) {
+    std::vector<uint32_t> ids(count);
+    std::iota(ids.begin(), ids.end(), first);
+    std::mt19937 random(seed);
+    std::shuffle(ids.begin(), ids.end(), random);
+    return ids;
+}
+
+std::vector<uint32_t> SortedIds(std::vector<uint32_t> ids) {
+    std::sort(ids.begin(), ids.end());
+    return ids;
+}
+
+// rows with a long email, a dozen or so to a leaf, so some thousands make a tree of three levels
+std::string LongEmail(uint32_t id) { return std::to_string(id) + std::string(200, 'x') + "@example.com"; }
+
+std::string InsertLong(uint32_t id) {
+    return "insert " + std::to_string(id) + " " + TestUsername(id) + " " + LongEmail(id);
+}
+
+std::string ExpectedLong(const std::vector<uint32_t>& ids) {
+    std::string rows;
+    for (uint32_t id : ids) {
+        rows += "(" + std::to_string(id) + ", " + TestUsername(id) + ", " + LongEmail(id) + ")\n";
+    }
+    return rows;
+}
+
+// internal nodes split as the tree grows, every row stays reachable in order
+void TestInternalNodesSplit() {
+    TestDatabase database("split.db");
+    std::vector<uint32_t> ids = ShuffledIds(1, 15000, 7);
+    for (uint32_t id : ids) {
+        CHECK_EQ(database.Execute(InsertLong(id)), EXECUTE_SUCCESS);
+    }
+    DbStats stats = database.db->TableStats(database.table);
+    CHECK(stats.internal_splits > 2);
+    CHECK_EQ(stats.num_rows, 15000u);
+    CHECK_EQ(database.Run("select"), ExpectedLong(SortedIds(ids)));
+    for (uint32_t id = 1; id <= 15000; id += 97) {
+        CHECK_EQ(database.Run("select where id = " + std::to_string(id)), ExpectedLong({id}));
+    }
+    CHECK_EQ(database.Execute(InsertLong(3000)), EXECUTE_DUPLICATE_KEY);
+
+    database.Reopen();
+    CHECK_EQ(database.Run("select"), ExpectedLong(SortedIds(ids)));
+}
+
+// deletes in random order merge and borrow between nodes down to an empty tree, the pages they free are reused
+void TestDeleteRebalances() {
+    TestDatabase database("delete.db");
+    std::vector<uint32_t> ids = ShuffledIds(1, 4000, 11);
+    for (uint32_t id : ids) {
+        CHECK_EQ(database.Execute(InsertLong(id)), EXECUTE_SUCCESS);
+    }
+    DbStats full = database.db->TableStats(database.table);
+    CHECK(full.tree_height >= 2);
+
+    std::vector<uint32_t> live = ids;
+    std::mt19937 random(13);
+    std::shuffle(ids.begin(), ids.end(), random);
+    for (uint32_t i = 0; i < ids.size(); ++i) {
+        CHECK_EQ(database.Execute("delete where id = " + std::to_string(ids[i])), EXECUTE_SUCCESS);
+        live.erase(std::find(live.begin(), live.end(), ids[i]));
+        if (i % 500 == 0 || i + 10 > ids.size()) {
+            CHECK_EQ(database.Run("select"), ExpectedLong(SortedIds(live)));
+            CHECK_EQ(database.Run("select count(*)"), "(" + std::to_string(live.size()) + ")\n");
+        }
+    }
+    CHECK_EQ(database.Execute("delete where id = 1"), EXECUTE_KEY_NOT_FOUND);
+    DbStats empty = database.db->TableStats(database.table);
+    CHECK_EQ(empty.tree_height, 1u);
+    CHECK_EQ(empty.num_rows, 0u);
+    CHECK(empty.free_pages + 4 > full.num_pages);
+
+    // the freed pages hold the table again, the file does not grow
+    database.Reopen();
+    for (uint32_t id : ids) {
+        CHECK_EQ(database.Execute(InsertLong(id)), EXECUTE_SUCCESS);
+    }
+    DbStats refilled = database.db->TableStats(database.table);
+    CHECK_EQ(refilled.num_pages, full.num_pages);
+    CHECK_EQ(database.Run("select"), ExpectedLong(SortedIds(ids)));
+}
+
+// updates that grow and shrink rows, whether or not they still fit their leaf
+void TestUpdate() {
+    TestDatabase database("update.db");
+    std::vector<uint32_t> ids = ShuffledIds(1, 2000, 17);
+    for (uint32_t id : ids) {
+        CHECK_EQ(database.Execute(InsertStatement(id)), EXECUTE_SUCCESS);
+    }
+    std::map<uint32_t, std::string> expected;
+    for (uint32_t id : ids) {
+        expected[id] = "(" + std::to_string(id) + ", " + TestUsername(id) + ", " + TestEmail(id) + ")\n";
+    }
+    for (uint32_t id = 1; id <= 2000; id += 3) {
+        std::string email = LongEmail(id);
+        CHECK_EQ(database.Execute("update set email = " + email + " where id = " + std::to_string(id)),
+                 EXECUTE_SUCCESS);
+        expected[id] = "(" + std::to_string(id) + ", " + TestUsername(id) + ", " + email + ")\n";
+    }
+    for (uint32_t id = 1; id <= 2000; id += 9) {
+        std::string username = "u" + std::to_string(id);
+        CHECK_EQ(database.Execute("update set username = " + username + ", email = e@x where id = " +
+                                  std::to_string(id)),
+                 EXECUTE_SUCCESS);
+        expected[id] = "(" + std::to_string(id) + ", " + username + ", e@x)\n";
+    }
+    CHECK_EQ(database.Execute("update set email = e@x where id = 2001"), EXECUTE_KEY_NOT_FOUND);
+
+    std::string rows;
+    for (const auto& row : expected) rows += row.second;
+    CHECK_EQ(database.Run("select"), rows);
+    database.Reopen();
+    CHECK_EQ(database.Run("select"), rows);
+}
+
+void WriteImportFile(const std::string& path, const std::vector<uint32_t>& ids) {
+    FILE* file = fopen(path.c_str(), "w");
+    for (uint32_t id : ids) {
+        fprintf(file, "%u,%s,%s\n", id, TestUsername(id).c_str(), TestEmail(id).c_str());
+    }
+    fclose(file);
+}
+
+// a sorted file is loaded into full leaves that take inserts and deletes like any others, an unsorted one or a
+// table with rows in it is refused and nothing is loaded
+void TestBulkLoad() {
+    TestDatabase database("bulk.db");
+    std::vector<uint32_t> ids;
+    for (uint32_t id = 1; id <= 40000; ++id) ids.push_back(2 * id);
+    WriteImportFile(TestPath("sorted.csv"), ids);
+    std::vector<uint32_t> unsorted = {1, 3, 2};
+    WriteImportFile(TestPath("unsorted.csv"), unsorted);
+
+    uint64_t line_num = 0;
+    CHECK_EQ(database.db->ImportFile(database.table, TestPath("unsorted.csv").c_str(), 100, &line_num),
+             EXECUTE_UNSORTED_INPUT);
+    CHECK_EQ(line_num, 3u);
+    CHECK_EQ(database.Run("select"), "");
+
+    CHECK_EQ(database.db->ImportFile(database.table, TestPath("sorted.csv").c_str(), 100, &line_num),
+             EXECUTE_SUCCESS);
+    DbStats stats = database.db->TableStats(database.table);
+    CHECK_EQ(stats.num_rows, ids.size());
+    CHECK(stats.tree_height >= 2);
+    CHECK(stats.leaf_fill > 0.9);
+    CHECK_EQ(database.Run("select"), ExpectedRows(ids));
+    CHECK_EQ(database.Run("select count(*)"), "(40000)\n");
+    CHECK_EQ(database.db->ImportFile(database.table, TestPath("sorted.csv").c_str(), 100, &line_num),
+             EXECUTE_TABLE_NOT_EMPTY);
+
+    for (uint32_t id = 1; id < 80000; id += 40) {
+        CHECK_EQ(database.Execute(InsertStatement(id)), EXECUTE_SUCCESS);
+        ids.push_back(id);
+    }
+    for (uint32_t id = 4; id <= 80000; id += 12) {
+        CHECK_EQ(database.Execute("delete where id = " + std::to_string(id)), EXECUTE_SUCCESS);
+        ids.erase(std::find(ids.begin(), ids.end(), id));
+    }
+    database.Reopen();
+    CHECK_EQ(database.Run("select"), ExpectedRows(SortedIds(ids)));
+}
+
+// rows take the space their strings need: short ones pack many to a leaf, the longest allowed fit, longer are refused
+void TestVariableLengthRows() {
+    TestDatabase database("rows.db");
+    for (uint32_t id = 1; id <= 2000; ++id) {
+        CHECK_EQ(database.Execute("insert " + std::to_string(id) + " u e"), EXECUTE_SUCCESS);
+    }
+    DbStats stats = database.db->TableStats(database.table);
+    // a fixed size row of the longest strings would fit fewer than 14 to a leaf
+    CHECK(stats.rows_per_leaf > 100);
+
+    std::string username(COLUMN_USERNAME_SIZE, 'u');
+    std::string email(COLUMN_EMAIL_SIZE, 'e');
+    CHECK_EQ(database.Execute("insert 5000 " + username + " " + email), EXECUTE_SUCCESS);
+    CHECK_EQ(database.Parse("insert 5001 " + username + "u " + email), PARSE_STATEMENT_STRING_TOO_LONG);
+    CHECK_EQ(database.Parse("insert 5001 " + username + " " + email + "e"), PARSE_STATEMENT_STRING_TOO_LONG);
+
+    // rows grow into the space others left behind, the leaf is compacted to make room
+    for (uint32_t round = 0; round < 4; ++round) {
+        for (uint32_t id = 1 + round % 2; id <= 2000; id += 2) {
+            std::string value = round % 2 ? "e" : std::string(40 + round * 10, 'e');
+            CHECK_EQ(database.Execute("update set email = " + value + " where id = " + std::to_string(id)),
+                     EXECUTE_SUCCESS);
+        }
+    }
+    database.Reopen();
+    std::string rows;
+    for (uint32_t id = 1; id <= 2000; ++id) {
+        rows += "(" + std::to_string(id) + ", u, " + (id % 2 ? std::string(60, 'e') : std::string("e")) + ")\n";
+    }
+    rows += "(5000, " + username + ", " + email + ")\n";
+    CHECK_EQ(database.Run("select"), rows);
+}
+
+// the kernel the CPU got agrees with a plain binary search at every size and position, keys with the top bit set
+// included since the vector compares are unsigned
+void TestKeySearch() {
+    LitDatabase db;
+    std::string kernel = db.KeySearchKernel();
+    CHECK(kernel == "avx2" || kernel == "sse4.1" || kernel == "scalar");
+    std::mt19937 random(19);
+    for (uint32_t num_keys = 0; num_keys <= 400; ++num_keys) {
+        std::set<uint32_t> distinct;
+        while (distinct.size() < num_keys) {
+            uint32_t key = random();
+            if (key % 3 == 0) key |= 0x80000000u;
+            distinct.insert(key == UINT32_MAX ? key - 1 : key);
+        }
+        std::vector<uint32_t> keys(distinct.begin(), distinct.end());
+        std::vector<uint32_t> probes = {0, 1, 0x7fffffffu, 0x80000000u, UINT32_MAX};
+        for (uint32_t key : keys) {
+            probes.push_back(key - 1);
+            probes.push_back(key);
+            probes.push_back(key + 1);
+        }
+        for (uint32_t probe : probes) {
+            uint32_t expected = std::lower_bound(keys.begin(), keys.end(), probe) - keys.begin();
+            if (!CHECK_EQ(db.KeyLowerBound(keys.data(), num_keys, probe), expected)) {
+                printf("  %u keys, searching for %u with %s\n", num_keys, probe, kernel.c_str());
+                return;
+            }
+        }
+    }
+}
+
+// counts, ranks and offsets come from the row counts kept in internal nodes, which stay exact through splits,
+// merges and borrows. A count reads a path down the tree for each end of its range and for the first and last row,
+// however many rows it covers.
+void TestOrderStatistics() {
+    TestDatabase database("rank.db");
+    std::vector<uint32_t> ids = ShuffledIds(1, 6000, 23);
+    for (uint32_t id : ids) {
+        CHECK_EQ(database.Execute(InsertLong(id)), EXECUTE_SUCCESS);
+    }
+    std::shuffle(ids.begin(), ids.end(), std::mt19937(29));
+    for (uint32_t i = 0; i < ids.size(); i += 3) {
+        CHECK_EQ(database.Execute("delete where id = " + std::to_string(ids[i])), EXECUTE_SUCCESS);
+    }
+    std::vector<uint32_t> live;
+    for (uint32_t i = 0; i < ids.size(); ++i) {
+        if (i % 3 != 0) live.push_back(ids[i]);
+    }
+    live = SortedIds(live);
+    std::string n = std::to_string(live.size());
+
+    for (uint32_t round = 0; round < 2; ++round) {
+        CHECK_EQ(database.Run("select count(*)"), "(" + n + ")\n");
+        for (uint32_t i = 0; i < live.size(); i += 37) {
+            CHECK_EQ(database.Run("select rank where id = " + std::to_string(live[i])),
+                     "(" + std::to_string(i + 1) + ")\n");
+        }
+        CHECK_EQ(database.Execute("select rank where id = " + std::to_string(ids[0])), EXECUTE_KEY_NOT_FOUND);
+
+        std::mt19937 random(31);
+        for (uint32_t i = 0; i < 50; ++i) {
+            uint32_t low = 1 + random() % 6000;
+            uint32_t high = low + random() % 2000;
+            auto first = std::lower_bound(live.begin(), live.end(), low);
+            auto last = std::upper_bound(live.begin(), live.end(), high);
+            std::string expected = "(" + std::to_string(last - first);
+            if (first != last) expected += ", " + std::to_string(*first) + ", " + std::to_string(*(last - 1));
+            std::string range = std::to_string(low) + " and " + std::to_string(high);
+            if (first != last) {
+                CHECK_EQ(database.Run("select count(*), min(id), max(id) where id between " + range), expected + ")\n");
+            } else {
+                CHECK_EQ(database.Run("select count(*) where id between " + range), expected + ")\n");
+            }
+
+            uint32_t offset = random() % 300;
+            std::vector<uint32_t> page(first + std::min<size_t>(offset, last - first),
+                                       first + std::min<size_t>(offset + 3, last - first));
+            CHECK_EQ(database.Run("select where id between " + range + " limit 3 offset " + std::to_string(offset)),
+                     ExpectedLong(page));
+        }
+        CHECK_EQ(database.Run("select limit 5 offset " + std::to_string(live.size() - 1)), ExpectedLong({live.back()}));
+        CHECK_EQ(database.Run("select offset " + n), "");
+
+        database.db->TimerStart(database.session.get(), database.table->pager);
+        database.Run("select count(*) where id between 1000 and 5000");
+        database.db->TimerFinish(database.session.get(), database.table->pager);
+        DbStats stats = database.db->TableStats(database.table);
+        CHECK(database.session->timer.pages <= 4 * stats.tree_height);
+        CHECK(database.session->timer.pages * 10 < stats.leaf_nodes);
+        database.Reopen();
+    }
+}
+
+// increasing ids go straight to the last leaf without a descent and leave every leaf but the last full, ids in
+// random order still split leaves in half. Keys between the appended ones land where they belong.
+void TestAppends() {
+    TestDatabase appended("appended.db");
+    for (uint32_t id = 2; id <= 20000; id += 2) {
+        CHECK_EQ(appended.Execute(InsertStatement(id)), EXECUTE_SUCCESS);
+    }
+    DbStats stats = appended.db->TableStats(appended.table);
+    CHECK(stats.rightmost_hits > 9900);
+    CHECK(stats.descent_levels < stats.descents + stats.descents / 10);
+    CHECK(stats.leaf_fill > 0.95);
+
+    TestDatabase shuffled("shuffled.db");
+    for (uint32_t id : ShuffledIds(1, 10000, 8)) {
+        CHECK_EQ(shuffled.Execute(InsertStatement(2 * id)), EXECUTE_SUCCESS);
+    }
+    DbStats shuffled_stats = shuffled.db->TableStats(shuffled.table);
+    CHECK(shuffled_stats.leaf_fill < 0.8);
+    CHECK(shuffled_stats.leaf_nodes > stats.leaf_nodes + stats.leaf_nodes / 4);
+    CHECK_EQ(shuffled.Run("select"), appended.Run("select"));
+
+    // a key below the last one descends, one past it appends again
+    std::vector<uint32_t> ids;
+    for (uint32_t id = 2; id <= 20000; id += 2) ids.push_back(id);
+    for (uint32_t id = 1; id < 20000; id += 200) {
+        CHECK_EQ(appended.Execute(InsertStatement(id)), EXECUTE_SUCCESS);
+        ids.push_back(id);
+    }
+    CHECK_EQ(appended.Execute(InsertStatement(20000)), EXECUTE_DUPLICATE_KEY);
+    for (uint32_t id = 20001; id <= 21000; ++id) {
+        CHECK_EQ(appended.Execute(InsertStatement(id)), EXECUTE_SUCCESS);
+        ids.push_back(id);
+    }
+    ids = SortedIds(ids);
+    CHECK_EQ(appended.Run("select"), ExpectedRows(ids));
+    appended.Reopen();
+    CHECK_EQ(appended.Run("select"), ExpectedRows(ids));
+    CHECK_EQ(appended.Execute(InsertStatement(21001)), EXECUTE_SUCCESS);
+    CHECK_EQ(appended.Run("select where id >= 21000"), ExpectedRows({21000, 21001}));
+}
+
+}  // namespace
+
+int main() {
+    return RunTests({
+        {"internal nodes split", TestInternalNodesSplit},
+        {"delete rebalances", TestDeleteRebalances},
+        {"update", TestUpdate},
+        {"bulk load", TestBulkLoad},
+        {"variable length rows", TestVariableLengthRows},
+        {"key search", TestKeySearch},
+        {"order statistics", TestOrderStatistics},
+        {"appends", TestAppends},
+    });
+}
@@ -0,0 +1,109 @@
+#include <numeric>
+#include <random>
+
+#include "test_util.h"
+
+// Tests of the write-ahead log. A crash is a child process that commits and leaves with _exit, the database is then
+// opened again by the test and has to recover from the log alone.
+
+namespace {
+
+std::vector<uint32_t> ShuffledIds(uint32_t first, uint32_t count, uint32_t seed) {
+    std::vector<uint32_t> ids(count);
+    std::iota(ids.begin(), ids.end(), first);
+    std::mt19937 random(seed);
+    std::shuffle(ids.begin(), ids.end(), random);
+    return ids;
+}
+
+std::vector<uint32_t> SortedIds(std::vector<uint32_t> ids) {
+    std::sort(ids.begin(), ids.end());
+    return ids;
+}
+
+// every statement that returned had committed, the rows are back after the crash. A frame torn off at the end of
+// the log is left out.
+void TestRecoversAfterCrash() {
+    std::string path = TestPath("crash.db");
+    std::vector<uint32_t> ids = ShuffledIds(1, 300, 3);
+    int status = RunInChild([&]() {
+        // never closed, the crash takes it down
+        TestDatabase* database = new TestDatabase("crash.db");
+        for (uint32_t id : ids) {
+            CHECK_EQ(database->Execute(InsertStatement(id)), EXECUTE_SUCCESS);
+        }
+        CHECK_EQ(database->Execute("delete where id = 150"), EXECUTE_SUCCESS);
+        CHECK_EQ(database->Execute("update set username = renamed where id = 151"), EXECUTE_SUCCESS);
+    });
+    CHECK_EQ(status, 0);
+    CHECK(FileSize(path + "-wal") > WAL_HEADER_SIZE);
+
+    FILE* wal = fopen((path + "-wal").c_str(), "a");
+    fputs("half a frame", wal);
+    fclose(wal);
+
+    TestDatabase database("crash.db");
+    std::vector<uint32_t> expected = SortedIds(ids);
+    expected.erase(std::find(expected.begin(), expected.end(), 150));
+    std::string rows = ExpectedRows(expected);
+    std::string renamed = "(151, renamed, " + TestEmail(151) + ")\n";
+    rows.replace(rows.find("(151, "), ExpectedRows({151}).size(), renamed);
+    CHECK_EQ(database.Run("select"), rows);
+    CHECK_EQ(database.Run("select count(*)"), "(299)\n");
+}
+
+// one insert of rows spread over a table of even ids, so scattered that its leaves do not fit the pool
+std::string ScatteredInsert(uint32_t first, uint32_t count, std::vector<uint32_t>* ids) {
+    std::string statement = "insert values ";
+    for (uint32_t i = 0; i < count; ++i) {
+        uint32_t id = first + 2 * 17 * i;
+        ids->push_back(id);
+        statement += (i == 0 ? "(" : ", (") + std::to_string(id) + ", " + TestUsername(id) + ", " + TestEmail(id) + ")";
+    }
+    return statement;
+}
+
+// a statement that dirties more pages than the pool holds spills some of them to the log before it commits. The
+// spilled frames belong to the commit that follows them, after a crash or a close they are in the file.
+void TestSpilledStatementCommits() {
+    const uint32_t frames = 8;
+    std::vector<uint32_t> ids;
+    int status = RunInChild([&]() {
+        TestDatabase* database = new TestDatabase("spill.db", frames);
+        for (uint32_t id : ShuffledIds(1, 3000, 5)) {
+            CHECK_EQ(database->Execute(InsertStatement(2 * id)), EXECUTE_SUCCESS);
+        }
+        // from an empty log, so the statement does not fill it and get checkpointed
+        database->Reopen();
+        std::vector<uint32_t> scattered;
+        CHECK_EQ(database->Execute(ScatteredInsert(1, 170, &scattered)), EXECUTE_SUCCESS);
+    });
+    CHECK_EQ(status, 0);
+    // more frames than the pool holds, most of them went to the log before the commit
+    CHECK(FileSize(TestPath("spill.db-wal")) > WAL_HEADER_SIZE + 2 * frames * WAL_FRAME_SIZE);
+    for (uint32_t id = 1; id <= 3000; ++id) ids.push_back(2 * id);
+    ScatteredInsert(1, 170, &ids);
+
+    TestDatabase database("spill.db", frames);
+    CHECK_EQ(database.Run("select"), ExpectedRows(SortedIds(ids)));
+    CHECK_EQ(database.Execute(ScatteredInsert(3, 170, &ids)), EXECUTE_SUCCESS);
+    CHECK_EQ(database.Execute("begin"), EXECUTE_SUCCESS);
+    for (uint32_t i = 0; i < 170; ++i) {
+        CHECK_EQ(database.Execute("delete where id = " + std::to_string(2 + 34 * i)), EXECUTE_SUCCESS);
+        ids.erase(std::find(ids.begin(), ids.end(), 2 + 34 * i));
+    }
+    CHECK_EQ(database.Execute("commit"), EXECUTE_SUCCESS);
+
+    database.Reopen();
+    CHECK_EQ(database.Run("select"), ExpectedRows(SortedIds(ids)));
+    CHECK_EQ(database.Run("select count(*)"), "(" + std::to_string(ids.size()) + ")\n");
+}
+
+}  // namespace
+
+int main() {
+    return RunTests({
+        {"recovers after crash", TestRecoversAfterCrash},
+        {"spilled statement commits", TestSpilledStatementCommits},
+    });
+}
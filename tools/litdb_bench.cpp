@@ -0,0 +1,280 @@
+// Benchmark of the storage engine. It drives the LitDatabase API directly, with no parsing and no server in the way,
+// and times every operation on its own:
+//
+//   insert_sequential  insert statements with ids 1..rows into a new database
+//   insert_random      insert statements with the same ids in random order into another new database
+//   find_point         TableFind on random ids of the second database
+//   find_many          TableGetMany on batches of 256 random ids of it, one op per batch
+//   scan_full          TableStart and CursorAdvance over every row
+//   get_page_cold      GetPage of every page in random order right after opening, the file dropped from the OS cache
+//   get_page_warm      the same pages again, now in the buffer pool
+//
+//   litdb_bench [--rows N] [--dir PATH] [--frames N] [--mmap] [--compress] [--seed N]
+//
+// The report is one JSON object on stdout with ops/sec and p50/p99/p999/max latency in nanoseconds per workload.
+// Whatever the engine prints goes to stderr instead.
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "LitDatabase.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+    uint32_t rows = 100000;
+    std::string dir = ".";
+    uint32_t frames = POOL_DEFAULT_FRAMES;
+    PagerMode pager_mode = PAGER_BUFFER_POOL;
+    bool compress_pages = false;
+    uint32_t seed = 1;
+};
+
+struct Result {
+    const char* name;
+    std::vector<uint64_t> latencies;  // nanoseconds
+    double seconds = 0;
+};
+
+uint64_t Nanoseconds(Clock::time_point start, Clock::time_point end) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+}
+
+uint64_t Percentile(const std::vector<uint64_t>& sorted, double fraction) {
+    if (sorted.empty()) return 0;
+    size_t rank = std::min(static_cast<size_t>(fraction * sorted.size()), sorted.size() - 1);
+    return sorted[rank];
+}
+
+// the smallest time two back to back clock reads take, included in every latency
+uint64_t TimerOverhead() {
+    uint64_t overhead = UINT64_MAX;
+    for (int i = 0; i < 1000; ++i) {
+        Clock::time_point start = Clock::now();
+        overhead = std::min(overhead, Nanoseconds(start, Clock::now()));
+    }
+    return overhead;
+}
+
+void RemoveDatabase(const std::string& path) {
+    unlink(path.c_str());
+    unlink((path + "-wal").c_str());
+}
+
+// write back and drop the pages of the file from the OS cache, so the next reads go to the disk
+void DropFileCache(const std::string& path) {
+    int file_descriptor = open(path.c_str(), O_RDONLY);
+    if (file_descriptor == -1) return;
+    fdatasync(file_descriptor);
+    posix_fadvise(file_descriptor, 0, 0, POSIX_FADV_DONTNEED);
+    close(file_descriptor);
+}
+
+Row MakeRow(uint32_t id) {
+    Row row;
+    row.id = id;
+    snprintf(row.username, sizeof(row.username), "user%u", id);
+    snprintf(row.email, sizeof(row.email), "user%u@example.com", id);
+    return row;
+}
+
+Result RunInserts(LitDatabase* db, const Options& options, const std::string& path, const std::vector<uint32_t>& ids,
+                  const char* name) {
+    RemoveDatabase(path);
+    Table* table = db->DbOpen(path.c_str(), options.frames, options.pager_mode);
+    Session session;
+    Result result;
+    result.name = name;
+    result.latencies.reserve(ids.size());
+    Clock::time_point begin = Clock::now();
+    for (uint32_t id : ids) {
+        Statement statement;
+        statement.type = STATEMENT_INSERT;
+        statement.row_to_insert = MakeRow(id);
+        Clock::time_point start = Clock::now();
+        ExecuteResult status = db->ExecuteStatement(&session, &statement, table);
+        result.latencies.push_back(Nanoseconds(start, Clock::now()));
+        if (status != EXECUTE_SUCCESS) {
+            fprintf(stderr, "insert of %u failed\n", id);
+            exit(EXIT_FAILURE);
+        }
+    }
+    result.seconds = std::chrono::duration<double>(Clock::now() - begin).count();
+    db->DbClose(table);
+    return result;
+}
+
+Result RunFinds(LitDatabase* db, Table* table, const std::vector<uint32_t>& ids) {
+    Result result;
+    result.name = "find_point";
+    result.latencies.reserve(ids.size());
+    Clock::time_point begin = Clock::now();
+    for (uint32_t id : ids) {
+        Clock::time_point start = Clock::now();
+        Cursor* cursor = db->TableFind(table, id);
+        void* node = db->GetPage(table->pager, cursor->page_num);
+        bool found = cursor->cell_num < *db->LeafNodeNumCells(node) && *db->LeafNodeKey(node, cursor->cell_num) == id;
+        db->UnpinPage(table->pager, cursor->page_num);
+        db->CursorClose(cursor);
+        result.latencies.push_back(Nanoseconds(start, Clock::now()));
+        if (!found) {
+            fprintf(stderr, "id %u not found\n", id);
+            exit(EXIT_FAILURE);
+        }
+    }
+    result.seconds = std::chrono::duration<double>(Clock::now() - begin).count();
+    return result;
+}
+
+Result RunGetMany(LitDatabase* db, Table* table, const std::vector<uint32_t>& ids) {
+    const size_t batch_size = 256;
+    Result result;
+    result.name = "find_many";
+    result.latencies.reserve(ids.size() / batch_size + 1);
+    Clock::time_point begin = Clock::now();
+    for (size_t first = 0; first < ids.size(); first += batch_size) {
+        std::vector<uint32_t> batch(ids.begin() + first, ids.begin() + std::min(ids.size(), first + batch_size));
+        Clock::time_point start = Clock::now();
+        std::vector<Row> rows = db->TableGetMany(table, batch);
+        result.latencies.push_back(Nanoseconds(start, Clock::now()));
+        if (rows.size() != batch.size()) {
+            fprintf(stderr, "found %zu of %zu ids\n", rows.size(), batch.size());
+            exit(EXIT_FAILURE);
+        }
+    }
+    result.seconds = std::chrono::duration<double>(Clock::now() - begin).count();
+    return result;
+}
+
+Result RunScan(LitDatabase* db, Table* table, uint32_t expected_rows) {
+    Result result;
+    result.name = "scan_full";
+    result.latencies.reserve(expected_rows);
+    Clock::time_point begin = Clock::now();
+    Cursor* cursor = db->TableStart(table);
+    while (!(cursor->end_of_table)) {
+        Clock::time_point start = Clock::now();
+        db->CursorAdvance(cursor);
+        result.latencies.push_back(Nanoseconds(start, Clock::now()));
+    }
+    db->CursorClose(cursor);
+    result.seconds = std::chrono::duration<double>(Clock::now() - begin).count();
+    if (result.latencies.size() != expected_rows) {
+        fprintf(stderr, "scan saw %zu rows, expected %u\n", result.latencies.size(), expected_rows);
+        exit(EXIT_FAILURE);
+    }
+    return result;
+}
+
+Result RunGetPages(LitDatabase* db, Table* table, const std::vector<uint32_t>& page_nums, const char* name) {
+    Result result;
+    result.name = name;
+    result.latencies.reserve(page_nums.size());
+    Clock::time_point begin = Clock::now();
+    for (uint32_t page_num : page_nums) {
+        Clock::time_point start = Clock::now();
+        db->GetPage(table->pager, page_num);
+        db->UnpinPage(table->pager, page_num);
+        result.latencies.push_back(Nanoseconds(start, Clock::now()));
+    }
+    result.seconds = std::chrono::duration<double>(Clock::now() - begin).count();
+    return result;
+}
+
+void PrintResult(FILE* report, Result* result, bool last) {
+    std::sort(result->latencies.begin(), result->latencies.end());
+    size_t ops = result->latencies.size();
+    fprintf(report,
+            "    {\"name\": \"%s\", \"ops\": %zu, \"seconds\": %.6f, \"ops_per_sec\": %.1f, \"latency_ns\": "
+            "{\"p50\": %lu, \"p99\": %lu, \"p999\": %lu, \"max\": %lu}}%s\n",
+            result->name, ops, result->seconds, result->seconds > 0 ? ops / result->seconds : 0.0,
+            Percentile(result->latencies, 0.50), Percentile(result->latencies, 0.99),
+            Percentile(result->latencies, 0.999), ops == 0 ? 0 : result->latencies.back(), last ? "" : ",");
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--rows") == 0 && i + 1 < argc) {
+            options.rows = std::max(atoi(argv[++i]), 1);
+        } else if (strcmp(argv[i], "--dir") == 0 && i + 1 < argc) {
+            options.dir = argv[++i];
+        } else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            options.frames = std::max(atoi(argv[++i]), 8);
+        } else if (strcmp(argv[i], "--mmap") == 0) {
+            options.pager_mode = PAGER_MMAP;
+        } else if (strcmp(argv[i], "--compress") == 0) {
+            options.compress_pages = true;
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            options.seed = atoi(argv[++i]);
+        } else {
+            fprintf(stderr,
+                    "Usage: litdb_bench [--rows N] [--dir PATH] [--frames N] [--mmap] [--compress] [--seed N]\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // stdout is kept for the report, the engine's messages go to stderr
+    FILE* report = fdopen(dup(STDOUT_FILENO), "w");
+    dup2(STDERR_FILENO, STDOUT_FILENO);
+
+    std::mt19937 random(options.seed);
+    std::vector<uint32_t> ids(options.rows);
+    std::iota(ids.begin(), ids.end(), 1);
+    std::vector<uint32_t> shuffled = ids;
+    std::shuffle(shuffled.begin(), shuffled.end(), random);
+
+    LitDatabase db;
+    db.compress_pages = options.compress_pages;
+    std::string sequential_path = options.dir + "/litdb_bench_sequential.db";
+    std::string random_path = options.dir + "/litdb_bench_random.db";
+    std::vector<Result> results;
+    results.push_back(RunInserts(&db, options, sequential_path, ids, "insert_sequential"));
+    results.push_back(RunInserts(&db, options, random_path, shuffled, "insert_random"));
+
+    // reads run on the randomly filled database, opened with a cold buffer pool and OS cache
+    DropFileCache(random_path);
+    Table* table = db.DbOpen(random_path.c_str(), options.frames, options.pager_mode);
+    std::vector<uint32_t> page_nums(table->pager->num_pages);
+    std::iota(page_nums.begin(), page_nums.end(), 0);
+    std::shuffle(page_nums.begin(), page_nums.end(), random);
+    results.push_back(RunGetPages(&db, table, page_nums, "get_page_cold"));
+    results.push_back(RunGetPages(&db, table, page_nums, "get_page_warm"));
+    std::shuffle(shuffled.begin(), shuffled.end(), random);
+    results.push_back(RunFinds(&db, table, shuffled));
+    std::shuffle(shuffled.begin(), shuffled.end(), random);
+    results.push_back(RunGetMany(&db, table, shuffled));
+    results.push_back(RunScan(&db, table, options.rows));
+    db.DbClose(table);
+    RemoveDatabase(sequential_path);
+    RemoveDatabase(random_path);
+
+    fprintf(report, "{\n");
+    fprintf(report, "  \"benchmark\": \"litdb_bench\",\n");
+    fprintf(report,
+            "  \"config\": {\"rows\": %u, \"frames\": %u, \"pager\": \"%s\", \"compress\": %s, \"seed\": %u},\n",
+            options.rows, options.frames, options.pager_mode == PAGER_MMAP ? "mmap" : "buffer_pool",
+            options.compress_pages ? "true" : "false", options.seed);
+    fprintf(report, "  \"timer_overhead_ns\": %lu,\n", TimerOverhead());
+    fprintf(report, "  \"results\": [\n");
+    for (size_t i = 0; i < results.size(); ++i) {
+        PrintResult(report, &results[i], i + 1 == results.size());
+    }
+    fprintf(report, "  ]\n}\n");
+    fclose(report);
+    return 0;
+}
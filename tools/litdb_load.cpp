@@ -0,0 +1,201 @@
+// Load generator for the LitDatabase server. Every connection runs on its own thread and keeps a number of requests
+// in flight: it sends requests until the pipeline is full, then reads answers and tops the pipeline up again. An
+// answer is complete at its status line, the first line that does not start with '('. Latency is measured from
+// handing a request to the socket to reading its status line.
+//
+//   litdb_load <socket> [--connections N] [--depth N] [--requests N] [--keys N] [--writes PERCENT] [--preload]
+//
+// Requests are point selects on ids in [1, keys], or with the given probability updates of the email of such a row.
+// --preload first inserts rows 1..keys over a single connection.
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+    const char* socket_path = nullptr;
+    uint32_t connections = 4;
+    uint32_t depth = 16;
+    uint64_t requests = 100000;  // per connection
+    uint32_t keys = 100000;
+    uint32_t write_percent = 0;
+    bool preload = false;
+};
+
+struct Result {
+    std::vector<double> latencies;  // microseconds
+    uint64_t errors = 0;
+};
+
+int Connect(const char* path) {
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+    int client = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (client == -1 || connect(client, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == -1) {
+        printf("Unable to connect to %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+    return client;
+}
+
+void SendAll(int client, const std::string& data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        ssize_t result = send(client, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (result <= 0) {
+            printf("Error sending request\n");
+            exit(EXIT_FAILURE);
+        }
+        sent += result;
+    }
+}
+
+// send count requests made by make_request keeping depth of them in flight
+void RunPipeline(int client, uint64_t count, uint32_t depth, const std::function<std::string(uint64_t)>& make_request,
+                 Result* result) {
+    std::deque<Clock::time_point> in_flight;
+    std::string batch;
+    std::string status;
+    char buffer[64 * 1024];
+    bool at_line_start = true;
+    bool in_status = false;
+    uint64_t sent = 0;
+    uint64_t answered = 0;
+    while (answered < count) {
+        batch.clear();
+        Clock::time_point now = Clock::now();
+        while (in_flight.size() < depth && sent < count) {
+            batch += make_request(sent++);
+            batch.push_back('\n');
+            in_flight.push_back(now);
+        }
+        if (!batch.empty()) SendAll(client, batch);
+
+        ssize_t length = recv(client, buffer, sizeof(buffer), 0);
+        if (length <= 0) {
+            printf("Connection closed by server\n");
+            exit(EXIT_FAILURE);
+        }
+        now = Clock::now();
+        // rows are skipped, only status lines are kept
+        for (ssize_t i = 0; i < length; ++i) {
+            if (at_line_start) in_status = buffer[i] != '(';
+            at_line_start = buffer[i] == '\n';
+            if (!at_line_start) {
+                if (in_status) status.push_back(buffer[i]);
+                continue;
+            }
+            if (!in_status) continue;
+            if (status != "Executed.") result->errors += 1;
+            status.clear();
+            result->latencies.push_back(std::chrono::duration<double, std::micro>(now - in_flight.front()).count());
+            in_flight.pop_front();
+            answered += 1;
+        }
+    }
+}
+
+double Percentile(const std::vector<double>& sorted, double fraction) {
+    if (sorted.empty()) return 0;
+    size_t rank = std::min(static_cast<size_t>(fraction * sorted.size()), sorted.size() - 1);
+    return sorted[rank];
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        printf("Usage: litdb_load <socket> [--connections N] [--depth N] [--requests N] [--keys N] "
+               "[--writes PERCENT] [--preload]\n");
+        exit(EXIT_FAILURE);
+    }
+    Options options;
+    options.socket_path = argv[1];
+    for (int i = 2; i < argc; ++i) {
+        if (strcmp(argv[i], "--connections") == 0 && i + 1 < argc) {
+            options.connections = std::max(atoi(argv[++i]), 1);
+        } else if (strcmp(argv[i], "--depth") == 0 && i + 1 < argc) {
+            options.depth = std::max(atoi(argv[++i]), 1);
+        } else if (strcmp(argv[i], "--requests") == 0 && i + 1 < argc) {
+            options.requests = strtoull(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--keys") == 0 && i + 1 < argc) {
+            options.keys = std::max(atoi(argv[++i]), 1);
+        } else if (strcmp(argv[i], "--writes") == 0 && i + 1 < argc) {
+            options.write_percent = std::min(std::max(atoi(argv[++i]), 0), 100);
+        } else if (strcmp(argv[i], "--preload") == 0) {
+            options.preload = true;
+        } else {
+            printf("Unknown option: %s\n", argv[i]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (options.preload) {
+        int client = Connect(options.socket_path);
+        Result result;
+        RunPipeline(client, options.keys, options.depth,
+                    [](uint64_t n) {
+                        std::string id = std::to_string(n + 1);
+                        return "insert " + id + " user" + id + " user" + id + "@example.com";
+                    },
+                    &result);
+        close(client);
+        printf("preloaded %u rows, %lu errors\n", options.keys, result.errors);
+    }
+
+    std::vector<Result> results(options.connections);
+    std::vector<std::thread> threads;
+    Clock::time_point start = Clock::now();
+    for (uint32_t c = 0; c < options.connections; ++c) {
+        threads.emplace_back([&options, &results, c]() {
+            int client = Connect(options.socket_path);
+            std::mt19937 random(c + 1);
+            RunPipeline(client, options.requests, options.depth,
+                        [&](uint64_t n) {
+                            std::string id = std::to_string(random() % options.keys + 1);
+                            if (random() % 100 < options.write_percent) {
+                                return "update set email = c" + std::to_string(c) + "n" + std::to_string(n) +
+                                       "@example.com where id = " + id;
+                            }
+                            return "select where id = " + id;
+                        },
+                        &results[c]);
+            close(client);
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    std::vector<double> latencies;
+    uint64_t errors = 0;
+    for (const Result& result : results) {
+        latencies.insert(latencies.end(), result.latencies.begin(), result.latencies.end());
+        errors += result.errors;
+    }
+    std::sort(latencies.begin(), latencies.end());
+    printf("%zu requests over %u connections (depth %u) in %.3f s: %.0f requests/s\n", latencies.size(),
+           options.connections, options.depth, seconds, latencies.size() / seconds);
+    printf("latency us: p50 %.1f, p99 %.1f, p999 %.1f, max %.1f\n", Percentile(latencies, 0.50),
+           Percentile(latencies, 0.99), Percentile(latencies, 0.999), latencies.empty() ? 0 : latencies.back());
+    printf("errors: %lu\n", errors);
+    return errors == 0 ? 0 : 1;
+}
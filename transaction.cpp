@@ -0,0 +1,157 @@
+#include "LitDatabase.h"
+
+// Transactions and multi-row inserts. A commit runs alone with the schema latch exclusive, like creating an index.
+// It first checks every statement against the table as the statements before it leave it, so a statement that would
+// fail fails the transaction before anything is written, then applies them and commits them to the log as one.
+// Consecutive inserts are sorted by id and go into the tree one leaf at a time, one descent for all the rows that
+// land in the same leaf.
+
+namespace {
+
+// the rows an insert statement adds, one for insert N ..., any number for insert values
+const Row* InsertRows(const Statement& statement, size_t* num_rows) {
+    if (statement.rows.empty()) {
+        *num_rows = 1;
+        return &statement.row_to_insert;
+    }
+    *num_rows = statement.rows.size();
+    return statement.rows.data();
+}
+
+}  // namespace
+
+ExecuteResult LitDatabase::ExecuteTransaction(Table* table, const std::vector<Statement>& statements) {
+    pthread_rwlock_wrlock(&table->schema_latch);
+    pthread_rwlock_rdlock(&table->pager->commit_latch);
+
+    ExecuteResult result = TransactionCheck(table, statements);
+    std::vector<Row> rows;
+    for (size_t i = 0; i < statements.size() && result == EXECUTE_SUCCESS;) {
+        Statement statement = statements[i];
+        if (statement.type != STATEMENT_INSERT) {
+            if (statement.type == STATEMENT_DELETE) ExecuteDelete(&statement, table);
+            if (statement.type == STATEMENT_UPDATE) ExecuteUpdate(&statement, table);
+            ++i;
+            continue;
+        }
+        rows.clear();
+        for (; i < statements.size() && statements[i].type == STATEMENT_INSERT; ++i) {
+            size_t num_rows;
+            const Row* insert_rows = InsertRows(statements[i], &num_rows);
+            rows.insert(rows.end(), insert_rows, insert_rows + num_rows);
+        }
+        std::sort(rows.begin(), rows.end(), [](const Row& a, const Row& b) { return a.id < b.id; });
+        ExecuteInsertBatch(table, rows);
+    }
+
+    pthread_rwlock_unlock(&table->pager->commit_latch);
+    pthread_rwlock_unlock(&table->schema_latch);
+    if (result == EXECUTE_SUCCESS) WalCommit(table->pager);
+    return result;
+}
+
+// the result of the first statement that would fail, with the keys the statements before it insert and delete
+// taken into account. Runs of inserts are looked up in id order a leaf at a time.
+ExecuteResult LitDatabase::TransactionCheck(Table* table, const std::vector<Statement>& statements) {
+    std::unordered_map<uint32_t, bool> written;  // whether the key is in the table after the statements so far
+    std::vector<uint32_t> keys;
+    for (size_t i = 0; i < statements.size();) {
+        const Statement& statement = statements[i];
+        if (statement.type != STATEMENT_INSERT) {
+            auto it = written.find(statement.key);
+            bool exists = it != written.end() ? it->second : TableHasKeys(table, {statement.key})[0];
+            if (!exists) return EXECUTE_KEY_NOT_FOUND;
+            if (statement.type == STATEMENT_DELETE) written[statement.key] = false;
+            ++i;
+            continue;
+        }
+
+        keys.clear();
+        for (; i < statements.size() && statements[i].type == STATEMENT_INSERT; ++i) {
+            size_t num_rows;
+            const Row* rows = InsertRows(statements[i], &num_rows);
+            for (size_t j = 0; j < num_rows; ++j) {
+                keys.push_back(rows[j].id);
+            }
+        }
+        std::sort(keys.begin(), keys.end());
+        if (std::adjacent_find(keys.begin(), keys.end()) != keys.end()) return EXECUTE_DUPLICATE_KEY;
+        std::vector<bool> in_table = TableHasKeys(table, keys);
+        for (size_t j = 0; j < keys.size(); ++j) {
+            auto it = written.find(keys[j]);
+            if (it != written.end() ? it->second : in_table[j]) return EXECUTE_DUPLICATE_KEY;
+            written[keys[j]] = true;
+        }
+    }
+    return EXECUTE_SUCCESS;
+}
+
+// whether each of the keys, sorted, is in the table. One descent finds every key that belongs in the same leaf.
+std::vector<bool> LitDatabase::TableHasKeys(Table* table, const std::vector<uint32_t>& keys) {
+    std::vector<bool> found(keys.size(), false);
+    for (size_t i = 0; i < keys.size();) {
+        Cursor* cursor = TableFind(table, keys[i], CURSOR_EXCLUSIVE);
+        uint32_t high = CursorLeafHigh(cursor);
+        void* node = GetPage(table->pager, cursor->page_num);
+        uint32_t num_cells = *LeafNodeNumCells(node);
+        uint32_t cell_num = cursor->cell_num;
+        for (; i < keys.size() && keys[i] <= high; ++i) {
+            cell_num += KeyLowerBound(LeafNodeKey(node, cell_num), num_cells - cell_num, keys[i]);
+            found[i] = cell_num < num_cells && *LeafNodeKey(node, cell_num) == keys[i];
+        }
+        UnpinPage(table->pager, cursor->page_num);
+        CursorClose(cursor);
+    }
+    return found;
+}
+
+// insert rows sorted by id whose ids are all new. The rows that fit in the leaf they belong to go in on one descent,
+// a row that does not splits the leaf and the rows after it go down again.
+void LitDatabase::ExecuteInsertBatch(Table* table, const std::vector<Row>& rows) {
+    Pager* pager = table->pager;
+    for (size_t i = 0; i < rows.size();) {
+        Cursor* cursor = TableFind(table, rows[i].id, CURSOR_EXCLUSIVE);
+        uint32_t high = CursorLeafHigh(cursor);
+        void* node = GetPage(pager, cursor->page_num);
+        size_t first = i;
+        bool full = false;
+        for (; i < rows.size() && rows[i].id <= high; ++i) {
+            uint32_t num_cells = *LeafNodeNumCells(node);
+            cursor->cell_num +=
+                KeyLowerBound(LeafNodeKey(node, cursor->cell_num), num_cells - cursor->cell_num, rows[i].id);
+            uint32_t length = SerializedRowSize(rows[i]);
+            if (LeafNodeFreeSpace(node) < LEAF_NODE_CELL_SIZE + length) {
+                full = true;
+                break;
+            }
+            SerializeRow(rows[i], LeafNodeInsertCell(node, cursor->cell_num, rows[i].id, length));
+        }
+        MarkPageDirty(pager, cursor->page_num);
+        UnpinPage(pager, cursor->page_num);
+        CursorAddRows(cursor, i - first);
+        if (full) {
+            LeafNodeInsert(cursor, rows[i].id, rows[i]);
+            ++i;
+        }
+        CursorClose(cursor);
+
+        for (size_t j = first; j < i; ++j) {
+            IndexUpdateRow(table, nullptr, &rows[j]);
+        }
+    }
+}
+
+// the largest key that belongs in the leaf of a cursor that recorded its ancestors: the key of the first ancestor,
+// going up, where the cursor did not take the right child
+uint32_t LitDatabase::CursorLeafHigh(Cursor* cursor) {
+    Pager* pager = cursor->table->pager;
+    for (uint32_t i = cursor->num_ancestors; i > 0; --i) {
+        void* node = GetPage(pager, cursor->ancestors[i - 1]);
+        uint32_t child_num = cursor->child_nums[i - 1];
+        bool has_key = child_num < *InternalNodeNumKeys(node);
+        uint32_t high = has_key ? *InternalNodeKey(node, child_num) : 0;
+        UnpinPage(pager, cursor->ancestors[i - 1]);
+        if (has_key) return high;
+    }
+    return UINT32_MAX;
+}
@@ -0,0 +1,287 @@
+#include "LitDatabase.h"
+
+void LitDatabase::WalOpen(Pager* pager) {
+    std::string wal_name = std::string(file_name) + "-wal";
+    int file_descriptor = open(wal_name.c_str(), O_RDWR | O_CREAT, S_IWUSR | S_IRUSR);
+    if (file_descriptor == -1) {
+        printf("unable to open write-ahead log\n");
+        exit(EXIT_FAILURE);
+    }
+    pager->wal.file_descriptor = file_descriptor;
+}
+
+// Fibonacci-weighted checksum over the first 12 header bytes and the page
+uint32_t LitDatabase::WalChecksum(const unsigned char* header, const void* page) {
+    uint32_t s1 = 0, s2 = 0;
+    uint32_t words[3];
+    memcpy(words, header, sizeof(words));
+    for (uint32_t i = 0; i < 3; ++i) {
+        s1 += words[i] + s2;
+        s2 += s1;
+    }
+    const uint32_t* data = static_cast<const uint32_t*>(page);
+    for (uint32_t i = 0; i < PAGE_SIZE / sizeof(uint32_t); i += 2) {
+        s1 += data[i] + s2;
+        s2 += data[i + 1] + s1;
+    }
+    return s1 ^ s2;
+}
+
+// append the given cached pages to the end of the log with one pwritev per IOV_MAX/2 frames
+void LitDatabase::WalAppendFrames(Pager* pager, const std::vector<uint32_t>& page_nums, bool commit) {
+    Wal& wal = pager->wal;
+    std::vector<unsigned char> headers(page_nums.size() * WAL_FRAME_HEADER_SIZE);
+    std::vector<struct iovec> iov;
+
+    size_t batch_start = 0;
+    while (batch_start < page_nums.size()) {
+        size_t batch_end = std::min(page_nums.size(), batch_start + IOV_MAX / 2);
+        iov.clear();
+        for (size_t i = batch_start; i < batch_end; ++i) {
+            void* page = PagerCachedPage(pager, page_nums[i]);
+            bool is_commit = commit && i + 1 == page_nums.size();
+
+            unsigned char* header = &headers[i * WAL_FRAME_HEADER_SIZE];
+            uint32_t fields[4] = {page_nums[i], is_commit ? pager->num_pages : 0, wal.salt, 0};
+            memcpy(header, fields, sizeof(fields));
+            fields[3] = WalChecksum(header, page);
+            memcpy(header, fields, sizeof(fields));
+
+            iov.push_back({header, WAL_FRAME_HEADER_SIZE});
+            iov.push_back({page, PAGE_SIZE});
+        }
+
+        ssize_t expected = (batch_end - batch_start) * WAL_FRAME_SIZE;
+        if (pwritev(wal.file_descriptor, iov.data(), iov.size(), wal.end) != expected) {
+            printf("Error writing write-ahead log\n");
+            exit(EXIT_FAILURE);
+        }
+        pager->counters.bytes_written.fetch_add(expected, std::memory_order_relaxed);
+
+        for (size_t i = batch_start; i < batch_end; ++i) {
+            wal.pending[page_nums[i]] = wal.end;
+            wal.end += WAL_FRAME_SIZE;
+        }
+        batch_start = batch_end;
+    }
+
+    if (commit) {
+        for (const auto& entry : wal.pending) {
+            auto it = wal.index.find(entry.first);
+            if (it == wal.index.end()) {
+                wal.index.emplace(entry.first, entry.second);
+                continue;
+            }
+            // an open snapshot may still want the image this one replaces
+            if (wal.snapshots > 0) wal.replaced[entry.first].push_back(it->second);
+            it->second = entry.second;
+        }
+        wal.pending.clear();
+        wal.commit_end = wal.end;
+    }
+}
+
+// commit the statements that finished and return once the commit is durable. Each caller takes a ticket and waits
+// until a commit covers it. The first to find no commit under way leads one for every ticket handed out by then:
+// it takes the commit latch exclusive to log the pages of all those statements with one commit frame, lets go of
+// it and syncs the log, so statements keep running during the fdatasync. Those that finish meanwhile wait for the
+// next leader, one of them, whose commit and sync cover all of them.
+void LitDatabase::WalCommit(Pager* pager) {
+    Wal& wal = pager->wal;
+    pthread_mutex_lock(&wal.commit_mutex);
+    uint64_t ticket = ++wal.commit_tickets;
+    while (wal.durable_tickets < ticket) {
+        if (wal.committing) {
+            pthread_cond_wait(&wal.committed, &wal.commit_mutex);
+            continue;
+        }
+        wal.committing = true;
+        pthread_mutex_unlock(&wal.commit_mutex);
+        // the committers the last sync let go are about to finish their next statements, give them the chance to
+        // come in under this commit rather than wait for the one after
+        sched_yield();
+
+        pthread_rwlock_wrlock(&pager->commit_latch);
+        // a statement takes its ticket after it let go of the commit latch, so the statements with the tickets handed
+        // out by now have all their pages in the pool. Those that were running when the leader came finished first.
+        pthread_mutex_lock(&wal.commit_mutex);
+        uint64_t covered = wal.commit_tickets;
+        pthread_mutex_unlock(&wal.commit_mutex);
+        pthread_mutex_lock(&pager->mutex);
+        PagerFlushDirty(pager);
+        // a frame left uncommitted would be dropped by the checkpoint below
+        if (!wal.pending.empty()) {
+            printf("Error committing write-ahead log\n");
+            exit(EXIT_FAILURE);
+        }
+        // while snapshots are open the checkpoint is left to the last of them, rather than tried by every commit
+        bool log_full = (wal.end - WAL_HEADER_SIZE) / WAL_FRAME_SIZE >= WAL_CHECKPOINT_FRAMES && wal.snapshots == 0;
+        pthread_mutex_unlock(&pager->mutex);
+        // a full log with nothing new committed had its checkpoint put off by snapshots
+        if (log_full) {
+            WalCheckpoint(pager);
+        }
+        pthread_rwlock_unlock(&pager->commit_latch);
+        WalSync(pager);
+
+        pthread_mutex_lock(&wal.commit_mutex);
+        wal.durable_tickets = covered;
+        wal.committing = false;
+        pthread_cond_broadcast(&wal.committed);
+    }
+    pthread_mutex_unlock(&wal.commit_mutex);
+}
+
+// sync the log up to the last commit. Run by the leader of a commit, or with the commit latch held exclusive by a
+// checkpoint inside one or while the table is opened or closed, never by two threads at once.
+void LitDatabase::WalSync(Pager* pager) {
+    Wal& wal = pager->wal;
+    pthread_mutex_lock(&pager->mutex);
+    off_t commit_end = wal.commit_end;
+    pthread_mutex_unlock(&pager->mutex);
+    if (wal.synced_end == commit_end) return;
+
+    if (fdatasync(wal.file_descriptor) == -1) {
+        printf("Error syncing write-ahead log\n");
+        exit(EXIT_FAILURE);
+    }
+    wal.synced_end = commit_end;
+}
+
+// copy the newest committed image of every logged page into the database file, then empty the log. Runs with no
+// writer active, the pager mutex keeps the cached pages it copies from being evicted. Put off while snapshots are
+// open, they read older images from the file and the log, see SnapshotOpen for how long.
+void LitDatabase::WalCheckpoint(Pager* pager) {
+    Wal& wal = pager->wal;
+    WalSync(pager);
+    pthread_mutex_lock(&pager->mutex);
+    if (wal.index.empty() || wal.snapshots > 0) {
+        pthread_mutex_unlock(&pager->mutex);
+        return;
+    }
+
+    std::vector<std::pair<uint32_t, off_t>> logged(wal.index.begin(), wal.index.end());
+    std::sort(logged.begin(), logged.end());
+
+    // adjacent pages go out in one pwritev, pages that are not cached are read back from the log
+    std::vector<struct iovec> iov;
+    std::vector<char> scratch;
+    size_t run_start = 0;
+    while (run_start < logged.size()) {
+        uint32_t first_page = logged[run_start].first;
+        size_t run_end = run_start;
+        while (run_end < logged.size() && run_end - run_start < IOV_MAX &&
+               logged[run_end].first == first_page + (run_end - run_start)) {
+            ++run_end;
+        }
+
+        scratch.resize((run_end - run_start) * PAGE_SIZE);
+        iov.clear();
+        for (size_t i = run_start; i < run_end; ++i) {
+            char* buffer = &scratch[(i - run_start) * PAGE_SIZE];
+            void* cached = PagerCachedPage(pager, logged[i].first);
+            if (cached) {
+                iov.push_back({cached, PAGE_SIZE});
+                continue;
+            }
+            if (pread(wal.file_descriptor, buffer, PAGE_SIZE, logged[i].second + WAL_FRAME_HEADER_SIZE) != PAGE_SIZE) {
+                printf("Error reading write-ahead log\n");
+                exit(EXIT_FAILURE);
+            }
+            iov.push_back({buffer, PAGE_SIZE});
+        }
+
+        if (pager->page_map.enabled) {
+            PageMapWrite(pager, first_page, iov);
+            run_start = run_end;
+            continue;
+        }
+        off_t offset = static_cast<off_t>(first_page) * PAGE_SIZE;
+        ssize_t bytes_written = pwritev(pager->file_descriptor, iov.data(), iov.size(), offset);
+        if (bytes_written != static_cast<ssize_t>(iov.size() * PAGE_SIZE)) {
+            printf("Error writing\n");
+            exit(EXIT_FAILURE);
+        }
+        if (offset + bytes_written > pager->file_length) {
+            pager->file_length = offset + bytes_written;
+        }
+        run_start = run_end;
+    }
+
+    if (pager->page_map.enabled) {
+        PageMapSync(pager);
+    } else if (fdatasync(pager->file_descriptor) == -1) {
+        printf("Error syncing db file\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (pager->mode == PAGER_MMAP) {
+        // the file holds these pages now, drop the private copies so memory does not grow with the session
+        for (const auto& entry : logged) {
+            madvise(pager->map + static_cast<size_t>(entry.first) * PAGE_SIZE, PAGE_SIZE, MADV_DONTNEED);
+        }
+    }
+    WalReset(pager);
+    pthread_mutex_unlock(&pager->mutex);
+}
+
+// start a new log generation, frames left over from the old salt no longer validate
+void LitDatabase::WalReset(Pager* pager) {
+    Wal& wal = pager->wal;
+    wal.salt += 1;
+    uint32_t header[4] = {WAL_MAGIC, PAGE_SIZE, wal.salt, 0};
+    if (pwrite(wal.file_descriptor, header, WAL_HEADER_SIZE, 0) != WAL_HEADER_SIZE ||
+        ftruncate(wal.file_descriptor, WAL_HEADER_SIZE) == -1 || fdatasync(wal.file_descriptor) == -1) {
+        printf("Error resetting write-ahead log\n");
+        exit(EXIT_FAILURE);
+    }
+
+    wal.index.clear();
+    wal.pending.clear();
+    wal.end = wal.commit_end = wal.synced_end = WAL_HEADER_SIZE;
+    pthread_cond_broadcast(&wal.checkpointed);
+}
+
+// replay the committed frames of a log left behind by a crash, a torn tail is discarded
+void LitDatabase::WalRecover(Pager* pager) {
+    Wal& wal = pager->wal;
+    uint32_t header[4];
+    if (pread(wal.file_descriptor, header, WAL_HEADER_SIZE, 0) != WAL_HEADER_SIZE || header[0] != WAL_MAGIC ||
+        header[1] != PAGE_SIZE) {
+        WalReset(pager);
+        return;
+    }
+    wal.salt = header[2];
+
+    void* page = malloc(PAGE_SIZE);
+    unsigned char frame_header[WAL_FRAME_HEADER_SIZE];
+    uint32_t recovered_commits = 0;
+    off_t offset = WAL_HEADER_SIZE;
+    while (pread(wal.file_descriptor, frame_header, WAL_FRAME_HEADER_SIZE, offset) == WAL_FRAME_HEADER_SIZE &&
+           pread(wal.file_descriptor, page, PAGE_SIZE, offset + WAL_FRAME_HEADER_SIZE) == PAGE_SIZE) {
+        uint32_t fields[4];
+        memcpy(fields, frame_header, sizeof(fields));
+        if (fields[2] != wal.salt || fields[3] != WalChecksum(frame_header, page)) break;
+
+        wal.pending[fields[0]] = offset;
+        offset += WAL_FRAME_SIZE;
+        if (fields[1] != 0) {
+            for (const auto& entry : wal.pending) {
+                wal.index[entry.first] = entry.second;
+            }
+            wal.pending.clear();
+            wal.commit_end = wal.synced_end = wal.end = offset;
+            if (fields[1] > pager->num_pages) pager->num_pages = fields[1];
+            recovered_commits += 1;
+        }
+    }
+    free(page);
+    wal.pending.clear();
+
+    if (recovered_commits > 0) {
+        std::cout << "Recovered " << recovered_commits << " commits from write-ahead log." << std::endl;
+        WalCheckpoint(pager);
+    } else {
+        WalReset(pager);
+    }
+}